@@ -31,8 +31,12 @@
  */
 
 #include "Archive.h"
+#include "ArchiveReader.h"
 #include "Depot.h"
+#include "Digest.h"
 #include "File.h"
+#include "PackFile.h"
+#include "PathIndex.h"
 #include "Utils.h"
 
 #include <assert.h>
@@ -40,6 +44,7 @@
 #include <libgen.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #if TARGET_OS_EMBEDDED
@@ -50,8 +55,33 @@
 # define COMPACT_COMPRESSION "j"
 #endif
 
+// packs kept open by expand_path() before the cache starts over
+#define ARCHIVE_OPEN_PACKS 32
+
 extern char** environ;
 
+// Packs opened by expand_path(), by the path of the pack.  An uninstall
+// makes a new Archive for each file it looks at, so the packs outlive
+// them, and the index of each pack is only read once.
+static PathIndex* open_packs = NULL;
+
+static int delete_pack(const char* path, void* value, void* context) {
+	delete (PackFile*)value;
+	return 0;
+}
+
+static void forget_pack(const char* packpath) {
+	if (open_packs && packpath) delete (PackFile*)open_packs->take(packpath);
+}
+
+void Archive::close_packs() {
+	if (open_packs) {
+		open_packs->each(&delete_pack, NULL);
+		delete open_packs;
+		open_packs = NULL;
+	}
+}
+
 Archive::Archive(const char* path) {
 	m_serial = 0;
 	uuid_generate_random(m_uuid);
@@ -59,11 +89,17 @@ Archive::Archive(const char* path) {
 	m_name = strdup(basename(m_path));
 	m_info = 0;
 	m_date_installed = time(NULL);
+	m_codec = PACK_CODEC_ZLIB;
 	m_is_superseded = -1;  // unknown
+	m_survivor = ARCHIVE_SURVIVOR_UNKNOWN;
+	m_file_count = 0;
+	m_byte_count = 0;
+	m_digests = NULL;
 }
 
 Archive::Archive(uint64_t serial, uuid_t uuid, const char* name, const char* path, 
-				 uint64_t info, time_t date_installed, const char* build) {
+				 uint64_t info, time_t date_installed, const char* build, 
+				 uint32_t codec) {
 	m_serial = serial;
 	uuid_copy(m_uuid, uuid);
 	m_name = name ? strdup(name) : NULL;
@@ -71,7 +107,12 @@ Archive::Archive(uint64_t serial, uuid_t uuid, const char* name, const char* pat
 	m_build = build ? strdup(build) : NULL;
 	m_info = info;
 	m_date_installed = date_installed;
+	m_codec = codec;
 	m_is_superseded = -1; // unknown
+	m_survivor = ARCHIVE_SURVIVOR_UNKNOWN;
+	m_file_count = 0;
+	m_byte_count = 0;
+	m_digests = NULL;
 }
 
 
@@ -79,6 +120,7 @@ Archive::~Archive() {
 	if (m_path) free(m_path);
 	if (m_name) free(m_name);
 	if (m_build) free(m_build);
+	this->free_digests();
 }
 
 uint64_t	Archive::serial()		{ return m_serial; }
@@ -88,6 +130,7 @@ const char*	Archive::path()			{ return m_path; }
 const char*	Archive::build()		{ return m_build; }
 uint64_t	Archive::info()			{ return m_info; }
 time_t		Archive::date_installed()	{ return m_date_installed; }
+uint32_t	Archive::codec()		{ return m_codec; }
 
 char* Archive::directory_name(const char* prefix) {
 	char* path = NULL;
@@ -100,6 +143,45 @@ char* Archive::directory_name(const char* prefix) {
 	return path;
 }
 
+char* Archive::compacted_name(const char* prefix) {
+	char* path = NULL;
+	char uuidstr[37];
+	uuid_unparse_upper(m_uuid, uuidstr);
+	asprintf(&path, "%s/%s" COMPACT_SUFFIX, prefix, uuidstr);
+	if (path == NULL) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+	}
+	return path;
+}
+
+char* Archive::packed_name(const char* prefix) {
+	char* path = NULL;
+	char uuidstr[37];
+	uuid_unparse_upper(m_uuid, uuidstr);
+	asprintf(&path, "%s/%s" PACK_SUFFIX, prefix, uuidstr);
+	if (path == NULL) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+	}
+	return path;
+}
+
+bool Archive::is_packed(const char* prefix) {
+	struct stat sb;
+	char* path = this->packed_name(prefix);
+	bool res = (path && lstat(path, &sb) == 0);
+	free(path);
+	return res;
+}
+
+bool Archive::is_compacted(const char* prefix) {
+	struct stat sb;
+	if (this->is_packed(prefix)) return true;
+	char* path = this->compacted_name(prefix);
+	bool res = (path && lstat(path, &sb) == 0);
+	free(path);
+	return res;
+}
+
 char* Archive::create_directory(const char* prefix) {
 	int res = 0;
 	char* path = this->directory_name(prefix);
@@ -114,34 +196,50 @@ char* Archive::create_directory(const char* prefix) {
 }
 
 int Archive::compact_directory(const char* prefix) {
+	extern uint32_t compress_level;
 	int res = 0;
-	char* tarpath = NULL;
-	char uuidstr[37];
-	uuid_unparse_upper(m_uuid, uuidstr);
-	asprintf(&tarpath, "%s/%s" COMPACT_SUFFIX, prefix, uuidstr);
-	if (tarpath) {
-		const char* args[] = {
-			"/usr/bin/tar",
-			"cf" COMPACT_COMPRESSION, tarpath,
-			"-C", prefix,
-			uuidstr,
-			NULL
-		};
-		res = exec_with_args(args);
-		free(tarpath);
+	char* dirpath = this->directory_name(prefix);
+	char* packpath = this->packed_name(prefix);
+	if (dirpath && packpath) {
+		forget_pack(packpath);
+		PackFile pack(packpath, m_codec);
+		res = pack.write(dirpath, compress_level);
 	} else {
-		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
 		res = -1;
 	}
+
+	// tar keeps the extended attributes, ACLs, flags and hard links
+	// that a pack would lose
+	if (res == PACK_UNSUPPORTED) {
+		IF_DEBUG("[pack] compacting %s into a tarball instead\n", dirpath);
+		char uuidstr[37];
+		uuid_unparse_upper(m_uuid, uuidstr);
+		char* tarpath = this->compacted_name(prefix);
+		if (tarpath) {
+			const char* args[] = {
+				"/usr/bin/tar",
+				"cf" COMPACT_COMPRESSION, tarpath,
+				"-C", prefix,
+				uuidstr,
+				NULL
+			};
+			res = exec_with_args(args);
+			free(tarpath);
+		} else {
+			res = -1;
+		}
+	}
+	free(packpath);
+	free(dirpath);
 	return res;
 }
 
 int Archive::expand_directory(const char* prefix) {
+	if (this->is_packed(prefix)) return this->expand_path(prefix, NULL, true);
+
+	// archives compacted before packs were tarballs
 	int res = 0;
-	char* tarpath = NULL;
-	char uuidstr[37];
-	uuid_unparse_upper(m_uuid, uuidstr);
-	asprintf(&tarpath, "%s/%s" COMPACT_SUFFIX, prefix, uuidstr);
+	char* tarpath = this->compacted_name(prefix);
 	if (tarpath) {
 		const char* args[] = {
 			"/usr/bin/tar",
@@ -153,22 +251,50 @@ int Archive::expand_directory(const char* prefix) {
 		res = exec_with_args(args);
 		free(tarpath);
 	} else {
-		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
 		res = -1;
 	}
 	return res;
 }
 
+int Archive::expand_path(const char* prefix, const char* path, bool subtree) {
+	int res = 0;
+	char* dirpath = this->directory_name(prefix);
+	char* packpath = this->packed_name(prefix);
+	if (dirpath && packpath) {
+		PackFile* pack = open_packs ? (PackFile*)open_packs->get(packpath) : NULL;
+		if (!pack) {
+			// bounds the file descriptors held open
+			if (open_packs && open_packs->count() >= ARCHIVE_OPEN_PACKS) {
+				Archive::close_packs();
+			}
+			if (!open_packs) open_packs = new PathIndex();
+			pack = new PackFile(packpath, m_codec);
+			open_packs->set(packpath, pack);
+		}
+		res = pack->extract(dirpath, path, subtree);
+	} else {
+		res = -1;
+	}
+	free(packpath);
+	free(dirpath);
+	return res;
+}
+
 int Archive::prune_compacted_archive(const char* prefix) {
 	int res = 0;
-	char* tarpath = NULL;
-	char uuidstr[37];
-	uuid_unparse_upper(m_uuid, uuidstr);
-	asprintf(&tarpath, "%s/%s" COMPACT_SUFFIX, prefix, uuidstr);
-	if (tarpath) {
-		res = unlink(tarpath);
-		if (res) perror(tarpath);
-		free(tarpath);
+	char* paths[] = { this->packed_name(prefix), this->compacted_name(prefix) };
+	for (int i = 0; i < 2; i++) {
+		if (!paths[i]) {
+			res = -1;
+			continue;
+		}
+		forget_pack(paths[i]);
+		// only one of them exists, or neither in a migrated depot
+		if (unlink(paths[i]) == -1 && errno != ENOENT) {
+			perror(paths[i]);
+			res = -1;
+		}
+		free(paths[i]);
 	}
 	return res;
 }
@@ -178,6 +304,39 @@ int Archive::extract(const char* destdir) {
 	return -1;
 }
 
+static int free_digest(const char* path, void* value, void* context) {
+	delete (Digest*)value;
+	return 0;
+}
+
+void Archive::free_digests() {
+	if (m_digests) {
+		m_digests->each(&free_digest, NULL);
+		delete m_digests;
+		m_digests = NULL;
+	}
+}
+
+int Archive::extract_stream(const char* destdir) {
+	this->free_digests();
+	m_digests = new PathIndex();
+	ArchiveReader* reader = new ArchiveReader(m_path);
+	int res = reader->extract(destdir, m_digests);
+	delete reader;
+	if (res != READER_OK) {
+		// anything extracted so far may be overwritten by another tool
+		this->free_digests();
+	}
+	if (res == READER_UNSUPPORTED) {
+		IF_DEBUG("[extract] %s needs an external tool\n", m_path);
+	}
+	return res;
+}
+
+Digest* Archive::staged_digest(const char* path) {
+	return m_digests ? (Digest*)m_digests->get(path) : NULL;
+}
+
 
 
 RollbackArchive::RollbackArchive() : Archive("<Rollback>") {
@@ -201,6 +360,8 @@ int DittoArchive::extract(const char* destdir) {
 DittoXArchive::DittoXArchive(const char* path) : Archive(path) {}
 
 int DittoXArchive::extract(const char* destdir) {
+	int res = this->extract_stream(destdir);
+	if (res != READER_UNSUPPORTED) return res;
 	const char* args[] = {
 		"/usr/bin/ditto",
 		"-x", m_path,
@@ -226,6 +387,8 @@ PaxBZ2Archive::PaxBZ2Archive(const char* path) : DittoXArchive(path) {}
 TarArchive::TarArchive(const char* path) : Archive(path) {}
 
 int TarArchive::extract(const char* destdir) {
+	int res = this->extract_stream(destdir);
+	if (res != READER_UNSUPPORTED) return res;
 	const char* args[] = {
 		"/usr/bin/tar",
 		"xf", m_path,
@@ -239,6 +402,8 @@ int TarArchive::extract(const char* destdir) {
 TarGZArchive::TarGZArchive(const char* path) : Archive(path) {}
 
 int TarGZArchive::extract(const char* destdir) {
+	int res = this->extract_stream(destdir);
+	if (res != READER_UNSUPPORTED) return res;
 	const char* args[] = {
 		"/usr/bin/tar",
 		"xzf", m_path,
@@ -252,6 +417,8 @@ int TarGZArchive::extract(const char* destdir) {
 TarBZ2Archive::TarBZ2Archive(const char* path) : Archive(path) {}
 
 int TarBZ2Archive::extract(const char* destdir) {
+	int res = this->extract_stream(destdir);
+	if (res != READER_UNSUPPORTED) return res;
 	const char* args[] = {
 		"/usr/bin/tar",
 		"xjf", m_path,
@@ -261,6 +428,21 @@ int TarBZ2Archive::extract(const char* destdir) {
 	return exec_with_args(args);
 }
 
+TarXZArchive::TarXZArchive(const char* path) : Archive(path) {}
+
+int TarXZArchive::extract(const char* destdir) {
+	int res = this->extract_stream(destdir);
+	if (res != READER_UNSUPPORTED) return res;
+	const char* args[] = {
+		"/usr/bin/tar",
+		"xJf", m_path,
+		"-C", destdir,
+		NULL
+	};
+	return exec_with_args(args);
+}
+
+
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
 XarArchive::XarArchive(const char* path) : Archive(path) {}
 
@@ -343,6 +525,8 @@ Archive* ArchiveFactory(const char* path, const char* tmppath) {
 				|| has_suffix(actpath, ".tbz2") 
 				|| has_suffix(actpath, ".tbz")) {
 		archive = new TarBZ2Archive(actpath);		
+	} else if (has_suffix(actpath, ".tar.xz") || has_suffix(actpath, ".txz")) {
+		archive = new TarXZArchive(actpath);
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
 	} else if (has_suffix(actpath, ".xar")) {
 		archive = new XarArchive(actpath);
@@ -54,8 +54,16 @@ enum archive_keyword_t {
 //
 const uint64_t ARCHIVE_INFO_ROLLBACK	= 0x0001;
 
+//
+// special values of the survivor stored with an archive, see m_survivor
+//
+const uint64_t ARCHIVE_SURVIVOR_UNKNOWN	= 0;
+const uint64_t ARCHIVE_SURVIVOR_NONE	= 0xFFFFFFFFFFFFFFFFULL;
+
 struct Archive;
 struct Depot;
+struct Digest;
+struct PathIndex;
 
 ////
 //  Archive
@@ -107,6 +115,9 @@ struct Archive {
 	
 	// The epoch seconds when the archive was installed.
 	virtual time_t date_installed();
+
+	// The PACK_CODEC the archive is compacted with.
+	virtual uint32_t codec();
 	
 		
 	////
@@ -118,6 +129,11 @@ struct Archive {
 	// by concrete subclasses.
 	virtual int extract(const char* destdir);
 
+	// Returns the digest computed while extracting the regular file
+	// at path (relative to destdir), or NULL if it must be read from
+	// the extracted file.  Do not modify or delete.
+	Digest* staged_digest(const char* path);
+
 	// Returns the backing-store directory name for the archive.
 	// This is prefix/uuid.
 	// The result should be released with free(3).
@@ -126,14 +142,38 @@ struct Archive {
 	// Creates the backing-store directory for the archive.
 	// Same directory name as returned by directory_name().
 	char* create_directory(const char* prefix);
+
+	// Returns the name of the tarball that archives were compacted
+	// into before packs.  This is prefix/uuid plus COMPACT_SUFFIX.
+	// The result should be released with free(3).
+	char* compacted_name(const char* prefix);
+
+	// Returns the name of the pack the archive is compacted into.
+	// This is prefix/uuid plus PACK_SUFFIX.
+	// The result should be released with free(3).
+	char* packed_name(const char* prefix);
+
+	// Returns true if the archive has a pack, or a compacted tarball.
+	bool is_packed(const char* prefix);
+	bool is_compacted(const char* prefix);
 	
-	// Compacts the backing-store directory into a single file.
+	// Compacts the backing-store directory into a pack, with the
+	// archive's codec.
 	int compact_directory(const char* prefix);
 	
-	// Expands the backing-store directory from its single file.
+	// Expands the whole backing-store directory from its pack or tarball.
 	int expand_directory(const char* prefix);
 
-	// Removes the compacted backing-store file from disk.
+	// Extracts only the file at path from the pack into the backing-store
+	// directory, along with everything below it if subtree is true.
+	// The pack stays open for later calls, for any Archive of the same
+	// archive, until close_packs().
+	int expand_path(const char* prefix, const char* path, bool subtree);
+
+	// Closes every pack opened by expand_path().
+	static void close_packs();
+
+	// Removes the compacted backing-store file from disk, if any.
 	int prune_compacted_archive(const char* prefix);
 
 	protected:
@@ -141,7 +181,13 @@ struct Archive {
 	// Constructor for subclasses and Depot to use when 
 	//  unserializing an archive from the database.
 	Archive(uint64_t serial, uuid_t uuid, const char* name, const char* path, 
-			uint64_t info, time_t date_installed, const char* build);
+			uint64_t info, time_t date_installed, const char* build, uint32_t codec);
+
+	// Extracts the archive in process with ArchiveReader, recording
+	// the digests of the extracted files.  Returns READER_UNSUPPORTED
+	// if the subclass should fall back to an external tool.
+	int extract_stream(const char* destdir);
+	void free_digests();
 	
 	uint64_t	m_serial;
 	uuid_t		m_uuid;
@@ -150,9 +196,23 @@ struct Archive {
 	char*       m_build;
 	uint64_t	m_info;
 	time_t		m_date_installed;
+	uint32_t	m_codec;
 	
 	// -1 unknown, 0 false, 1 true
 	int       m_is_superseded;
+	// The serial of a file of this archive that no newer archive
+	// installed over and that was unchanged on disk when last checked,
+	// ARCHIVE_SURVIVOR_NONE if newer archives installed every path, or
+	// ARCHIVE_SURVIVOR_UNKNOWN.  Kept in the database until an archive
+	// is installed or uninstalled.
+	uint64_t  m_survivor;
+	// Files the depot has inserted into the archive, and the bytes of
+	// the data they carry, for its archive_stats row.
+	uint64_t  m_file_count;
+	uint64_t  m_byte_count;
+
+	// digests of the files written by extract_stream()
+	PathIndex* m_digests;
 	
 	friend struct Depot;
 	friend struct DarwinupDatabase;
@@ -188,7 +248,9 @@ struct DittoArchive : public Archive {
 //  DittoXArchive
 //
 //  Handles any file that `ditto -x` can handle. Intended to be the parent
-//  of suffix-specific archive objects. 
+//  of suffix-specific archive objects.  cpio and pax archives are
+//  extracted in process, and only handed to ditto(1) if ArchiveReader
+//  does not support them.
 ////
 struct DittoXArchive : public Archive {
 	DittoXArchive(const char* path);
@@ -200,8 +262,7 @@ struct DittoXArchive : public Archive {
 //  CpioArchive
 //
 //  Corresponds to the cpio(1) file format.  
-//  This installs archives using the ditto(1) command line tool with
-//  the -x option.
+//  Extracted by DittoXArchive.
 ////
 struct CpioArchive : public DittoXArchive {
 	CpioArchive(const char* path);
@@ -211,8 +272,7 @@ struct CpioArchive : public DittoXArchive {
 //  CpioGZArchive
 //
 //  Corresponds to the cpio(1) file format, compressed with gzip(1).
-//  This installs archives using the ditto(1) command line tool with
-//  the -x option.
+//  Extracted by DittoXArchive.
 ////
 struct CpioGZArchive : public DittoXArchive {
 	CpioGZArchive(const char* path);
@@ -222,8 +282,7 @@ struct CpioGZArchive : public DittoXArchive {
 //  CpioBZ2Archive
 //
 //  Corresponds to the cpio(1) file format, compressed with bzip2(1).
-//  This installs archives using the ditto(1) command line tool with
-//  the -x option.
+//  Extracted by DittoXArchive.
 ////
 struct CpioBZ2Archive : public DittoXArchive {
 	CpioBZ2Archive(const char* path);
@@ -234,8 +293,7 @@ struct CpioBZ2Archive : public DittoXArchive {
 //  PaxArchive
 //
 //  Corresponds to the pax(1) file format.  
-//  This installs archives using the ditto(1) command line tool with
-//  the -x option.
+//  Extracted by DittoXArchive.
 ////
 struct PaxArchive : public DittoXArchive {
 	PaxArchive(const char* path);
@@ -246,8 +304,7 @@ struct PaxArchive : public DittoXArchive {
 //  PaxGZArchive
 //
 //  Corresponds to the pax(1) file format, compressed with gzip(1).
-//  This installs archives using the ditto(1) command line tool with
-//  the -x option.
+//  Extracted by DittoXArchive.
 ////
 struct PaxGZArchive : public DittoXArchive {
 	PaxGZArchive(const char* path);
@@ -258,8 +315,7 @@ struct PaxGZArchive : public DittoXArchive {
 //  PaxBZ2Archive
 //
 //  Corresponds to the pax(1) file format, compressed with bzip2(1).
-//  This installs archives using the ditto(1) command line tool with
-//  the -x option.
+//  Extracted by DittoXArchive.
 ////
 struct PaxBZ2Archive : public DittoXArchive {
 	PaxBZ2Archive(const char* path);
@@ -269,8 +325,8 @@ struct PaxBZ2Archive : public DittoXArchive {
 ////
 //  TarArchive
 //
-//  Corresponds to the tar(1) file format.  This handles uncompressed tar
-//  archives by using the tar(1) command line tool.
+//  Corresponds to the tar(1) file format.  Uncompressed tar archives
+//  are extracted in process, falling back to the tar(1) command line tool.
 ////
 struct TarArchive : public Archive {
         TarArchive(const char* path);
@@ -282,8 +338,8 @@ struct TarArchive : public Archive {
 //  TarGZArchive
 //
 //  Corresponds to the tar(1) file format, compressed with gzip(1).
-//  This installs archives using the tar(1) command line tool with
-//  the -z option.
+//  Extracted in process, falling back to the tar(1) command line tool
+//  with the -z option.
 ////
 struct TarGZArchive : public Archive {
         TarGZArchive(const char* path);
@@ -295,14 +351,27 @@ struct TarGZArchive : public Archive {
 //  TarBZ2Archive
 //
 //  Corresponds to the tar(1) file format, compressed with bzip2(1).
-//  This installs archives using the tar(1) command line tool with
-//  the -j option.
+//  Extracted in process, falling back to the tar(1) command line tool
+//  with the -j option.
 ////
 struct TarBZ2Archive : public Archive {
         TarBZ2Archive(const char* path);
         virtual int extract(const char* destdir);
 };
 
+
+////
+//  TarXZArchive
+//
+//  Corresponds to the tar(1) file format, compressed with xz(1).
+//  Extracted in process, falling back to the tar(1) command line tool
+//  with the -J option.
+////
+struct TarXZArchive : public Archive {
+        TarXZArchive(const char* path);
+        virtual int extract(const char* destdir);
+};
+
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
 ////
 //  XarArchive
@@ -0,0 +1,1130 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "ArchiveReader.h"
+#include "Digest.h"
+#include "PathIndex.h"
+#include "Utils.h"
+
+#include <Availability.h>
+#include <assert.h>
+#include <bzlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__APPLE__)
+# if __MAC_OS_X_VERSION_MIN_REQUIRED >= 101100
+#  include <compression.h>
+#  define READER_HAS_XZ 1
+# endif
+#else
+# include <lzma.h>
+# define READER_HAS_XZ 1
+#endif
+
+#define CODEC_NONE   0
+#define CODEC_GZIP   1
+#define CODEC_BZIP2  2
+#define CODEC_XZ     3
+
+#define TAR_BLOCK    512
+
+static const uint8_t XZ_MAGIC[6] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+
+
+// Parses a tar numeric field: octal, or base-256 if the high bit is set.
+static uint64_t tar_number(const uint8_t* p, size_t len) {
+	uint64_t value = 0;
+	size_t i = 0;
+	if (p[0] & 0x80) {
+		value = p[0] & 0x3F;
+		for (i = 1; i < len; i++) value = (value << 8) | p[i];
+		return value;
+	}
+	while (i < len && (p[i] == ' ' || p[i] == 0)) i++;
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) {
+		value = (value << 3) | (p[i] - '0');
+	}
+	return value;
+}
+
+// Parses a fixed width cpio field in the given base (8 or 16).
+static uint64_t cpio_number(const uint8_t* p, size_t len, int base) {
+	char field[16];
+	if (len >= sizeof(field)) len = sizeof(field) - 1;
+	memcpy(field, p, len);
+	field[len] = 0;
+	return strtoull(field, NULL, base);
+}
+
+static bool tar_checksum_ok(const uint8_t* h) {
+	uint64_t expected = tar_number(h + 148, 8);
+	uint64_t usum = 0;
+	int64_t ssum = 0;
+	for (int i = 0; i < TAR_BLOCK; i++) {
+		uint8_t c = (i >= 148 && i < 156) ? ' ' : h[i];
+		usum += c;
+		ssum += (int8_t)c;
+	}
+	return expected == usum || (int64_t)expected == ssum;
+}
+
+static bool is_zero_block(const uint8_t* h) {
+	for (int i = 0; i < TAR_BLOCK; i++) {
+		if (h[i]) return false;
+	}
+	return true;
+}
+
+// Copies a fixed width, possibly unterminated, string field.
+static void copy_field(char* dst, const uint8_t* src, size_t len) {
+	memcpy(dst, src, len);
+	dst[len] = 0;
+}
+
+// Returns a copy of name relative to the destination, without leading
+// slashes or "." components, or NULL if any component is "..".
+static char* relative_path(const char* name) {
+	size_t len = strlen(name);
+	char* rel = (char*)malloc(len + 1);
+	if (!rel) return NULL;
+	size_t out = 0;
+	const char* p = name;
+	while (*p) {
+		const char* end = strchr(p, '/');
+		size_t n = end ? (size_t)(end - p) : strlen(p);
+		if (n == 2 && p[0] == '.' && p[1] == '.') {
+			free(rel);
+			return NULL;
+		}
+		if (n > 0 && !(n == 1 && p[0] == '.')) {
+			if (out) rel[out++] = '/';
+			memcpy(rel + out, p, n);
+			out += n;
+		}
+		p += n;
+		if (*p == '/') p++;
+	}
+	rel[out] = 0;
+	return rel;
+}
+
+static bool is_unsupported_key(const char* key) {
+	return strncmp(key, "SCHILY.xattr.", 13) == 0 ||
+	       strncmp(key, "LIBARCHIVE.xattr.", 17) == 0 ||
+	       strncmp(key, "SCHILY.acl.", 11) == 0 ||
+	       strncmp(key, "GNU.sparse.", 11) == 0;
+}
+
+static void entry_init(ReaderEntry* ent) {
+	memset(ent, 0, sizeof(*ent));
+	ent->size = -1;
+	ent->uid = (uid_t)-1;
+	ent->gid = (gid_t)-1;
+	ent->mtime = -1;
+}
+
+static void entry_free(ReaderEntry* ent) {
+	if (ent->path) free(ent->path);
+	if (ent->linkpath) free(ent->linkpath);
+	entry_init(ent);
+}
+
+
+ArchiveReader::ArchiveReader(const char* path) {
+	m_path = strdup(path);
+	m_destdir = NULL;
+	m_digests = NULL;
+	m_fd = -1;
+	m_codec = CODEC_NONE;
+	m_stream = NULL;
+	m_stream_end = false;
+	m_input_end = false;
+	m_input = NULL;
+	m_input_pos = NULL;
+	m_input_len = 0;
+	m_buf = NULL;
+	m_buf_pos = 0;
+	m_buf_len = 0;
+	m_error = false;
+	m_links = new PathIndex();
+	m_dirs = NULL;
+	m_dirs_count = 0;
+	m_dirs_max = 0;
+	m_is_root = (geteuid() == 0);
+	m_umask = umask(0);
+	umask(m_umask);
+	m_uname[0] = 0;
+	m_uid = 0;
+	m_gname[0] = 0;
+	m_gid = 0;
+}
+
+static int free_link(const char* key, void* value, void* context) {
+	free(value);
+	return 0;
+}
+
+ArchiveReader::~ArchiveReader() {
+	this->close_stream();
+	if (m_fd != -1) close(m_fd);
+	m_links->each(&free_link, NULL);
+	delete m_links;
+	for (uint32_t i = 0; i < m_dirs_count; i++) free(m_dirs[i].path);
+	free(m_dirs);
+	free(m_buf);
+	free(m_input);
+	free(m_destdir);
+	free(m_path);
+}
+
+int ArchiveReader::extract(const char* destdir, PathIndex* digests) {
+	int res = READER_OK;
+	m_destdir = strdup(destdir);
+	m_digests = digests;
+
+	m_fd = open(m_path, O_RDONLY);
+	if (m_fd == -1) {
+		fprintf(stderr, "Error: unable to open %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return READER_ERROR;
+	}
+
+	res = this->open_stream();
+	if (res == READER_OK) {
+		size_t avail = this->fill(TAR_BLOCK);
+		uint8_t* h = m_buf + m_buf_pos;
+		if (m_error) {
+			res = READER_ERROR;
+		} else if (avail >= 6 && memcmp(h, "07070", 5) == 0 && (h[5] == '7' || h[5] == '1' || h[5] == '2')) {
+			res = this->extract_cpio();
+		} else if (avail >= TAR_BLOCK && tar_checksum_ok(h)) {
+			res = this->extract_tar();
+		} else {
+			res = READER_UNSUPPORTED;
+		}
+	}
+	this->finish_directories();
+
+	IF_DEBUG("[extract] %s: result %d with %u digests\n", m_path, res, digests->count());
+	return res;
+}
+
+
+////
+//  Decompression
+////
+
+int ArchiveReader::open_stream() {
+	uint8_t magic[6];
+	ssize_t n = pread(m_fd, magic, sizeof(magic), 0);
+	if (n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+		m_codec = CODEC_GZIP;
+	} else if (n >= 3 && memcmp(magic, "BZh", 3) == 0) {
+		m_codec = CODEC_BZIP2;
+	} else if (n >= 6 && memcmp(magic, XZ_MAGIC, 6) == 0) {
+		m_codec = CODEC_XZ;
+	}
+
+	m_input = (uint8_t*)malloc(READER_BUFFER_SIZE);
+	m_buf = (uint8_t*)malloc(READER_BUFFER_SIZE);
+	if (!m_input || !m_buf) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		return READER_ERROR;
+	}
+	m_input_pos = m_input;
+
+	int res = 0;
+	if (m_codec == CODEC_GZIP) {
+		z_stream* z = (z_stream*)calloc(1, sizeof(z_stream));
+		if (z) res = inflateInit2(z, 15 + 16) == Z_OK ? 0 : -1;
+		m_stream = z;
+	} else if (m_codec == CODEC_BZIP2) {
+		bz_stream* bz = (bz_stream*)calloc(1, sizeof(bz_stream));
+		if (bz) res = BZ2_bzDecompressInit(bz, 0, 0) == BZ_OK ? 0 : -1;
+		m_stream = bz;
+	} else if (m_codec == CODEC_XZ) {
+#if !READER_HAS_XZ
+		return READER_UNSUPPORTED;
+#elif defined(__APPLE__)
+		compression_stream* cs = (compression_stream*)calloc(1, sizeof(compression_stream));
+		if (cs) res = compression_stream_init(cs, COMPRESSION_STREAM_DECODE, COMPRESSION_LZMA) == COMPRESSION_STATUS_OK ? 0 : -1;
+		m_stream = cs;
+#else
+		lzma_stream* xz = (lzma_stream*)calloc(1, sizeof(lzma_stream));
+		if (xz) res = lzma_stream_decoder(xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK ? 0 : -1;
+		m_stream = xz;
+#endif
+	}
+	if (m_codec != CODEC_NONE && (m_stream == NULL || res != 0)) {
+		fprintf(stderr, "Error: unable to initialize decompression for %s\n", m_path);
+		free(m_stream);
+		m_stream = NULL;
+		return READER_ERROR;
+	}
+	return READER_OK;
+}
+
+void ArchiveReader::close_stream() {
+	if (!m_stream) return;
+	if (m_codec == CODEC_GZIP) {
+		inflateEnd((z_stream*)m_stream);
+	} else if (m_codec == CODEC_BZIP2) {
+		BZ2_bzDecompressEnd((bz_stream*)m_stream);
+	} else if (m_codec == CODEC_XZ) {
+#if READER_HAS_XZ && defined(__APPLE__)
+		compression_stream_destroy((compression_stream*)m_stream);
+#elif READER_HAS_XZ
+		lzma_end((lzma_stream*)m_stream);
+#endif
+	}
+	free(m_stream);
+	m_stream = NULL;
+}
+
+// Refills the compressed input buffer once it has been consumed.
+// Returns the number of bytes read, 0 at end of file, or -1.
+ssize_t ArchiveReader::read_input() {
+	ssize_t n;
+	do {
+		n = read(m_fd, m_input, READER_BUFFER_SIZE);
+	} while (n == -1 && errno == EINTR);
+	if (n == -1) {
+		fprintf(stderr, "Error: unable to read %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return -1;
+	}
+	if (n == 0) m_input_end = true;
+	m_input_pos = m_input;
+	m_input_len = n;
+	return n;
+}
+
+// Decompresses up to len bytes into buf.
+// Returns the number of bytes produced, 0 at the end of the stream, or -1.
+ssize_t ArchiveReader::decompress(uint8_t* buf, size_t len) {
+	if (m_stream_end) return 0;
+
+	if (m_codec == CODEC_NONE) {
+		ssize_t n;
+		do {
+			n = read(m_fd, buf, len);
+		} while (n == -1 && errno == EINTR);
+		if (n == -1) {
+			fprintf(stderr, "Error: unable to read %s: %s (%d)\n", m_path, strerror(errno), errno);
+		}
+		if (n == 0) m_stream_end = true;
+		return n;
+	}
+
+	size_t produced = 0;
+	while (produced == 0 && !m_stream_end) {
+		if (m_input_len == 0 && !m_input_end && this->read_input() == -1) return -1;
+
+		bool more = false;  // another concatenated stream follows
+		int status = 0;     // 1 at the end of a stream, -1 on error
+		if (m_codec == CODEC_GZIP) {
+			z_stream* z = (z_stream*)m_stream;
+			z->next_in = m_input_pos;
+			z->avail_in = (uInt)m_input_len;
+			z->next_out = buf;
+			z->avail_out = (uInt)len;
+			int zres = inflate(z, Z_NO_FLUSH);
+			produced = len - z->avail_out;
+			m_input_pos = z->next_in;
+			m_input_len = z->avail_in;
+			if (zres == Z_STREAM_END) status = 1;
+			else if (zres != Z_OK && zres != Z_BUF_ERROR) status = -1;
+		} else if (m_codec == CODEC_BZIP2) {
+			bz_stream* bz = (bz_stream*)m_stream;
+			bz->next_in = (char*)m_input_pos;
+			bz->avail_in = (unsigned int)m_input_len;
+			bz->next_out = (char*)buf;
+			bz->avail_out = (unsigned int)len;
+			int bres = BZ2_bzDecompress(bz);
+			produced = len - bz->avail_out;
+			m_input_pos = (uint8_t*)bz->next_in;
+			m_input_len = bz->avail_in;
+			if (bres == BZ_STREAM_END) status = 1;
+			else if (bres != BZ_OK) status = -1;
+		} else if (m_codec == CODEC_XZ) {
+#if READER_HAS_XZ && defined(__APPLE__)
+			compression_stream* cs = (compression_stream*)m_stream;
+			cs->src_ptr = m_input_pos;
+			cs->src_size = m_input_len;
+			cs->dst_ptr = buf;
+			cs->dst_size = len;
+			compression_status cres = compression_stream_process(cs, m_input_end ? COMPRESSION_STREAM_FINALIZE : 0);
+			produced = len - cs->dst_size;
+			m_input_pos = (uint8_t*)cs->src_ptr;
+			m_input_len = cs->src_size;
+			if (cres == COMPRESSION_STATUS_END) status = 1;
+			else if (cres != COMPRESSION_STATUS_OK) status = -1;
+#elif READER_HAS_XZ
+			// LZMA_CONCATENATED handles multiple streams itself
+			lzma_stream* xz = (lzma_stream*)m_stream;
+			xz->next_in = m_input_pos;
+			xz->avail_in = m_input_len;
+			xz->next_out = buf;
+			xz->avail_out = len;
+			lzma_ret lres = lzma_code(xz, m_input_end ? LZMA_FINISH : LZMA_RUN);
+			produced = len - xz->avail_out;
+			m_input_pos = (uint8_t*)xz->next_in;
+			m_input_len = xz->avail_in;
+			if (lres == LZMA_STREAM_END) status = 1;
+			else if (lres != LZMA_OK && lres != LZMA_BUF_ERROR) status = -1;
+#endif
+		}
+
+		if (status == 1) {
+			// gzip and bzip2 streams may be concatenated
+			if (m_codec != CODEC_XZ && m_input_len == 0 && !m_input_end && this->read_input() == -1) return -1;
+			if (m_codec == CODEC_GZIP && m_input_len >= 2 && 
+				m_input_pos[0] == 0x1F && m_input_pos[1] == 0x8B) {
+				more = (inflateReset((z_stream*)m_stream) == Z_OK);
+			} else if (m_codec == CODEC_BZIP2 && m_input_len >= 3 && 
+					   memcmp(m_input_pos, "BZh", 3) == 0) {
+				bz_stream* bz = (bz_stream*)m_stream;
+				BZ2_bzDecompressEnd(bz);
+				memset(bz, 0, sizeof(*bz));
+				more = (BZ2_bzDecompressInit(bz, 0, 0) == BZ_OK);
+			}
+			if (!more) m_stream_end = true;
+		} else if (status == -1 || (produced == 0 && m_input_end && m_input_len == 0)) {
+			fprintf(stderr, "Error: %s: truncated or corrupt compressed data\n", m_path);
+			return -1;
+		}
+	}
+	return produced;
+}
+
+// Makes at least len bytes of decompressed data available at m_buf_pos,
+// unless the stream ends first.  Returns the number of bytes available.
+size_t ArchiveReader::fill(size_t len) {
+	size_t avail = m_buf_len - m_buf_pos;
+	if (avail >= len) return avail;
+	memmove(m_buf, m_buf + m_buf_pos, avail);
+	m_buf_pos = 0;
+	m_buf_len = avail;
+	while (m_buf_len < len && !m_error) {
+		ssize_t n = this->decompress(m_buf + m_buf_len, READER_BUFFER_SIZE - m_buf_len);
+		if (n == -1) m_error = true;
+		if (n <= 0) break;
+		m_buf_len += n;
+	}
+	return m_buf_len - m_buf_pos;
+}
+
+int ArchiveReader::read_data(void* buf, size_t len) {
+	uint8_t* p = (uint8_t*)buf;
+	while (len > 0) {
+		size_t avail = this->fill(len < READER_BUFFER_SIZE ? len : READER_BUFFER_SIZE);
+		if (avail == 0) {
+			if (!m_error) fprintf(stderr, "Error: %s: unexpected end of archive\n", m_path);
+			return READER_ERROR;
+		}
+		size_t n = avail < len ? avail : len;
+		memcpy(p, m_buf + m_buf_pos, n);
+		m_buf_pos += n;
+		p += n;
+		len -= n;
+	}
+	return READER_OK;
+}
+
+int ArchiveReader::skip_data(off_t len) {
+	while (len > 0) {
+		size_t avail = this->fill(len < READER_BUFFER_SIZE ? (size_t)len : READER_BUFFER_SIZE);
+		if (avail == 0) {
+			if (!m_error) fprintf(stderr, "Error: %s: unexpected end of archive\n", m_path);
+			return READER_ERROR;
+		}
+		size_t n = (off_t)avail < len ? avail : (size_t)len;
+		m_buf_pos += n;
+		len -= n;
+	}
+	return READER_OK;
+}
+
+
+////
+//  Formats
+////
+
+int ArchiveReader::extract_tar() {
+	int res = READER_OK;
+	char name[257];
+	char* longname = NULL;
+	char* longlink = NULL;
+	ReaderEntry pax;
+	ReaderEntry ent;
+	entry_init(&pax);
+	entry_init(&ent);
+
+	while (res == READER_OK) {
+		size_t avail = this->fill(TAR_BLOCK);
+		if (m_error) {
+			res = READER_ERROR;
+			break;
+		}
+		// archives missing their end-of-archive blocks are accepted, as tar(1) does
+		if (avail == 0) break;
+		if (avail < TAR_BLOCK) {
+			fprintf(stderr, "Error: %s: unexpected end of archive\n", m_path);
+			res = READER_ERROR;
+			break;
+		}
+		uint8_t* h = m_buf + m_buf_pos;
+		if (is_zero_block(h)) break;
+		if (!tar_checksum_ok(h)) {
+			fprintf(stderr, "Error: %s: corrupt tar header\n", m_path);
+			res = READER_ERROR;
+			break;
+		}
+		m_buf_pos += TAR_BLOCK;
+
+		char typeflag = h[156];
+		off_t size = (off_t)tar_number(h + 124, 12);
+		if (size < 0) {
+			fprintf(stderr, "Error: %s: corrupt tar header\n", m_path);
+			res = READER_ERROR;
+			break;
+		}
+		off_t padding = (TAR_BLOCK - (size % TAR_BLOCK)) % TAR_BLOCK;
+
+		if (typeflag == 'x') {
+			res = this->read_pax_header(&pax, size);
+			continue;
+		} else if (typeflag == 'g') {
+			res = this->read_pax_header(NULL, size);
+			continue;
+		} else if (typeflag == 'L') {
+			res = this->read_long_name(&longname, size);
+			continue;
+		} else if (typeflag == 'K') {
+			res = this->read_long_name(&longlink, size);
+			continue;
+		} else if (typeflag == 'V') {
+			res = this->skip_data(size + padding);
+			continue;
+		} else if (typeflag == 'S' || typeflag == 'M') {
+			IF_DEBUG("[extract] unsupported tar entry type '%c'\n", typeflag);
+			res = READER_UNSUPPORTED;
+			break;
+		}
+
+		// POSIX ustar splits long names between the prefix and name fields
+		name[0] = 0;
+		if (memcmp(h + 257, "ustar", 6) == 0 && h[345]) {
+			copy_field(name, h + 345, 155);
+			strlcat(name, "/", sizeof(name));
+		}
+		char field[101];
+		copy_field(field, h, 100);
+		strlcat(name, field, sizeof(name));
+
+		if (pax.path) {
+			ent.path = pax.path;
+			pax.path = NULL;
+		} else if (longname) {
+			ent.path = longname;
+			longname = NULL;
+		} else {
+			ent.path = strdup(name);
+		}
+		if (pax.linkpath) {
+			ent.linkpath = pax.linkpath;
+			pax.linkpath = NULL;
+		} else if (longlink) {
+			ent.linkpath = longlink;
+			longlink = NULL;
+		} else {
+			copy_field(field, h + 157, 100);
+			ent.linkpath = strdup(field);
+		}
+
+		ent.mode = (mode_t)tar_number(h + 100, 8) & ALLPERMS;
+		ent.uid = pax.uid != (uid_t)-1 ? pax.uid : (uid_t)tar_number(h + 108, 8);
+		ent.gid = pax.gid != (gid_t)-1 ? pax.gid : (gid_t)tar_number(h + 116, 8);
+		if (pax.size != -1) {
+			size = pax.size;
+			padding = (TAR_BLOCK - (size % TAR_BLOCK)) % TAR_BLOCK;
+		}
+		ent.size = size;
+		ent.mtime = pax.mtime != -1 ? pax.mtime : (time_t)tar_number(h + 136, 12);
+		if (pax.uname[0]) strlcpy(ent.uname, pax.uname, sizeof(ent.uname));
+		else copy_field(ent.uname, h + 265, 32);
+		if (pax.gname[0]) strlcpy(ent.gname, pax.gname, sizeof(ent.gname));
+		else copy_field(ent.gname, h + 297, 32);
+		ent.rdev = makedev(tar_number(h + 329, 8), tar_number(h + 337, 8));
+		ent.nlink = 1;
+
+		switch (typeflag) {
+			case '1': ent.type = 'h'; break;
+			case '2': ent.type = 'l'; break;
+			case '3': ent.type = 'c'; break;
+			case '4': ent.type = 'b'; break;
+			case '5': ent.type = 'd'; break;
+			case '6': ent.type = 'p'; break;
+			case 'D': ent.type = 'd'; break;
+			default: {
+				// old archives mark directories with a trailing slash
+				size_t len = strlen(ent.path);
+				ent.type = (len && ent.path[len - 1] == '/') ? 'd' : 'f';
+				break;
+			}
+		}
+
+		res = this->make_entry(&ent, padding);
+		entry_free(&ent);
+		entry_free(&pax);
+	}
+
+	entry_free(&ent);
+	entry_free(&pax);
+	if (longname) free(longname);
+	if (longlink) free(longlink);
+	return res;
+}
+
+// Reads a pax extended header into ent, or only checks a global header
+// for unsupported keys if ent is NULL.
+int ArchiveReader::read_pax_header(ReaderEntry* ent, off_t size) {
+	int res = READER_OK;
+	if (size < 0 || size > READER_MAX_PAX_SIZE) {
+		fprintf(stderr, "Error: %s: corrupt pax header\n", m_path);
+		return READER_ERROR;
+	}
+	char* data = (char*)malloc(size + 1);
+	if (!data) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		return READER_ERROR;
+	}
+	res = this->read_data(data, size);
+	if (res == READER_OK) res = this->skip_data((TAR_BLOCK - (size % TAR_BLOCK)) % TAR_BLOCK);
+	data[size] = 0;
+
+	// each record is "<length> <key>=<value>\n"
+	char* p = data;
+	char* end = data + size;
+	while (res == READER_OK && p < end) {
+		char* key = NULL;
+		long len = strtol(p, &key, 10);
+		if (len <= 0 || key == p || *key != ' ' || p + len > end || p[len - 1] != '\n') {
+			fprintf(stderr, "Error: %s: corrupt pax header\n", m_path);
+			res = READER_ERROR;
+			break;
+		}
+		key++;
+		p[len - 1] = 0;
+		char* value = strchr(key, '=');
+		p += len;
+		if (!value) continue;
+		*value++ = 0;
+
+		if (is_unsupported_key(key)) {
+			IF_DEBUG("[extract] unsupported pax key %s\n", key);
+			res = READER_UNSUPPORTED;
+		} else if (ent == NULL) {
+			continue;
+		} else if (strcmp(key, "path") == 0) {
+			if (ent->path) free(ent->path);
+			ent->path = strdup(value);
+		} else if (strcmp(key, "linkpath") == 0) {
+			if (ent->linkpath) free(ent->linkpath);
+			ent->linkpath = strdup(value);
+		} else if (strcmp(key, "size") == 0) {
+			ent->size = (off_t)strtoll(value, NULL, 10);
+		} else if (strcmp(key, "uid") == 0) {
+			ent->uid = (uid_t)strtoul(value, NULL, 10);
+		} else if (strcmp(key, "gid") == 0) {
+			ent->gid = (gid_t)strtoul(value, NULL, 10);
+		} else if (strcmp(key, "uname") == 0) {
+			strlcpy(ent->uname, value, sizeof(ent->uname));
+		} else if (strcmp(key, "gname") == 0) {
+			strlcpy(ent->gname, value, sizeof(ent->gname));
+		} else if (strcmp(key, "mtime") == 0) {
+			ent->mtime = (time_t)strtoll(value, NULL, 10);
+		}
+	}
+	free(data);
+	return res;
+}
+
+// Reads a GNU long name or long link entry.
+int ArchiveReader::read_long_name(char** name, off_t size) {
+	if (*name) free(*name);
+	*name = NULL;
+	if (size < 0 || size > PATH_MAX) {
+		fprintf(stderr, "Error: %s: corrupt tar header\n", m_path);
+		return READER_ERROR;
+	}
+	*name = (char*)malloc(size + 1);
+	if (!*name) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		return READER_ERROR;
+	}
+	int res = this->read_data(*name, size);
+	(*name)[size] = 0;
+	if (res == READER_OK) res = this->skip_data((TAR_BLOCK - (size % TAR_BLOCK)) % TAR_BLOCK);
+	return res;
+}
+
+int ArchiveReader::extract_cpio() {
+	int res = READER_OK;
+	ReaderEntry ent;
+	entry_init(&ent);
+
+	while (res == READER_OK) {
+		size_t avail = this->fill(6);
+		uint8_t* h = m_buf + m_buf_pos;
+		bool newc = avail >= 6 && (memcmp(h, "070701", 6) == 0 || memcmp(h, "070702", 6) == 0);
+		bool odc = avail >= 6 && memcmp(h, "070707", 6) == 0;
+		if (!newc && !odc) {
+			if (!m_error) fprintf(stderr, "Error: %s: corrupt cpio header\n", m_path);
+			res = READER_ERROR;
+			break;
+		}
+		size_t hdrlen = newc ? 110 : 76;
+		if (this->fill(hdrlen) < hdrlen) {
+			if (!m_error) fprintf(stderr, "Error: %s: unexpected end of archive\n", m_path);
+			res = READER_ERROR;
+			break;
+		}
+		h = m_buf + m_buf_pos;
+
+		size_t namesize;
+		if (newc) {
+			ent.ino = cpio_number(h + 6, 8, 16);
+			ent.mode = (mode_t)cpio_number(h + 14, 8, 16);
+			ent.uid = (uid_t)cpio_number(h + 22, 8, 16);
+			ent.gid = (gid_t)cpio_number(h + 30, 8, 16);
+			ent.nlink = (uint32_t)cpio_number(h + 38, 8, 16);
+			ent.mtime = (time_t)cpio_number(h + 46, 8, 16);
+			ent.size = (off_t)cpio_number(h + 54, 8, 16);
+			ent.dev = (cpio_number(h + 62, 8, 16) << 32) | cpio_number(h + 70, 8, 16);
+			ent.rdev = makedev(cpio_number(h + 78, 8, 16), cpio_number(h + 86, 8, 16));
+			namesize = (size_t)cpio_number(h + 94, 8, 16);
+		} else {
+			ent.dev = cpio_number(h + 6, 6, 8);
+			ent.ino = cpio_number(h + 12, 6, 8);
+			ent.mode = (mode_t)cpio_number(h + 18, 6, 8);
+			ent.uid = (uid_t)cpio_number(h + 24, 6, 8);
+			ent.gid = (gid_t)cpio_number(h + 30, 6, 8);
+			ent.nlink = (uint32_t)cpio_number(h + 36, 6, 8);
+			ent.rdev = (dev_t)cpio_number(h + 42, 6, 8);
+			ent.mtime = (time_t)cpio_number(h + 48, 11, 8);
+			namesize = (size_t)cpio_number(h + 59, 6, 8);
+			ent.size = (off_t)cpio_number(h + 65, 11, 8);
+		}
+		m_buf_pos += hdrlen;
+
+		// newc pads the header and name, and the data, to 4 bytes
+		off_t padding = newc ? (4 - ((hdrlen + namesize) % 4)) % 4 : 0;
+		if (namesize == 0 || namesize > PATH_MAX) {
+			fprintf(stderr, "Error: %s: corrupt cpio header\n", m_path);
+			res = READER_ERROR;
+			break;
+		}
+		ent.path = (char*)malloc(namesize + 1);
+		if (!ent.path) {
+			fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+			res = READER_ERROR;
+			break;
+		}
+		res = this->read_data(ent.path, namesize);
+		ent.path[namesize] = 0;
+		if (res == READER_OK) res = this->skip_data(padding);
+		if (res != READER_OK) break;
+		if (strcmp(ent.path, "TRAILER!!!") == 0) break;
+
+		padding = newc ? (4 - (ent.size % 4)) % 4 : 0;
+		switch (ent.mode & S_IFMT) {
+			case S_IFDIR: ent.type = 'd'; break;
+			case S_IFCHR: ent.type = 'c'; break;
+			case S_IFBLK: ent.type = 'b'; break;
+			case S_IFIFO: ent.type = 'p'; break;
+			case S_IFLNK: ent.type = 'l'; break;
+			default:      ent.type = 'f'; break;
+		}
+		ent.mode &= ALLPERMS;
+
+		// symlink targets are stored as the entry's data
+		if (ent.type == 'l') {
+			if (ent.size > PATH_MAX) {
+				fprintf(stderr, "Error: %s: corrupt cpio header\n", m_path);
+				res = READER_ERROR;
+				break;
+			}
+			ent.linkpath = (char*)malloc(ent.size + 1);
+			if (!ent.linkpath) {
+				fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+				res = READER_ERROR;
+				break;
+			}
+			res = this->read_data(ent.linkpath, ent.size);
+			ent.linkpath[ent.size] = 0;
+			if (res == READER_OK) res = this->skip_data(padding);
+			ent.size = 0;
+			padding = 0;
+		}
+
+		if (res == READER_OK) res = this->make_entry(&ent, padding);
+		entry_free(&ent);
+	}
+
+	entry_free(&ent);
+	return res;
+}
+
+
+////
+//  Extraction
+////
+
+int ArchiveReader::make_entry(ReaderEntry* ent, off_t padding) {
+	int res = READER_OK;
+	char* rel = relative_path(ent->path);
+	if (!rel) {
+		fprintf(stderr, "Error: %s: refusing to extract path containing '..': %s\n", m_path, ent->path);
+		return READER_ERROR;
+	}
+	// the entry for the destination itself
+	if (rel[0] == 0) {
+		free(rel);
+		return this->skip_data(ent->size + padding);
+	}
+#ifdef __APPLE__
+	// AppleDouble files are restored as extended attributes by tar(1)
+	const char* base = strrchr(rel, '/');
+	if (strncmp(base ? base + 1 : rel, "._", 2) == 0) {
+		IF_DEBUG("[extract] AppleDouble entry %s\n", rel);
+		free(rel);
+		return READER_UNSUPPORTED;
+	}
+#endif
+
+	// earlier entries may have made symlinks anywhere in the destination
+	res = this->check_parents(rel);
+
+	char* path = NULL;
+	char* key = NULL;
+	char* target = NULL;
+	char* target_key = NULL;
+	asprintf(&path, "%s/%s", m_destdir, rel);
+	asprintf(&key, "/%s", rel);
+	if (!path || !key) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		res = READER_ERROR;
+	}
+
+	if (res == READER_OK && ent->type == 'h') {
+		char* trel = relative_path(ent->linkpath);
+		if (!trel || trel[0] == 0) {
+			fprintf(stderr, "Error: %s: invalid hard link target: %s\n", m_path, ent->linkpath);
+			res = READER_ERROR;
+		} else {
+			res = this->check_parents(trel);
+		}
+		if (res == READER_OK) {
+			asprintf(&target, "%s/%s", m_destdir, trel);
+			asprintf(&target_key, "/%s", trel);
+			// link(2) follows a symlink target on some systems
+			struct stat sb;
+			if (target && lstat(target, &sb) == 0 && S_ISLNK(sb.st_mode)) {
+				fprintf(stderr, "Error: %s: refusing to hard link to a symlink: %s\n", 
+						m_path, ent->linkpath);
+				res = READER_ERROR;
+			}
+		}
+		if (trel) free(trel);
+	}
+
+	// cpio archives repeat hard linked files, with the data in any of
+	// the entries, so each later entry is linked to the first
+	if (res == READER_OK && ent->type == 'f' && ent->nlink > 1 && ent->ino) {
+		char link_key[64];
+		snprintf(link_key, sizeof(link_key), "%llx:%llx", 
+				 (unsigned long long)ent->dev, (unsigned long long)ent->ino);
+		char* first = (char*)m_links->get(link_key);
+		if (first) {
+			ent->type = 'h';
+			target = strdup(first);
+		} else {
+			m_links->set(link_key, strdup(path));
+		}
+	}
+
+	Digest* digest = NULL;
+	if (res == READER_OK) {
+		int fd = this->create(ent, path, target);
+		if (fd == -1) {
+			fprintf(stderr, "Error: unable to extract %s: %s (%d)\n", path, strerror(errno), errno);
+			res = READER_ERROR;
+		} else if (ent->type == 'f' || (ent->type == 'h' && ent->size > 0)) {
+			// data for a cpio hard link is written through the first path
+			if (ent->type == 'h') {
+				fd = open(target, O_WRONLY | O_TRUNC | O_NOFOLLOW);
+				if (fd == -1) {
+					fprintf(stderr, "Error: unable to open %s: %s (%d)\n", target, strerror(errno), errno);
+					res = READER_ERROR;
+				}
+			}
+			if (res == READER_OK) res = this->write_data(fd, ent->size, &digest);
+			if (res == READER_OK) res = this->skip_data(padding);
+			if (res == READER_OK) {
+				this->set_owner(NULL, fd, ent);
+				struct timeval tv[2];
+				tv[0].tv_sec = tv[1].tv_sec = ent->mtime;
+				tv[0].tv_usec = tv[1].tv_usec = 0;
+				futimes(fd, tv);
+			}
+			if (fd != -1) close(fd);
+		} else {
+			res = this->skip_data(ent->size + padding);
+		}
+	}
+
+	if (res == READER_OK) {
+		if (ent->type == 'h' && !digest && target_key) {
+			Digest* linked = (Digest*)m_digests->get(target_key);
+			if (linked) digest = new SHA1Digest(linked);
+		}
+		// a cpio hard link without data may be filled in by a later entry
+		if (ent->type == 'f' && ent->nlink > 1 && ent->size == 0 && digest) {
+			delete digest;
+			digest = NULL;
+		}
+		Digest* older = digest ? (Digest*)m_digests->set(key, digest) : (Digest*)m_digests->take(key);
+		if (older) delete older;
+	} else if (digest) {
+		delete digest;
+	}
+
+	free(rel);
+	free(path);
+	free(key);
+	if (target) free(target);
+	if (target_key) free(target_key);
+	return res;
+}
+
+// Creates the file system object for ent at path, replacing whatever
+// was extracted there before and creating any missing parents.
+// Returns a file descriptor for regular files, 0 for others, or -1.
+int ArchiveReader::create(ReaderEntry* ent, const char* path, const char* target) {
+	int res = -1;
+	for (int tries = 0; tries < 3; tries++) {
+		switch (ent->type) {
+			case 'f':
+				res = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+				break;
+			case 'd':
+				res = mkdir(path, 0700);
+				if (res == -1 && errno == EEXIST && is_directory(path, false)) res = 0;
+				break;
+			case 'l':
+				res = symlink(ent->linkpath, path);
+				break;
+			case 'h':
+				res = link(target, path);
+				break;
+			case 'c':
+				res = mknod(path, S_IFCHR | entry_mode(ent), ent->rdev);
+				break;
+			case 'b':
+				res = mknod(path, S_IFBLK | entry_mode(ent), ent->rdev);
+				break;
+			case 'p':
+				res = mkfifo(path, entry_mode(ent));
+				break;
+		}
+		if (res != -1) break;
+		if (errno == ENOENT) {
+			char parent[PATH_MAX];
+			strlcpy(parent, path, sizeof(parent));
+			char* slash = strrchr(parent, '/');
+			if (slash) *slash = 0;
+			if (mkdir_p(parent) != 0 && errno != EEXIST) break;
+		} else if (errno == EEXIST) {
+			if (this->make_room(path) != 0) break;
+		} else {
+			break;
+		}
+	}
+	if (res == -1) return -1;
+
+	if (ent->type == 'd') {
+		this->set_owner(path, -1, ent);
+		if (m_dirs_count == m_dirs_max) {
+			m_dirs_max = m_dirs_max ? m_dirs_max * 2 : 64;
+			m_dirs = (ReaderDirectory*)realloc(m_dirs, m_dirs_max * sizeof(ReaderDirectory));
+			assert(m_dirs != NULL);
+		}
+		m_dirs[m_dirs_count].path = strdup(path);
+		m_dirs[m_dirs_count].mode = entry_mode(ent);
+		m_dirs[m_dirs_count].mtime = ent->mtime;
+		m_dirs_count++;
+	} else if (ent->type == 'l') {
+		this->set_owner(path, -1, ent);
+		struct timeval tv[2];
+		tv[0].tv_sec = tv[1].tv_sec = ent->mtime;
+		tv[0].tv_usec = tv[1].tv_usec = 0;
+		lutimes(path, tv);
+	} else if (ent->type == 'c' || ent->type == 'b' || ent->type == 'p') {
+		this->set_owner(path, -1, ent);
+	}
+	return res;
+}
+
+// Removes an earlier entry at path so it can be replaced.
+int ArchiveReader::make_room(const char* path) {
+	struct stat sb;
+	if (lstat(path, &sb) == -1) return -1;
+	int res = S_ISDIR(sb.st_mode) ? rmdir(path) : unlink(path);
+	if (res == -1) {
+		fprintf(stderr, "Error: unable to replace %s: %s (%d)\n", path, strerror(errno), errno);
+	}
+	return res;
+}
+
+// Fails if any parent of relpath in the destination is a symlink, so
+// that an archive cannot write outside of the destination.
+int ArchiveReader::check_parents(const char* relpath) {
+	char path[PATH_MAX];
+	size_t base = strlcpy(path, m_destdir, sizeof(path));
+	strlcat(path, "/", sizeof(path));
+	strlcat(path, relpath, sizeof(path));
+	for (char* slash = strchr(path + base + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+		*slash = 0;
+		struct stat sb;
+		int res = lstat(path, &sb);
+		bool is_link = (res == 0 && S_ISLNK(sb.st_mode));
+		*slash = '/';
+		if (res == -1) break;
+		if (is_link) {
+			fprintf(stderr, "Error: %s: refusing to extract through a symlink: %s\n", m_path, relpath);
+			return READER_ERROR;
+		}
+	}
+	return READER_OK;
+}
+
+// Writes size bytes of entry data to fd, computing their digest.
+int ArchiveReader::write_data(int fd, off_t size, Digest** digest) {
+	CC_SHA1_CTX c;
+	CC_SHA1_Init(&c);
+	while (size > 0) {
+		size_t avail = this->fill(size < READER_BUFFER_SIZE ? (size_t)size : READER_BUFFER_SIZE);
+		if (avail == 0) {
+			if (!m_error) fprintf(stderr, "Error: %s: unexpected end of archive\n", m_path);
+			return READER_ERROR;
+		}
+		size_t n = (off_t)avail < size ? avail : (size_t)size;
+		uint8_t* p = m_buf + m_buf_pos;
+		CC_SHA1_Update(&c, p, (CC_LONG)n);
+		m_buf_pos += n;
+		size -= n;
+		while (n > 0) {
+			ssize_t written = write(fd, p, n);
+			if (written == -1 && errno == EINTR) continue;
+			if (written == -1) {
+				fprintf(stderr, "Error: write failed: %s (%d)\n", strerror(errno), errno);
+				return READER_ERROR;
+			}
+			p += written;
+			n -= written;
+		}
+	}
+	SHA1Digest* sha1 = new SHA1Digest();
+	CC_SHA1_Final(sha1->m_data, &c);
+	*digest = sha1;
+	return READER_OK;
+}
+
+// Sets ownership, and for regular files the mode, as tar(1) would:
+// by name when the name is known here, and only when running as root.
+void ArchiveReader::set_owner(const char* path, int fd, ReaderEntry* ent) {
+	if (m_is_root) {
+		uid_t uid = ent->uid;
+		gid_t gid = ent->gid;
+		if (ent->uname[0]) {
+			if (strcmp(ent->uname, m_uname) != 0) {
+				struct passwd* pw = getpwnam(ent->uname);
+				strlcpy(m_uname, ent->uname, sizeof(m_uname));
+				m_uid = pw ? pw->pw_uid : (uid_t)-1;
+			}
+			if (m_uid != (uid_t)-1) uid = m_uid;
+		}
+		if (ent->gname[0]) {
+			if (strcmp(ent->gname, m_gname) != 0) {
+				struct group* gr = getgrnam(ent->gname);
+				strlcpy(m_gname, ent->gname, sizeof(m_gname));
+				m_gid = gr ? gr->gr_gid : (gid_t)-1;
+			}
+			if (m_gid != (gid_t)-1) gid = m_gid;
+		}
+		if (fd != -1) fchown(fd, uid, gid);
+		else lchown(path, uid, gid);
+	}
+	// chown clears the set-id bits, so the mode comes after
+	if (fd != -1) fchmod(fd, entry_mode(ent));
+	else if (ent->type == 'c' || ent->type == 'b' || ent->type == 'p') chmod(path, entry_mode(ent));
+}
+
+mode_t ArchiveReader::entry_mode(ReaderEntry* ent) {
+	mode_t mode = ent->mode & ALLPERMS;
+	if (!m_is_root) mode &= ~(m_umask | S_ISUID | S_ISGID);
+	return mode;
+}
+
+// Applies directory modes and times, deepest first, once their
+// contents have been extracted.
+void ArchiveReader::finish_directories() {
+	for (uint32_t i = m_dirs_count; i > 0; i--) {
+		ReaderDirectory* dir = &m_dirs[i - 1];
+		chmod(dir->path, dir->mode);
+		struct timeval tv[2];
+		tv[0].tv_sec = tv[1].tv_sec = dir->mtime;
+		tv[0].tv_usec = tv[1].tv_usec = 0;
+		utimes(dir->path, tv);
+		free(dir->path);
+	}
+	m_dirs_count = 0;
+}
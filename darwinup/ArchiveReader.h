@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _ARCHIVEREADER_H
+#define _ARCHIVEREADER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define READER_OK            0
+#define READER_ERROR        -1
+#define READER_UNSUPPORTED   1
+
+// size of the decompressed data buffer, a multiple of the tar block size
+#define READER_BUFFER_SIZE   (64 * 1024)
+
+// largest pax extended header that is read into memory
+#define READER_MAX_PAX_SIZE  (1024 * 1024)
+
+struct Digest;
+struct PathIndex;
+
+////
+//  ReaderEntry
+//
+//  One member of an archive, as described by its tar or cpio header.
+////
+struct ReaderEntry {
+	char     type;        // one of "fdlhcbp"
+	char*    path;        // relative to the destination
+	char*    linkpath;    // symlink target or hard link source
+	mode_t   mode;
+	uid_t    uid;
+	gid_t    gid;
+	char     uname[33];
+	char     gname[33];
+	off_t    size;
+	time_t   mtime;
+	dev_t    rdev;
+	uint64_t dev;         // cpio only, for hard links
+	uint64_t ino;
+	uint32_t nlink;
+};
+
+////
+//  ReaderDirectory
+//
+//  A directory whose mode and mtime are applied once extraction is
+//  done, so that read-only directories can still be filled in.
+////
+struct ReaderDirectory {
+	char*  path;
+	mode_t mode;
+	time_t mtime;
+};
+
+////
+//  ArchiveReader
+//
+//  Extracts tar, ustar, pax and cpio (odc and newc) archives in process,
+//  optionally compressed with gzip, bzip2 or xz.  The compression and the
+//  format are detected from the data, not the file name.
+//
+//  The SHA-1 digest of every regular file is computed as it is written,
+//  and stored in the digests index under the file's path relative to
+//  the destination (with a leading slash, like File::path()), so that
+//  the staged data never has to be read back in.
+////
+struct ArchiveReader {
+	ArchiveReader(const char* path);
+	virtual ~ArchiveReader();
+
+	// Extracts the archive into destdir, adding a Digest to digests for
+	// each regular file.  Digests are owned by the caller.
+	// Returns READER_UNSUPPORTED if the archive uses a format or feature
+	// that must be left to an external tool, in which case some entries
+	// may already have been extracted into destdir.
+	int extract(const char* destdir, PathIndex* digests);
+
+	protected:
+
+	int     open_stream();
+	void    close_stream();
+	ssize_t read_input();
+	ssize_t decompress(uint8_t* buf, size_t len);
+	size_t  fill(size_t len);
+	int     read_data(void* buf, size_t len);
+	int     skip_data(off_t len);
+
+	int     extract_tar();
+	int     extract_cpio();
+	int     read_pax_header(ReaderEntry* ent, off_t size);
+	int     read_long_name(char** name, off_t size);
+
+	int     make_entry(ReaderEntry* ent, off_t padding);
+	int     create(ReaderEntry* ent, const char* path, const char* target);
+	int     make_room(const char* path);
+	int     check_parents(const char* relpath);
+	int     write_data(int fd, off_t size, Digest** digest);
+	void    set_owner(const char* path, int fd, ReaderEntry* ent);
+	mode_t  entry_mode(ReaderEntry* ent);
+	void    finish_directories();
+
+	char*            m_path;
+	char*            m_destdir;
+	PathIndex*       m_digests;
+	int              m_fd;
+	int              m_codec;
+	void*            m_stream;
+	bool             m_stream_end;
+	bool             m_input_end;
+
+	uint8_t*         m_input;
+	uint8_t*         m_input_pos;
+	size_t           m_input_len;
+	uint8_t*         m_buf;
+	size_t           m_buf_pos;
+	size_t           m_buf_len;
+	bool             m_error;
+
+	// hard link targets from cpio archives, keyed by dev and inode
+	PathIndex*       m_links;
+	ReaderDirectory* m_dirs;
+	uint32_t         m_dirs_count;
+	uint32_t         m_dirs_max;
+	bool             m_is_root;
+	mode_t           m_umask;
+
+	// last user and group names looked up
+	char             m_uname[33];
+	uid_t            m_uid;
+	char             m_gname[33];
+	gid_t            m_gid;
+};
+
+#endif
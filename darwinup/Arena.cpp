@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "Arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// every allocation, and the chunk header, is a multiple of this
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+Arena::Arena() {
+	m_first = NULL;
+	m_current = NULL;
+	m_allocations = 0;
+	m_chunks = 0;
+}
+
+Arena::~Arena() {
+	ArenaChunk* chunk = m_first;
+	while (chunk) {
+		ArenaChunk* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
+void* Arena::alloc(size_t size) {
+	size = ARENA_ROUND(size);
+	++m_allocations;
+
+	// use the rest of the current chunk, then any chunks kept by clear()
+	while (m_current && m_current->size - m_current->used < size && m_current->next) {
+		m_current = m_current->next;
+		m_current->used = 0;
+	}
+	if (!m_current || m_current->size - m_current->used < size) {
+		size_t chunk_size = ARENA_CHUNK_SIZE;
+		if (size > chunk_size) chunk_size = size;
+		ArenaChunk* chunk = (ArenaChunk*)malloc(ARENA_ROUND(sizeof(ArenaChunk)) + chunk_size);
+		if (!chunk) {
+			fprintf(stderr, "Error: ran out of memory in Arena::alloc\n");
+			return NULL;
+		}
+		++m_chunks;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		// the new chunk goes after the current one, so the chunks that 
+		// follow are still reused after the next clear()
+		if (m_current) {
+			chunk->next = m_current->next;
+			m_current->next = chunk;
+		} else {
+			chunk->next = m_first;
+			m_first = chunk;
+		}
+		m_current = chunk;
+	}
+
+	void* result = (uint8_t*)m_current + ARENA_ROUND(sizeof(ArenaChunk)) + m_current->used;
+	m_current->used += size;
+	return result;
+}
+
+void* Arena::copy(const void* data, size_t size) {
+	void* result = this->alloc(size);
+	if (result && size) memcpy(result, data, size);
+	return result;
+}
+
+char* Arena::copy(const char* str) {
+	return (char*)this->copy((const void*)str, strlen(str) + 1);
+}
+
+void Arena::clear() {
+	m_current = m_first;
+	if (m_current) m_current->used = 0;
+}
+
+uint64_t Arena::allocations() {
+	return m_allocations;
+}
+
+uint64_t Arena::chunks() {
+	return m_chunks;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// smallest block the arena asks malloc(3) for
+#define ARENA_CHUNK_SIZE 16384
+
+struct ArenaChunk {
+	ArenaChunk* next;
+	size_t      size;
+	size_t      used;
+};
+
+////
+//  Arena
+//
+//  A bump allocator for data that is all thrown away at once, like
+//  the text and blobs of the row a query is reading.  Memory is
+//  handed out from large chunks that clear() keeps for reuse, so
+//  after the first few rows reading another one costs no malloc(3).
+//  Nothing allocated from an arena may be passed to free(3).
+////
+struct Arena {
+	Arena();
+	~Arena();
+
+	// Returns size bytes, aligned for any type, valid until clear().
+	void*    alloc(size_t size);
+
+	// Returns a copy of size bytes of data, or of the string str.
+	void*    copy(const void* data, size_t size);
+	char*    copy(const char* str);
+
+	// Releases everything allocated so far, keeping the chunks.
+	void     clear();
+
+	// Number of alloc() calls and of chunks malloc'd over the life
+	// of the arena.
+	uint64_t allocations();
+	uint64_t chunks();
+
+	protected:
+
+	ArenaChunk* m_first;
+	ArenaChunk* m_current;
+	uint64_t    m_allocations;
+	uint64_t    m_chunks;
+};
+
+#endif
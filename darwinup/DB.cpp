@@ -33,15 +33,29 @@
 #include "DB.h"
 
 
-DarwinupDatabase::DarwinupDatabase(const char* path) : Database(path) {
-	this->connect();
+DarwinupDatabase::DarwinupDatabase(const char* path, bool snapshot) : Database(path) {
+	extern uint32_t db_profile;
+	extern uint32_t lock_timeout;
+	if (db_profile != DB_PROFILE_STORED) this->set_profile(db_profile);
+	this->set_busy_timeout(lock_timeout);
+	this->set_snapshot(snapshot);
 	this->last_archive = NULL;
+	this->m_dir_serials = NULL;
+	if (this->connect() == DB_OK) {
+		char** paths = NULL;
+		if (this->get_information_value("paths", &paths) == SQLITE_ROW) {
+			if (strcmp(*paths, "interned") == 0) this->split_paths();
+			free(*paths);
+		}
+		free(paths);
+	}
 }
 
 DarwinupDatabase::~DarwinupDatabase() {
 	// parent automatically deallocates schema objects
 
 	if (this->last_archive) delete this->last_archive;
+	if (this->m_dir_serials) delete this->m_dir_serials;
 }
 
 int DarwinupDatabase::init_schema() {
@@ -79,6 +93,211 @@ int DarwinupDatabase::init_schema() {
 	SCHEMA_VERSION(1);
 
 	ADD_TEXT(m_archives_table, "osbuild");
+
+
+	SCHEMA_VERSION(2);
+
+	// lstat(2) of the installed file, along with size, recorded after
+	// installing so its digest can be trusted while these still match
+	ADD_INTEGER(m_files_table, "dev");
+	ADD_INTEGER(m_files_table, "ino");
+	ADD_INTEGER(m_files_table, "mtime");
+	ADD_INTEGER(m_files_table, "ctime");
+
+
+	SCHEMA_VERSION(3);
+
+	// PACK_CODEC of the archive's backing store, NULL (zlib) before this
+	ADD_INTEGER(m_archives_table, "codec");
+
+
+	SCHEMA_VERSION(4);
+
+	// finds the file before or after an archive at a path with one seek,
+	// in archive order either way, instead of reading every file at the 
+	// path out of files_path and sorting them
+	ADD_TABLE_INDEX(m_files_table, "files_path_archive", "path, archive");
+
+
+	SCHEMA_VERSION(5);
+
+	// paths may be interned, see intern_paths(), to store each directory once
+	this->m_dirs_table = new Table("dirs");
+	ADD_TABLE(this->m_dirs_table);
+	ADD_PK(m_dirs_table, "serial");
+	ADD_COLUMN(m_dirs_table, "path", TYPE_TEXT, false, false, true);
+	ADD_INTEGER(m_files_table, "dir");
+	ADD_TEXT(m_files_table, "basename");
+
+
+	SCHEMA_VERSION(6);
+
+	// what decided whether the archive is superseded, see Archive::m_survivor
+	ADD_INTEGER(m_archives_table, "survivor");
+
+
+	SCHEMA_VERSION(7);
+
+	// totals of each archive, see ArchiveStats, so list -l reads no files
+	this->m_archive_stats_table = new Table("archive_stats");
+	ADD_TABLE(this->m_archive_stats_table);
+	ADD_PK(m_archive_stats_table, "serial");
+	ADD_INDEX(m_archive_stats_table, "archive", TYPE_INTEGER, true);
+	ADD_INTEGER(m_archive_stats_table, "files");
+	ADD_INTEGER(m_archive_stats_table, "bytes");
+	ADD_INTEGER(m_archive_stats_table, "rollback_bytes");
+	ADD_INTEGER(m_archive_stats_table, "duration");
+	
+	return this->init_queries();
+}
+
+int DarwinupDatabase::init_queries() {
+	Column* archive_serial = m_archives_table->column(0);
+	Column* archive_uuid = m_archives_table->column(1);
+	Column* archive_name = m_archives_table->column(2);
+	Column* archive_date_added = m_archives_table->column(3);
+	Column* archive_active = m_archives_table->column(4);
+	Column* archive_survivor = m_archives_table->column(8);
+	Column* file_serial = m_files_table->column(0);
+	Column* file_archive = m_files_table->column(1);
+	Column* file_digest = m_files_table->column(7);
+	Column* file_path = m_files_table->column(8);
+	
+	// Archives
+	m_set_archive_active = new Query(m_archives_table, QUERY_UPDATE, archive_active);
+	m_set_archive_active->where(archive_serial, '=');
+	ADD_QUERY(m_set_archive_active);
+	
+	m_set_archive_survivor = new Query(m_archives_table, QUERY_UPDATE, archive_survivor);
+	m_set_archive_survivor->where(archive_serial, '=');
+	ADD_QUERY(m_set_archive_survivor);
+	
+	m_forget_survivors = new Query(m_archives_table, QUERY_UPDATE, archive_survivor);
+	m_forget_survivors->where(archive_serial, '<');
+	ADD_QUERY(m_forget_survivors);
+	
+	m_archive_by_uuid = new Query(m_archives_table, QUERY_ROW);
+	m_archive_by_uuid->where(archive_uuid, '=');
+	ADD_QUERY(m_archive_by_uuid);
+	
+	m_archive_by_serial = new Query(m_archives_table, QUERY_ROW);
+	m_archive_by_serial->where(archive_serial, '=');
+	ADD_QUERY(m_archive_by_serial);
+	
+	m_archive_by_name = new Query(m_archives_table, QUERY_ROW);
+	m_archive_by_name->where(archive_name, '=');
+	ADD_QUERY(m_archive_by_name);
+	
+	m_archive_newest = new Query(m_archives_table, QUERY_ROW);
+	m_archive_newest->where(archive_name, '!')->order_by(archive_date_added, ORDER_BY_DESC);
+	ADD_QUERY(m_archive_newest);
+	
+	m_archive_oldest = new Query(m_archives_table, QUERY_ROW);
+	m_archive_oldest->where(archive_name, '!')->order_by(archive_date_added, ORDER_BY_ASC);
+	ADD_QUERY(m_archive_oldest);
+	
+	m_archives = new Query(m_archives_table, QUERY_ROWS);
+	m_archives->where(archive_name, '!')->order_by(archive_serial, ORDER_BY_DESC);
+	ADD_QUERY(m_archives);
+	
+	m_count_archives = new Query(m_archives_table, QUERY_COUNT);
+	ADD_QUERY(m_count_archives);
+	
+	m_count_archives_norollback = new Query(m_archives_table, QUERY_COUNT);
+	m_count_archives_norollback->where(archive_name, '!');
+	ADD_QUERY(m_count_archives_norollback);
+	
+	m_inactive_archive_serials = new Query(m_archives_table, QUERY_COLUMN, archive_serial);
+	m_inactive_archive_serials->where(archive_active, '=');
+	ADD_QUERY(m_inactive_archive_serials);
+	
+	// Files
+	// only files of active archives precede or supersede another
+	m_file_preceded = new Query(m_files_table, QUERY_ROW);
+	m_file_preceded->where(file_archive, '<')->where(file_path, '=');
+	m_file_preceded->where_exists(file_archive, m_archives_table, archive_serial, 
+								  archive_active);
+	m_file_preceded->order_by(file_archive, ORDER_BY_DESC);
+	ADD_QUERY(m_file_preceded);
+	
+	m_file_superseded = new Query(m_files_table, QUERY_ROW);
+	m_file_superseded->where(file_archive, '>')->where(file_path, '=');
+	m_file_superseded->where_exists(file_archive, m_archives_table, archive_serial, 
+									archive_active);
+	m_file_superseded->order_by(file_archive, ORDER_BY_ASC);
+	ADD_QUERY(m_file_superseded);
+	
+	m_files_at_path = new Query(m_files_table, QUERY_ROWS);
+	m_files_at_path->where(file_path, '=')->order_by(file_archive, ORDER_BY_DESC);
+	ADD_QUERY(m_files_at_path);
+	
+	m_file_owner = new Query(m_files_table, QUERY_ROW);
+	m_file_owner->where(file_path, '=');
+	m_file_owner->where_exists(file_archive, m_archives_table, archive_serial, 
+							   archive_active);
+	m_file_owner->order_by(file_archive, ORDER_BY_DESC);
+	ADD_QUERY(m_file_owner);
+	
+	// every file, grouped by path for find_survivors()
+	m_files_by_path = new Query(m_files_table, QUERY_ROWS);
+	m_files_by_path->order_by(file_path, ORDER_BY_GROUP);
+	ADD_QUERY(m_files_by_path);
+	
+	m_file_by_serial = new Query(m_files_table, QUERY_ROW);
+	m_file_by_serial->where(file_serial, '=');
+	ADD_QUERY(m_file_by_serial);
+	
+	m_files_archive = new Query(m_files_table, QUERY_ROWS);
+	m_files_archive->where(file_archive, '=')->order_by(file_path, ORDER_BY_ASC);
+	ADD_QUERY(m_files_archive);
+	
+	m_files_archive_reverse = new Query(m_files_table, QUERY_ROWS);
+	m_files_archive_reverse->where(file_archive, '=')->order_by(file_path, ORDER_BY_DESC);
+	ADD_QUERY(m_files_archive_reverse);
+	
+	m_file_serial_archive_path = new Query(m_files_table, QUERY_VALUE, file_serial);
+	m_file_serial_archive_path->where(file_archive, '=')->where(file_path, '=');
+	ADD_QUERY(m_file_serial_archive_path);
+	
+	m_count_files = new Query(m_files_table, QUERY_COUNT);
+	m_count_files->where(file_archive, '=')->where(file_path, '=');
+	ADD_QUERY(m_count_files);
+	
+	m_count_all_files = new Query(m_files_table, QUERY_COUNT);
+	ADD_QUERY(m_count_all_files);
+	
+	m_delete_files_archive = new Query(m_files_table, QUERY_DELETE);
+	m_delete_files_archive->where(file_archive, '=');
+	ADD_QUERY(m_delete_files_archive);
+	
+	m_file_serials = new Query(m_files_table, QUERY_COLUMN, file_serial);
+	ADD_QUERY(m_file_serials);
+	
+	m_file_digests = new Query(m_files_table, QUERY_COLUMN, file_digest);
+	ADD_QUERY(m_file_digests);
+	
+	// Directories
+	m_dir_serial = new Query(m_dirs_table, QUERY_VALUE, m_dirs_table->column(0));
+	m_dir_serial->where(m_dirs_table->column(1), '=');
+	ADD_QUERY(m_dir_serial);
+	
+	m_count_dirs = new Query(m_dirs_table, QUERY_COUNT);
+	ADD_QUERY(m_count_dirs);
+	
+	// Archive stats
+	Column* stats_archive = m_archive_stats_table->column(1);
+	Column* stats_duration = m_archive_stats_table->column(5);
+	m_archive_stats = new Query(m_archive_stats_table, QUERY_ROW);
+	m_archive_stats->where(stats_archive, '=');
+	ADD_QUERY(m_archive_stats);
+	
+	m_set_archive_duration = new Query(m_archive_stats_table, QUERY_UPDATE, stats_duration);
+	m_set_archive_duration->where(stats_archive, '=');
+	ADD_QUERY(m_set_archive_duration);
+	
+	m_delete_archive_stats = new Query(m_archive_stats_table, QUERY_DELETE);
+	m_delete_archive_stats->where(stats_archive, '=');
+	ADD_QUERY(m_delete_archive_stats);
 	
 	return 0;
 }
@@ -95,18 +314,26 @@ int DarwinupDatabase::deactivate_archive(uint64_t serial) {
 
 int DarwinupDatabase::set_archive_active(uint64_t serial, uint64_t* active) {
 	this->clear_last_archive();
-	return this->update_value("activate_archive", 
-							  this->m_archives_table,
-							  this->m_archives_table->column(4), // active
-							  (void**)active,
-							  1,                                 // number of where conditions
-							  this->m_archives_table->column(0), // serial
-							  '=', serial);
+	int res = this->update_value(m_set_archive_active->bind(*active)->bind(serial));
+	// the paths of the archive now belong to someone else
+	if (res == DB_OK) res = this->forget_survivors(serial);
+	return res;
+}
+
+int DarwinupDatabase::set_archive_survivor(uint64_t serial, uint64_t survivor) {
+	this->clear_last_archive();
+	return this->update_value(m_set_archive_survivor->bind(survivor)->bind(serial));
+}
+
+int DarwinupDatabase::forget_survivors(uint64_t serial) {
+	this->clear_last_archive();
+	return this->update_value(m_forget_survivors->bind(ARCHIVE_SURVIVOR_UNKNOWN)
+							  ->bind(serial + 1));
 }
 
 int DarwinupDatabase::update_archive(uint64_t serial, uuid_t uuid, const char* name,
 									 time_t date_added, uint32_t active, uint64_t info,
-									 const char* build) {
+									 const char* build, uint32_t codec, uint64_t survivor) {
 	this->clear_last_archive();
 	return this->update(this->m_archives_table, serial,
 						(uint8_t*)uuid,
@@ -115,11 +342,13 @@ int DarwinupDatabase::update_archive(uint64_t serial, uuid_t uuid, const char* n
 						(uint64_t)date_added,
 						(uint64_t)active,
 						(uint64_t)info,
-						build);
+						build,
+						(uint64_t)codec,
+						survivor);
 }
 
 uint64_t DarwinupDatabase::insert_archive(uuid_t uuid, uint64_t info, const char* name, 
-										  time_t date_added, const char* build) {
+										  time_t date_added, const char* build, uint32_t codec) {
 	
 	int res = this->insert(this->m_archives_table,
 						   (uint8_t*)uuid,
@@ -128,7 +357,9 @@ uint64_t DarwinupDatabase::insert_archive(uuid_t uuid, uint64_t info, const char
 						   (uint64_t)date_added,
 						   (uint64_t)0,
 						   (uint64_t)info,
-						   build);
+						   build,
+						   (uint64_t)codec,
+						   ARCHIVE_SURVIVOR_UNKNOWN);
 	if (res != SQLITE_OK) {
 		fprintf(stderr, "Error: unable to insert archive %s: %s \n",
 				name, this->error());
@@ -139,6 +370,12 @@ uint64_t DarwinupDatabase::insert_archive(uuid_t uuid, uint64_t info, const char
 }
 
 File* DarwinupDatabase::make_file(uint8_t* data) {
+	File* result = this->read_file(data, false);
+	this->m_files_table->free_result(data);
+	return result;
+}
+
+File* DarwinupDatabase::read_file(uint8_t* data, bool borrow_path) {
 	// XXX do this with a for loop and column->type()
 	uint64_t serial;
 	memcpy(&serial, &data[this->file_offset(0)], sizeof(uint64_t));
@@ -166,6 +403,15 @@ File* DarwinupDatabase::make_file(uint8_t* data) {
 	
 	char* path;
 	memcpy(&path, &data[this->file_offset(8)], sizeof(char*));
+
+	uint64_t dev;
+	memcpy(&dev, &data[this->file_offset(9)], sizeof(uint64_t));
+	uint64_t ino;
+	memcpy(&ino, &data[this->file_offset(10)], sizeof(uint64_t));
+	int64_t mtime;
+	memcpy(&mtime, &data[this->file_offset(11)], sizeof(int64_t));
+	int64_t ctime;
+	memcpy(&ctime, &data[this->file_offset(12)], sizeof(int64_t));
 	
 	// get archive, which may be stored in last_archive
 	int res = DB_OK;
@@ -184,8 +430,8 @@ File* DarwinupDatabase::make_file(uint8_t* data) {
 		return NULL;
 	}
 
-	File* result = FileFactory(serial, archive, (uint32_t)info, (const char*)path, mode, (uid_t)uid, (gid_t)gid, size, digest);
-	this->m_files_table->free_result(data);
+	File* result = FileFactory(serial, archive, (uint32_t)info, (const char*)path, mode, (uid_t)uid, (gid_t)gid, size, digest, borrow_path);
+	if (result) result->stat_set(dev, ino, mtime, ctime);
 	
 	return result;
 }
@@ -195,40 +441,61 @@ File* DarwinupDatabase::make_file(uint8_t* data) {
 int DarwinupDatabase::get_next_file(uint8_t** data, File* file, file_starseded_t star) {
 	int res = SQLITE_OK;
 	
-	char comp = '<';
-	const char* name = "file_preceded";
-	int order = ORDER_BY_DESC;
+	Query* query = m_file_preceded;
 	if (star == FILE_SUPERSEDED) {
-		comp = '>';
-		name = "file_superseded";
-		order = ORDER_BY_ASC;
-	}
-	res = this->get_row_ordered(name,
-								data,
-								this->m_files_table,
-								this->m_files_table->column(1), // order by archive
-								order,
-								2,
-								this->m_files_table->column(1), // archive
-								comp, file->archive()->serial(),
-								this->m_files_table->column(8), // path
-								'=', file->path());
+		query = m_file_superseded;
+	}
+	uint64_t active = 1;
+	res = this->get_row(query->bind(file->archive()->serial())
+							 ->bind(file->path())
+							 ->bind(active), 
+						data);
+	
+	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::get_file_preceding(uint8_t** data, const char* path, Archive* archive) {
+	// the archive of a dry run was never inserted, so every file
+	// already in the database comes before it
+	uint64_t serial = archive->serial() ? archive->serial() : INT64_MAX;
+	uint64_t active = 1;
+	int res = this->get_row(m_file_preceded->bind(serial)->bind(path)->bind(active), data);
+	
+	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::get_files_at_path(uint8_t*** data, uint32_t* count, const char* path) {
+	int res = this->get_all(m_files_at_path->bind(path), data, count);
+	
+	if ((res == SQLITE_DONE) && *count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+int DarwinupDatabase::get_file_owner(uint8_t** data, const char* path) {
+	uint64_t active = 1;
+	int res = this->get_row(m_file_owner->bind(path)->bind(active), data);
 	
 	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
 	if (res == SQLITE_DONE) return DB_OK;
 	return DB_ERROR;
 }
 
+int DarwinupDatabase::get_file(uint8_t** data, uint64_t serial) {
+	int res = this->get_row(m_file_by_serial->bind(serial), data);
+	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
 int DarwinupDatabase::get_file_serial_from_archive(Archive* archive, const char* path, uint64_t** serial) {
-	int res = this->get_value("file_serial__archive_path",
-							  (void**)serial,
-							  this->m_files_table,
-							  this->m_files_table->column(0), // serial
-							  2,                              // number of where conditions
-							  this->m_files_table->column(1), // archive
-							  '=', (uint64_t)archive->serial(),
-							  this->m_files_table->column(8), // path
-							  '=', path);
+	int res = this->get_value(m_file_serial_archive_path->bind(archive->serial())
+																->bind(path),
+							  (void**)serial);
 	
 	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
 	if (res == SQLITE_DONE) return DB_OK;
@@ -238,19 +505,30 @@ int DarwinupDatabase::get_file_serial_from_archive(Archive* archive, const char*
 int DarwinupDatabase::update_file(uint64_t serial, Archive* archive, uint64_t info, mode_t mode, 
 								   uid_t uid, gid_t gid, Digest* digest, const char* path) {
 
-	int res = SQLITE_OK;
+	const char* whole;
+	uint64_t dir;
+	const char* name;
+	int res = this->store_path(path, &whole, &dir, &name);
 								  
 	// update the information
-	res = this->update(this->m_files_table, serial,
-					   (uint64_t)archive->serial(),
-					   (uint64_t)info,
-					   (uint64_t)mode,
-					   (uint64_t)uid,
-					   (uint64_t)gid,
-					   (uint64_t)0, 
-					   (uint8_t*)(digest ? digest->data() : NULL), 
-					   (uint32_t)(digest ? digest->size() : 0), 
-					   path);
+	if (res == DB_OK) {
+		res = this->update(this->m_files_table, serial,
+						   (uint64_t)archive->serial(),
+						   (uint64_t)info,
+						   (uint64_t)mode,
+						   (uint64_t)uid,
+						   (uint64_t)gid,
+						   (uint64_t)0, 
+						   (uint8_t*)(digest ? digest->data() : NULL), 
+						   (uint32_t)(digest ? digest->size() : 0), 
+						   whole,
+						   (uint64_t)0,
+						   (uint64_t)0,
+						   (uint64_t)0,
+						   (uint64_t)0,
+						   dir,
+						   name);
+	}
 
 	if (res != SQLITE_OK) {
 		fprintf(stderr, "Error: unable to update file with serial %llu and path %s: %s \n",
@@ -259,20 +537,63 @@ int DarwinupDatabase::update_file(uint64_t serial, Archive* archive, uint64_t in
 	
 	return res;
 }
+
+int DarwinupDatabase::update_file_stat(File* file) {
+	Digest* digest = file->digest();
+	const char* whole;
+	uint64_t dir;
+	const char* name;
+	int res = this->store_path(file->path(), &whole, &dir, &name);
+	if (res == DB_OK) {
+		res = this->update(this->m_files_table, file->serial(),
+						   (uint64_t)file->archive()->serial(),
+						   (uint64_t)file->info(),
+						   (uint64_t)file->mode(),
+						   (uint64_t)file->uid(),
+						   (uint64_t)file->gid(),
+						   (uint64_t)file->size(),
+						   (uint8_t*)(digest ? digest->data() : NULL), 
+						   (uint32_t)(digest ? digest->size() : 0), 
+						   whole,
+						   file->stat_dev(),
+						   file->stat_ino(),
+						   (uint64_t)file->stat_mtime(),
+						   (uint64_t)file->stat_ctime(),
+						   dir,
+						   name);
+	}
+	if (res != SQLITE_OK) {
+		fprintf(stderr, "Error: unable to record stat of file with serial %llu and "
+				"path %s: %s \n", file->serial(), file->path(), this->error());
+	}
+	return res;
+}
 										  
 uint64_t DarwinupDatabase::insert_file(uint64_t info, mode_t mode, uid_t uid, gid_t gid, 
 									   Digest* digest, Archive* archive, const char* path) {
 	
-	int res = this->insert(this->m_files_table,
-							(uint64_t)archive->serial(),
-							(uint64_t)info,
-							(uint64_t)mode,
-							(uint64_t)uid,
-							(uint64_t)gid,
-							(uint64_t)0, 
-							(uint8_t*)(digest ? digest->data() : NULL), 
-							(uint32_t)(digest ? digest->size() : 0), 
-							path);
+	const char* whole;
+	uint64_t dir;
+	const char* name;
+	int res = this->store_path(path, &whole, &dir, &name);
+	if (res == DB_OK) {
+		res = this->insert(this->m_files_table,
+						   (uint64_t)archive->serial(),
+						   (uint64_t)info,
+						   (uint64_t)mode,
+						   (uint64_t)uid,
+						   (uint64_t)gid,
+						   (uint64_t)0, 
+						   (uint8_t*)(digest ? digest->data() : NULL), 
+						   (uint32_t)(digest ? digest->size() : 0), 
+						   whole,
+						   (uint64_t)0,
+						   (uint64_t)0,
+						   (uint64_t)0,
+						   (uint64_t)0,
+						   dir,
+						   name);
+	}
 	if (res != SQLITE_OK) {
 		fprintf(stderr, "Error: unable to insert file at %s: %s \n",
 				path, this->error());
@@ -284,52 +605,37 @@ uint64_t DarwinupDatabase::insert_file(uint64_t info, mode_t mode, uid_t uid, gi
 
 uint64_t DarwinupDatabase::count_files(Archive* archive, const char* path) {
 	int res = SQLITE_OK;
-	uint64_t* c;
-	res = this->count("count_files",
-					  (void**)&c,
-					  this->m_files_table,
-					  2,                              // number of where conditions
-					  this->m_files_table->column(1), // archive
-					  '=', (uint64_t)archive->serial(),
-					  this->m_files_table->column(8), // path
-					  '=', path);	
+	uint64_t c = 0;
+	res = this->count(m_count_files->bind(archive->serial())->bind(path), &c);
 	if (res != SQLITE_ROW) {
 		fprintf(stderr, "Error: unable to count files: %d \n", res);
 		return 0;
 	}
-	return *c;
+	return c;
 }
 
 uint64_t DarwinupDatabase::count_archives(bool include_rollbacks) {
 	int res = SQLITE_OK;
-	uint64_t* c;
+	uint64_t c = 0;
 	if (include_rollbacks) {
-		res = this->count("count_archives",
-						  (void**)&c,
-						  this->m_archives_table, 0);				
+		res = this->count(m_count_archives, &c);
 	} else {
-		res = this->count("count_archives_norollback",
-						  (void**)&c,
-						  this->m_archives_table,
-						  1,
-						  this->m_archives_table->column(2), // name
-						  '!', "<Rollback>");
+		res = this->count(m_count_archives_norollback->bind("<Rollback>"), &c);
 	}
 	if (res != SQLITE_ROW) {
 		fprintf(stderr, "Error: unable to count archives: %d \n", res);
 		return 0;
 	}	
-	return *c;	
+	return c;	
 }
 
 int DarwinupDatabase::delete_archive(Archive* archive) {
-	int res = this->del(this->m_archives_table, archive->serial());
-	if (res != SQLITE_OK) return DB_ERROR;
-	return DB_OK;
+	return this->delete_archive(archive->serial());
 }
 
 int DarwinupDatabase::delete_archive(uint64_t serial) {
 	int res = this->del(this->m_archives_table, serial);
+	if (res == SQLITE_OK) res = this->del(m_delete_archive_stats->bind(serial));
 	if (res != SQLITE_OK) return DB_ERROR;
 	return DB_OK;
 }
@@ -341,10 +647,49 @@ int DarwinupDatabase::delete_empty_archives() {
 						" (SELECT serial FROM archives "
 						"  WHERE serial NOT IN "
 						"   (SELECT DISTINCT archive FROM files));");	
+	if (res == SQLITE_OK) {
+		res = this->sql("delete_empty_archive_stats",
+						"DELETE FROM archive_stats "
+						"WHERE archive NOT IN (SELECT serial FROM archives);");
+	}
 	if (res != SQLITE_OK) return DB_ERROR;
 	return DB_OK;
 }
 
+int DarwinupDatabase::insert_archive_stats(Archive* archive, Archive* rollback) {
+	int res = this->insert(this->m_archive_stats_table,
+						   (uint64_t)archive->serial(),
+						   archive->m_file_count,
+						   archive->m_byte_count,
+						   (uint64_t)(rollback ? rollback->m_byte_count : 0),
+						   (uint64_t)0);
+	if (res != SQLITE_OK) {
+		fprintf(stderr, "Error: unable to insert stats of archive %llu: %s \n",
+				archive->serial(), this->error());
+		return DB_ERROR;
+	}
+	return DB_OK;
+}
+
+int DarwinupDatabase::set_archive_duration(uint64_t serial, uint64_t duration) {
+	return this->update_value(m_set_archive_duration->bind(duration)->bind(serial));
+}
+
+int DarwinupDatabase::get_archive_stats(uint64_t serial, ArchiveStats* stats) {
+	uint8_t* data;
+	int res = this->get_row(m_archive_stats->bind(serial), &data);
+	if (res == SQLITE_DONE) return DB_OK;
+	if (res != SQLITE_ROW) return DB_ERROR;
+	
+	Table* table = this->m_archive_stats_table;
+	memcpy(&stats->files, &data[table->offset(2)], sizeof(uint64_t));
+	memcpy(&stats->bytes, &data[table->offset(3)], sizeof(uint64_t));
+	memcpy(&stats->rollback_bytes, &data[table->offset(4)], sizeof(uint64_t));
+	memcpy(&stats->duration, &data[table->offset(5)], sizeof(uint64_t));
+	table->free_result(data);
+	return (DB_FOUND | DB_OK);
+}
+
 int DarwinupDatabase::free_archive(uint8_t* data) {
 	return this->m_archives_table->free_result(data);
 }
@@ -362,11 +707,7 @@ int DarwinupDatabase::delete_file(uint64_t serial) {
 }
 
 int DarwinupDatabase::delete_files(Archive* archive) {
-	int res = this->del("delete_files__archive",
-						this->m_files_table,
-						1,                               // number of where conditions
-						this->m_files_table->column(1),  // archive
-						'=', (uint64_t)archive->serial());
+	int res = this->del(m_delete_files_archive->bind(archive->serial()));
 	if (res != SQLITE_OK) return DB_ERROR;
 	return DB_OK;
 }
@@ -375,45 +716,212 @@ int DarwinupDatabase::free_file(uint8_t* data) {
 	return this->m_files_table->free_result(data);
 }
 
+bool DarwinupDatabase::paths_interned() {
+	return this->m_files_table->split() != NULL;
+}
+
+int DarwinupDatabase::split_paths() {
+	int res = this->m_files_table->split_column(this->m_files_table->column(8),   // path
+												this->m_files_table->column(13),  // dir
+												this->m_files_table->column(14),  // basename
+												this->m_dirs_table,
+												this->m_dirs_table->column(0),    // serial
+												this->m_dirs_table->column(1));   // path
+	if (res) return DB_ERROR;
+	
+	// queries already prepared still read the path column
+	for (uint32_t i = 0; i < this->m_query_count; i++) {
+		if (this->m_queries[i]->table() == this->m_files_table) {
+			this->m_queries[i]->forget();
+		}
+	}
+	
+	this->m_dir_serials = new PathIndex();
+	return DB_OK;
+}
+
+int DarwinupDatabase::store_path(const char* path, const char** whole, uint64_t* dir,
+								 const char** name) {
+	*whole = path;
+	*dir = 0;
+	*name = NULL;
+	if (!this->paths_interned() || !path) return DB_OK;
+	
+	// everything before the last '/' is the directory, as Query binds it
+	const char* slash = strrchr(path, '/');
+	*dir = this->intern_dir(path, slash ? (size_t)(slash - path) : 0);
+	if (!*dir) return DB_ERROR;
+	*whole = NULL;
+	*name = slash ? slash + 1 : path;
+	return DB_OK;
+}
+
+uint64_t DarwinupDatabase::intern_dir(const char* path, size_t length) {
+	char* dir = strndup(path, length);
+	if (!dir) {
+		fprintf(stderr, "Error: ran out of memory!\n");
+		return 0;
+	}
+	
+	uint64_t serial = (uint64_t)(uintptr_t)this->m_dir_serials->get(dir);
+	if (!serial) {
+		uint64_t* found = NULL;
+		int res = this->get_value(m_dir_serial->bind(dir), (void**)&found);
+		if (res == SQLITE_ROW) {
+			serial = *found;
+		} else if (res == SQLITE_DONE) {
+			if (this->insert(this->m_dirs_table, dir) == SQLITE_OK) {
+				serial = this->last_insert_id();
+			}
+		}
+		free(found);
+		if (serial) {
+			this->m_dir_serials->set(dir, (void*)(uintptr_t)serial);
+		} else {
+			fprintf(stderr, "Error: unable to store directory %s\n", dir);
+		}
+	}
+	
+	free(dir);
+	return serial;
+}
+
+int DarwinupDatabase::rollback_transaction() {
+	// directories added by the transaction are gone with it
+	if (this->m_dir_serials) {
+		delete this->m_dir_serials;
+		this->m_dir_serials = new PathIndex();
+	}
+	return Database::rollback_transaction();
+}
+
+int DarwinupDatabase::intern_paths(uint64_t* files, uint64_t* dirs) {
+	int res = this->begin_transaction();
+	
+	// each directory is everything before the last '/' of a path
+	if (res == SQLITE_OK) {
+		res = this->sql_once("INSERT OR IGNORE INTO dirs (path) "
+							 "SELECT DISTINCT substr(d, 1, length(d) - 1) FROM "
+							 " (SELECT rtrim(path, replace(path, '/', '')) AS d "
+							 "  FROM files WHERE path IS NOT NULL);");
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("UPDATE files SET "
+							 " dir=(SELECT serial FROM dirs WHERE dirs.path="
+							 "  substr(files.path, 1, length(rtrim(files.path, "
+							 "   replace(files.path, '/', ''))) - 1)), "
+							 " basename=substr(files.path, length(rtrim(files.path, "
+							 "  replace(files.path, '/', ''))) + 1), "
+							 " path=NULL "
+							 "WHERE path IS NOT NULL;");
+	}
+	
+	// the path indexes only hold NULLs from now on
+	if (res == SQLITE_OK) {
+		res = this->sql_once("DROP INDEX IF EXISTS files_path;");
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("DROP INDEX IF EXISTS files_archive_path;");
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("DROP INDEX IF EXISTS files_path_archive;");
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("CREATE INDEX IF NOT EXISTS files_dir_basename_archive "
+							 "ON files (dir, basename, archive);");
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("CREATE UNIQUE INDEX IF NOT EXISTS files_archive_dir_basename "
+							 "ON files (archive, dir, basename);");
+	}
+	
+	// directories of files that have been deleted
+	if (res == SQLITE_OK) {
+		res = this->sql_once("DELETE FROM dirs WHERE serial NOT IN "
+							 " (SELECT DISTINCT dir FROM files WHERE dir IS NOT NULL);");
+	}
+	if (res == SQLITE_OK) {
+		res = this->update_information_value("paths", "interned");
+	}
+	
+	if (res == SQLITE_OK) {
+		res = this->commit_transaction();
+	} else {
+		this->rollback_transaction();
+	}
+	if (res != SQLITE_OK) return DB_ERROR;
+	
+	if (!this->paths_interned() && this->split_paths() != DB_OK) return DB_ERROR;
+	// the pruned directory cache may now name deleted rows
+	delete this->m_dir_serials;
+	this->m_dir_serials = new PathIndex();
+	
+	*files = 0;
+	*dirs = 0;
+	this->count(m_count_all_files, files);
+	this->count(m_count_dirs, dirs);
+	return DB_OK;
+}
+
 int DarwinupDatabase::get_inactive_archive_serials(uint64_t** serials, uint32_t* count) {
-	int res = this->get_column("inactive_archive_serials",
-							   (void**)serials, count,
-							   this->m_archives_table,
-							   this->m_archives_table->column(0), // serial
-							   1,
-							   this->m_archives_table->column(4), // active
-							   '=', (uint64_t)0);
+	int res = this->get_column(m_inactive_archive_serials->bind((uint64_t)0),
+							   (void**)serials, count);
 	if (res == SQLITE_DONE && *count) return (DB_OK | DB_FOUND);
 	if (res == SQLITE_DONE) return DB_OK;
 	return DB_ERROR;
 }
 
 int DarwinupDatabase::get_files(uint8_t*** data, uint32_t* count, Archive* archive, bool reverse) {
-	int order = ORDER_BY_ASC;
-	const char* name = "files_archive";
-	if (reverse) {
-		order = ORDER_BY_DESC;
-		name = "files_archive_reverse";
-	}
-	int res = this->get_all_ordered(name,
-									data, count,
-									this->m_files_table,
-									this->m_files_table->column(8), // order by path
-									order,
-									1,
-									this->m_files_table->column(1),
-									'=', archive->serial());
+	Query* query = (reverse ? m_files_archive_reverse : m_files_archive);
+	int res = this->get_all(query->bind(archive->serial()), data, count);
 	
 	if ((res == SQLITE_DONE) && *count) return (DB_OK | DB_FOUND);
 	if (res == SQLITE_DONE) return DB_OK;
 	return DB_ERROR;
 }
 
+Query* DarwinupDatabase::begin_files(Archive* archive, bool reverse) {
+	Query* query = (reverse ? m_files_archive_reverse : m_files_archive);
+	return query->bind(archive->serial());
+}
+
+Query* DarwinupDatabase::begin_files_by_path() {
+	return m_files_by_path;
+}
+
+int DarwinupDatabase::next_file(Query* files, File** file, bool borrow_path) {
+	uint8_t* data;
+	*file = NULL;
+	int res = this->next_file_data(files, &data);
+	if (FOUND(res)) {
+		*file = this->read_file(data, borrow_path);
+		if (*file) return (DB_FOUND | DB_OK);
+		this->end_files(files);
+		return DB_ERROR;
+	}
+	return res;
+}
+
+int DarwinupDatabase::next_file_data(Query* files, uint8_t** data) {
+	int res = this->get_next(files, data);
+	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;
+}
+
+void DarwinupDatabase::end_files(Query* files) {
+	files->reset();
+}
+
 int DarwinupDatabase::get_file_serials(uint64_t** serials, uint32_t* count) {
-	int res = this->get_column("file_serials", (void**)serials, count, 
-							   this->m_files_table,
-							   this->m_files_table->column(0),
-							   0);
+	int res = this->get_column(m_file_serials, (void**)serials, count);
+	if (res == SQLITE_DONE && *count) return (DB_OK | DB_FOUND);
+	if (res == SQLITE_DONE) return DB_OK;
+	return DB_ERROR;	
+}
+
+int DarwinupDatabase::get_file_digests(uint8_t*** digests, uint32_t* count) {
+	int res = this->get_column(m_file_digests, (void**)digests, count);
 	if (res == SQLITE_DONE && *count) return (DB_OK | DB_FOUND);
 	if (res == SQLITE_DONE) return DB_OK;
 	return DB_ERROR;	
@@ -434,22 +942,22 @@ Archive* DarwinupDatabase::make_archive(uint8_t* data) {
 	memcpy(&info, &data[this->archive_offset(5)], sizeof(uint64_t));
 	char* build;
 	memcpy(&build, &data[this->archive_offset(6)], sizeof(char*));
+	uint64_t codec;
+	memcpy(&codec, &data[this->archive_offset(7)], sizeof(uint64_t));
+	uint64_t survivor;
+	memcpy(&survivor, &data[this->archive_offset(8)], sizeof(uint64_t));
 
-	Archive* archive = new Archive(serial, *uuid, name, NULL, info, date_added, build);
+	Archive* archive = new Archive(serial, *uuid, name, NULL, info, date_added, build,
+								   (uint32_t)codec);
+	archive->m_survivor = survivor;
 	this->m_archives_table->free_result(data);
 
 	return archive;
 }
 
 int DarwinupDatabase::get_archives(uint8_t*** data, uint32_t* count, bool include_rollbacks) {
-	int res = this->get_all_ordered("get_archives",
-									data, count,
-									this->m_archives_table,
-									this->m_archives_table->column(0), // order by serial
-									ORDER_BY_DESC,
-									1,
-									this->m_archives_table->column(2),  // name
-									'!', (include_rollbacks ? "" : "<Rollback>"));
+	int res = this->get_all(m_archives->bind(include_rollbacks ? "" : "<Rollback>"),
+							data, count);
 	
 	if ((res == SQLITE_DONE) && *count) return (DB_OK | DB_FOUND);
 	if (res == SQLITE_DONE) return DB_OK;
@@ -457,24 +965,14 @@ int DarwinupDatabase::get_archives(uint8_t*** data, uint32_t* count, bool includ
 }
 
 int DarwinupDatabase::get_archive(uint8_t** data, uuid_t uuid) {
-	int res = this->get_row("archive__uuid",
-							data,
-							this->m_archives_table,
-							1,
-							this->m_archives_table->column(1), // uuid
-							'=', uuid, sizeof(uuid_t));
+	int res = this->get_row(m_archive_by_uuid->bind(uuid, sizeof(uuid_t)), data);
 	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
 	if (res == SQLITE_DONE) return DB_OK;
 	return DB_ERROR;	
 }
 
 int DarwinupDatabase::get_archive(uint8_t** data, uint64_t serial) {
-	int res = this->get_row("archive__serial",
-							data,
-							this->m_archives_table,
-							1,
-							this->m_archives_table->column(0), // serial
-							'=', serial);
+	int res = this->get_row(m_archive_by_serial->bind(serial), data);
 	if (res == SQLITE_ROW) {
 		return (DB_FOUND | DB_OK);
 	}
@@ -483,12 +981,7 @@ int DarwinupDatabase::get_archive(uint8_t** data, uint64_t serial) {
 }
 
 int DarwinupDatabase::get_archive(uint8_t** data, const char* name) {
-	int res = this->get_row("archive__name",
-							data,
-							this->m_archives_table,
-							1,
-							this->m_archives_table->column(2), // name
-							'=', name);
+	int res = this->get_row(m_archive_by_name->bind(name), data);
 	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
 	if (res == SQLITE_DONE) return DB_OK;
 	return DB_ERROR;	
@@ -496,22 +989,12 @@ int DarwinupDatabase::get_archive(uint8_t** data, const char* name) {
 
 int DarwinupDatabase::get_archive(uint8_t** data, archive_keyword_t keyword) {
 	int res = SQLITE_OK;
-	int order = ORDER_BY_DESC;
-	const char* name = "archive_newest";
-
+	Query* query = m_archive_newest;
 	if (keyword == DEPOT_ARCHIVE_OLDEST) {
-		order = ORDER_BY_ASC;
-		name = "archive_oldest";
-	}
-	
-	res = this->get_row_ordered(name,
-								data,
-								this->m_archives_table,
-								this->m_archives_table->column(3), // order by date_added
-								order,
-								1,
-								this->m_archives_table->column(2), // name
-								'!', "<Rollback>");
+		query = m_archive_oldest;
+	}
+	
+	res = this->get_row(query->bind("<Rollback>"), data);
 	
 	if (res == SQLITE_ROW) return (DB_FOUND | DB_OK);
 	if (res == SQLITE_DONE) return DB_OK;
@@ -43,7 +43,15 @@
 #include "Archive.h"
 #include "Digest.h"
 #include "File.h"
+#include "PathIndex.h"
 
+// a row of the archive_stats table, made as the archive is installed
+struct ArchiveStats {
+	uint64_t files;           // files of the archive
+	uint64_t bytes;           // in its regular files
+	uint64_t rollback_bytes;  // saved in its rollback archive
+	uint64_t duration;        // milliseconds the install, or its resume, took
+};
 
 /**
  *
@@ -54,7 +62,8 @@
  *
  */
 struct DarwinupDatabase : Database {
-	DarwinupDatabase(const char* path);
+	// a snapshot connection only reads, see Database::set_snapshot()
+	DarwinupDatabase(const char* path, bool snapshot = false);
 	virtual ~DarwinupDatabase();
 	int init_schema();
 	
@@ -74,24 +83,64 @@ struct DarwinupDatabase : Database {
 	int      deactivate_archive(uint64_t serial);
 	int      update_archive(uint64_t serial, uuid_t uuid, const char* name,
 							time_t date_added, uint32_t active, uint64_t info,
-							const char* build);
+							const char* build, uint32_t codec, uint64_t survivor);
+	// Archive::m_survivor, which activating or deactivating an archive
+	//  forgets for it and every archive before it
+	int      set_archive_survivor(uint64_t serial, uint64_t survivor);
+	int      forget_survivors(uint64_t serial);
 	uint64_t insert_archive(uuid_t uuid, uint64_t info, const char* name, 
-							time_t date, const char* build);
+							time_t date, const char* build, uint32_t codec);
 	int      delete_empty_archives();
 	int      delete_archive(Archive* archive);
 	int      delete_archive(uint64_t serial);
 	int      free_archive(uint8_t* data);
 
+	// Archive stats, the Archive::m_file_count and m_byte_count of an 
+	//  archive and its rollback, kept from its install until it is
+	//  deleted.  get_archive_stats returns DB_OK without DB_FOUND for 
+	//  archives installed before there were any.
+	int      insert_archive_stats(Archive* archive, Archive* rollback);
+	int      set_archive_duration(uint64_t serial, uint64_t duration);
+	int      get_archive_stats(uint64_t serial, ArchiveStats* stats);
+
 	// Files
 	File*    make_file(uint8_t* data);
+	// like make_file, but leaves data to its owner, and with borrow_path 
+	//  the file uses the path in data instead of a copy
+	File*    read_file(uint8_t* data, bool borrow_path);
+	int      get_file(uint8_t** data, uint64_t serial);
 	int      get_next_file(uint8_t** data, File* file, file_starseded_t star);
+	// the file of the newest active archive before archive at path, 
+	//  with one seek of the (path, archive) index; any archive if its
+	//  serial is 0
+	int      get_file_preceding(uint8_t** data, const char* path, Archive* archive);
+	// every file at path, newest archive first
+	int      get_files_at_path(uint8_t*** data, uint32_t* count, const char* path);
+	// the file of the newest active archive at path, with one index seek
+	int      get_file_owner(uint8_t** data, const char* path);
 	int      get_file_serials(uint64_t** serials, uint32_t* count);
+	// the digest of every file, NULL where there is none
+	int      get_file_digests(uint8_t*** digests, uint32_t* count);
 	int      get_file_serial_from_archive(Archive* archive, const char* path, 
 										  uint64_t** serial);
 	int      get_files(uint8_t*** data, uint32_t* count, Archive* archive, bool reverse);
+	// Step through the files of archive one at a time, in the same order
+	//  as get_files, without loading them all.  next_file returns 
+	//  DB_FOUND|DB_OK with the next file and DB_OK after the last one.  
+	//  With borrow_path, the file's path is only valid until the next call.
+	//  end_files must be called when stopping before the last file.
+	Query*   begin_files(Archive* archive, bool reverse);
+	// every file of every archive, those at the same path together
+	Query*   begin_files_by_path();
+	int      next_file(Query* files, File** file, bool borrow_path);
+	// the row next_file would make a file from, valid until the next call
+	int      next_file_data(Query* files, uint8_t** data);
+	void     end_files(Query* files);
 	int      file_offset(int column);
 	int      update_file(uint64_t serial, Archive* archive, uint64_t info, mode_t mode,
 						 uid_t uid, gid_t gid, Digest* digest, const char* path);
+	// records the size and stat_set() identity of an installed file
+	int      update_file_stat(File* file);
 	uint64_t insert_file(uint64_t info, mode_t mode, uid_t uid, gid_t gid,
 						 Digest* digest, Archive* archive, const char* path);
 	int      delete_file(uint64_t serial);
@@ -99,6 +148,18 @@ struct DarwinupDatabase : Database {
 	int      delete_files(Archive* archive);
 	int      free_file(uint8_t* data);
 	
+	// Paths are stored whole, unless they have been interned: then each
+	//  is stored as the serial of its directory in the dirs table and 
+	//  its last component, and read back whole.  intern_paths() moves
+	//  every file to interned paths, or prunes unused directories if 
+	//  they already are, and reports how many files and directories
+	//  there are.
+	bool     paths_interned();
+	int      intern_paths(uint64_t* files, uint64_t* dirs);
+	
+	// forgets interned directories the rollback removes
+	int      rollback_transaction();
+	
 	// memoization
 	Archive* get_last_archive(uint64_t serial);
 	int      clear_last_archive();
@@ -108,9 +169,58 @@ struct DarwinupDatabase : Database {
 protected:
 	
 	int      set_archive_active(uint64_t serial, uint64_t* active);
+	// define the queries behind the accessors above, after the schema
+	int      init_queries();
+	
+	// reads paths whole from the dirs table and basename from now on
+	int      split_paths();
+	// the values to store for path: itself, or else the serial of its
+	//  directory and its last component
+	int      store_path(const char* path, const char** whole, uint64_t* dir,
+						const char** name);
+	// returns the serial of the directory at the first length bytes of 
+	//  path, adding it to the dirs table if it is new, or 0 on error
+	uint64_t intern_dir(const char* path, size_t length);
 	
 	Table*        m_archives_table;
 	Table*        m_files_table;
+	Table*        m_dirs_table;
+	Table*        m_archive_stats_table;
+	
+	Query*        m_set_archive_active;
+	Query*        m_set_archive_survivor;
+	Query*        m_forget_survivors;
+	Query*        m_archive_by_uuid;
+	Query*        m_archive_by_serial;
+	Query*        m_archive_by_name;
+	Query*        m_archive_newest;
+	Query*        m_archive_oldest;
+	Query*        m_archives;
+	Query*        m_count_archives;
+	Query*        m_count_archives_norollback;
+	Query*        m_inactive_archive_serials;
+	Query*        m_file_preceded;
+	Query*        m_file_superseded;
+	Query*        m_files_at_path;
+	Query*        m_file_owner;
+	Query*        m_files_by_path;
+	Query*        m_file_by_serial;
+	Query*        m_files_archive;
+	Query*        m_files_archive_reverse;
+	Query*        m_file_serial_archive_path;
+	Query*        m_count_files;
+	Query*        m_delete_files_archive;
+	Query*        m_file_serials;
+	Query*        m_file_digests;
+	Query*        m_dir_serial;
+	Query*        m_count_all_files;
+	Query*        m_count_dirs;
+	Query*        m_archive_stats;
+	Query*        m_set_archive_duration;
+	Query*        m_delete_archive_stats;
+	
+	// serials of the directories interned by this connection
+	PathIndex*    m_dir_serials;
 	
 	// memoize some get_archive calls
 	Archive*      last_archive;
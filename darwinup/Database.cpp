@@ -32,6 +32,13 @@
 
 #include "Database.h"
 
+static const DatabaseProfile database_profiles[DB_PROFILES] = {
+	// name     journal    synchronous cache_size mmap_size   temp_store optimize
+	{ "default", "DELETE", "FULL",     -2000,     0,          "DEFAULT", false },
+	{ "wal",     "WAL",    "FULL",     -16384,    268435456,  "MEMORY",  true  },
+	{ "fast",    "WAL",    "NORMAL",   -16384,    268435456,  "MEMORY",  true  },
+};
+
 /**
  * sqlite3_trace callback for debugging
  */
@@ -44,11 +51,20 @@ Database::Database() {
 	m_table_max = 2;
 	m_table_count = 0;
 	m_tables = (Table**)malloc(sizeof(Table*) * m_table_max);
-	this->init_cache();
+	m_query_max = 2;
+	m_query_count = 0;
+	m_queries = (Query**)malloc(sizeof(Query*) * m_query_max);
+	m_statements = new StatementRegistry();
 	m_db = NULL;	
 	m_path = NULL;
 	m_error_size = ERROR_BUF_SIZE;
 	m_error = (char*)malloc(m_error_size);
+	m_readonly = false;
+	m_snapshot = false;
+	m_profile = DB_PROFILE_STORED;
+	m_optimized_changes = 0;
+	m_busy_timeout = DB_BUSY_TIMEOUT;
+	m_busy_start = 0;
 }
 
 Database::Database(const char* path) {
@@ -56,7 +72,10 @@ Database::Database(const char* path) {
 	m_table_max = 2;
 	m_table_count = 0;
 	m_tables = (Table**)malloc(sizeof(Table*) * m_table_max);
-	this->init_cache();
+	m_query_max = 2;
+	m_query_count = 0;
+	m_queries = (Query**)malloc(sizeof(Query*) * m_query_max);
+	m_statements = new StatementRegistry();
 	m_db = NULL;		
 	m_path = strdup(path);
 	if (!m_path) {
@@ -65,19 +84,33 @@ Database::Database(const char* path) {
 	}
 	m_error_size = ERROR_BUF_SIZE;
 	m_error = (char*)malloc(m_error_size);
+	m_readonly = false;
+	m_snapshot = false;
+	m_profile = DB_PROFILE_STORED;
+	m_optimized_changes = 0;
+	m_busy_timeout = DB_BUSY_TIMEOUT;
+	m_busy_start = 0;
 }
 
 Database::~Database() {
+	// queries refer to their tables
+	for (uint32_t i = 0; i < m_query_count; i++) {
+		delete m_queries[i];
+	}
 	for (uint32_t i = 0; i < m_table_count; i++) {
 		delete m_tables[i];
 	}
-	this->destroy_cache();
+	IF_DEBUG("statements: %u kept, %llu hits, %llu misses, %llu prepared\n",
+			 m_statements->count(), m_statements->hits(), m_statements->misses(),
+			 m_statements->prepares());
+	delete m_statements;
 	
 	sqlite3_finalize(m_begin_transaction);
 	sqlite3_finalize(m_rollback_transaction);
 	sqlite3_finalize(m_commit_transaction);
 
 	free(m_tables);
+	free(m_queries);
 	free(m_path);
 	free(m_error);
 }
@@ -136,6 +169,7 @@ int Database::connect() {
 		// db exists already but we cannot write to it
 		readonly = true;
 	}
+	m_readonly = readonly || m_snapshot;
 
 	res = sqlite3_open(m_path, &m_db);
 	if (res) {
@@ -164,6 +198,13 @@ int Database::connect() {
 		}
 
 		if (version < this->m_schema_version) {
+			if (m_snapshot) {
+				// leave the upgrade to a connection that may write
+				IF_DEBUG("cannot read a snapshot of a schema %u database\n", version);
+				sqlite3_close(m_db);
+				m_db = NULL;
+				return DB_ERROR;
+			}
 			if (readonly) {
 				fprintf(stderr, 
 						"Error: the darwinup database needs to be upgraded "
@@ -185,6 +226,17 @@ int Database::connect() {
 		}
 	}
 	
+	res = this->apply_profile();
+	if (res) {
+		fprintf(stderr, "Error: unable to apply the %s database profile: %s\n",
+				Database::profile_name(m_profile), m_error);
+	}
+	
+	// the read transaction, and so the snapshot, lasts until we disconnect
+	if (res == DB_OK && m_snapshot) {
+		res = this->sql_once("BEGIN DEFERRED; SELECT COUNT(*) FROM sqlite_master;");
+	}
+	
 	return res;	
 }
 
@@ -209,6 +261,9 @@ int Database::post_connect() {
 		res = sqlite3_prepare_v2(m_db, "COMMIT TRANSACTION", 19,
 								 &m_commit_transaction, NULL);	
 
+	// wait for other connections instead of failing with SQLITE_BUSY
+	if (res == DB_OK) res = sqlite3_busy_handler(m_db, &Database::busy, this);
+
 	// debug settings
 	extern uint32_t verbosity;
 	if (verbosity & VERBOSE_SQL) {
@@ -232,16 +287,164 @@ bool Database::is_connected() {
 	return m_db != NULL;
 }
 
+void Database::set_busy_timeout(uint32_t seconds) {
+	m_busy_timeout = seconds;
+}
+
+int Database::busy(void* context, int count) {
+	Database* db = (Database*)context;
+	uint64_t now = Stats::now();
+	if (count == 0) db->m_busy_start = now;
+	uint64_t waited = now - db->m_busy_start;
+	uint64_t timeout = (uint64_t)db->m_busy_timeout * 1000000000ULL;
+	if (waited >= timeout) {
+		fprintf(stderr, "Error: database is still locked after %u seconds, "
+				"giving up.\n", db->m_busy_timeout);
+		return 0;
+	}
+	
+	// back off exponentially, but not past the deadline
+	uint64_t delay = DB_BUSY_MAX_DELAY;
+	if (count < 8 && (DB_BUSY_MIN_DELAY << count) < DB_BUSY_MAX_DELAY) {
+		delay = DB_BUSY_MIN_DELAY << count;
+	}
+	if (delay > (timeout - waited) / 1000) delay = (timeout - waited) / 1000;
+	IF_DEBUG("database is locked, waiting %llu us\n", (unsigned long long)delay);
+	usleep((useconds_t)delay);
+	if (stats) stats->wait("database_busy", Stats::now() - now);
+	return 1;
+}
+
+void Database::set_snapshot(bool snapshot) {
+	m_snapshot = snapshot;
+}
+
+bool Database::is_snapshot() {
+	return m_snapshot;
+}
+
+bool Database::is_readonly() {
+	return m_readonly;
+}
+
+bool Database::is_wal(const char* path) {
+	// the file format version numbers in the header are 2 in WAL mode
+	unsigned char header[20];
+	bool wal = false;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return false;
+	if (read(fd, header, sizeof(header)) == sizeof(header)) {
+		wal = (header[18] == 2 && header[19] == 2);
+	}
+	close(fd);
+	return wal;
+}
+
 int Database::begin_transaction() {
-	return this->execute(m_begin_transaction);
+	uint64_t start = STATS_START();
+	int res = this->execute(m_begin_transaction);
+	STATS_STATEMENT("begin_transaction", start, 0);
+	return res;
 }
 
 int Database::rollback_transaction() {
-	return this->execute(m_rollback_transaction);
+	uint64_t start = STATS_START();
+	int res = this->execute(m_rollback_transaction);
+	STATS_STATEMENT("rollback_transaction", start, 0);
+	return res;
 }
 
 int Database::commit_transaction() {
-	return this->execute(m_commit_transaction);
+	uint64_t start = STATS_START();
+	int res = this->execute(m_commit_transaction);
+	STATS_STATEMENT("commit_transaction", start, 0);
+	if (res == SQLITE_OK) this->optimize();
+	return res;
+}
+
+uint32_t Database::profile_named(const char* name) {
+	for (uint32_t i = 0; i < DB_PROFILES; i++) {
+		if (strcmp(name, database_profiles[i].name) == 0) return i;
+	}
+	return DB_PROFILE_STORED;
+}
+
+const char* Database::profile_name(uint32_t profile) {
+	if (profile < DB_PROFILES) return database_profiles[profile].name;
+	return "stored";
+}
+
+uint32_t Database::profile() {
+	return m_profile;
+}
+
+int Database::set_profile(uint32_t profile) {
+	if (profile >= DB_PROFILES) {
+		fprintf(stderr, "Error: unknown database profile %u\n", profile);
+		return DB_ERROR;
+	}
+	m_profile = profile;
+	if (this->is_connected()) return this->apply_profile();
+	return DB_OK;
+}
+
+int Database::store_profile(uint32_t profile) {
+	int res = this->set_profile(profile);
+	if (res == DB_OK) {
+		res = this->update_information_value("profile", Database::profile_name(profile));
+	}
+	return res;
+}
+
+int Database::apply_profile() {
+	int res = SQLITE_OK;
+	if (m_profile == DB_PROFILE_STORED) {
+		m_profile = DB_PROFILE_DEFAULT;
+		char** name = NULL;
+		if (this->get_information_value("profile", &name) == SQLITE_ROW) {
+			m_profile = Database::profile_named(*name);
+			if (m_profile == DB_PROFILE_STORED) {
+				fprintf(stderr, "Warning: unknown database profile %s, using %s\n",
+						*name, Database::profile_name(DB_PROFILE_DEFAULT));
+				m_profile = DB_PROFILE_DEFAULT;
+			}
+			free(*name);
+		}
+		free(name);
+	}
+	
+	const DatabaseProfile* profile = &database_profiles[m_profile];
+	IF_DEBUG("database profile: %s\n", profile->name);
+	// the journal mode is kept in the database, so only a writer may change it
+	if (res == SQLITE_OK && !m_readonly) {
+		res = this->sql_once("PRAGMA journal_mode=%s;", profile->journal_mode);
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("PRAGMA synchronous=%s;", profile->synchronous);
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("PRAGMA cache_size=%d;", profile->cache_size);
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("PRAGMA mmap_size=%lld;", profile->mmap_size);
+	}
+	if (res == SQLITE_OK) {
+		res = this->sql_once("PRAGMA temp_store=%s;", profile->temp_store);
+	}
+	m_optimized_changes = sqlite3_total_changes(m_db);
+	return res;
+}
+
+int Database::optimize() {
+	if (m_profile >= DB_PROFILES || !database_profiles[m_profile].optimize) {
+		return DB_OK;
+	}
+	int changes = sqlite3_total_changes(m_db);
+	if (changes - m_optimized_changes < DB_OPTIMIZE_CHANGES) return DB_OK;
+	IF_DEBUG("optimizing database after %d changes\n", changes - m_optimized_changes);
+	m_optimized_changes = changes;
+	// look at every table, so the first large write also runs ANALYZE
+	return this->sql_once("PRAGMA optimize=0x10002;");
 }
 
 int Database::bind_all_columns(sqlite3_stmt* stmt, Table* table, va_list args) {
@@ -321,23 +524,32 @@ int Database::bind_columns(sqlite3_stmt* stmt, uint32_t count, int param,
 }
 
 #define __get_stmt(expr) \
-	sqlite3_stmt* stmt; \
-    sqlite3_stmt** pps; \
-	char* key = strdup(name); \
-	cache_get_and_retain(m_statement_cache, key, (void**)&pps); \
-	if (!pps) { \
+	uint32_t id = m_statements->intern(name); \
+	sqlite3_stmt* stmt = m_statements->get(id); \
+	if (!stmt) { \
 		va_list args; \
 		va_start(args, count); \
-		pps = expr; \
+		sqlite3_stmt** pps = expr; \
 		va_end(args); \
-		cache_set_and_retain(m_statement_cache, key, pps, 0); \
+		if (pps) { \
+			stmt = *pps; \
+			free(pps); \
+		} \
+		m_statements->set(id, stmt); \
 	} \
-    stmt = *pps; \
-	free(key);
+	if (!stmt) { \
+		va_end(args); \
+		return SQLITE_ERROR; \
+	}
+
+// a statement the registry had no room for is only used once
+#define __release_stmt \
+	if (id == STATEMENT_NONE) sqlite3_finalize(stmt);
 
 int Database::count(const char* name, void** output, Table* table, 
 					uint32_t count, ...) {
 	va_list args;
+	uint64_t start = STATS_START();
 	va_start(args, count);
 	__get_stmt(table->count(m_db, count, args));
 	int res = SQLITE_OK;
@@ -346,7 +558,8 @@ int Database::count(const char* name, void** output, Table* table,
 	assert(*output);
 	res = this->step_once(stmt, *(uint8_t**)output, NULL);
 	sqlite3_reset(stmt);
-	cache_release_value(m_statement_cache, pps);
+	STATS_STATEMENT(name, start, (res == SQLITE_ROW));
+	__release_stmt;
 	va_end(args);
 	return res;
 }
@@ -354,6 +567,7 @@ int Database::count(const char* name, void** output, Table* table,
 int Database::get_value(const char* name, void** output, Table* table, 
 						Column* value_column, uint32_t count, ...) {
 	va_list args;
+	uint64_t start = STATS_START();
 	va_start(args, count);
 	__get_stmt(table->get_column(m_db, value_column, count, args));
 	int res = SQLITE_OK;
@@ -363,7 +577,8 @@ int Database::get_value(const char* name, void** output, Table* table,
 	assert(*output);
 	res = this->step_once(stmt, (uint8_t*)*output, NULL);
 	sqlite3_reset(stmt);
-	cache_release_value(m_statement_cache, pps);
+	STATS_STATEMENT(name, start, (res == SQLITE_ROW));
+	__release_stmt;
 	va_end(args);
 	return res;
 }
@@ -371,6 +586,7 @@ int Database::get_value(const char* name, void** output, Table* table,
 int Database::get_column(const char* name, void** output, uint32_t* result_count,
 						 Table* table, Column* column, uint32_t count, ...) {
 	va_list args;
+	uint64_t start = STATS_START();
 	va_start(args, count);
 	__get_stmt(table->get_column(m_db, column, count, args));
 	int res = SQLITE_OK;
@@ -379,7 +595,8 @@ int Database::get_column(const char* name, void** output, uint32_t* result_count
 	*output = malloc(size);
 	res = this->step_all(stmt, output, size, result_count);
 	sqlite3_reset(stmt);
-	cache_release_value(m_statement_cache, pps);
+	STATS_STATEMENT(name, start, *result_count);
+	__release_stmt;
 	va_end(args);
 	return res;
 }
@@ -387,6 +604,7 @@ int Database::get_column(const char* name, void** output, uint32_t* result_count
 int Database::get_row(const char* name, uint8_t** output, Table* table, 
 					  uint32_t count, ...) {
 	va_list args;
+	uint64_t start = STATS_START();
 	va_start(args, count);
 	__get_stmt(table->get_row(m_db, count, args));
 	int res = SQLITE_OK;
@@ -394,7 +612,8 @@ int Database::get_row(const char* name, uint8_t** output, Table* table,
 	*output = table->alloc_result();
 	res = this->step_once(stmt, *output, NULL);
 	sqlite3_reset(stmt);
-	cache_release_value(m_statement_cache, pps);
+	STATS_STATEMENT(name, start, (res == SQLITE_ROW));
+	__release_stmt;
 	va_end(args);
 	return res;
 }
@@ -402,6 +621,7 @@ int Database::get_row(const char* name, uint8_t** output, Table* table,
 int Database::get_row_ordered(const char* name, uint8_t** output, Table* table, 
 							  Column* order_by, int order, uint32_t count, ...) {
 	va_list args;
+	uint64_t start = STATS_START();
 	va_start(args, count);
 	__get_stmt(table->get_row_ordered(m_db, order_by, order, count, args));
 	int res = SQLITE_OK;
@@ -409,7 +629,8 @@ int Database::get_row_ordered(const char* name, uint8_t** output, Table* table,
 	*output = table->alloc_result();
 	res = this->step_once(stmt, *output, NULL);
 	sqlite3_reset(stmt);
-	cache_release_value(m_statement_cache, pps);
+	STATS_STATEMENT(name, start, (res == SQLITE_ROW));
+	__release_stmt;
 	va_end(args);
 	return res;
 }
@@ -418,6 +639,7 @@ int Database::get_all_ordered(const char* name, uint8_t*** output,
 							  uint32_t* result_count, Table* table, 
 							  Column* order_by, int order, uint32_t count, ...) {
 	va_list args;
+	uint64_t start = STATS_START();
 	va_start(args, count);
 	__get_stmt(table->get_row_ordered(m_db, order_by, order, count, args));
 	int res = SQLITE_OK;
@@ -449,7 +671,8 @@ int Database::get_all_ordered(const char* name, uint8_t*** output,
 	}
 
 	sqlite3_reset(stmt);
-	cache_release_value(m_statement_cache, pps);
+	STATS_STATEMENT(name, start, *result_count);
+	__release_stmt;
 	va_end(args);
 	return res;
 }
@@ -457,6 +680,7 @@ int Database::get_all_ordered(const char* name, uint8_t*** output,
 int Database::update_value(const char* name, Table* table, Column* value_column, 
 						   void** value, uint32_t count, ...) {
 	va_list args;
+	uint64_t start = STATS_START();
 	va_start(args, count);
 	__get_stmt(table->update_value(m_db, value_column, count, args));
 	int param = 1;
@@ -483,18 +707,22 @@ int Database::update_value(const char* name, Table* table, Column* value_column,
 	this->bind_columns(stmt, count, param, args);
 	res = sqlite3_step(stmt);
 	sqlite3_reset(stmt);
-    cache_release_value(m_statement_cache, pps);
+	STATS_STATEMENT(name, start, 0);
+	__release_stmt;
 	va_end(args);
 	return (res == SQLITE_DONE ? SQLITE_OK : res);
 }
 
 int Database::del(const char* name, Table* table, uint32_t count, ...) {
 	va_list args;
+	uint64_t start = STATS_START();
 	va_start(args, count);
 	__get_stmt(table->del(m_db, count, args));
 	int res = SQLITE_OK;
 	this->bind_va_columns(stmt, count, args);
 	if (res == SQLITE_OK) res = this->execute(stmt);
+	STATS_STATEMENT(name, start, 0);
+	__release_stmt;
 	va_end(args);
 	return res;
 	
@@ -510,11 +738,149 @@ int Database::del(const char* name, Table* table, uint32_t count, ...) {
  * of data and then the uint32_t value for size of the data. 
  *
  */
+int Database::count(Query* query, uint64_t* output) {
+	assert(query->kind() == QUERY_COUNT);
+	uint64_t start = STATS_START();
+	sqlite3_stmt* stmt = query->statement(m_db);
+	if (!stmt) return SQLITE_ERROR;
+	int res = this->step_once(stmt, (uint8_t*)output, NULL);
+	STATS_STATEMENT(query->name(), start, (res == SQLITE_ROW));
+	query->reset();
+	return res;
+}
+
+int Database::get_value(Query* query, void** output) {
+	assert(query->kind() == QUERY_VALUE);
+	*output = NULL;
+	uint64_t start = STATS_START();
+	sqlite3_stmt* stmt = query->statement(m_db);
+	if (!stmt) return SQLITE_ERROR;
+	*output = malloc(query->column()->size());
+	assert(*output);
+	int res = this->step_once(stmt, (uint8_t*)*output, NULL);
+	STATS_STATEMENT(query->name(), start, (res == SQLITE_ROW));
+	query->reset();
+	return res;
+}
+
+int Database::get_column(Query* query, void** output, uint32_t* result_count) {
+	assert(query->kind() == QUERY_COLUMN);
+	*output = NULL;
+	*result_count = 0;
+	uint64_t start = STATS_START();
+	sqlite3_stmt* stmt = query->statement(m_db);
+	if (!stmt) return SQLITE_ERROR;
+	uint32_t size = INITIAL_ROWS * query->column()->size();
+	*output = malloc(size);
+	int res = this->step_all(stmt, output, size, result_count);
+	STATS_STATEMENT(query->name(), start, *result_count);
+	query->reset();
+	return res;
+}
+
+int Database::get_row(Query* query, uint8_t** output) {
+	assert(query->kind() == QUERY_ROW);
+	*output = NULL;
+	uint64_t start = STATS_START();
+	sqlite3_stmt* stmt = query->statement(m_db);
+	if (!stmt) return SQLITE_ERROR;
+	*output = query->table()->alloc_result();
+	int res = this->step_once(stmt, *output, NULL);
+	STATS_STATEMENT(query->name(), start, (res == SQLITE_ROW));
+	query->reset();
+	return res;
+}
+
+int Database::get_all(Query* query, uint8_t*** output, uint32_t* result_count) {
+	assert(query->kind() == QUERY_ROWS);
+	*output = NULL;
+	*result_count = 0;
+	uint64_t start = STATS_START();
+	sqlite3_stmt* stmt = query->statement(m_db);
+	if (!stmt) return SQLITE_ERROR;
+	Table* table = query->table();
+	uint8_t* current = NULL;
+	uint32_t output_max = INITIAL_ROWS;
+	*output = (uint8_t**)calloc(output_max, sizeof(uint8_t*));
+	
+	int res = SQLITE_ROW;
+	while (res == SQLITE_ROW) {
+		if ((*result_count) >= output_max) {
+			output_max *= REALLOC_FACTOR;
+			*output = (uint8_t**)realloc((*output), output_max * sizeof(uint8_t*));
+			if (!(*output)) {
+				fprintf(stderr, "Error: ran out of memory trying to realloc output"
+						        "in get_all.\n");
+				query->reset();
+				return DB_ERROR;
+			}
+		}
+		current = table->alloc_result();
+		res = this->step_once(stmt, current, NULL);
+		if (res == SQLITE_ROW) {
+			(*output)[(*result_count)] = current;
+			(*result_count)++;
+		} else {
+			table->free_result(current);
+		}
+	}
+	STATS_STATEMENT(query->name(), start, *result_count);
+	
+	query->reset();
+	return res;
+}
+
+int Database::get_next(Query* query, uint8_t** output) {
+	assert(query->kind() == QUERY_ROWS);
+	*output = NULL;
+	uint64_t start = STATS_START();
+	sqlite3_stmt* stmt = query->cursor(m_db);
+	if (!stmt) return SQLITE_ERROR;
+	*output = query->row();
+	int res = this->step_once(stmt, *output, NULL, query->arena());
+	STATS_STATEMENT(query->name(), start, (res == SQLITE_ROW));
+	if (res != SQLITE_ROW) {
+		*output = NULL;
+		query->reset();
+	}
+	return res;
+}
+
+int Database::update_value(Query* query) {
+	assert(query->kind() == QUERY_UPDATE);
+	uint64_t start = STATS_START();
+	sqlite3_stmt* stmt = query->statement(m_db);
+	if (!stmt) return SQLITE_ERROR;
+	int res = sqlite3_step(stmt);
+	STATS_STATEMENT(query->name(), start, 0);
+	query->reset();
+	return (res == SQLITE_DONE ? SQLITE_OK : res);
+}
+
+int Database::del(Query* query) {
+	assert(query->kind() == QUERY_DELETE);
+	uint64_t start = STATS_START();
+	sqlite3_stmt* stmt = query->statement(m_db);
+	if (!stmt) return SQLITE_ERROR;
+	int res = this->execute(stmt);
+	STATS_STATEMENT(query->name(), start, 0);
+	query->reset();
+	return res;
+}
+
+// tables prepare their own statements to insert, update and delete rows
+static void table_statement(const char* verb, Table* table, uint64_t start) {
+	char name[64];
+	snprintf(name, sizeof(name), "%s_%s", verb, table->name());
+	stats->statement(name, start, 0);
+}
+
 int Database::update(Table* table, uint64_t pkvalue, ...) {
 	va_list args;
 	va_start(args, pkvalue);
 
 	int res = SQLITE_OK;
+	uint64_t start = STATS_START();
 	
 	// get the prepared statement
 	sqlite3_stmt* stmt = table->update(m_db);
@@ -532,6 +898,7 @@ int Database::update(Table* table, uint64_t pkvalue, ...) {
 	if (res==SQLITE_OK) res = sqlite3_bind_int64(stmt, table->column_count(), 
 												 pkvalue);
 	if (res==SQLITE_OK) res = this->execute(stmt);
+	if (stats) table_statement("update", table, start);
 	va_end(args);
 	return res;
 }
@@ -541,6 +908,7 @@ int Database::insert(Table* table, ...) {
 	va_start(args, table);
 
 	int res = SQLITE_OK;
+	uint64_t start = STATS_START();
 	// get the prepared statement
 	sqlite3_stmt* stmt = table->insert(m_db);
 	if (!stmt) {
@@ -550,14 +918,17 @@ int Database::insert(Table* table, ...) {
 	}
 	this->bind_all_columns(stmt, table, args);
 	if (res == SQLITE_OK) res = this->execute(stmt);
+	if (stats) table_statement("insert", table, start);
 	va_end(args);
 	return res;
 }
 
 #undef __get_stmt
+#undef __release_stmt
 
 int Database::del(Table* table, uint64_t serial) {
 	int res = SQLITE_OK;
+	uint64_t start = STATS_START();
 	sqlite3_stmt* stmt = table->del(m_db);
 	if (!stmt) {
 		fprintf(stderr, "Error: %s table gave a NULL statement when trying to "
@@ -566,6 +937,7 @@ int Database::del(Table* table, uint64_t serial) {
 	}
 	if (res == SQLITE_OK) res = sqlite3_bind_int64(stmt, 1, serial);
 	if (res == SQLITE_OK) res = this->execute(stmt);
+	if (stats) table_statement("delete", table, start);
 	return res;
 }
 
@@ -573,6 +945,10 @@ uint64_t Database::last_insert_id() {
 	return (uint64_t)sqlite3_last_insert_rowid(m_db);
 }
 
+int Database::vacuum() {
+	return this->sql_once("VACUUM;");
+}
+
 
 
 int Database::sql_once(const char* fmt, ...) {
@@ -599,26 +975,29 @@ int Database::sql_once(const char* fmt, ...) {
 }
 
 int Database::sql(const char* name, const char* fmt, ...) {
-	sqlite3_stmt* stmt;
-	char* key = strdup(name);
-	cache_get_and_retain(m_statement_cache, key, (void**)&stmt);
+	uint64_t start = STATS_START();
+	uint32_t id = m_statements->intern(name);
+	sqlite3_stmt* stmt = m_statements->get(id);
 	if (!stmt) {
 		va_list args;
 		va_start(args, fmt);
 		char* query = sqlite3_vmprintf(fmt, args);
-		int res = sqlite3_prepare_v2(m_db, query, (int)strlen(query), &stmt, NULL);
+		int res = sqlite3_prepare_v2(m_db, query, -1, &stmt, NULL);
 		va_end(args);
 		if (res != SQLITE_OK) {
 			fprintf(stderr, "Error: unable to prepare statement for query: %s\n"
 					        "Error: %s\n",
 					query, sqlite3_errmsg(m_db));
-			free(key);
+			sqlite3_free(query);
 			return res;
 		}
-		cache_set_and_retain(m_statement_cache, key, stmt, 0); \
-		free(key);
+		sqlite3_free(query);
+		m_statements->set(id, stmt);
 	}
-	return this->execute(stmt);
+	int res = this->execute(stmt);
+	STATS_STATEMENT(name, start, 0);
+	if (id == STATEMENT_NONE) sqlite3_finalize(stmt);
+	return res;
 }
 
 int Database::execute(sqlite3_stmt* stmt) {
@@ -651,6 +1030,24 @@ int Database::add_table(Table* t) {
 	return 0;
 }
 
+int Database::add_query(Query* q, const char* name) {
+	if (m_query_count >= m_query_max) {
+		m_queries = (Query**)realloc(m_queries, 
+									 m_query_max*sizeof(Query*)*REALLOC_FACTOR);
+		if (!m_queries) {
+			fprintf(stderr, "Error: unable to reallocate memory to add a "
+					"query\n");
+			return 1;
+		}
+		m_query_max *= REALLOC_FACTOR;
+	}
+	m_queries[m_query_count++] = q;
+	if (strncmp(name, "m_", 2) == 0) name += 2;
+	q->set_name(name);
+	
+	return 0;
+}
+
 /**
  * get a row count of the first table to detect if the schema
  * needs to be initialized
@@ -711,7 +1108,7 @@ int Database::upgrade_schema(uint32_t version) {
 		} else {
 			// table is same version, so check for new columns
 			for (uint32_t ci = 0; res == DB_OK && ci < m_tables[ti]->column_count(); ci++) {
-				if (m_tables[ti]->column(ci)->version() < version) {
+				if (m_tables[ti]->column(ci)->version() < m_tables[ti]->version()) {
 					// this should never happen
 					fprintf(stderr, "Error: internal error with schema versioning."
 									" Column %s is older than its table %s. \n",
@@ -728,6 +1125,18 @@ int Database::upgrade_schema(uint32_t version) {
 					}		
 				}
 			}
+			// and for new indexes
+			for (uint32_t ii = 0; res == DB_OK && ii < m_tables[ti]->index_count(); ii++) {
+				TableIndex* index = m_tables[ti]->index(ii);
+				if (index->version > version) {
+					res = this->sql_once(index->sql);
+					if (res != DB_OK) {
+						fprintf(stderr, "Error: sql error trying to upgrade table: %s"
+								" index: %s : %s\n", 
+								m_tables[ti]->name(), index->name, m_error);
+					}
+				}
+			}
 		}
 	}
 	
@@ -756,6 +1165,21 @@ int Database::init_internal_schema() {
 	ADD_PK(m_information_table, "id");
 	ADD_INDEX(m_information_table, "variable", TYPE_TEXT, true);
 	ADD_TEXT(m_information_table, "value");
+	
+	m_get_information_value = new Query(m_information_table, QUERY_VALUE,
+										m_information_table->column(2)); // value
+	m_get_information_value->where(m_information_table->column(1), '='); // variable
+	ADD_QUERY(m_get_information_value);
+	
+	m_count_information_value = new Query(m_information_table, QUERY_COUNT);
+	m_count_information_value->where(m_information_table->column(1), '='); // variable
+	ADD_QUERY(m_count_information_value);
+	
+	m_update_information_value = new Query(m_information_table, QUERY_UPDATE,
+										   m_information_table->column(2)); // value
+	m_update_information_value->where(m_information_table->column(1), '='); // variable
+	ADD_QUERY(m_update_information_value);
+	
 	return DB_OK;
 }
 
@@ -765,33 +1189,15 @@ int Database::initial_data() {
 }
 
 int Database::get_information_value(const char* variable, char*** value) {
-	return this->get_value("get_information_value",
-						   (void**)value,
-						   this->m_information_table,
-						   this->m_information_table->column(2), // value
-						   1,
-						   this->m_information_table->column(1), // variable
-						   '=', variable);
+	return this->get_value(m_get_information_value->bind(variable), (void**)value);
 }
 
 int Database::update_information_value(const char* variable, const char* value) {
 	int res = SQLITE_OK;
-	uint64_t* c;
-	res = this->count("count_info_var",
-					  (void**)&c,
-					  this->m_information_table,
-					  1,
-					  this->m_information_table->column(1), // variable
-					  '=', variable);
-					  
-	if (*c > 0) {
-		res = this->update_value("update_information_value",
-								  this->m_information_table,
-								  this->m_information_table->column(2), // value
-								  (void**)&value, 
-								  1,
-								  this->m_information_table->column(1), // variable
-								  '=', variable);
+	uint64_t c = 0;
+	res = this->count(m_count_information_value->bind(variable), &c);
+	if (c > 0) {
+		res = this->update_value(m_update_information_value->bind(value)->bind(variable));
 	} else {
 		res = this->insert(m_information_table, variable, value);
 	}
@@ -833,7 +1239,8 @@ int Database::set_schema_version(uint32_t version) {
 	return res;
 }
 
-size_t Database::store_column(sqlite3_stmt* stmt, int column, uint8_t* output) {
+size_t Database::store_column(sqlite3_stmt* stmt, int column, uint8_t* output, 
+							  Arena* arena) {
 	size_t used;
 	int type = sqlite3_column_type(stmt, column);
 	const void* blob;
@@ -844,14 +1251,23 @@ size_t Database::store_column(sqlite3_stmt* stmt, int column, uint8_t* output) {
 			used = sizeof(uint64_t);
 			break;
 		case SQLITE_TEXT:
-			*(const char**)output = strdup((const char*)sqlite3_column_text(stmt, 
-																			column));
+			if (arena) {
+				*(const char**)output = arena->copy((const char*)sqlite3_column_text(stmt, 
+																					 column));
+			} else {
+				*(const char**)output = strdup((const char*)sqlite3_column_text(stmt, 
+																				column));
+			}
 			used = sizeof(char*);
 			break;
 		case SQLITE_BLOB:
 			blob = sqlite3_column_blob(stmt, column);
 			blobsize = sqlite3_column_bytes(stmt, column);
-			*(void**)output = malloc(blobsize);
+			if (arena) {
+				*(void**)output = arena->alloc(blobsize);
+			} else {
+				*(void**)output = malloc(blobsize);
+			}
 			if (*(void**)output && blobsize) {
 				memcpy(*(void**)output, blob, blobsize);
 			} else {
@@ -880,6 +1296,11 @@ size_t Database::store_column(sqlite3_stmt* stmt, int column, uint8_t* output) {
  *   were written to output
  */
 int Database::step_once(sqlite3_stmt* stmt, uint8_t* output, uint32_t* used) {
+	return this->step_once(stmt, output, used, NULL);
+}
+
+int Database::step_once(sqlite3_stmt* stmt, uint8_t* output, uint32_t* used,
+						Arena* arena) {
 	int res = SQLITE_OK;
 	res = sqlite3_step(stmt);
 	uint8_t* current = output;
@@ -887,7 +1308,7 @@ int Database::step_once(sqlite3_stmt* stmt, uint8_t* output, uint32_t* used) {
 	if (res == SQLITE_ROW) {
 		int count = sqlite3_column_count(stmt);
 		for (int i = 0; i < count; i++) {
-			current += this->store_column(stmt, i, current);
+			current += this->store_column(stmt, i, current, arena);
 		}
 		if (used) {
 			*used = (uint32_t)(current - output);
@@ -922,37 +1343,3 @@ int Database::step_all(sqlite3_stmt* stmt, void** output, uint32_t size,
     sqlite3_reset(stmt);
 	return res;
 }
-
-
-/**
- *
- *  libcache
- *
- */
-void Database::init_cache() {
-	cache_attributes_t attrs;
-	attrs.version = CACHE_ATTRIBUTES_VERSION_2;
-	attrs.key_hash_cb = cache_key_hash_cb_cstring;
-	attrs.key_is_equal_cb = cache_key_is_equal_cb_cstring;
-	attrs.key_retain_cb = cache_key_retain;
-	attrs.key_release_cb = cache_release_cb_free;
-	attrs.value_release_cb = cache_statement_release;
-	attrs.value_retain_cb = NULL;
-	attrs.value_make_purgeable_cb = NULL;
-	attrs.value_make_nonpurgeable_cb = NULL;
-	attrs.user_data = NULL;
-	cache_create("org.macosforge.darwinbuild.darwinup.statements", 
-				 &attrs, &m_statement_cache);
-}
-
-void Database::destroy_cache() {
-	cache_destroy(m_statement_cache);
-}
-
-void cache_key_retain(void* key_in, void** key_out, void* user_data) {
-	*key_out = strdup((char*)key_in);
-}
-
-void cache_statement_release(void* value, void* user_data) {
-	sqlite3_finalize(*(sqlite3_stmt**)value);
-}
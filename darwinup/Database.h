@@ -34,8 +34,6 @@
 #define _DATABASE_H
 
 #include <assert.h>
-#include <cache.h>
-#include <cache_callbacks.h>
 #include <sqlite3.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -43,13 +41,19 @@
 #include <stdarg.h>
 #include <stdlib.h>
 
+#include "StatementRegistry.h"
+#include "Stats.h"
 #include "Table.h"
+#include "Query.h"
 #include "Digest.h"
 #include "Archive.h"
 
 // flag for generating queries with ORDER BY clauses
 #define ORDER_BY_DESC 0
 #define ORDER_BY_ASC  1
+// rows with equal values come one after another, in whatever order is
+//  cheapest, for a split column by its parent and then its leaf
+#define ORDER_BY_GROUP 2
 
 // initial number of rows we allocate for when querying
 #define INITIAL_ROWS   8
@@ -66,6 +70,27 @@
 // test return code to see if actual results were found
 #define FOUND(x)  ((x & DB_FOUND) && !(x & DB_ERROR))
 
+// connection profiles, see Database::set_profile()
+#define DB_PROFILE_DEFAULT 0 // rollback journal, synchronous=FULL
+#define DB_PROFILE_WAL     1 // write-ahead log, synchronous=FULL
+#define DB_PROFILE_FAST    2 // write-ahead log, synchronous=NORMAL
+#define DB_PROFILES        3
+// no profile chosen, use the one stored in the database
+#define DB_PROFILE_STORED  0xFFFFFFFF
+
+// rows a connection changes before it runs PRAGMA optimize after a commit
+#define DB_OPTIMIZE_CHANGES 10000
+
+struct DatabaseProfile {
+	const char* name;
+	const char* journal_mode;
+	const char* synchronous;
+	int         cache_size;   // pages, or KiB if negative
+	int64_t     mmap_size;    // bytes
+	const char* temp_store;
+	bool        optimize;     // PRAGMA optimize after large writes
+};
+
 // Schema creation macros
 #define SCHEMA_VERSION(v) this->schema_version(v);
 #define ADD_TABLE(t) assert(this->add_table(t)==0);
@@ -82,28 +107,16 @@
 	assert(table->add_column(new Column(name, TYPE_INTEGER), this->schema_version())==0);
 #define ADD_BLOB(table, name) \
 	assert(table->add_column(new Column(name, TYPE_BLOB), this->schema_version())==0);
+#define ADD_TABLE_INDEX(table, name, columns) \
+	assert(table->add_index(name, columns, this->schema_version())==0);
+#define ADD_QUERY(q) assert(this->add_query(q, #q)==0);
 
-// retry an operation a few times if we hit a lock
-#define __retry_if_locked(operation) \
-    do { \
-    extern uint32_t verbosity; \
-    fprintf(stderr, "retry: verbosity %u \n", verbosity); \
-    res = operation; \
-    fprintf(stderr, "retry: initial res %d \n", res); \
-    if (res == 5 || res == 6) { \
-        fprintf(stderr, "retry: locked \n"); \
-        int _num_tries = 3; \
-        while (_num_tries--) { \
-            fprintf(stderr, "retry: tries left %d \n", _num_tries); \
-            if (verbosity) fprintf(stdout, "Database is locked, " \
-								   "trying again in 1 second...\n"); \
-	        sleep(1); \
-            res = operation; \
-			fprintf(stderr, "retry: res %d \n", res); \
-		} \
-        if (verbosity) fprintf(stdout, "Database is still locked, giving up.\n"); \
-	} \
-    } while (0);
+// while the database is locked by another connection, sqlite waits this
+// long, doubling up to the max, before trying again, see Database::busy()
+#define DB_BUSY_MIN_DELAY    1000   // microseconds
+#define DB_BUSY_MAX_DELAY    128000
+// seconds to wait for a locked database, unless set_busy_timeout() says
+#define DB_BUSY_TIMEOUT      300
 
 
 /**
@@ -138,14 +151,51 @@ struct Database {
 	int          connect(const char* path);
 	bool         is_connected();
 	
+	// Gives up on a locked database after seconds, 0 does not wait
+	void         set_busy_timeout(uint32_t seconds);
+	
+	/**
+	 * snapshots
+	 *
+	 * A connection made after set_snapshot(true) never writes, and reads
+	 *  everything from the database as it was when it connected, even
+	 *  while another connection commits.  Only a database in write-ahead
+	 *  log mode can be read that way without blocking its writers, 
+	 *  see is_wal().  Connecting fails if the schema needs an upgrade.
+	 */
+	void         set_snapshot(bool snapshot);
+	bool         is_snapshot();
+	// true if this connection cannot write, like a snapshot
+	bool         is_readonly();
+	// true if the database at path is in write-ahead log mode
+	static bool  is_wal(const char* path);
+	
 	int          begin_transaction();
-	int          rollback_transaction();
+	virtual int  rollback_transaction();
 	int          commit_transaction();
 	
+	/**
+	 * connection profile
+	 *
+	 * A profile is a set of pragmas applied to every connection, chosen
+	 *  with set_profile() before connecting, or else read from the 
+	 *  "profile" information variable.  The WAL profiles leave the 
+	 *  database in write-ahead log mode until another profile is used.
+	 *  DB_PROFILE_FAST may lose the last transactions on power loss, 
+	 *  but not on a crash of the process.
+	 */
+	static uint32_t  profile_named(const char* name);
+	static const char* profile_name(uint32_t profile);
+	uint32_t     profile();
+	int          set_profile(uint32_t profile);
+	// saves profile as the one later connections use, and applies it
+	int          store_profile(uint32_t profile);
+	
 	/**
 	 * statement caching and execution
 	 *
-	 * - name is a string key that labels the query for caching purposes 
+	 * - name is a string constant that labels the query, its statement is 
+	 *     prepared the first time and kept in m_statements under that name
 	 * - output is where we will store the value requested
 	 * - count is the number of sets of parameters
 	 * - va_list should have sets of 3 (integer and text) or 4 (blob) 
@@ -174,6 +224,28 @@ struct Database {
 					  uint32_t count, ...);
 	int  del(const char* name, Table* table, uint32_t count, ...);
 	
+	/**
+	 * Query execution
+	 *
+	 * Each runs a Query of the matching kind once all of its values are 
+	 *  bound, see Query.h.  Outputs are allocated and returned like the 
+	 *  statement functions above, except count which fills in output.
+	 *
+	 */
+	int  count(Query* query, uint64_t* output);
+	int  get_value(Query* query, void** output);
+	int  get_column(Query* query, void** output, uint32_t* result_count);
+	int  get_row(Query* query, uint8_t** output);
+	int  get_all(Query* query, uint8_t*** output, uint32_t* result_count);
+	// Steps to the next row of a QUERY_ROWS query, binding it on the first
+	//  call.  output, and its text and blobs, are only valid until the next
+	//  call, they are kept in the query's arena instead of being malloc'd.
+	//  The query resets itself after the last row and must be reset() if 
+	//  left before that.
+	int  get_next(Query* query, uint8_t** output);
+	int  update_value(Query* query);
+	int  del(Query* query);
+	
 	/**
 	 * update/insert whole rows
 	 *
@@ -198,12 +270,22 @@ struct Database {
 	
 	uint64_t last_insert_id();
 	
+	// rebuild the database file without its free pages, outside of
+	//  any transaction
+	int  vacuum();
+	
 	
 protected:
 
+	// sqlite3_busy_handler, sleeps for the next delay or gives up
+	static int busy(void* db, int count);
+	
 	// pre- and post- connection work
 	int   pre_connect();
 	int   post_connect();
+	int   apply_profile();
+	// run PRAGMA optimize if enough rows changed since the last time
+	int   optimize();
 	
 	int   upgrade_schema(uint32_t version);
 	int   upgrade_internal_schema(uint32_t version);
@@ -225,6 +307,9 @@ protected:
 	int   execute(sqlite3_stmt* stmt);
 	
 	int   add_table(Table*);
+	// the Database deletes its queries along with its tables, name is
+	//  how stats know the query, less any m_ prefix
+	int   add_query(Query*, const char* name);
 	
 	// test if database has had its tables created
 	bool  is_empty();
@@ -245,26 +330,42 @@ protected:
 	/**
 	 * step and store functions
 	 */
-	size_t store_column(sqlite3_stmt* stmt, int column, uint8_t* output);
+	// text and blob columns are copied into arena, or malloc'd if it is NULL
+	size_t store_column(sqlite3_stmt* stmt, int column, uint8_t* output, 
+						Arena* arena);
 	int step_once(sqlite3_stmt* stmt, uint8_t* output, uint32_t* used);
+	int step_once(sqlite3_stmt* stmt, uint8_t* output, uint32_t* used, 
+				  Arena* arena);
 	int step_all(sqlite3_stmt* stmt, void** output, uint32_t size, uint32_t* count);
 	
-	// libcache
-	void init_cache();
-	void destroy_cache();
 	
 	char*            m_path;
 	sqlite3*         m_db;
+	bool             m_readonly;
+	bool             m_snapshot;
+	
+	uint32_t         m_profile;
+	int              m_optimized_changes;
+	
+	uint32_t         m_busy_timeout;
+	uint64_t         m_busy_start;
 	
 	uint32_t         m_schema_version;
 	Table*           m_information_table;
-	sqlite3_stmt*    m_get_information_value;
+	Query*           m_get_information_value;
+	Query*           m_count_information_value;
+	Query*           m_update_information_value;
 	
 	Table**          m_tables;
 	uint32_t         m_table_count;
 	uint32_t         m_table_max;
+	
+	Query**          m_queries;
+	uint32_t         m_query_count;
+	uint32_t         m_query_max;
 
-	cache_t*         m_statement_cache;
+	// statements prepared by sql() and the name and va_list functions
+	StatementRegistry* m_statements;
 	
 	sqlite3_stmt*    m_begin_transaction;
 	sqlite3_stmt*    m_rollback_transaction;
@@ -279,9 +380,4 @@ protected:
 
 };
 
-// libcache callbacks
-void cache_key_retain(void* key_in, void** key_out, void* user_data);
-void cache_statement_retain(void* value, void* user_data);
-void cache_statement_release(void* value, void* user_data);
-
 #endif
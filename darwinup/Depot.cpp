@@ -33,10 +33,18 @@
 #include "Archive.h"
 #include "Depot.h"
 #include "File.h"
+#include "Journal.h"
+#include "LockQueue.h"
+#include "ObjectStore.h"
+#include "PathIndex.h"
+#include "Plan.h"
 #include "SerialSet.h"
+#include "Stats.h"
 #include "Utils.h"
+#include "WorkQueue.h"
 #include <assert.h>
 #include <copyfile.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
@@ -55,17 +63,22 @@ Depot::Depot() {
 	m_database_path = NULL;
 	m_archives_path = NULL;
 	m_downloads_path = NULL;
+	m_queue_path = NULL;
 	m_build = NULL;
 	m_db = NULL;
+	m_objects = NULL;
 	m_lock_fd = -1;
 	m_is_locked = 0;
 	m_depot_mode = 0750;
 	m_is_dirty = false;
 	m_modified_extensions = false;
 	m_modified_xpc_services = false;
+	m_plan = NULL;
 }
 
 Depot::Depot(const char* prefix) {
+	m_db = NULL;
+	m_objects = NULL;
 	m_lock_fd = -1;
 	m_is_locked = 0;
 	m_depot_mode = 0750;
@@ -73,12 +86,14 @@ Depot::Depot(const char* prefix) {
 	m_is_dirty = false;
 	m_modified_extensions = false;
 	m_modified_xpc_services = false;
+	m_plan = NULL;
 	
 	asprintf(&m_prefix, "%s", prefix);
 	join_path(&m_depot_path, m_prefix, "/.DarwinDepot");
 	join_path(&m_database_path, m_depot_path, "/Database-V100");
 	join_path(&m_archives_path, m_depot_path, "/Archives");
 	join_path(&m_downloads_path, m_depot_path, "/Downloads");
+	join_path(&m_queue_path, m_depot_path, "/Queue");
 }
 
 Depot::~Depot() {
@@ -86,13 +101,16 @@ Depot::~Depot() {
 	// XXX: this is expensive, but is it necessary?
 	//this->check_consistency();
 
+	Archive::close_packs();
 	if (m_lock_fd != -1)	this->unlock();
 	delete m_db;
+	delete m_objects;
 	if (m_prefix)           free(m_prefix);
 	if (m_depot_path)	free(m_depot_path);
 	if (m_database_path)	free(m_database_path);
 	if (m_archives_path)	free(m_archives_path);
 	if (m_downloads_path)	free(m_downloads_path);
+	if (m_queue_path)	free(m_queue_path);
 }
 
 const char*	Depot::archives_path()		      { return m_archives_path; }
@@ -111,6 +129,17 @@ int Depot::connect() {
 	return DB_OK;
 }
 
+int Depot::connect_snapshot() {
+	if (!Database::is_wal(m_database_path)) return DB_ERROR;
+	m_db = new DarwinupDatabase(m_database_path, true);
+	if (!m_db->is_connected()) {
+		delete m_db;
+		m_db = NULL;
+		return DB_ERROR;
+	}
+	return DB_OK;
+}
+
 int Depot::create_storage() {
 	uid_t uid = getuid();
 	gid_t gid = 0;
@@ -146,6 +175,14 @@ int Depot::create_storage() {
 		perror(m_downloads_path);
 		return res;
 	}
+	
+	res = mkdir(m_queue_path, m_depot_mode);
+	res = chmod(m_queue_path, m_depot_mode);
+	res = chown(m_queue_path, uid, gid);
+	if (res && errno != EEXIST) {
+		perror(m_queue_path);
+		return res;
+	}
 	return DEPOT_OK;
 }
 
@@ -187,12 +224,23 @@ int Depot::initialize(bool writable) {
 		return DEPOT_PERM_DENIED;
 	}
 
-	// take an exclusive lock
-	res = this->lock(LOCK_EX);
-	if (res) return res;
-	m_is_locked = 1;			
+	// a snapshot shows readers the last commit of whoever holds the lock,
+	// so they need not wait for it
+	if (!writable && this->connect_snapshot() == DB_OK) {
+		IF_DEBUG("reading a snapshot of the depot\n");
+	} else {
+		// take an exclusive lock
+		res = this->lock(LOCK_EX);
+		if (res) return res;
+		m_is_locked = 1;			
 		
-	res = this->connect();
+		res = this->connect();
+	}
+
+	// a migrated depot keeps file data in the object store
+	if (res == 0 && ObjectStore::exists(m_archives_path)) {
+		m_objects = new ObjectStore(m_archives_path);
+	}
 
 	return res;
 }
@@ -324,18 +372,33 @@ Archive** Depot::get_superseded_archives(uint32_t* count) {
 	}
 
 	uint32_t i = 0;
-	uint32_t cur = i;
+	uint32_t made = 0;
+	uint32_t unknown = 0;
 	if (FOUND(res)) {
 		while (i < *count) {
 			Archive* archive = this->m_db->make_archive(archlist[i++]);
-			if (archive && this->is_superseded(archive)) {
-				list[cur++] = archive;
-			} else if (!archive) {
+			if (!archive) {
 				fprintf(stderr, "%s:%d: DB::make_archive returned NULL\n",
 						__FILE__, __LINE__);
 				res = -1;
 				break;
 			}
+			list[made++] = archive;
+			if (!this->check_survivor(archive)) unknown++;
+		}
+	}
+
+	// whatever the stored survivors could not answer is found in one pass
+	IF_DEBUG("[superseded] %u of %u archives answered by their survivor\n", 
+			 made - unknown, made);
+	if (res != -1) res = unknown ? this->find_survivors(list, made) : 0;
+
+	uint32_t cur = 0;
+	for (i = 0; i < made; i++) {
+		if (res == 0 && list[i]->m_is_superseded == 1) {
+			list[cur++] = list[i];
+		} else {
+			delete list[i];
 		}
 	}
 	// adjust count based on our is_superseded filtering
@@ -358,6 +421,13 @@ struct InstallContext {
 		files_removed = 0;
 		files_to_remove = new SerialSet();
 		reverse_files = false;
+		for (int i = 0; i < BACKUP_METHODS; i++) backup_bytes[i] = 0;
+		link_objects = false;
+		objects_stored = 0;
+		objects_present = 0;
+		subtree = NULL;
+		uninstalling = NULL;
+		journal = NULL;
 	}
 	
 	~InstallContext() {
@@ -371,6 +441,13 @@ struct InstallContext {
 	uint64_t files_removed;
 	SerialSet* files_to_remove;	// for uninstall
 	bool reverse_files; // for uninstall
+	uint64_t backup_bytes[BACKUP_METHODS]; // for backup, by BACKUP_ method
+	bool link_objects; // for store_file, the staged files are discarded after
+	uint64_t objects_stored; // for store_file and backup_file
+	uint64_t objects_present;
+	const char* subtree; // for restore_file
+	SerialSet* uninstalling; // for uninstall, serials of the archives being removed
+	Journal* journal; // for backup_file and install_file, NULL if not journaled
 };
 
 int Depot::iterate_archives(ArchiveIteratorFunc func, void* context) {
@@ -388,32 +465,124 @@ int Depot::iterate_archives(ArchiveIteratorFunc func, void* context) {
 
 int Depot::iterate_files(Archive* archive, FileIteratorFunc func, void* context) {
 	int res = DB_OK;
-	uint8_t** filelist;
-	uint32_t count;
 	bool reverse = false;
 	if (context) reverse = ((InstallContext*)context)->reverse_files;
-	res = this->m_db->get_files(&filelist, &count, archive, reverse);
-	if (FOUND(res)) {
-		for (uint32_t i=0; i < count; i++) {
-			File* file = this->m_db->make_file(filelist[i]);
-			if (file) {
-				res = func(file, context);
-				delete file;
-			} else {
-				fprintf(stderr, "%s:%d: DB::make_file returned NULL\n", __FILE__, __LINE__);
-				res = -1;
-				break;
-			}
+
+	// files are read one at a time, so large archives are never
+	// held in memory all at once
+	Query* files = this->m_db->begin_files(archive, reverse);
+	File* file;
+	int found = this->m_db->next_file(files, &file, true);
+	while (FOUND(found)) {
+		res = func(file, context);
+		delete file;
+		if (res != 0) {
+			// the first failure is the one returned
+			this->m_db->end_files(files);
+			break;
 		}
+		found = this->m_db->next_file(files, &file, true);
+	}
+	if (found & DB_ERROR) {
+		fprintf(stderr, "%s:%d: unable to read the files of archive %llu\n", 
+				__FILE__, __LINE__, archive->serial());
+		res = -1;
 	}
 
 	return res;
 }
 
+////
+//  AnalyzeJob
+//
+//  A file from the staging area on its way through analyze_stage.
+//  The digest of the staged file and the actual file on disk are
+//  filled in by Depot::analyze_file on one of the worker threads.
+//  staged is the digest computed when the archive was extracted, and
+//  preceding the file this path had before the archive, if any.
+////
+struct AnalyzeJob {
+	AnalyzeJob(File* f, FTSENT* ent, const char* prefix, Plan* plan) {
+		file = f;
+		accpath = strdup(ent->fts_accpath);
+		join_path(&actpath, prefix, f->path());
+		actual = NULL;
+		preceding = NULL;
+		staged = f->archive()->staged_digest(f->path());
+		planned = plan ? plan->get(f->path()) : NULL;
+		reused = 0;
+		level = ent->fts_level;
+	}
+
+	~AnalyzeJob() {
+		if (file) delete file;
+		if (actual) delete actual;
+		if (preceding) delete preceding;
+		free(accpath);
+		free(actpath);
+	}
+
+	File* file;
+	char* accpath;   // path of the staged file
+	char* actpath;   // path of the installed file
+	File* actual;
+	File* preceding;
+	Digest* staged;
+	PlanEntry* planned; // when applying a plan
+	uint32_t reused;   // digests of live files taken from the plan
+	short level;
+};
+
+int Depot::analyze_file(void* item, void* context) {
+	AnalyzeJob* job = (AnalyzeJob*)item;
+	PlanEntry* planned = job->planned;
+	extern uint32_t paranoid;
+	if (job->staged && S_ISREG(job->file->mode())) {
+		job->file->m_digest = new SHA1Digest(job->staged);
+	} else {
+		job->file->digest_data(job->accpath);
+	}
+	// anything that cannot be stat'd is left for analyze_stage
+	// so errors are reported in order
+	struct stat sb;
+	if (lstat(job->actpath, &sb) == 0) {
+		// the live file the plan looked at is newer than what the
+		// database last recorded for it
+		File* known = job->preceding;
+		if (planned && planned->actual) known = planned->actual;
+		job->actual = FileFactory(job->actpath, known);
+		if (known && planned && known == planned->actual && !paranoid && 
+			known->stat_matches(&sb)) {
+			job->reused++;
+		}
+	}
+	return 0;
+}
+
+int Depot::find_preceding(Archive* archive, const char* path, File** preceding) {
+	uint8_t* data;
+	*preceding = NULL;
+	int res = this->m_db->get_file_preceding(&data, path, archive);
+	if (FOUND(res)) {
+		*preceding = this->m_db->make_file(data);
+		if (!*preceding) return DEPOT_ERROR;
+	} else if (res & DB_ERROR) {
+		fprintf(stderr, "Error: unable to look up the file preceding %s\n", path);
+		return DEPOT_ERROR;
+	}
+	return DEPOT_OK;
+}
+
+int Depot::free_file(const char* path, void* value, void* context) {
+	delete (File*)value;
+	return 0;
+}
+
 int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 						 int* rollback_files) {
 	extern uint32_t force;
 	extern uint32_t dryrun;
+	extern uint32_t verbosity;
 	int res = 0;
 	assert(archive != NULL);
 	assert(rollback != NULL);
@@ -425,10 +594,60 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 	
 	IF_DEBUG("[analyze] analyzing path: %s\n", path);
 
-	FTS* fts = fts_open((char**)path_argv, FTS_PHYSICAL | FTS_COMFOLLOW | FTS_XDEV, fts_compare);
+	uint32_t lookups = 0;
+	uint32_t reused = 0;
+
+	// Digests and the lstat of the installed files are computed by the
+	// work queue, up to queue->capacity() files ahead of the diff below.
+	// FTS_NOCHDIR keeps fts_accpath valid from the worker threads.
+	extern uint32_t io_jobs;
+	WorkQueue* queue = new WorkQueue(&Depot::analyze_file, NULL, io_jobs);
+	uint32_t pending = 0;
+	if (res == 0) res = queue->start();
+
+	// most recent directory seen at each level, for saving parents
+	File** dirs = NULL;
+	short dirs_max = 0;
+
+	AnalyzeJob* job = NULL;
+	FTS* fts = fts_open((char**)path_argv, 
+						FTS_PHYSICAL | FTS_COMFOLLOW | FTS_XDEV | FTS_NOCHDIR, 
+						fts_compare);
 	FTSENT* ent = fts_read(fts); // throw away the entry for path itself
-	while (res != -1 && (ent = fts_read(fts)) != NULL) {
-		File* file = FileFactory(archive, ent);
+	while (res == 0) {
+		while (ent && pending < queue->capacity()) {
+			ent = fts_read(fts);
+			if (ent == NULL) break;
+			File* file = FileFactory(archive, ent, false);
+			if (file) {
+				// The file preceding each path is found with one seek of the
+				// (path, archive) index, before the workers need it.  Only
+				// the analysis of this same path inserts rollback rows at it.
+				AnalyzeJob* next = new AnalyzeJob(file, ent, this->prefix(), m_plan);
+				res = this->find_preceding(archive, file->path(), &next->preceding);
+				lookups++;
+				if (res != 0) {
+					delete next;
+					break;
+				}
+				res = queue->push(next);
+				if (res != 0) {
+					delete next;
+					break;
+				}
+				pending++;
+			}
+		}
+		if (res != 0 || pending == 0) break;
+		job = (AnalyzeJob*)queue->pop();
+		if (job == NULL) {
+			fprintf(stderr, "Error: the work queue stopped while analyzing %s\n", path);
+			res = DEPOT_ERROR;
+			break;
+		}
+		pending--;
+
+		File* file = job->file;
 		if (file) {
 			char state = '?';
 
@@ -437,21 +656,23 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 			if (strcasestr(file->path(), ".DarwinDepot")) {
 				fprintf(stderr, "Error: Root contains a .DarwinDepot, "
 						"aborting to avoid damaging darwinup metadata.\n");
-				return DEPOT_ERROR;
+				res = DEPOT_ERROR;
+				break;
 			}
 
 			// Perform a three-way-diff between the file to be installed (file),
 			// the file we last installed in this location (preceding),
 			// and the file that actually exists in this location (actual).
 		
-			char* actpath;
-			join_path(&actpath, this->prefix(), file->path());
-			File* actual = FileFactory(actpath);
-			File* preceding = this->file_preceded_by(file);
+			// the job owns preceding
+			File* preceding = job->preceding;
+			if (job->actual == NULL) job->actual = FileFactory(job->actpath, preceding);
+			File* actual = job->actual;
 			
 			if (actual == NULL) {
 				// No actual file exists already, so we create a placeholder.
 				actual = new NoEntry(file->path());
+				job->actual = actual;
 				IF_DEBUG("[analyze]    actual == NULL\n");
 			}
 			
@@ -471,7 +692,8 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 					IF_DEBUG("[analyze]    directory being replaced by file, save children\n");
 					const char* sub_argv[] = { actual->path(), NULL };
 					FTS* subfts = fts_open((char**)sub_argv, 
-										   FTS_PHYSICAL | FTS_COMFOLLOW | FTS_XDEV, 
+										   FTS_PHYSICAL | FTS_COMFOLLOW | FTS_XDEV | 
+										   FTS_NOCHDIR, 
 										   fts_compare);
 					FTSENT* subent = fts_read(subfts); // throw away actual
 					while ((subent = fts_read(subfts)) != NULL) {
@@ -524,7 +746,8 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 						fprintf(stderr, FILE_OBJ_CHANGE_ERROR, actual->path(), 
 								FILE_TYPE_STRING(file_type),
 								FILE_TYPE_STRING(actual_type));
-						return DEPOT_OBJ_CHANGE;
+						res = DEPOT_OBJ_CHANGE;
+						break;
 					}
 					state = 'U';
 				}
@@ -585,11 +808,14 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 
 				if (!INFO_TEST(actual->info(), FILE_INFO_NO_ENTRY)) {
 					// need to save parent directories as well
-					FTSENT *pent = ent->fts_parent;
-					
 					// while we have a valid path that is below the prefix
-					while (pent && pent->fts_level > 0) {
-						File* parent = FileFactory(rollback, pent);
+					for (short level = job->level - 1; level > 0; level--) {
+						File* dir = dirs[level];
+						File* parent = NULL;
+						if (dir) parent = FileFactory(0, rollback, FILE_INFO_NONE, 
+													  dir->path(), dir->mode(), 
+													  dir->uid(), dir->gid(), 
+													  dir->size(), NULL);
 						
 						// if parent dir does not exist, we are
 						//  generating a rollback of base system
@@ -606,7 +832,7 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 							if (!dryrun) res = this->insert(rollback, parent);
 						}
 						assert(res == 0);
-						pent = pent->fts_parent;
+						delete parent;
 					}
 				}
 			}
@@ -614,12 +840,67 @@ int Depot::analyze_stage(const char* path, Archive* archive, Archive* rollback,
 			fprintf(stdout, "%c %s\n", state, file->path());
 			if (!dryrun) res = this->insert(archive, file);
 			assert(res == 0);
-			if (preceding && preceding != actual) delete preceding;
-			if (actual) delete actual;
-			free(actpath);
-			delete file;
+
+			// a plan being written records the decision, one being
+			// applied checks it against what was recorded
+			if (m_plan && m_plan->is_writing()) {
+				res = m_plan->record(file, actual, state);
+			} else if (m_plan) {
+				m_plan->check(file, actual, state);
+			}
+			reused += job->reused;
+
+			// remember directories until their children have been analyzed
+			if (S_ISDIR(file->mode())) {
+				if (job->level >= dirs_max) {
+					short new_max = job->level * 2;
+					File** grown = (File**)realloc(dirs, new_max * sizeof(File*));
+					if (!grown) {
+						fprintf(stderr, "Error: ran out of memory in Depot::analyze_stage\n");
+						res = DEPOT_ERROR;
+						break;
+					}
+					memset(grown + dirs_max, 0, (new_max - dirs_max) * sizeof(File*));
+					dirs = grown;
+					dirs_max = new_max;
+				}
+				if (dirs[job->level]) delete dirs[job->level];
+				dirs[job->level] = file;
+				job->file = NULL;
+			}
 		}
+		delete job;
+		job = NULL;
+	}
+
+	// stop the workers and free whatever they had not finished
+	if (job) delete job;
+	queue->cancel();
+	while ((job = (AnalyzeJob*)queue->pop()) != NULL) {
+		delete job;
+	}
+	delete queue;
+	if (verbosity) {
+		fprintf(stdout, "Looked up the preceding files of %u paths\n", lookups);
 	}
+	if (m_plan && verbosity) {
+		fprintf(stdout, "Reused %u digests of live files from the plan\n", reused);
+	}
+	if (res == 0 && m_plan && !m_plan->is_writing() && m_plan->differences()) {
+		if (force) {
+			fprintf(stderr, "Warning: %u paths are not installed as planned in %s.\n",
+					m_plan->differences(), m_plan->path());
+		} else {
+			fprintf(stderr, "Error: %u paths would not be installed as planned in %s. "
+					"Make a new plan, or use -f to install anyway.\n", 
+					m_plan->differences(), m_plan->path());
+			res = DEPOT_ERROR;
+		}
+	}
+	for (short level = 0; level < dirs_max; level++) {
+		if (dirs[level]) delete dirs[level];
+	}
+	free(dirs);
 	if (fts) fts_close(fts);
 	return res;
 }
@@ -630,6 +911,37 @@ int Depot::backup_file(File* file, void* ctx) {
 
 	IF_DEBUG("[backup] backup_file: %s , %s \n", file->path(), context->archive->m_name);
 
+	if (context->journal && context->journal->is_done(JOURNAL_BACKUP, file)) {
+		IF_DEBUG("[backup] already backed up before the install was interrupted\n");
+		return 0;
+	}
+
+	if (INFO_TEST(file->info(), FILE_INFO_ROLLBACK_DATA) && context->depot->m_objects) {
+		// the rollback archive is only a set of references to objects,
+		// so there is no backing store directory to fill
+		char* path;
+		join_path(&path, context->depot->m_prefix, file->path());
+		++context->files_modified;
+
+		int method;
+		off_t size;
+		// never linked: the live file can still be modified in place
+		// after a failed install, and the object would change with it
+		res = context->depot->m_objects->store(file, path, false, &method, &size);
+		if (res == 0 && method != -1) {
+			context->backup_bytes[method] += size;
+			++context->objects_stored;
+		} else if (res == 0 && ObjectStore::has_data(file)) {
+			++context->objects_present;
+		}
+		if (res == 0 && context->journal) res = context->journal->record(JOURNAL_BACKUP, file);
+
+		// store() fails if the file changed after it was digested, which
+		// iterate_files() hands back so the install is rolled back
+		free(path);
+		return res;
+	}
+
 	if (INFO_TEST(file->info(), FILE_INFO_ROLLBACK_DATA)) {
 		char *path;        // the file's path
 		char *dstpath;     // the path inside the archives
@@ -690,11 +1002,16 @@ int Depot::backup_file(File* file, void* ctx) {
 		++context->files_modified;
 
 		// XXX: res = file->backup()
-		IF_DEBUG("[backup] copyfile(%s, %s)\n", path, dstpath);
-		res = copyfile(path, dstpath, NULL, COPYFILE_ALL|COPYFILE_NOFOLLOW);
+		// analyze_stage only asks for rollback data when the file is
+		// about to be installed over, which renames or unlinks it
+		int method;
+		off_t size;
+		res = backup_data(path, dstpath, true, &method, &size);
 
 		if (res != 0) fprintf(stderr, "%s:%d: backup failed: %s: %s (%d)\n", 
 							  __FILE__, __LINE__, dstpath, strerror(errno), errno);
+		if (res == 0) context->backup_bytes[method] += size;
+		if (res == 0 && context->journal) res = context->journal->record(JOURNAL_BACKUP, file);
 
 		// XXX: we cant propagate error from callback, but its safe to die here
 		assert(res == 0);
@@ -711,24 +1028,91 @@ int Depot::backup_file(File* file, void* ctx) {
 int Depot::install_file(File* file, void* ctx) {
 	InstallContext* context = (InstallContext*)ctx;
 	int res = 0;
+	bool written = false;
 
-	// Strip the quarantine xattr off all files to avoid them being rendered useless.
-	if (file->unquarantine(context->depot->m_archives_path) != 0) {
-		fprintf(stderr, "Error: unable to unquarantine file in staging area.\n");
-		return DEPOT_ERROR;
+	if (context->journal && context->journal->is_done(JOURNAL_INSTALL, file)) {
+		// its stat was rolled back with the transaction, and is not
+		// recorded again since the file may have changed since
+		IF_DEBUG("[install] %s already installed before the install was interrupted\n",
+				 file->path());
+	} else {
+		// Strip the quarantine xattr off all files to avoid them being rendered useless.
+		if (file->unquarantine(context->depot->m_archives_path) != 0) {
+			fprintf(stderr, "Error: unable to unquarantine file in staging area.\n");
+			return DEPOT_ERROR;
+		}
+
+		if (INFO_TEST(file->info(), FILE_INFO_INSTALL_DATA)) {
+			++context->files_modified;
+
+			res = file->install(context->depot->m_archives_path,
+			                    context->depot->m_prefix,
+			                    context->reverse_files);
+			written = (res == 0);
+		} else {
+			res = file->install_info(context->depot->m_prefix);
+		}
+		if (res != 0) fprintf(stderr, "%s:%d: install failed: %s: %s (%d)\n", 
+							  __FILE__, __LINE__, file->path(), strerror(errno), errno);
+		if (res == 0 && context->journal) res = context->journal->record(JOURNAL_INSTALL, file);
 	}
 
-	if (INFO_TEST(file->info(), FILE_INFO_INSTALL_DATA)) {
-		++context->files_modified;
+	// Record what the installed file looks like, so later commands can
+	// trust its digest instead of reading it again.  Only data written
+	// here is known to match the digest; a file left in place may have
+	// changed since it was analyzed.
+	if (res == 0 && written && file->digest()) {
+		char* dstpath;
+		struct stat sb;
+		join_path(&dstpath, context->depot->m_prefix, file->path());
+		if (lstat(dstpath, &sb) == 0) {
+			file->stat_set(&sb);
+			res = context->depot->m_db->update_file_stat(file);
+		}
+		free(dstpath);
+	}
+	return res;
+}
 
-		res = file->install(context->depot->m_archives_path,
-                        context->depot->m_prefix,
-                        context->reverse_files);
-	} else {
-		res = file->install_info(context->depot->m_prefix);
+int Depot::store_file(File* file, void* ctx) {
+	InstallContext* context = (InstallContext*)ctx;
+	int res = 0;
+	if (!ObjectStore::has_data(file)) return 0;
+
+	char* dirpath = context->archive->directory_name(context->depot->m_archives_path);
+	char* srcpath;
+	join_path(&srcpath, dirpath, file->path());
+
+	int method;
+	off_t size;
+	res = context->depot->m_objects->store(file, srcpath, context->link_objects, 
+										   &method, &size);
+	if (res == 0 && method != -1) {
+		++context->objects_stored;
+	} else if (res == 0) {
+		++context->objects_present;
 	}
-	if (res != 0) fprintf(stderr, "%s:%d: install failed: %s: %s (%d)\n", 
-						  __FILE__, __LINE__, file->path(), strerror(errno), errno);
+
+	free(srcpath);
+	free(dirpath);
+	return res;
+}
+
+int Depot::restore_file(File* file, void* ctx) {
+	InstallContext* context = (InstallContext*)ctx;
+	const char* path = file->path();
+	size_t len = strlen(context->subtree);
+	if (strncmp(path, context->subtree, len) != 0 ||
+		(path[len] != 0 && path[len] != '/')) {
+		return 0;
+	}
+
+	char* dirpath = context->archive->directory_name(context->depot->m_archives_path);
+	char* dstpath;
+	join_path(&dstpath, dirpath, path);
+	int res = context->depot->m_objects->restore(file, dstpath);
+	free(dstpath);
+	free(dirpath);
 	return res;
 }
 
@@ -771,8 +1155,38 @@ int Depot::install(const char* path) {
 }
 
 
+int Depot::plan(const char* path, const char* plan_path) {
+	Plan* plan = new Plan(plan_path);
+	int res = plan->create(path);
+	if (res == 0) {
+		m_plan = plan;
+		res = this->install(plan->root());
+		m_plan = NULL;
+	}
+	if (plan->finish(res == 0) && res == 0) res = DEPOT_ERROR;
+	if (res == 0) fprintf(stdout, "Planned %u paths in %s\n", plan->count(), plan_path);
+	delete plan;
+	return res;
+}
+
+int Depot::apply(const char* plan_path) {
+	Plan* plan = new Plan(plan_path);
+	int res = plan->load();
+	if (res == 0) {
+		m_plan = plan;
+		res = this->install(plan->root());
+		m_plan = NULL;
+	} else {
+		res = DEPOT_ERROR;
+	}
+	delete plan;
+	return res;
+}
+
 int Depot::install(Archive* archive) {
 	extern uint32_t dryrun;
+	extern uint32_t verbosity;
+	extern uint32_t compress_codec;
 	int res = 0;
 	Archive* rollback = new RollbackArchive();
 
@@ -780,6 +1194,8 @@ int Depot::install(Archive* archive) {
 		rollback->m_build = strdup(this->m_build);
 		archive->m_build = strdup(this->m_build);
 	}
+	rollback->m_codec = compress_codec;
+	archive->m_codec = compress_codec;
 	
 	assert(rollback != NULL);
 	assert(archive != NULL);
@@ -789,6 +1205,8 @@ int Depot::install(Archive* archive) {
 	//
 	// The fun starts here
 	//
+	uint64_t started = Stats::now();
+	uint64_t mark = STATS_START();
 	if (!dryrun && res == 0) res = this->begin_transaction();	
 
 	//
@@ -807,14 +1225,18 @@ int Depot::install(Archive* archive) {
 	char* rollback_path = rollback->create_directory(m_archives_path);
 	assert(rollback_path != NULL);
 
+	STATS_PHASE("install.prepare", &mark);
+
 	// Extract the archive into its backing store directory
 	if (res == 0) res = archive->extract(archive_path);
+	STATS_PHASE("install.extract", &mark);
 
 	// Analyze the files in the archive backing store directory
 	// Inserts new file records into the database for both the new archive being
 	// installed and the rollback archive.
 	int rollback_files = 0;
 	if (res == 0) res = this->analyze_stage(archive_path, archive, rollback, &rollback_files);
+	STATS_PHASE("install.analyze", &mark);
 	
 	// we can stop now if analyze failed or this is a dry run
 	if (res || dryrun) {
@@ -834,6 +1256,12 @@ int Depot::install(Archive* archive) {
 		res = this->remove(rollback);
 	}
 
+	// The totals list -l shows are known now, except for the duration.
+	if (res == 0 && rollback_files) res = this->m_db->insert_archive_stats(rollback, NULL);
+	if (res == 0) {
+		res = this->m_db->insert_archive_stats(archive, rollback_files ? rollback : NULL);
+	}
+
 	// Commit the archive and its list of files to the database.
 	// Note that the archive's "active" flag is still not set.
 	if (res == 0) {
@@ -841,29 +1269,98 @@ int Depot::install(Archive* archive) {
 	} else {
 		this->rollback_transaction();
 	}
+	STATS_PHASE("install.commit", &mark);
+
+	// From here on the install can be resumed, so keep track of its progress.
+	Journal* journal = NULL;
+	if (res == 0) {
+		journal = new Journal(m_archives_path, archive);
+		res = journal->open();
+		if (res == 0) res = journal->set_rollback(rollback_files ? rollback->serial() : 0);
+	}
 
 	// Save a copy of the backing store directory now, we will soon
 	// be moving the files into place.
-	if (res == 0) res = archive->compact_directory(m_archives_path);
+	if (res == 0 && m_objects) {
+		InstallContext store_context(this, archive);
+		res = this->iterate_files(archive, &Depot::store_file, &store_context);
+		if (res == 0 && verbosity) {
+			fprintf(stdout, "Stored %llu new objects, %llu already present\n",
+					store_context.objects_stored, store_context.objects_present);
+		}
+	} else if (res == 0) {
+		res = archive->compact_directory(m_archives_path);
+	}
+	if (res == 0) res = journal->set_phase(JOURNAL_STAGED);
+	STATS_PHASE("install.store", &mark);
+
+	if (res == 0) res = this->finish_install(archive, rollback_files ? rollback : NULL, 
+											 journal, started);
+	if (journal) delete journal;
+	mark = STATS_START();
+
+	// Remove the stage and rollback directories (save disk space)
+	remove_directory(archive_path);
+	remove_directory(rollback_path);
+	free(rollback_path);
+	free(archive_path);
+	STATS_PHASE("install.cleanup", &mark);
+
+	return res;
+}
+
+int Depot::finish_install(Archive* archive, Archive* rollback, Journal* journal,
+						  uint64_t started) {
+	extern uint32_t verbosity;
+	int res = 0;
+	uint64_t mark = STATS_START();
 
 	//
 	// Move files from the root file system to the rollback archive's backing store,
 	// then move files from the archive backing directory to the root filesystem
 	//
-	InstallContext rollback_context(this, rollback);
-	if (res == 0) res = this->iterate_files(rollback, &Depot::backup_file, &rollback_context);
+	if (rollback && journal->phase() < JOURNAL_BACKED_UP) {
+		InstallContext rollback_context(this, rollback);
+		rollback_context.journal = journal;
+		res = this->iterate_files(rollback, &Depot::backup_file, &rollback_context);
+		if (res == 0 && verbosity && rollback_context.files_modified > 0) {
+			fprintf(stdout, "Backed up %llu files: %llu bytes cloned, %llu bytes linked, "
+					"%llu bytes copied\n", rollback_context.files_modified,
+					rollback_context.backup_bytes[BACKUP_CLONED],
+					rollback_context.backup_bytes[BACKUP_LINKED],
+					rollback_context.backup_bytes[BACKUP_COPIED]);
+		}
+		if (res == 0 && verbosity && m_objects && rollback_context.files_modified > 0) {
+			fprintf(stdout, "Stored %llu new rollback objects, %llu already present\n",
+					rollback_context.objects_stored, rollback_context.objects_present);
+		}
 
-	// compact the rollback archive (if we actually added any files)
-	if (rollback_context.files_modified > 0) {
-		if (res == 0) res = rollback->compact_directory(m_archives_path);
+		// compact the rollback archive (if we actually added any files)
+		if (!m_objects && (rollback_context.files_modified > 0 ||
+						   journal->count(JOURNAL_BACKUP) > 0)) {
+			if (res == 0) res = rollback->compact_directory(m_archives_path);
+		}
+		STATS_PHASE("install.backup", &mark);
 	}
 
-	InstallContext install_context(this, archive);
-	if (res == 0) res = this->iterate_files(archive, &Depot::install_file, &install_context);
+	// Synced before any file is moved into place, so an uninstall that
+	// finds this phase undoes every file of the archive.
+	if (res == 0 && journal->phase() < JOURNAL_BACKED_UP) {
+		res = journal->set_phase(JOURNAL_BACKED_UP);
+	}
 
-	// Installation is complete.  Activate the archive in the database.
+	// The stat of each installed file is committed along with the activation.
+	InstallContext install_context(this, archive);
+	install_context.journal = journal;
 	if (res == 0) res = this->begin_transaction();
 	if (res == 0) {
+		res = this->iterate_files(archive, &Depot::install_file, &install_context);
+		if (res) this->rollback_transaction();
+	}
+	STATS_PHASE("install.files", &mark);
+
+	// Installation is complete.  Activate the archive in the database.
+	if (res == 0 && rollback) {
 		res = this->m_db->activate_archive(rollback->serial());
 		if (res) this->rollback_transaction();
 	}
@@ -871,17 +1368,80 @@ int Depot::install(Archive* archive) {
 		res = this->m_db->activate_archive(archive->serial());
 		if (res) this->rollback_transaction();
 	}
+	if (res == 0) {
+		res = this->m_db->set_archive_duration(archive->serial(), 
+											   (Stats::now() - started) / 1000000);
+		if (res) this->rollback_transaction();
+	}
 	if (res == 0) res = this->commit_transaction();
 
-	// Remove the stage and rollback directories (save disk space)
-	remove_directory(archive_path);
-	remove_directory(rollback_path);
-	free(rollback_path);
-	free(archive_path);
+	// An active archive has nothing left to resume or undo.
+	if (res == 0) res = journal->remove();
+	STATS_PHASE("install.activate", &mark);
 
 	return res;
 }
 
+int Depot::resume(Archive* archive) {
+	extern uint32_t dryrun;
+	int res = 0;
+	uint64_t started = Stats::now();
+
+	if (!Journal::exists(m_archives_path, archive)) {
+		fprintf(stderr, "Error: archive %llu %s has no interrupted install to resume.\n",
+				archive->serial(), archive->name());
+		return DEPOT_ERROR;
+	}
+
+	Journal journal(m_archives_path, archive);
+	res = journal.load();
+	if (res == 0 && journal.phase() < JOURNAL_STAGED) {
+		fprintf(stderr, "Error: the install of %s was interrupted before its data was "
+				"saved. Uninstall it and install it again.\n", archive->name());
+		return DEPOT_ERROR;
+	}
+
+	Archive* rollback = NULL;
+	if (res == 0 && journal.rollback_serial()) {
+		rollback = this->archive(journal.rollback_serial());
+		if (!rollback) {
+			fprintf(stderr, "Error: unable to find the rollback archive of %s.\n", 
+					archive->name());
+			res = DEPOT_ERROR;
+		}
+	}
+	if (res != 0 || dryrun) {
+		delete rollback;
+		return res;
+	}
+
+	// Rollback data is only kept in the backing store directory until the
+	// rollback archive is compacted, so if that directory has been pruned
+	// the backups have to be made again.
+	char* archive_path = archive->directory_name(m_archives_path);
+	char* rollback_path = rollback ? rollback->directory_name(m_archives_path) : NULL;
+	if (rollback && !m_objects && journal.phase() < JOURNAL_BACKED_UP &&
+		!is_directory(rollback_path)) {
+		IF_DEBUG("[resume] rollback directory is gone, backing up again\n");
+		journal.forget(JOURNAL_BACKUP);
+	}
+
+	// Files missing from the archive's backing store directory are
+	// restored from its compacted data as they are installed.
+	res = journal.open();
+	if (res == 0) res = this->finish_install(archive, rollback, &journal, started);
+
+	if (res == 0) {
+		remove_directory(archive_path);
+		if (rollback_path) remove_directory(rollback_path);
+		fprintf(stdout, "Resumed archive: %llu %s \n", archive->serial(), archive->name());
+	}
+	free(archive_path);
+	free(rollback_path);
+	delete rollback;
+	return res;
+}
+
 // deletes expanded backing store directories in m_archives_path
 int Depot::prune_directories() {
 	int res = 0;
@@ -892,7 +1452,7 @@ int Depot::prune_directories() {
 	FTSENT* ent = fts_read(fts); // get the entry for m_archives_path itself
 	ent = fts_children(fts, 0);
 	while (res != -1 && ent != NULL) {
-		if (ent->fts_info == FTS_D) {
+		if (ent->fts_info == FTS_D && strcmp(ent->fts_name, "objects") != 0) {
 			char path[PATH_MAX];
 			snprintf(path, PATH_MAX, "%s/%s", m_archives_path, ent->fts_name);
 			res = remove_directory(path);
@@ -905,6 +1465,10 @@ int Depot::prune_directories() {
 
 // delete the unexpanded tarball from archives storage
 int Depot::prune_archive(Archive* archive) {
+	return this->prune_archives(&archive, 1);
+}
+
+int Depot::prune_archives(Archive** archives, uint32_t count) {
 	int res = 0;
 	
 	// clean up database
@@ -915,10 +1479,62 @@ int Depot::prune_archive(Archive* archive) {
 	}
 	
 	// clean up disk
-	res = archive->prune_compacted_archive(m_archives_path);
+	for (uint32_t i = 0; res == 0 && i < count; i++) {
+		res = archives[i]->prune_compacted_archive(m_archives_path);
+	}
+	if (res == 0 && m_objects) res = this->prune_objects();
 	return res;
 }
 
+int Depot::prune_objects() {
+	extern uint32_t verbosity;
+	uint8_t** digests;
+	uint32_t count;
+	int res = this->m_db->get_file_digests(&digests, &count);
+	if (res & DB_ERROR) {
+		fprintf(stderr, "Error: unable to get file digests from database.\n");
+		return res;
+	}
+
+	// an object is referenced while any file, installed or
+	// rollback, has its digest
+	PathIndex referenced;
+	SHA1Digest digest;
+	digest.m_size = CC_SHA1_DIGEST_LENGTH;
+	for (uint32_t i = 0; i < count; i++) {
+		if (!digests[i]) continue;
+		memcpy(digest.m_data, digests[i], CC_SHA1_DIGEST_LENGTH);
+		char* hex = digest.string();
+		referenced.set(hex, digests[i]);
+		free(hex);
+	}
+
+	uint32_t removed = 0;
+	res = m_objects->prune(&referenced, &removed);
+	if (res == 0 && verbosity && removed) {
+		fprintf(stdout, "Removed %u unreferenced objects\n", removed);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		free(digests[i]);
+	}
+	free(digests);
+	return res;
+}
+
+int Depot::expand_objects(File* directory) {
+	Archive* archive = directory->archive();
+
+	// archives that have not been migrated are expanded from their
+	// pack or tarball by Directory::dirrename()
+	if (archive->is_compacted(m_archives_path)) return 0;
+
+	IF_DEBUG("[objects] restoring %s for directory rename\n", directory->path());
+	InstallContext context(this, archive);
+	context.subtree = directory->path();
+	return this->iterate_files(archive, &Depot::restore_file, &context);
+}
+
 int Depot::uninstall_file(File* file, void* ctx) {
 	extern uint32_t dryrun;
 	InstallContext* context = (InstallContext*)ctx;
@@ -933,79 +1549,129 @@ int Depot::uninstall_file(File* file, void* ctx) {
 		return DEPOT_OK;
 	}
 	
+	// every file recorded at this path, newest archive first
+	uint8_t** filelist = NULL;
+	uint32_t count = 0;
+	res = context->depot->m_db->get_files_at_path(&filelist, &count, file->path());
+	if (!FOUND(res)) {
+		fprintf(stderr, "Error: unable to load files at %s\n", file->path());
+		free(filelist);
+		return DEPOT_ERROR;
+	}
+	res = 0;
+	File** chain = (File**)calloc(count, sizeof(File*));
+	if (!chain) {
+		fprintf(stderr, "Error: ran out of memory in Depot::uninstall_file\n");
+		for (uint32_t i = 0; i < count; i++) context->depot->m_db->free_file(filelist[i]);
+		free(filelist);
+		return DEPOT_ERROR;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		chain[i] = context->depot->m_db->make_file(filelist[i]);
+		if (!chain[i]) {
+			fprintf(stderr, "%s:%d: DB::make_file returned NULL\n", __FILE__, __LINE__);
+			res = -1;
+		}
+	}
+	free(filelist);
+	File* newest = chain[0];
+
 	char* actpath;
 	join_path(&actpath, context->depot->m_prefix, file->path());
 	IF_DEBUG("[uninstall] actual path is %s\n", actpath);
-	File* actual = FileFactory(actpath);
-	uint32_t flags = File::compare(file, actual);
+	File* actual = FileFactory(actpath, file);
+	uint32_t flags = 0;
+	if (res == 0) flags = File::compare(newest, actual);
 	
-	if (actual == NULL) {
+	if (res != 0) {
+		// make_file failed, leave the path alone
+	} else if (actual == NULL) {
 		IF_DEBUG("[uninstall]    actual file missing, "
 				 "possibly due to parent being removed already\n");
 		state = '!';
+	} else if (!context->uninstalling->contains(newest->archive()->serial())) {
+		IF_DEBUG("[uninstall]    in use by newer installation; leaving in place\n");
 	} else if (flags != FILE_INFO_IDENTICAL) {
 		IF_DEBUG("[uninstall]    changes since install; skipping\n");
 	} else {
-		File* superseded = context->depot->file_superseded_by(file);
-		if (superseded == NULL) {
-			// no one's using this file anymore
-			File* preceding = context->depot->file_preceded_by(file);
-			assert(preceding != NULL);
-			if (INFO_TEST(preceding->info(), FILE_INFO_NO_ENTRY)) {
-				context->depot->m_is_dirty = true;
-				state = 'R';
-				IF_DEBUG("[uninstall]    removing file\n");
-				if (!dryrun && actual && res == 0) res = actual->remove();
-			} else {
-				// copy the preceding file back out to the system
-				// if it's different from what's already there
-				uint32_t flags = File::compare(file, preceding);
-				if (INFO_TEST(flags, FILE_INFO_DATA_DIFFERS)) {
-					context->depot->m_is_dirty = true;
-					state = 'U';
-					IF_DEBUG("[uninstall]    restoring\n");
-					if (!dryrun && res == 0) {
-						if (INFO_TEST(flags, FILE_INFO_TYPE_DIFFERS) &&
-							S_ISDIR(preceding->mode())) {
-							// use rename instead of mkdir so children are restored
-							res = preceding->dirrename(context->depot->m_archives_path, 
-													               context->depot->m_prefix,
-                                         context->reverse_files);							
-
-						} else {
-							res = preceding->install(context->depot->m_archives_path, 
-													             context->depot->m_prefix,
-                                       context->reverse_files);
-						}
-					}
-				} else if (INFO_TEST(flags, FILE_INFO_MODE_DIFFERS) ||
-					   INFO_TEST(flags, FILE_INFO_GID_DIFFERS) ||
-					   INFO_TEST(flags, FILE_INFO_UID_DIFFERS)) {
-					context->depot->m_is_dirty = true;
-					state = 'M';
-					if (!dryrun && res == 0) {
-						res = preceding->install_info(context->depot->m_prefix);
-					}
-				} else {
-					IF_DEBUG("[uninstall]    no changes; leaving in place\n");
-				}
-				if (!context->depot->m_modified_extensions &&
-					(strncmp(file->path(), "/System/Library/Extensions", 26) == 0)) {
-					IF_DEBUG("[uninstall]    kernel extension detected\n");
-					context->depot->m_modified_extensions = true;
-				}
+		// Walk down from the newest file the way uninstalling each archive
+		// in turn would, without putting the intermediate files in place.
+		// Rollback data is spent once the file it was saved for is gone.
+		// The next uninstalled archive then finds that data in place, and
+		// only goes on if it is the file that archive installed; otherwise
+		// the user changed the file in between and it is left alone.
+		File* preceding = NULL;
+		uint32_t i = 0;
+		while (i < count && context->uninstalling->contains(chain[i]->archive()->serial())) {
+			if (i + 1 == count) {
+				// the oldest record at this path is being uninstalled
+				preceding = NULL;
+				break;
 			}
+			preceding = chain[i + 1];
 			uint64_t info = preceding->info();
 			if (INFO_TEST(info, FILE_INFO_NO_ENTRY | FILE_INFO_ROLLBACK_DATA) &&
 			    !INFO_TEST(info, FILE_INFO_BASE_SYSTEM)) {
-				if (!dryrun && res == 0) {
-					res = context->files_to_remove->add(preceding->serial());
+				if (!dryrun) context->files_to_remove->add(preceding->serial());
+				if (i + 2 < count &&
+				    context->uninstalling->contains(chain[i + 2]->archive()->serial()) &&
+				    File::compare(chain[i + 2], preceding) != FILE_INFO_IDENTICAL) {
+					break;
 				}
+				i += 2;
+			} else {
+				i += 1;
 			}
-			delete preceding;
+		}
+		
+		if (preceding == NULL) {
+			IF_DEBUG("[uninstall]    no preceding file; leaving in place\n");
+		} else if (INFO_TEST(preceding->info(), FILE_INFO_NO_ENTRY)) {
+			context->depot->m_is_dirty = true;
+			state = 'R';
+			IF_DEBUG("[uninstall]    removing file\n");
+			if (!dryrun && actual && res == 0) res = actual->remove();
 		} else {
-			IF_DEBUG("[uninstall]    in use by newer installation; leaving in place\n");
-			delete superseded;
+			// copy the preceding file back out to the system
+			// if it's different from what's already there
+			uint32_t flags = File::compare(newest, preceding);
+			if (INFO_TEST(flags, FILE_INFO_DATA_DIFFERS)) {
+				context->depot->m_is_dirty = true;
+				state = 'U';
+				IF_DEBUG("[uninstall]    restoring\n");
+				if (!dryrun && res == 0) {
+					if (INFO_TEST(flags, FILE_INFO_TYPE_DIFFERS) &&
+						S_ISDIR(preceding->mode())) {
+						// use rename instead of mkdir so children are restored
+						if (context->depot->m_objects) {
+							res = context->depot->expand_objects(preceding);
+						}
+						if (res == 0) res = preceding->dirrename(context->depot->m_archives_path, 
+												               context->depot->m_prefix,
+                                     context->reverse_files);							
+
+					} else {
+						res = preceding->install(context->depot->m_archives_path, 
+												             context->depot->m_prefix,
+                                   context->reverse_files);
+					}
+				}
+			} else if (INFO_TEST(flags, FILE_INFO_MODE_DIFFERS) ||
+				   INFO_TEST(flags, FILE_INFO_GID_DIFFERS) ||
+				   INFO_TEST(flags, FILE_INFO_UID_DIFFERS)) {
+				context->depot->m_is_dirty = true;
+				state = 'M';
+				if (!dryrun && res == 0) {
+					res = preceding->install_info(context->depot->m_prefix);
+				}
+			} else {
+				IF_DEBUG("[uninstall]    no changes; leaving in place\n");
+			}
+			if (!context->depot->m_modified_extensions &&
+				(strncmp(file->path(), "/System/Library/Extensions", 26) == 0)) {
+				IF_DEBUG("[uninstall]    kernel extension detected\n");
+				context->depot->m_modified_extensions = true;
+			}
 		}
 	}
 
@@ -1014,55 +1680,101 @@ int Depot::uninstall_file(File* file, void* ctx) {
 	if (res != 0) fprintf(stderr, "%s:%d: uninstall failed: %s\n", 
 						  __FILE__, __LINE__, file->path());
 
+	for (uint32_t i = 0; i < count; i++) delete chain[i];
+	free(chain);
+	delete actual;
 	free(actpath);
 	return res;
 }
 
+static int compare_paths_reverse(const void* a, const void* b) {
+	return strcmp((*(File**)b)->path(), (*(File**)a)->path());
+}
+
 int Depot::uninstall(Archive* archive) {
+	return this->uninstall(&archive, 1);
+}
+
+int Depot::uninstall(Archive** archives, uint32_t count) {
 	extern uint32_t verbosity;
 	extern uint32_t force;
 	extern uint32_t dryrun;
 	int res = 0;
 
-	assert(archive != NULL);
-	uint64_t serial = archive->serial();
+	Archive** list = (Archive**)malloc(sizeof(Archive*) * (count ? count : 1));
+	SerialSet* uninstalling = new SerialSet();
+	if (!list) {
+		fprintf(stderr, "Error: ran out of memory in Depot::uninstall\n");
+		delete uninstalling;
+		return DEPOT_ERROR;
+	}
+	uint32_t n = 0;
+	for (uint32_t i = 0; res == 0 && i < count; i++) {
+		Archive* archive = archives[i];
+		assert(archive != NULL);
+
+		if (INFO_TEST(archive->info(), ARCHIVE_INFO_ROLLBACK)) {
+			// if in debug mode, get_all_archives returns rollbacks too, so just ignore
+			if (verbosity & VERBOSE_DEBUG) {
+				fprintf(stderr, "[uninstall] skipping uninstall since archive is a rollback.\n");
+				continue;
+			}
+			fprintf(stderr, "%s:%d: cannot uninstall a rollback archive.\n", __FILE__, __LINE__);
+			res = DEPOT_ERROR;
+			break;
+		}
 
-	if (INFO_TEST(archive->info(), ARCHIVE_INFO_ROLLBACK)) {
-		// if in debug mode, get_all_archives returns rollbacks too, so just ignore
-		if (verbosity & VERBOSE_DEBUG) {
-			fprintf(stderr, "[uninstall] skipping uninstall since archive is a rollback.\n");
-			return DEPOT_OK;
+		/** 
+		 * require -f to force uninstalling an archive installed on top of an older
+		 * base system since the rollback archive we'll use will potentially damage
+		 * the base system.
+		 */
+		if (!force && 
+			this->m_build &&
+			archive->build() &&
+			(strcmp(this->m_build, archive->build()) != 0) &&
+			!this->is_superseded(archive)
+			) {
+			fprintf(stderr, 
+					"-------------------------------------------------------------------------------\n"
+					"The %s root was installed on a different base OS build (%s). The current    \n"
+					"OS build is %s. Uninstalling a root that was installed on a different OS     \n"
+					"build has the potential to damage your OS install due to the fact that the   \n"
+					"rollback data is from the wrong OS version.\n\n"
+					" You must use the force (-f) option to make this potentially unsafe operation  \n"
+					"happen.\n"
+					"-------------------------------------------------------------------------------\n",
+					archive->name(), archive->build(), m_build);
+			res = DEPOT_BUILD_MISMATCH;
+			break;
 		}
-		fprintf(stderr, "%s:%d: cannot uninstall a rollback archive.\n", __FILE__, __LINE__);
-		return DEPOT_ERROR;
+
+		list[n++] = archive;
+		uninstalling->add(archive->serial());
 	}
 
-	/** 
-	 * require -f to force uninstalling an archive installed on top of an older
-	 * base system since the rollback archive we'll use will potentially damage
-	 * the base system.
-	 */
-	if (!force && 
-		this->m_build &&
-		archive->build() &&
-		(strcmp(this->m_build, archive->build()) != 0) &&
-		!this->is_superseded(archive)
-		) {
-		fprintf(stderr, 
-				"-------------------------------------------------------------------------------\n"
-				"The %s root was installed on a different base OS build (%s). The current    \n"
-				"OS build is %s. Uninstalling a root that was installed on a different OS     \n"
-				"build has the potential to damage your OS install due to the fact that the   \n"
-				"rollback data is from the wrong OS version.\n\n"
-				" You must use the force (-f) option to make this potentially unsafe operation  \n"
-				"happen.\n"
-				"-------------------------------------------------------------------------------\n",
-				archive->name(), archive->build(), m_build);
-		return DEPOT_BUILD_MISMATCH;
+	// An interrupted install that never got to move files into place
+	// only needs its records removed.
+	Journal** journals = (Journal**)calloc(n ? n : 1, sizeof(Journal*));
+	if (!journals) {
+		fprintf(stderr, "Error: ran out of memory in Depot::uninstall\n");
+		res = DEPOT_ERROR;
+	}
+	for (uint32_t i = 0; res == 0 && i < n; i++) {
+		if (!Journal::exists(m_archives_path, list[i])) continue;
+		journals[i] = new Journal(m_archives_path, list[i]);
+		res = journals[i]->load();
 	}
 
-	if (res != 0) return res;
+	if (res != 0 || n == 0) {
+		for (uint32_t i = 0; journals && i < n; i++) delete journals[i];
+		free(journals);
+		free(list);
+		delete uninstalling;
+		return res;
+	}
 
+	uint64_t mark = STATS_START();
 	if (!dryrun) {
 		// XXX: this may be superfluous
 		// uninstall_file should be smart enough to do a mtime check...
@@ -1070,13 +1782,60 @@ int Depot::uninstall(Archive* archive) {
 
 		// We do this here to get an exclusive lock on the database.
 		if (res == 0) res = this->begin_transaction();
-		if (res == 0) res = m_db->deactivate_archive(serial);
+		for (uint32_t i = 0; res == 0 && i < n; i++) {
+			res = m_db->deactivate_archive(list[i]->serial());
+		}
 		if (res == 0) res = this->commit_transaction();
 	}
+	STATS_PHASE("uninstall.deactivate", &mark);
 	
-	InstallContext context(this, archive);
-	context.reverse_files = true; // uninstall children before parents
-	if (res == 0) res = this->iterate_files(archive, &Depot::uninstall_file, &context);
+	// gather every path the archives touch, once each
+	uint32_t files_max = INITIAL_ROWS;
+	uint32_t files_count = 0;
+	File** files = (File**)malloc(sizeof(File*) * files_max);
+	PathIndex* seen = new PathIndex();
+	if (!files) {
+		fprintf(stderr, "Error: ran out of memory in Depot::uninstall\n");
+		res = DEPOT_ERROR;
+	}
+	for (uint32_t i = 0; res == 0 && i < n; i++) {
+		// no file of it was moved into place
+		if (journals[i] && journals[i]->phase() < JOURNAL_BACKED_UP) continue;
+		Query* archive_files = this->m_db->begin_files(list[i], true);
+		File* file;
+		int found = this->m_db->next_file(archive_files, &file, false);
+		for (; FOUND(found); found = this->m_db->next_file(archive_files, &file, false)) {
+			if (seen->get(file->path())) {
+				delete file;
+				continue;
+			}
+			if (files_count == files_max) {
+				files_max *= REALLOC_FACTOR;
+				files = (File**)realloc(files, sizeof(File*) * files_max);
+				assert(files != NULL);
+			}
+			seen->set(file->path(), file);
+			files[files_count++] = file;
+		}
+		if (found & DB_ERROR) {
+			fprintf(stderr, "Error: unable to load files of archive %s\n", list[i]->name());
+			res = DEPOT_ERROR;
+		}
+	}
+	delete seen;
+	STATS_PHASE("uninstall.gather", &mark);
+
+	// uninstall children before parents
+	qsort(files, files_count, sizeof(File*), compare_paths_reverse);
+	InstallContext context(this, list[0]);
+	context.reverse_files = true;
+	context.uninstalling = uninstalling;
+	for (uint32_t i = 0; i < files_count; i++) {
+		if (res == 0) res = Depot::uninstall_file(files[i], &context);
+		delete files[i];
+	}
+	free(files);
+	STATS_PHASE("uninstall.files", &mark);
 	
 	if (!dryrun) {
 		if (res == 0) res = this->begin_transaction();
@@ -1085,39 +1844,68 @@ int Depot::uninstall(Archive* archive) {
 			uint64_t serial = context.files_to_remove->values[i];
 			if (res == 0) res = m_db->delete_file(serial);
 		}
+		for (i = 0; i < n; ++i) {
+			if (res == 0) res = this->remove(list[i]);
+		}
 		if (res == 0) res = this->commit_transaction();
-
-		if (res == 0) res = this->begin_transaction();	
-		if (res == 0) res = this->remove(archive);
-		if (res == 0) res = this->commit_transaction();
+		STATS_PHASE("uninstall.commit", &mark);
 
 		// delete all of the expanded archive backing stores to save disk space
 		if (res == 0) res = this->prune_directories();
 
-		if (res == 0) res = this->prune_archive(archive);
+		if (res == 0) res = this->prune_archives(list, n);
+
+		for (uint32_t i = 0; res == 0 && i < n; i++) {
+			if (journals[i]) res = journals[i]->remove();
+		}
+		STATS_PHASE("uninstall.prune", &mark);
 	}
 	
-	if (res == 0) fprintf(stdout, "Uninstalled archive: %llu %s \n",
-						  archive->serial(), archive->name());
+	for (uint32_t i = 0; res == 0 && i < n; i++) {
+		fprintf(stdout, "Uninstalled archive: %llu %s \n",
+				list[i]->serial(), list[i]->name());
+	}
 
+	for (uint32_t i = 0; i < n; i++) delete journals[i];
+	free(journals);
+	free(list);
+	delete uninstalling;
 	return res;
 }
 
-int Depot::verify_file(File* file, void* context) {
-	File* actual = FileFactory(file->path());
-	if (actual) {
-		uint32_t flags = File::compare(file, actual);
-		
-		if (flags != FILE_INFO_IDENTICAL) {
-			fprintf(stdout, "M ");
-		} else {
-			fprintf(stdout, "  ");
-		}
-	} else {
-		fprintf(stdout, "R ");
+////
+//  VerifyJob
+//
+//  A file of an archive on its way through verify_archive.  actual is
+//  what is on disk at its path, read by Depot::verify_file on one of
+//  the worker threads, or shared with an archive verified before.
+////
+struct VerifyJob {
+	VerifyJob(File* f, const char* prefix) {
+		file = f;
+		join_path(&actpath, prefix, f->path());
+		actual = NULL;
+		shared = false;
 	}
-	file->print(stdout);
-	return DEPOT_OK;
+
+	~VerifyJob() {
+		delete file;
+		if (actual && !shared) delete actual;
+		free(actpath);
+	}
+
+	File* file;
+	char* actpath;
+	File* actual;    // a NoEntry if nothing is there
+	bool  shared;    // actual belongs to the verify's PathIndex
+};
+
+int Depot::verify_file(void* item, void* context) {
+	VerifyJob* job = (VerifyJob*)item;
+	if (job->shared) return 0;
+	job->actual = FileFactory(job->actpath, job->file);
+	if (!job->actual) job->actual = new NoEntry(job->file->path());
+	return 0;
 }
 
 void Depot::archive_header() {
@@ -1127,12 +1915,123 @@ void Depot::archive_header() {
 			"============  =======  =================\n");	
 }
 
+void Depot::archive_stats_header() {
+	fprintf(stdout, "%-6s %-36s  %-12s  %-7s  %7s  %12s  %12s  %8s  %-4s  %s\n", 
+			"Serial", "UUID", "Date", "Build", "Files", "Bytes", "Rollback", "Seconds",
+			"Sup", "Name");
+	fprintf(stdout, "====== ====================================  "
+			"============  =======  =======  ============  ============  ========  "
+			"====  =================\n");	
+}
+
 int Depot::verify(Archive* archive) {
+	return this->verify(&archive, 1);
+}
+
+int Depot::verify(Archive** archives, uint32_t count) {
+	extern uint32_t io_jobs;
+	int res = 0;
+
+	// archives that did not finish installing have nothing to compare to
+	SerialSet* inactive = new SerialSet();
+	uint64_t* serials = NULL;
+	uint32_t inactive_count = 0;
+	if (count > 1) this->m_db->get_inactive_archive_serials(&serials, &inactive_count);
+	for (uint32_t i = 0; i < inactive_count; i++) inactive->add(serials[i]);
+	free(serials);
+
+	// Files are read and hashed by the work queue, at most io_jobs at a
+	// time, and printed in archive order as they come back.  When more
+	// than one archive is verified, what is on disk at each path is
+	// kept, so a path shared by several archives is only read once.
+	PathIndex* actuals = (count > 1) ? new PathIndex() : NULL;
+	WorkQueue* queue = new WorkQueue(&Depot::verify_file, NULL, io_jobs);
+	res = queue->start();
+	for (uint32_t i = 0; res == 0 && i < count; i++) {
+		if (inactive->contains(archives[i]->serial())) {
+			fprintf(stderr, "Warning: skipping archive %llu %s, it is not active.\n",
+					archives[i]->serial(), archives[i]->name());
+			continue;
+		}
+		res = this->verify_archive(archives[i], queue, actuals);
+	}
+
+	// stop the workers and free whatever they had not finished
+	queue->cancel();
+	VerifyJob* job;
+	while ((job = (VerifyJob*)queue->pop()) != NULL) {
+		delete job;
+	}
+	delete queue;
+	if (actuals) {
+		IF_DEBUG("[verify] read %u paths\n", actuals->count());
+		actuals->each(&Depot::free_file, NULL);
+		delete actuals;
+	}
+	delete inactive;
+	return res;
+}
+
+int Depot::verify_archive(Archive* archive, WorkQueue* queue, PathIndex* actuals) {
 	int res = 0;
 	this->archive_header();
 	list_archive(archive, stdout);	
 	hr();
-	if (res == 0) res = this->iterate_files(archive, &Depot::verify_file, NULL);
+
+	// files outlive the row they are read from while they are queued
+	Query* files = this->m_db->begin_files(archive, false);
+	File* file;
+	uint32_t pending = 0;
+	int found = this->m_db->next_file(files, &file, false);
+	while (res == 0) {
+		while (res == 0 && FOUND(found) && pending < queue->capacity()) {
+			VerifyJob* job = new VerifyJob(file, m_prefix);
+			if (actuals) job->actual = (File*)actuals->get(file->path());
+			job->shared = (job->actual != NULL);
+			res = queue->push(job);
+			if (res != 0) {
+				delete job; // and file with it
+				file = NULL;
+				break;
+			}
+			pending++;
+			found = this->m_db->next_file(files, &file, false);
+		}
+		if (res != 0 || pending == 0) break;
+		VerifyJob* job = (VerifyJob*)queue->pop();
+		if (job == NULL) {
+			fprintf(stderr, "Error: the work queue stopped while verifying archive %llu\n",
+					archive->serial());
+			res = -1;
+			break;
+		}
+		pending--;
+
+		if (INFO_TEST(job->actual->info(), FILE_INFO_NO_ENTRY)) {
+			fprintf(stdout, "R ");
+		} else if (File::compare(job->file, job->actual) != FILE_INFO_IDENTICAL) {
+			fprintf(stdout, "M ");
+		} else {
+			fprintf(stdout, "  ");
+		}
+		job->file->print(stdout);
+		
+		if (actuals && !job->shared) {
+			actuals->set(job->file->path(), job->actual);
+			job->shared = true;
+		}
+		delete job;
+	}
+	if (FOUND(found)) {
+		// stopped early, with a file read but not queued
+		delete file;
+		this->m_db->end_files(files);
+	} else if (found & DB_ERROR) {
+		fprintf(stderr, "%s:%d: unable to read the files of archive %llu\n", 
+				__FILE__, __LINE__, archive->serial());
+		res = -1;
+	}
+
 	hr();
 	fprintf(stdout, "\n");
 	return res;
@@ -1156,17 +2055,73 @@ int Depot::list_archive(Archive* archive, void* context) {
 	return DEPOT_OK;
 }
 
+int Depot::list_archive_stats(Archive* archive, void* context) {
+	Depot* depot = (Depot*)context;
+	
+	char uuid[37];
+	uuid_unparse_upper(archive->uuid(), uuid);
+
+	char date[100];
+	struct tm local;
+	time_t seconds = archive->date_installed();
+	localtime_r(&seconds, &local);
+	strftime(date, sizeof(date), "%b %e %H:%M", &local);
+
+	// archives installed before there were stats have none
+	char files[24] = "-";
+	char bytes[24] = "-";
+	char rollback[24] = "-";
+	char duration[24] = "-";
+	ArchiveStats stats;
+	int res = depot->m_db->get_archive_stats(archive->serial(), &stats);
+	if (res & DB_ERROR) {
+		fprintf(stderr, "Error: unable to read the stats of archive %llu\n", 
+				archive->serial());
+		return DEPOT_ERROR;
+	}
+	if (FOUND(res)) {
+		snprintf(files, sizeof(files), "%llu", stats.files);
+		snprintf(bytes, sizeof(bytes), "%llu", stats.bytes);
+		snprintf(rollback, sizeof(rollback), "%llu", stats.rollback_bytes);
+		snprintf(duration, sizeof(duration), "%llu.%03llu", 
+				 stats.duration / 1000, stats.duration % 1000);
+	}
+
+	// superseded as last found, without looking at the files again
+	const char* superseded = "?";
+	if (archive->m_survivor == ARCHIVE_SURVIVOR_NONE) {
+		superseded = "yes";
+	} else if (archive->m_survivor != ARCHIVE_SURVIVOR_UNKNOWN) {
+		superseded = "no";
+	}
+
+	fprintf(stdout, "%-6llu %-36s  %-12s  %-7s  %7s  %12s  %12s  %8s  %-4s  %s\n", 
+			archive->serial(), uuid, date, (archive->build()?archive->build():""), 
+			files, bytes, rollback, duration, superseded, archive->name());
+	
+	return DEPOT_OK;
+}
+
 int Depot::list() {
 	return this->list(0, NULL);
 }
 
 int Depot::list(int count, char** args) {
+	extern uint32_t long_list;
 	int res = 0;
 
-	this->archive_header();
+	ArchiveIteratorFunc list_one = &Depot::list_archive;
+	void* context = stdout;
+	if (long_list) {
+		list_one = &Depot::list_archive_stats;
+		context = this;
+		this->archive_stats_header();
+	} else {
+		this->archive_header();
+	}
 	
 	// handle the default case of "all"
-	if (count == 0) return this->iterate_archives(&Depot::list_archive, stdout);
+	if (count == 0) return this->iterate_archives(list_one, context);
 
 	Archive** list;
 	Archive* archive;
@@ -1184,12 +2139,12 @@ int Depot::list(int count, char** args) {
 		if (archcnt) {
 			// loop over special keyword results
 			for (uint32_t j = 0; res == 0 && j < archcnt; j++) {
-				res = this->list_archive(list[j], stdout);
+				res = list_one(list[j], context);
 			}
 		} else {
 			// arg is a single-archive specifier
 			archive = this->get_archive(args[i]);
-			if (archive) res = this->list_archive(archive, stdout);
+			if (archive) res = list_one(archive, context);
 		}
 	}
 
@@ -1214,6 +2169,53 @@ int Depot::files(Archive* archive) {
 	return res;
 }
 
+int Depot::owner(const char* path) {
+	int res = 0;
+	if (strcmp(path, "-") != 0) return this->print_owner(path);
+
+	char line[PATH_MAX + 1];
+	while (res == 0 && fgets(line, sizeof(line), stdin)) {
+		line[strcspn(line, "\n")] = 0;
+		if (line[0]) res = this->print_owner(line);
+	}
+	if (ferror(stdin)) {
+		fprintf(stderr, "Error: unable to read paths from stdin: %s\n", strerror(errno));
+		res = DEPOT_ERROR;
+	}
+	return res;
+}
+
+int Depot::print_owner(const char* path) {
+	// paths are stored relative to the prefix, and without trailing slashes
+	char relpath[PATH_MAX];
+	size_t prefixlen = strlen(this->prefix());
+	if (prefixlen > 1 && strncmp(path, this->prefix(), prefixlen) == 0) {
+		path += prefixlen - 1;
+	}
+	snprintf(relpath, sizeof(relpath), "%s%s", (path[0] == '/' ? "" : "/"), path);
+	size_t len = strlen(relpath);
+	while (len > 1 && relpath[len - 1] == '/') relpath[--len] = 0;
+
+	uint8_t* data;
+	File* file = NULL;
+	int res = this->m_db->get_file_owner(&data, relpath);
+	if (res & DB_ERROR) {
+		fprintf(stderr, "Error: unable to look up the owner of %s\n", relpath);
+		return DEPOT_ERROR;
+	}
+	if (FOUND(res)) file = this->m_db->make_file(data);
+
+	// a rollback archive only owns what was there before any root
+	Archive* archive = file ? file->archive() : NULL;
+	if (archive && !(archive->info() & ARCHIVE_INFO_ROLLBACK)) {
+		fprintf(stdout, "%-6llu %-24s %s\n", archive->serial(), archive->name(), relpath);
+	} else {
+		fprintf(stdout, "%-6s %-24s %s\n", "-", "-", relpath);
+	}
+	if (file) delete file;
+	return DEPOT_OK;
+}
+
 int Depot::dump_archive(Archive* archive, void* context) {
 	Depot* depot = (Depot*)context;
 	int res = 0;
@@ -1313,47 +2315,212 @@ int Depot::is_locked() { return m_is_locked; }
 
 bool Depot::is_superseded(Archive* archive) {
 	// return early if already known
-	if (archive->m_is_superseded != -1) { 
+	if (this->check_survivor(archive)) { 
 		return (archive->m_is_superseded == 1);
 	}
 	
 	// need to find out if superseded
 	int res = DB_OK;
-	uint8_t** filelist;
 	uint8_t* data;
-	uint32_t count;	
-	res = this->m_db->get_files(&filelist, &count, archive, false);
-	if (FOUND(res)) {
-		for (uint32_t i=0; i < count; i++) {
-			File* file = this->m_db->make_file(filelist[i]);
-			
-			// check for being superseded by a root
-			res = this->m_db->get_next_file(&data, file, FILE_SUPERSEDED);
-			this->m_db->free_file(data);
-			if (FOUND(res)) continue;
-			
-			// check for being superseded by external changes
-			char* actpath;
-			join_path(&actpath, this->prefix(), file->path());
-			File* actual = FileFactory(actpath);
-			free(actpath);
-			uint32_t flags = File::compare(file, actual);
-
-			// not found in database and no changes on disk, 
-			// so file is the current version of actual
-			if (flags == FILE_INFO_IDENTICAL) {
-				archive->m_is_superseded = 0;
-				return false;
-			}
-			 
-			// something external changed contents of actual,
-			// so we consider this file superseded (by OS upgrade?)
+	File* file;
+	Query* files = this->m_db->begin_files(archive, false);
+	while (FOUND(this->m_db->next_file(files, &file, true))) {
+		// check for being superseded by a root
+		res = this->m_db->get_next_file(&data, file, FILE_SUPERSEDED);
+		this->m_db->free_file(data);
+		if (FOUND(res)) {
+			delete file;
+			continue;
+		}
+		
+		// check for being superseded by external changes
+		bool unchanged = this->is_unchanged(file);
+		delete file;
+
+		// not found in database and no changes on disk, 
+		// so file is the current version of actual
+		if (unchanged) {
+			this->m_db->end_files(files);
+			archive->m_is_superseded = 0;
+			return false;
 		}
+		 
+		// something external changed contents of actual,
+		// so we consider this file superseded (by OS upgrade?)
 	}
 	archive->m_is_superseded = 1;
 	return true;			
 }
 
+bool Depot::is_unchanged(File* file) {
+	char* actpath;
+	join_path(&actpath, this->prefix(), file->path());
+	File* actual = FileFactory(actpath, file);
+	free(actpath);
+	uint32_t flags = File::compare(file, actual);
+	if (actual) delete actual;
+	return (flags == FILE_INFO_IDENTICAL);
+}
+
+bool Depot::check_survivor(Archive* archive) {
+	if (archive->m_is_superseded != -1) return true;
+	if (archive->m_survivor == ARCHIVE_SURVIVOR_UNKNOWN) return false;
+	if (archive->m_survivor == ARCHIVE_SURVIVOR_NONE) {
+		archive->m_is_superseded = 1;
+		return true;
+	}
+
+	// newer archives have not installed over it, but it may have changed
+	uint8_t* data;
+	File* file = NULL;
+	if (FOUND(this->m_db->get_file(&data, archive->m_survivor))) {
+		file = this->m_db->make_file(data);
+	}
+	bool unchanged = (file && this->is_unchanged(file));
+	if (file) delete file;
+	if (unchanged) archive->m_is_superseded = 0;
+	return unchanged;
+}
+
+////
+//  SurvivorCheck
+//
+//  What find_survivors has found out about one of its archives.
+////
+struct SurvivorCheck {
+	uint64_t serial;
+	Archive* archive;
+	bool     survives;  // some path of it is not installed over
+	uint64_t witness;   // a surviving file unchanged on disk, or 0
+};
+
+static int compare_checks(const void* a, const void* b) {
+	uint64_t x = ((SurvivorCheck*)a)->serial;
+	uint64_t y = ((SurvivorCheck*)b)->serial;
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+int Depot::find_survivors(Archive** archives, uint32_t count) {
+	extern uint32_t dryrun;
+	int res = DB_OK;
+
+	// archives that did not finish installing own no paths
+	SerialSet* inactive = new SerialSet();
+	uint64_t* serials = NULL;
+	uint32_t inactive_count = 0;
+	this->m_db->get_inactive_archive_serials(&serials, &inactive_count);
+	for (uint32_t i = 0; i < inactive_count; i++) inactive->add(serials[i]);
+	free(serials);
+
+	SurvivorCheck* checks = (SurvivorCheck*)calloc(count, sizeof(SurvivorCheck));
+	if (!checks) {
+		fprintf(stderr, "Error: ran out of memory in Depot::find_survivors\n");
+		delete inactive;
+		return DEPOT_ERROR;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		checks[i].serial = archives[i]->serial();
+		checks[i].archive = archives[i];
+	}
+	qsort(checks, count, sizeof(SurvivorCheck), compare_checks);
+
+	// The files at a path come one after another.  Those of the newest
+	// active archive there, and of any inactive archive after it, are 
+	// the path's survivors, and only they are looked at on disk, until
+	// each archive has one that is unchanged.
+	char path[PATH_MAX] = "";
+	uint64_t* group = NULL;      // file serial, archive serial pairs
+	uint32_t group_count = 0;
+	uint32_t group_max = 0;
+	uint32_t rows = 0;
+	uint32_t looked = 0;
+	uint8_t* data = NULL;
+	Query* files = this->m_db->begin_files_by_path();
+	int found = this->m_db->next_file_data(files, &data);
+	while (res == DB_OK) {
+		char* fpath = NULL;
+		if (FOUND(found)) memcpy(&fpath, &data[this->m_db->file_offset(8)], sizeof(char*));
+		if (group_count && (!fpath || strcmp(fpath, path) != 0)) {
+			uint64_t newest = 0;
+			for (uint32_t i = 0; i < group_count; i++) {
+				uint64_t serial = group[2*i+1];
+				if (serial > newest && !inactive->contains(serial)) newest = serial;
+			}
+			for (uint32_t i = 0; res == DB_OK && i < group_count; i++) {
+				SurvivorCheck key;
+				key.serial = group[2*i+1];
+				if (key.serial < newest) continue;
+				SurvivorCheck* check = (SurvivorCheck*)bsearch(&key, checks, count, 
+															   sizeof(SurvivorCheck), 
+															   compare_checks);
+				if (!check || check->witness) continue;
+				check->survives = true;
+				uint8_t* fdata;
+				File* file = NULL;
+				if (FOUND(this->m_db->get_file(&fdata, group[2*i]))) {
+					file = this->m_db->make_file(fdata);
+				}
+				if (!file) {
+					fprintf(stderr, "Error: unable to read file %llu\n", group[2*i]);
+					res = DEPOT_ERROR;
+					break;
+				}
+				looked++;
+				if (this->is_unchanged(file)) check->witness = file->serial();
+				delete file;
+			}
+			group_count = 0;
+		}
+		if (!FOUND(found)) break;
+
+		if (group_count == group_max) {
+			group_max = group_max ? group_max * 2 : 16;
+			group = (uint64_t*)realloc(group, 2 * group_max * sizeof(uint64_t));
+		}
+		memcpy(&group[2*group_count], &data[this->m_db->file_offset(0)], sizeof(uint64_t));
+		memcpy(&group[2*group_count+1], &data[this->m_db->file_offset(1)], sizeof(uint64_t));
+		group_count++;
+		rows++;
+		strlcpy(path, fpath, sizeof(path));
+		found = this->m_db->next_file_data(files, &data);
+	}
+	if (found & DB_ERROR) {
+		fprintf(stderr, "Error: unable to read the files of the depot\n");
+		res = DEPOT_ERROR;
+	}
+	if (FOUND(found)) this->m_db->end_files(files);
+	free(group);
+	IF_DEBUG("[superseded] read %u files, looked at %u on disk\n", rows, looked);
+
+	// Archives whose survivors all changed on disk are not remembered,
+	// since what is on disk could change back.
+	bool store = (res == DB_OK && !dryrun && !this->m_db->is_readonly());
+	if (store) store = (this->begin_transaction() == DB_OK);
+	for (uint32_t i = 0; res == DB_OK && i < count; i++) {
+		Archive* archive = checks[i].archive;
+		archive->m_is_superseded = checks[i].witness ? 0 : 1;
+		uint64_t survivor = ARCHIVE_SURVIVOR_UNKNOWN;
+		if (checks[i].witness) {
+			survivor = checks[i].witness;
+		} else if (!checks[i].survives) {
+			survivor = ARCHIVE_SURVIVOR_NONE;
+		}
+		if (store && survivor != archive->m_survivor) {
+			res = this->m_db->set_archive_survivor(archive->serial(), survivor);
+		}
+		archive->m_survivor = survivor;
+	}
+	if (store && res == DB_OK) {
+		res = this->commit_transaction();
+	} else if (store) {
+		this->rollback_transaction();
+	}
+
+	free(checks);
+	delete inactive;
+	return res;
+}
+
 int Depot::lock(int operation) {
 	int res = 0;
 	if (m_lock_fd == -1) {
@@ -1364,10 +2531,20 @@ int Depot::lock(int operation) {
 		}
 	}
 	if (res) return res;
-	res = flock(m_lock_fd, operation);
-	if (res == -1) {
+	
+	// wait our turn behind any other darwinup using this depot
+	extern uint32_t lock_timeout;
+	LockQueue queue(m_queue_path);
+	uint64_t waited = 0;
+	res = queue.lock(m_lock_fd, operation, (uint64_t)lock_timeout * 1000000000ULL, &waited);
+	if (res == -1 && errno == ETIMEDOUT) {
+		fprintf(stderr, "Error: another darwinup is still using %s after %u seconds, "
+				"giving up.\n", m_depot_path, lock_timeout);
+	} else if (res == -1) {
 		perror(m_depot_path);
 	}
+	IF_DEBUG("waited %llu ms for the depot lock\n", (unsigned long long)(waited / 1000000));
+	if (stats) stats->wait("depot_lock", waited);
 	return res;
 }
 
@@ -1389,7 +2566,8 @@ int Depot::insert(Archive* archive) {
 											 archive->info(),
 											 archive->name(),
 											 archive->date_installed(),
-											 archive->build());
+											 archive->build(),
+											 archive->codec());
 	return archive->m_serial == 0;
 }
 
@@ -1411,6 +2589,14 @@ int Depot::insert(Archive* archive, File* file) {
 		return DB_ERROR;
 	}
 
+	// a rollback archive only saves the data of some of its files
+	archive->m_file_count++;
+	if (S_ISREG(file->mode()) && 
+		(!(archive->info() & ARCHIVE_INFO_ROLLBACK) || 
+		 INFO_TEST(file->info(), FILE_INFO_ROLLBACK_DATA))) {
+		archive->m_byte_count += file->size();
+	}
+
 	free(path);
 	return DEPOT_OK;
 }
@@ -1461,6 +2647,8 @@ int Depot::dispatch_command(Archive* archive, const char* command) {
 		res = this->uninstall(archive);
 	} else if (strncasecmp((char*)command, "verify", 6) == 0) {
 		res = this->verify(archive);
+	} else if (strncasecmp((char*)command, "resume", 6) == 0) {
+		res = this->resume(archive);
 	} else {
 		fprintf(stderr, "Error: unknown command given to dispatch_command.\n");
 	}
@@ -1498,6 +2686,26 @@ int Depot::process_archive(const char* command, const char* archspec) {
 			uuid_unparse_upper(list[i]->uuid(), uuid);
 			fprintf(stdout, "Found archive: %s\n", uuid);
 		}
+	}
+
+	// archives are uninstalled together so each path is only restored once,
+	// and verified together so each path is only read once
+	if (strncasecmp((char*)command, "uninstall", 9) == 0 ||
+		strncasecmp((char*)command, "verify", 6) == 0) {
+		if (strncasecmp((char*)command, "uninstall", 9) == 0) {
+			res = this->uninstall(list, count);
+		} else {
+			res = this->verify(list, count);
+		}
+		if (res != 0) {
+			fprintf(stdout, "An error occurred.\n");
+		}
+		for (size_t i = 0; i < count; i++) delete list[i];
+		free(list);
+		return res;
+	}
+
+	for (size_t i = 0; i < count; i++) {
 		res = this->dispatch_command(list[i], command);
 		delete list[i];
 	} 
@@ -1542,7 +2750,9 @@ int Depot::rename_archive(const char* archspec, const char* name) {
 							   archive->date_installed(),
 							   1,
 							   archive->info(),
-							   archive->build());
+							   archive->build(),
+							   archive->codec(),
+							   archive->m_survivor);
 
 	if (res == 0) fprintf(stdout, "Renamed archive %s to '%s'.\n", 
 						  uuid, archive->name());
@@ -1550,3 +2760,130 @@ int Depot::rename_archive(const char* archspec, const char* name) {
 	delete archive;
 	return res;
 }
+
+int Depot::migrate_store() {
+	extern uint32_t verbosity;
+	int res = 0;
+
+	if (!m_objects) {
+		struct stat sb;
+		res = stat(m_archives_path, &sb);
+		if (res == 0) {
+			m_objects = new ObjectStore(m_archives_path);
+			res = m_objects->create(m_depot_mode, sb.st_uid, sb.st_gid);
+		} else {
+			perror(m_archives_path);
+		}
+	}
+
+	// start from the compacted backing stores alone
+	if (res == 0) res = this->prune_directories();
+
+	uint8_t** archlist = NULL;
+	uint32_t count = 0;
+	if (res == 0) {
+		res = this->m_db->get_archives(&archlist, &count, true);
+		if (res & DB_ERROR) {
+			fprintf(stderr, "Error: unable to get archives from database.\n");
+			return res;
+		}
+		res = 0;
+	}
+
+	uint32_t migrated = 0;
+	uint64_t stored = 0;
+	uint64_t present = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		Archive* archive = this->m_db->make_archive(archlist[i]);
+		if (!archive) {
+			fprintf(stderr, "%s:%d: DB::make_archive returned NULL\n", __FILE__, __LINE__);
+			res = DEPOT_ERROR;
+			break;
+		}
+
+		// archives without a compacted backing store were already
+		// migrated, or never needed one
+		if (res == 0 && archive->is_compacted(m_archives_path)) {
+			char uuid[37];
+			uuid_unparse_upper(archive->uuid(), uuid);
+			IF_DEBUG("[objects] migrating %s\n", uuid);
+
+			// the expanded copy is removed below, so objects may link to it
+			InstallContext context(this, archive);
+			context.link_objects = true;
+			char* dirpath = archive->directory_name(m_archives_path);
+			res = archive->expand_directory(m_archives_path);
+			if (res == 0) res = this->iterate_files(archive, &Depot::store_file, &context);
+			if (dirpath) remove_directory(dirpath);
+			free(dirpath);
+
+			// the pack goes only once all of its data is safe
+			if (res == 0) res = archive->prune_compacted_archive(m_archives_path);
+			if (res == 0) {
+				if (verbosity) {
+					fprintf(stdout, "Migrated archive %llu %s: %llu new objects, "
+							"%llu already present\n", archive->serial(), uuid,
+							context.objects_stored, context.objects_present);
+				}
+				++migrated;
+				stored += context.objects_stored;
+				present += context.objects_present;
+			} else {
+				fprintf(stderr, "Error: unable to migrate archive %llu %s\n",
+						archive->serial(), uuid);
+			}
+		}
+		delete archive;
+	}
+	free(archlist);
+
+	if (res == 0) {
+		fprintf(stdout, "Migrated %u archives to the object store: %llu objects stored, "
+				"%llu shared\n", migrated, stored, present);
+	}
+	return res;
+}
+
+int Depot::migrate_paths() {
+	struct stat before;
+	int res = stat(m_database_path, &before);
+	if (res) {
+		perror(m_database_path);
+		return res;
+	}
+	
+	uint64_t files = 0;
+	uint64_t dirs = 0;
+	res = this->m_db->intern_paths(&files, &dirs);
+	if (res != DB_OK) {
+		fprintf(stderr, "Error: unable to intern the paths of files in the database.\n");
+		return res;
+	}
+	// give back the pages the whole paths used
+	res = this->m_db->vacuum();
+	
+	struct stat after;
+	if (res == 0) res = stat(m_database_path, &after);
+	if (res == 0) {
+		fprintf(stdout, "Interned the paths of %llu files in %llu directories: "
+				"database is %lld KB, was %lld KB\n", files, dirs,
+				(long long)after.st_size / 1024, (long long)before.st_size / 1024);
+	}
+	return res;
+}
+
+int Depot::set_profile(const char* name) {
+	if (!name) {
+		fprintf(stdout, "%s\n", Database::profile_name(m_db->profile()));
+		return 0;
+	}
+	
+	uint32_t profile = Database::profile_named(name);
+	if (profile == DB_PROFILE_STORED) {
+		fprintf(stderr, "Error: unknown database profile: %s\n", name);
+		return DEPOT_USAGE_ERROR;
+	}
+	int res = m_db->store_profile(profile);
+	if (res == 0) fprintf(stdout, "Database profile is now %s.\n", name);
+	return res;
+}
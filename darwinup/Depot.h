@@ -52,6 +52,11 @@
 struct Archive;
 struct File;
 struct DarwinupDatabase;
+struct Journal;
+struct ObjectStore;
+struct PathIndex;
+struct Plan;
+struct WorkQueue;
 
 typedef int (*ArchiveIteratorFunc)(Archive* archive, void* context);
 typedef int (*FileIteratorFunc)(File* file, void* context);
@@ -64,12 +69,15 @@ struct Depot {
 
 	// establish database connection
 	int connect();
+	// or connect to a snapshot of a WAL database, which needs no lock
+	int connect_snapshot();
 
 	// create directories we need for storage
 	int create_storage();
 	
 	// use initialize() to connect to database 
-	//  and (optionally) create the storage directories
+	//  and (optionally) create the storage directories,
+	//  readers of a WAL database get a snapshot instead of the lock
 	int initialize(bool writable);
 	int is_initialized();
 	
@@ -99,21 +107,44 @@ struct Depot {
 	int list();
 	int list(int count, char** args);
 	static int list_archive(Archive* archive, void* context);
+	// list -l, with the archive's stats, context is the depot
+	static int list_archive_stats(Archive* archive, void* context);
 
 	int install(const char* path);
 	int install(Archive* archive);
 	static int install_file(File* file, void* context);
 	static int backup_file(File* file, void* context);
 
+	// Does a dry run install of path, saving what it would do to the
+	// plan at plan_path.  Applying the plan installs path again, reusing
+	// the digests of files that have not changed since it was made.
+	int plan(const char* path, const char* plan_path);
+	int apply(const char* plan_path);
+
+	// continues an install that was interrupted after its files were
+	// committed to the database, skipping the work its journal records
+	int resume(Archive* archive);
+
 	int uninstall(Archive* archive);
+	// uninstalls the archives together, moving every path they touch
+	// straight to its final state and updating the database once
+	int uninstall(Archive** archives, uint32_t count);
 	static int uninstall_file(File* file, void* context);
 
 	int verify(Archive* archive);
-	static int verify_file(File* file, void* context);
+	// verifies the archives in one pass, reading each path only once
+	int verify(Archive** archives, uint32_t count);
+	int verify_archive(Archive* archive, WorkQueue* queue, PathIndex* actuals);
+	static int verify_file(void* item, void* context);
 
 	int files(Archive* archive);
 	static int print_file(File* file, void* context);
 
+	// Prints the serial and name of the root that installed what is at
+	// path, or - if none did, path "-" reads paths from stdin, one a line.
+	int owner(const char* path);
+	int print_owner(const char* path);
+
 	int iterate_files(Archive* archive, FileIteratorFunc func, void* context);
 	int iterate_archives(ArchiveIteratorFunc func, void* context);
 
@@ -123,6 +154,20 @@ struct Depot {
 	int process_archive(const char* command, const char* archspec);
 	
 	int rename_archive(const char* archspec, const char* name);
+
+	// moves the data of every compacted archive into the object store,
+	// which the depot uses from then on
+	int migrate_store();
+	static int store_file(File* file, void* context);
+	static int restore_file(File* file, void* context);
+	
+	// stores the paths of files as their directory and last component,
+	//  see DarwinupDatabase::intern_paths()
+	int migrate_paths();
+	
+	// prints the database profile, or stores name as the profile
+	//  every later run uses
+	int set_profile(const char* name);
 	
 	// test if the depot is currently locked 
 	int is_locked();
@@ -130,6 +175,7 @@ struct Depot {
 	bool is_superseded(Archive* archive);
 
 	void    archive_header();
+	void    archive_stats_header();
 	
 	bool    is_dirty();
 	bool    has_modified_extensions();
@@ -161,17 +207,45 @@ protected:
 	int     remove(File* file);
 
 	int		analyze_stage(const char* path, Archive* archive, Archive* rollback, int* rollback_files);
+	// backs up the files rollback replaces, moves the archive's files into
+	// place and activates both, rollback is NULL if there is none,
+	// started is the Stats::now() the install or resume began at
+	int		finish_install(Archive* archive, Archive* rollback, Journal* journal,
+						   uint64_t started);
+	// Looks up the file that precedes archive at path, or NULL, like
+	// file_preceded_by() without needing a File for path.
+	int		find_preceding(Archive* archive, const char* path, File** preceding);
+	// deletes the File stored for each path of a PathIndex
+	static int free_file(const char* path, void* value, void* context);
+	static int analyze_file(void* item, void* context);
 
 	// removes expand and unexpanded files from archives path
 	int		prune_directories();
 	int		prune_archive(Archive* archive);
+	int		prune_archives(Archive** archives, uint32_t count);
+	// removes objects no longer referenced by any file
+	int		prune_objects();
+
+	// restores the part of directory's archive under directory from the
+	// object store, so the whole subtree can be renamed into place
+	int		expand_objects(File* directory);
 	
 	File*	file_superseded_by(File* file);
 	File*	file_preceded_by(File* file);
 
+	// true if what is on disk at file's path is still the file
+	bool	is_unchanged(File* file);
+	// Decides is_superseded() from the archive's stored survivor, if it
+	// still holds, returning false if the archive must be looked at again.
+	bool	check_survivor(Archive* archive);
+	// Decides is_superseded() for every archive in one pass over the 
+	// files, grouped by path, and stores what it found in the database.
+	int		find_survivors(Archive** archives, uint32_t count);
+
 	int		check_consistency();
 	
 	DarwinupDatabase* m_db;
+	ObjectStore*      m_objects; // NULL unless the depot has been migrated
 	
 	mode_t		m_depot_mode;
 	char*       m_prefix;
@@ -179,12 +253,14 @@ protected:
 	char*		m_database_path;
 	char*		m_archives_path;
 	char*		m_downloads_path;
+	char*		m_queue_path;
 	char*       m_build;
 	int		    m_lock_fd;
 	int         m_is_locked;
 	bool        m_is_dirty; // track if we need to update dyld cache
 	bool        m_modified_extensions; // track if we need to touch /S/L/E
 	bool        m_modified_xpc_services; // track if we need to run xpchelper
+	Plan*       m_plan; // being written or applied by the current install
 
 };
 
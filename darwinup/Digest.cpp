@@ -76,6 +76,11 @@ SHA1Digest::SHA1Digest() {
 	m_size = CC_SHA1_DIGEST_LENGTH;
 }
 
+SHA1Digest::SHA1Digest(Digest* digest) {
+	m_size = CC_SHA1_DIGEST_LENGTH;
+	memcpy(m_data, digest->data(), m_size);
+}
+
 SHA1Digest::SHA1Digest(int fd) {
 	m_size = CC_SHA1_DIGEST_LENGTH;
 	digest(m_data, fd);
@@ -101,11 +106,9 @@ void SHA1Digest::digest(unsigned char* md, int fd) {
 	CC_SHA1_Init(&c);
 	
 	ssize_t len;
+	// on the stack so that files can be digested from several threads
 	const unsigned int blocklen = 8192;
-	static uint8_t* block = NULL;
-	if (block == NULL) {
-		block = (uint8_t*)malloc(blocklen);
-	}
+	uint8_t block[blocklen];
 	while(1) {
 		len = read(fd, block, blocklen);
 		if (len == 0) { close(fd); break; }
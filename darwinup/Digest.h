@@ -89,6 +89,9 @@ struct Digest {
 	
 	friend struct Depot;
 	friend struct DarwinupDatabase;
+	friend struct ArchiveReader;
+	friend struct Plan;
+	friend struct ObjectStore;
 };
 
 ////
@@ -97,6 +100,9 @@ struct Digest {
 struct SHA1Digest : Digest {
 	// Creates an empty digest.
 	SHA1Digest();
+
+	// Copies another SHA-1 digest.
+	SHA1Digest(Digest* digest);
     	
 	// Computes the SHA-1 digest of data read from the stream.
 	SHA1Digest(int fd);
@@ -32,6 +32,7 @@
 
 #include "Archive.h"
 #include "File.h"
+#include "ObjectStore.h"
 #include "Utils.h"
 
 #include <assert.h>
@@ -49,11 +50,16 @@ File::File() {
 	m_archive = NULL;
 	m_info = FILE_INFO_NONE;
 	m_path = NULL;
+	m_path_borrowed = false;
 	m_mode = 0;
 	m_uid = 0;
 	m_gid = 0;
 	m_size = 0;
 	m_digest = NULL;
+	m_dev = 0;
+	m_ino = 0;
+	m_mtime = 0;
+	m_ctime = 0;
 }
 
 File::File(const char* path) {
@@ -65,7 +71,12 @@ File::File(const char* path) {
 	m_gid = 0;
 	m_size = 0;
 	m_digest = NULL;
-	if (path) m_path = strdup(path);
+	m_dev = 0;
+	m_ino = 0;
+	m_mtime = 0;
+	m_ctime = 0;
+	m_path = path ? strdup(path) : NULL;
+	m_path_borrowed = false;
 }
 
 File::File(Archive* archive, FTSENT* ent) {	
@@ -73,6 +84,7 @@ File::File(Archive* archive, FTSENT* ent) {
 	path[0] = 0;
 	ftsent_filename(ent, path, PATH_MAX);
 	m_path = strdup(path);
+	m_path_borrowed = false;
 	m_archive = archive;
 	m_info = FILE_INFO_NONE;
 	m_mode = ent->fts_statp->st_mode;
@@ -81,24 +93,34 @@ File::File(Archive* archive, FTSENT* ent) {
 	m_size = ent->fts_statp->st_size;
 	
 	m_digest = NULL;
+	m_dev = 0;
+	m_ino = 0;
+	m_mtime = 0;
+	m_ctime = 0;
 }
 
 File::File(uint64_t serial, Archive* archive, uint32_t info, const char* path, 
-		   mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest) {
+		   mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest,
+		   bool borrow_path) {
 	m_serial = serial;
 	m_archive = archive;
 	m_info = info;
-	m_path = strdup(path);
+	m_path = borrow_path ? (char*)path : strdup(path);
+	m_path_borrowed = borrow_path;
 	m_mode = mode;
 	m_uid = uid;
 	m_gid = gid;
 	m_size = size;
 	m_digest = digest;
+	m_dev = 0;
+	m_ino = 0;
+	m_mtime = 0;
+	m_ctime = 0;
 }
 
 
 File::~File() {
-	if (m_path) free(m_path);
+	if (m_path && !m_path_borrowed) free(m_path);
 	if (m_digest) delete m_digest;
 }
 
@@ -111,11 +133,45 @@ uid_t		File::uid()	{ return m_uid; }
 gid_t		File::gid()	{ return m_gid; }
 off_t		File::size()	{ return m_size; }
 Digest*		File::digest()	{ return m_digest; }
+uint64_t	File::stat_dev()	{ return m_dev; }
+uint64_t	File::stat_ino()	{ return m_ino; }
+int64_t		File::stat_mtime()	{ return m_mtime; }
+int64_t		File::stat_ctime()	{ return m_ctime; }
 
 void		File::info_set(uint64_t flag)	{ m_info = INFO_SET(m_info, flag); }
 void		File::info_clr(uint64_t flag)	{ m_info = INFO_CLR(m_info, flag); }
 void		File::archive(Archive* archive) { m_archive = archive; }
 
+static int64_t timespec_ns(struct timespec* ts) {
+	return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+void File::stat_set(struct stat* sb) {
+	m_size = sb->st_size;
+	m_dev = sb->st_dev;
+	m_ino = sb->st_ino;
+	m_mtime = timespec_ns(&sb->st_mtimespec);
+	m_ctime = timespec_ns(&sb->st_ctimespec);
+}
+
+void File::stat_set(uint64_t dev, uint64_t ino, int64_t mtime, int64_t ctime) {
+	m_dev = dev;
+	m_ino = ino;
+	m_mtime = mtime;
+	m_ctime = ctime;
+}
+
+bool File::stat_matches(struct stat* sb) {
+	// nothing was recorded
+	if (m_ino == 0) return false;
+	return ((m_mode & S_IFMT) == (sb->st_mode & S_IFMT) &&
+			m_size == sb->st_size &&
+			m_dev == (uint64_t)sb->st_dev &&
+			m_ino == (uint64_t)sb->st_ino &&
+			m_mtime == timespec_ns(&sb->st_mtimespec) &&
+			m_ctime == timespec_ns(&sb->st_ctimespec));
+}
+
 uint32_t File::compare(File* a, File* b) {
 	if (a == b) return FILE_INFO_IDENTICAL; // identity
 	// existent and nonexistent file are infinitely different
@@ -172,8 +228,13 @@ int File::install(const char* prefix, const char* dest, bool uninstall) {
 					dirpath, path);
 			return -1;
 		}
+		// bring back just this file if the archive was not expanded
+		struct stat sb;
+		if (lstat(srcpath, &sb) == -1 && errno == ENOENT) {
+			res = this->restore_data(prefix, srcpath);
+		}
 		IF_DEBUG("[install] rename(%s, %s)\n", srcpath, dstpath);
-		res = rename(srcpath, dstpath);
+		if (res == 0) res = rename(srcpath, dstpath);
 		if (res == -1) {
 			if (errno == ENOENT) {
 				// the file wasn't found, try to do on-demand
@@ -233,6 +294,23 @@ int File::install(const char* prefix, const char* dest, bool uninstall) {
 	return res;
 }
 
+int File::restore_data(const char* prefix, const char* srcpath) {
+	int res = 0;
+	Archive* archive = this->archive();
+	if (ObjectStore::exists(prefix)) {
+		ObjectStore objects(prefix);
+		if (objects.has(this)) {
+			IF_DEBUG("[install] restoring %s from object store\n", srcpath);
+			return objects.restore(this, srcpath);
+		}
+	}
+	if (archive->is_packed(prefix)) {
+		IF_DEBUG("[install] extracting %s from pack\n", srcpath);
+		res = archive->expand_path(prefix, this->path(), false);
+	}
+	return res;
+}
+
 int File::dirrename(const char* prefix, const char* dest, bool uninstall) {
 	// only used for directories
 	assert(0);
@@ -258,6 +336,10 @@ int File::unquarantine(const char *prefix) {
 		// Safely ignore ENOATTR, we didn't have the quarantine
 		// xattr set on this file.
 		res = 0;
+	} else if (res == -1 && errno == ENOENT) {
+		// The staging area is gone when an install is resumed, the file
+		// is restored from the archive's saved data, which has no xattrs.
+		res = 0;
 	} else if (res != 0) {
 		fprintf(stderr, "%s:%d: %s: %s (%d)\n",
 				__FILE__, __LINE__, m_path, strerror(errno), errno);
@@ -265,6 +347,10 @@ int File::unquarantine(const char *prefix) {
 	return res;
 }
 
+void File::digest_data(const char* path) {
+	// nothing to digest
+}
+
 int File::install_info(const char* dest) {
 	int res = 0;
 	char* path;
@@ -287,21 +373,28 @@ NoEntry::NoEntry(const char* path) : File(path) {
 }
 
 NoEntry::NoEntry(uint64_t serial, Archive* archive, uint32_t info, const char* path, 
-				 mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest) 
-: File(serial, archive, info, path, mode, uid, gid, size, digest) {}
+				 mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest,
+				 bool borrow_path) 
+: File(serial, archive, info, path, mode, uid, gid, size, digest, borrow_path) {}
 
-Regular::Regular(Archive* archive, FTSENT* ent) : File(archive, ent) {
-	m_digest = new SHA1Digest(ent->fts_accpath);
+Regular::Regular(Archive* archive, FTSENT* ent, bool digest) : File(archive, ent) {
+	if (digest) m_digest = new SHA1Digest(ent->fts_accpath);
 }
 
 Regular::Regular(uint64_t serial, Archive* archive, uint32_t info, const char* path, 
-				 mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest) 
-: File(serial, archive, info, path, mode, uid, gid, size, digest) {
-	if (digest == NULL || serial == 0) {
+				 mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest,
+				 bool borrow_path) 
+: File(serial, archive, info, path, mode, uid, gid, size, digest, borrow_path) {
+	if (digest == NULL) {
 		m_digest = new SHA1Digest(path);
 	}
 }
 
+void Regular::digest_data(const char* path) {
+	if (m_digest) delete m_digest;
+	m_digest = new SHA1Digest(path);
+}
+
 int Regular::remove() {
 	int res = 0;
 	const char* path = this->path();
@@ -318,18 +411,24 @@ int Regular::remove() {
 	return res;
 }
 
-Symlink::Symlink(Archive* archive, FTSENT* ent) : File(archive, ent) {
-	m_digest = new SHA1DigestSymlink(ent->fts_accpath);
+Symlink::Symlink(Archive* archive, FTSENT* ent, bool digest) : File(archive, ent) {
+	if (digest) m_digest = new SHA1DigestSymlink(ent->fts_accpath);
 }
 
 Symlink::Symlink(uint64_t serial, Archive* archive, uint32_t info, const char* path,
-				 mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest) 
-: File(serial, archive, info, path, mode, uid, gid, size, digest) {
-	if (digest == NULL || serial == 0) {
+				 mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest,
+				 bool borrow_path) 
+: File(serial, archive, info, path, mode, uid, gid, size, digest, borrow_path) {
+	if (digest == NULL) {
 		m_digest = new SHA1DigestSymlink(path);
 	}
 }
 
+void Symlink::digest_data(const char* path) {
+	if (m_digest) delete m_digest;
+	m_digest = new SHA1DigestSymlink(path);
+}
+
 int Symlink::remove() {
 	int res = 0;
 	const char* path = this->path();
@@ -367,8 +466,8 @@ Directory::Directory(Archive* archive, FTSENT* ent) : File(archive, ent) {}
 
 Directory::Directory(uint64_t serial, Archive* archive, uint32_t info, 
 					 const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size,
-					 Digest* digest) 
-: File(serial, archive, info, path, mode, uid, gid, size, digest) {};
+					 Digest* digest, bool borrow_path) 
+: File(serial, archive, info, path, mode, uid, gid, size, digest, borrow_path) {};
 
 int Directory::install(const char* prefix, const char* dest, bool uninstall) {
 	return this->_install(prefix, dest, uninstall, false);
@@ -402,7 +501,10 @@ int Directory::_install(const char* prefix, const char* dest, bool uninstall, bo
 		Archive* archive = this->archive();
 		char* dirpath = archive->directory_name(prefix);
 		IF_DEBUG("[install] dirpath is %s\n", dirpath);
-		if (is_directory(dirpath) == 0) {
+		if (archive->is_packed(prefix)) {
+			IF_DEBUG("[install] extracting subtree for directory rename\n");
+			res = archive->expand_path(prefix, path, true);
+		} else if (is_directory(dirpath) == 0) {
 			IF_DEBUG("[install] expanding archive for directory rename\n");
 			res = archive->expand_directory(prefix);
 		}
@@ -487,24 +589,30 @@ int Directory::remove() {
 
 File* FileFactory(uint64_t serial, Archive* archive, uint32_t info, const char* path, 
 				  mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest) {
+	return FileFactory(serial, archive, info, path, mode, uid, gid, size, digest, false);
+}
+
+File* FileFactory(uint64_t serial, Archive* archive, uint32_t info, const char* path, 
+				  mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest,
+				  bool borrow_path) {
 	File* file = NULL;
 	switch (mode & S_IFMT) {
 		case S_IFDIR:
 			file = new Directory(serial, archive, info, path, mode, uid, gid, size, 
-								 digest);
+								 digest, borrow_path);
 			break;
 		case S_IFREG:
 			file = new Regular(serial, archive, info, path, mode, uid, gid, size, 
-							   digest);
+							   digest, borrow_path);
 			break;
 		case S_IFLNK:
 			file = new Symlink(serial, archive, info, path, mode, uid, gid, size, 
-							   digest);
+							   digest, borrow_path);
 			break;
 		case 0:
 			if (INFO_TEST(info, FILE_INFO_NO_ENTRY)) {
 				file = new NoEntry(serial, archive, info, path, mode, uid, gid, size, 
-								   digest);
+								   digest, borrow_path);
 				break;
 			}
 		default:
@@ -516,17 +624,21 @@ File* FileFactory(uint64_t serial, Archive* archive, uint32_t info, const char*
 }
 
 File* FileFactory(Archive* archive, FTSENT* ent) {
+	return FileFactory(archive, ent, true);
+}
+
+File* FileFactory(Archive* archive, FTSENT* ent, bool digest) {
 	File* file = NULL;
 	switch (ent->fts_info) {
 		case FTS_D:
 			file = new Directory(archive, ent);
 			break;
 		case FTS_F:
-			file = new Regular(archive, ent);
+			file = new Regular(archive, ent, digest);
 			break;
 		case FTS_SL:
 		case FTS_SLNONE:
-			file = new Symlink(archive, ent);
+			file = new Symlink(archive, ent, digest);
 			break;
 		case FTS_DP:
 			break;
@@ -544,10 +656,15 @@ File* FileFactory(Archive* archive, FTSENT* ent) {
 }
 
 File* FileFactory(const char* path) {
+	return FileFactory(path, NULL);
+}
+
+File* FileFactory(const char* path, File* known) {
 	File* file = NULL;
 	struct stat sb;
 	int res = 0;
 	extern uint32_t force;
+	extern uint32_t paranoid;
 	
 	res = lstat(path, &sb);
 	if (res == -1 && errno == ENOENT) {
@@ -567,7 +684,16 @@ File* FileFactory(const char* path) {
 		return NULL;
 	}
 	
+	// if this is the same file darwinup recorded, its data has not
+	// changed and the recorded digest can be used without reading it
+	Digest* digest = NULL;
+	if (known && known->digest() && !paranoid && known->stat_matches(&sb)) {
+		IF_DEBUG("[factory]    stat matches, using recorded digest for %s\n", path);
+		digest = new SHA1Digest(known->digest());
+	}
+
 	file = FileFactory(0, NULL, FILE_INFO_NONE, path, sb.st_mode, sb.st_uid, 
-					   sb.st_gid, sb.st_size, NULL);
+					   sb.st_gid, sb.st_size, digest);
+	if (file) file->stat_set(&sb);
 	return file;
 }
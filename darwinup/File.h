@@ -110,8 +110,17 @@ struct File;
 ////
 
 File* FileFactory(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest);
+// Same as above, but with borrow_path the file keeps path itself instead
+// of a copy, so path must outlive the file.
+File* FileFactory(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest, bool borrow_path);
 File* FileFactory(const char* path);
+// Same as above, but if known was recorded by stat_set() from the file
+// now at path, known's digest is used instead of reading the file.
+File* FileFactory(const char* path, File* known);
 File* FileFactory(Archive* archive, FTSENT* ent);
+// Same as above, but if digest is false the file's data is not read
+// and File::digest_data() must be used to fill in the digest later.
+File* FileFactory(Archive* archive, FTSENT* ent, bool digest);
 
 
 struct File {
@@ -119,7 +128,7 @@ struct File {
 	File(File*);
 	File(const char* path);
 	File(Archive* archive, FTSENT* ent);
-	File(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest);
+	File(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest, bool borrow_path);
 	virtual ~File();
 
 	////
@@ -157,6 +166,13 @@ struct File {
 	// Digest of the file's data.
 	virtual Digest* digest();
 
+	// Device, inode and nanosecond mtime and ctime of the installed
+	// file when it was recorded, or 0 if unknown.
+	virtual uint64_t stat_dev();
+	virtual uint64_t stat_ino();
+	virtual int64_t  stat_mtime();
+	virtual int64_t  stat_ctime();
+
 	////
 	//  Class functions
 	////
@@ -186,21 +202,43 @@ struct File {
 	// Removes any quarantine xattrs present
 	int unquarantine(const char *prefix);
 
+	// Computes the digest of the data at path, for files that
+	// were created without one.
+	virtual void digest_data(const char* path);
+
 	// Prints one line to the output stream indicating
 	// the file mode, ownership, digest and name.
 	virtual void print(FILE* stream);
 
+	// Records the size and identity of the file from its lstat(2).
+	void stat_set(struct stat* sb);
+	void stat_set(uint64_t dev, uint64_t ino, int64_t mtime, int64_t ctime);
+
+	// Returns true if sb describes the same unmodified file that
+	// was recorded with stat_set().
+	bool stat_matches(struct stat* sb);
+
 	protected:
 
+	// Recreates the file at srcpath, inside the archive's backing-store
+	// directory, from the object store or the archive's pack, without
+	// expanding the whole archive.  Does nothing if neither has it.
+	int restore_data(const char* prefix, const char* srcpath);
+
 	uint64_t	m_serial;
 	uint64_t	m_info;
 	Archive*	m_archive;
 	char*		m_path;
+	bool		m_path_borrowed; // m_path belongs to someone else
 	mode_t		m_mode;
 	uid_t		m_uid;
 	gid_t		m_gid;
 	off_t		m_size;
 	Digest*		m_digest;
+	uint64_t	m_dev;
+	uint64_t	m_ino;
+	int64_t		m_mtime;
+	int64_t		m_ctime;
 	
 	friend struct Depot;
 };
@@ -214,7 +252,7 @@ struct File {
 
 struct NoEntry : File {
 	NoEntry(const char* path);
-	NoEntry(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest);
+	NoEntry(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest, bool borrow_path);
 };
 
 ////
@@ -223,9 +261,10 @@ struct NoEntry : File {
 //  NOTE: Extended attributes are not detected or preserved.
 ////
 struct Regular : File {
-	Regular(Archive* archive, FTSENT* ent);
-	Regular(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest);
+	Regular(Archive* archive, FTSENT* ent, bool digest);
+	Regular(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest, bool borrow_path);
 	virtual int remove();
+	virtual void digest_data(const char* path);
 };
 
 ////
@@ -233,10 +272,11 @@ struct Regular : File {
 //  Digest is of the target obtained via readlink(2).
 ////
 struct Symlink : File {
-	Symlink(Archive* archive, FTSENT* ent);
-	Symlink(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest);
+	Symlink(Archive* archive, FTSENT* ent, bool digest);
+	Symlink(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest, bool borrow_path);
 	virtual int install_info(const char* dest);
 	virtual int remove();
+	virtual void digest_data(const char* path);
 };
 
 ////
@@ -245,7 +285,7 @@ struct Symlink : File {
 ////
 struct Directory : File {
 	Directory(Archive* archive, FTSENT* ent);
-	Directory(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest);
+	Directory(uint64_t serial, Archive* archive, uint32_t info, const char* path, mode_t mode, uid_t uid, gid_t gid, off_t size, Digest* digest, bool borrow_path);
 	virtual int install(const char* prefix, const char* dest, bool uninstall);
 	virtual int dirrename(const char* prefix, const char* dest, bool uninstall);
 	int _install(const char* prefix, const char* dest, bool uninstall, bool use_rename);
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "Journal.h"
+#include "Archive.h"
+#include "File.h"
+#include "Utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char JOURNAL_TAGS[JOURNAL_KINDS] = { 'B', 'I' };
+
+static int compare_serials(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	if (x < y) return -1;
+	if (x > y) return 1;
+	return 0;
+}
+
+Journal::Journal(const char* archives_path, Archive* archive) {
+	char uuidstr[37];
+	uuid_unparse_upper(archive->uuid(), uuidstr);
+	asprintf(&m_path, "%s/%s" JOURNAL_SUFFIX, archives_path, uuidstr);
+	m_fd = -1;
+	m_phase = JOURNAL_STARTED;
+	m_rollback = 0;
+	for (int i = 0; i < JOURNAL_KINDS; i++) {
+		m_done[i] = NULL;
+		m_done_count[i] = 0;
+	}
+}
+
+Journal::~Journal() {
+	if (m_fd != -1) close(m_fd);
+	for (int i = 0; i < JOURNAL_KINDS; i++) {
+		if (m_done[i]) free(m_done[i]);
+	}
+	if (m_path) free(m_path);
+}
+
+bool Journal::exists(const char* archives_path, Archive* archive) {
+	Journal journal(archives_path, archive);
+	return journal.m_path && access(journal.m_path, F_OK) == 0;
+}
+
+const char* Journal::path()          { return m_path; }
+uint32_t    Journal::phase()         { return m_phase; }
+uint64_t    Journal::rollback_serial() { return m_rollback; }
+
+int Journal::load() {
+	if (!m_path) return -1;
+	FILE* f = fopen(m_path, "r");
+	if (!f) {
+		fprintf(stderr, "Error: unable to read %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return -1;
+	}
+
+	uint32_t capacity[JOURNAL_KINDS];
+	for (int i = 0; i < JOURNAL_KINDS; i++) capacity[i] = m_done_count[i] = 0;
+
+	char line[64];
+	while (fgets(line, sizeof(line), f)) {
+		char tag;
+		unsigned long long value;
+		// a line without its newline was cut short by a crash
+		if (!strchr(line, '\n')) break;
+		if (sscanf(line, "%c %llu", &tag, &value) != 2) continue;
+		if (tag == 'P') {
+			if (value > m_phase) m_phase = (uint32_t)value;
+			continue;
+		}
+		if (tag == 'R') {
+			m_rollback = value;
+			continue;
+		}
+		for (int i = 0; i < JOURNAL_KINDS; i++) {
+			if (tag != JOURNAL_TAGS[i]) continue;
+			if (m_done_count[i] == capacity[i]) {
+				capacity[i] = capacity[i] ? capacity[i] * 4 : 64;
+				m_done[i] = (uint64_t*)realloc(m_done[i], capacity[i] * sizeof(uint64_t));
+				if (!m_done[i]) {
+					fprintf(stderr, "Error: ran out of memory in Journal::load\n");
+					fclose(f);
+					return -1;
+				}
+			}
+			m_done[i][m_done_count[i]++] = value;
+		}
+	}
+	fclose(f);
+
+	for (int i = 0; i < JOURNAL_KINDS; i++) {
+		if (m_done[i]) qsort(m_done[i], m_done_count[i], sizeof(uint64_t), compare_serials);
+	}
+	IF_DEBUG("[journal] %s: phase %u, %u backed up, %u installed\n", m_path, m_phase,
+			 m_done_count[JOURNAL_BACKUP], m_done_count[JOURNAL_INSTALL]);
+	return 0;
+}
+
+int Journal::open() {
+	if (!m_path) return -1;
+	m_fd = ::open(m_path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (m_fd == -1) {
+		fprintf(stderr, "Error: unable to open %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return -1;
+	}
+	return 0;
+}
+
+int Journal::remove() {
+	if (m_fd != -1) {
+		close(m_fd);
+		m_fd = -1;
+	}
+	int res = unlink(m_path);
+	if (res == -1 && errno == ENOENT) res = 0;
+	if (res) fprintf(stderr, "Error: unable to remove %s: %s (%d)\n", m_path, strerror(errno), errno);
+	return res;
+}
+
+int Journal::append(char tag, uint64_t value) {
+	char line[32];
+	int len = snprintf(line, sizeof(line), "%c %llu\n", tag, (unsigned long long)value);
+	if (write(m_fd, line, len) != len) {
+		fprintf(stderr, "Error: unable to write %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return -1;
+	}
+	return 0;
+}
+
+int Journal::set_rollback(uint64_t serial) {
+	m_rollback = serial;
+	return this->append('R', serial);
+}
+
+int Journal::set_phase(uint32_t phase) {
+	m_phase = phase;
+	int res = this->append('P', phase);
+	if (res == 0 && fsync(m_fd) == -1) {
+		fprintf(stderr, "Error: unable to sync %s: %s (%d)\n", m_path, strerror(errno), errno);
+		res = -1;
+	}
+	return res;
+}
+
+int Journal::record(uint32_t kind, File* file) {
+	return this->append(JOURNAL_TAGS[kind], file->serial());
+}
+
+bool Journal::is_done(uint32_t kind, File* file) {
+	uint64_t serial = file->serial();
+	return m_done_count[kind] && bsearch(&serial, m_done[kind], m_done_count[kind], 
+										 sizeof(uint64_t), compare_serials) != NULL;
+}
+
+uint32_t Journal::count(uint32_t kind) {
+	return m_done_count[kind];
+}
+
+void Journal::forget(uint32_t kind) {
+	m_done_count[kind] = 0;
+}
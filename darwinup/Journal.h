@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct Archive;
+struct File;
+
+#define JOURNAL_SUFFIX ".journal"
+
+// how far an install got; a phase is recorded once all of its work is done
+#define JOURNAL_STARTED   0 // nothing can be resumed yet
+#define JOURNAL_STAGED    1 // file records committed, archive data saved
+#define JOURNAL_BACKED_UP 2 // rollback data saved, files may be moved into place
+
+// kinds of per-file records
+#define JOURNAL_BACKUP     0 // rollback data saved
+#define JOURNAL_INSTALL    1 // moved into place
+#define JOURNAL_KINDS      2
+
+////
+//  Journal
+//
+//  Records the progress of an install that has committed its files to the
+//  database, so that an interrupted install can be resumed, or rolled back
+//  by undoing its files once any may have been moved into place.  It lives
+//  next to the archive's compacted data, at
+//
+//      Archives/<archive UUID>.journal
+//
+//  and is removed once the archive has been activated.  Each line is one
+//  record, appended as the install goes:
+//
+//      R <serial>   serial of the rollback archive, 0 if there is none
+//      P <phase>    a JOURNAL_ phase completed
+//      B <serial>   rollback data saved for a file
+//      I <serial>   a file was moved into place
+//
+//  The journal is only synced to disk when a phase completes.  Per-file
+//  records survive the process dying, and work whose record was lost in
+//  a power failure is simply done again.  Uninstall only relies on the
+//  synced phase to know whether files may have been moved into place.
+////
+struct Journal {
+	Journal(const char* archives_path, Archive* archive);
+	virtual ~Journal();
+
+	// Returns true if archive has a journal, meaning it was interrupted.
+	static bool exists(const char* archives_path, Archive* archive);
+
+	// Reads the records left by an earlier run.
+	int load();
+
+	// Opens the journal for appending, creating it if needed.
+	int open();
+
+	// Deletes the journal.
+	int remove();
+
+	const char* path();
+	uint32_t    phase();
+	uint64_t    rollback_serial();
+
+	int  set_rollback(uint64_t serial);
+	// Syncs the journal to disk after recording the phase.
+	int  set_phase(uint32_t phase);
+
+	// Records that kind of work is done for file.
+	int  record(uint32_t kind, File* file);
+	// Returns true if a loaded record says kind of work is done for file.
+	bool is_done(uint32_t kind, File* file);
+	// Number of loaded records of kind.
+	uint32_t count(uint32_t kind);
+	// Ignores the loaded records of kind, so the work is done again.
+	void forget(uint32_t kind);
+
+	protected:
+
+	int  append(char tag, uint64_t value);
+
+	char*     m_path;
+	int       m_fd;
+	uint32_t  m_phase;
+	uint64_t  m_rollback;
+	uint64_t* m_done[JOURNAL_KINDS]; // sorted after load()
+	uint32_t  m_done_count[JOURNAL_KINDS];
+};
+
+#endif
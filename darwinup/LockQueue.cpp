@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "LockQueue.h"
+#include "Stats.h"
+#include "Utils.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+LockQueue::LockQueue(const char* path) {
+	m_path = strdup(path);
+	m_ticket = NULL;
+	m_ticket_name = NULL;
+	m_ticket_fd = -1;
+}
+
+LockQueue::~LockQueue() {
+	this->leave();
+	free(m_path);
+}
+
+int LockQueue::lock(int fd, int operation, uint64_t timeout, uint64_t* waited) {
+	uint64_t start = Stats::now();
+	*waited = 0;
+	
+	// without a ticket we still wait, just not in line
+	bool queued = (this->join() == 0);
+	
+	int res = 0;
+	uint64_t delay = LOCKQUEUE_MIN_DELAY;
+	for (;;) {
+		if (!queued || this->is_next()) {
+			res = flock(fd, operation | LOCK_NB);
+			if (res == 0 || errno != EWOULDBLOCK) break;
+		}
+		uint64_t elapsed = Stats::now() - start;
+		if (elapsed >= timeout) {
+			errno = ETIMEDOUT;
+			res = -1;
+			break;
+		}
+		uint64_t left = (timeout - elapsed) / 1000;
+		usleep((useconds_t)(delay < left ? delay : left));
+		if (delay < LOCKQUEUE_MAX_DELAY) delay *= 2;
+	}
+	
+	int saved = errno;
+	this->leave();
+	*waited = Stats::now() - start;
+	errno = saved;
+	return res;
+}
+
+int LockQueue::join() {
+	char* ticket_name = NULL;
+	char* temp = NULL;
+	asprintf(&ticket_name, "%016llx-%d", (unsigned long long)Stats::now(), (int)getpid());
+	if (ticket_name) join_path(&m_ticket, m_path, ticket_name);
+	// made under a hidden name first, so it is never seen unlocked
+	if (ticket_name) asprintf(&temp, "%s/.%s", m_path, ticket_name);
+	if (!ticket_name || !m_ticket || !temp) {
+		fprintf(stderr, "Error: ran out of memory in LockQueue::join\n");
+		free(ticket_name);
+		free(temp);
+		return -1;
+	}
+	m_ticket_name = ticket_name;
+	
+	int res = 0;
+	m_ticket_fd = open(temp, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (m_ticket_fd == -1) res = -1;
+	if (res == 0) res = flock(m_ticket_fd, LOCK_SH | LOCK_NB);
+	if (res == 0) res = rename(temp, m_ticket);
+	if (res) {
+		IF_DEBUG("waiting for the lock without a ticket: %s: %s\n", temp, strerror(errno));
+		if (m_ticket_fd != -1) {
+			unlink(temp);
+			close(m_ticket_fd);
+			m_ticket_fd = -1;
+		}
+	}
+	free(temp);
+	return res;
+}
+
+bool LockQueue::is_next() {
+	DIR* dir = opendir(m_path);
+	if (!dir) return true;
+	
+	bool next = true;
+	struct dirent* entry;
+	while (next && (entry = readdir(dir)) != NULL) {
+		// hidden tickets are still being made, so are younger than ours
+		if (entry->d_name[0] == '.') continue;
+		if (strcmp(entry->d_name, m_ticket_name) >= 0) continue;
+		
+		char* path;
+		join_path(&path, m_path, entry->d_name);
+		int fd = open(path, O_RDONLY);
+		if (fd != -1) {
+			if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+				// nobody holds it, so its process is gone
+				IF_DEBUG("removing the abandoned lock ticket %s\n", path);
+				unlink(path);
+			} else {
+				next = false;
+			}
+			close(fd);
+		}
+		free(path);
+	}
+	closedir(dir);
+	return next;
+}
+
+void LockQueue::leave() {
+	if (m_ticket_fd != -1) {
+		unlink(m_ticket);
+		close(m_ticket_fd);
+		m_ticket_fd = -1;
+	}
+	free(m_ticket);
+	m_ticket = NULL;
+	free(m_ticket_name);
+	m_ticket_name = NULL;
+}
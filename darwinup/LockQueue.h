@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _LOCKQUEUE_H
+#define _LOCKQUEUE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// how long a waiter sleeps before looking again, doubling up to the max
+#define LOCKQUEUE_MIN_DELAY 1000   // microseconds
+#define LOCKQUEUE_MAX_DELAY 64000
+
+////
+//  LockQueue
+//
+//  Hands out an flock(2) to the processes waiting for it in the order
+//  they started waiting, instead of whichever flock(2) happens to wake.
+//
+//  Each waiter leaves a ticket in the queue directory, named for the
+//  time it joined, and only tries the lock once no older ticket is
+//  left.  A waiter holds a shared flock(2) on its own ticket, so the
+//  ticket of a process that went away can be told apart and skipped.
+//  A process that cannot write to the queue directory still waits for
+//  the lock, but without a place in line.
+////
+struct LockQueue {
+	LockQueue(const char* path);
+	~LockQueue();
+
+	// Takes operation, LOCK_SH or LOCK_EX, on fd, waiting at most
+	// timeout nanoseconds for the processes ahead in line.
+	// Returns 0, or -1 with errno set, ETIMEDOUT if the wait timed out.
+	// waited is how long it took.
+	int      lock(int fd, int operation, uint64_t timeout, uint64_t* waited);
+
+	protected:
+
+	// adds a ticket for this process to the queue
+	int      join();
+	// true if no older ticket of a live process is in the queue
+	bool     is_next();
+	// removes this process' ticket
+	void     leave();
+
+	char*    m_path;
+	char*    m_ticket;
+	char*    m_ticket_name;
+	int      m_ticket_fd;
+};
+
+#endif
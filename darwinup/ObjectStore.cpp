@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "ObjectStore.h"
+#include "Digest.h"
+#include "File.h"
+#include "PathIndex.h"
+#include "Utils.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ObjectStore::ObjectStore(const char* archives_path) {
+	join_path(&m_path, archives_path, "/objects");
+}
+
+ObjectStore::~ObjectStore() {
+	if (m_path) free(m_path);
+}
+
+const char* ObjectStore::path() { return m_path; }
+
+bool ObjectStore::exists(const char* archives_path) {
+	char* path;
+	join_path(&path, archives_path, "/objects");
+	bool res = is_directory(path, false);
+	free(path);
+	return res;
+}
+
+bool ObjectStore::has_data(File* file) {
+	mode_t type = file->mode() & S_IFMT;
+	return (type == S_IFREG || type == S_IFLNK) && file->digest() != NULL;
+}
+
+int ObjectStore::create(mode_t mode, uid_t uid, gid_t gid) {
+	int res = mkdir(m_path, mode);
+	if (res == -1 && errno == EEXIST) res = 0;
+	if (res == 0) res = chmod(m_path, mode);
+	if (res == 0) res = chown(m_path, uid, gid);
+	if (res != 0) perror(m_path);
+	return res;
+}
+
+char* ObjectStore::object_path(Digest* digest) {
+	char* path = NULL;
+	char* hex = digest->string();
+	asprintf(&path, "%s/%.2s/%s", m_path, hex, hex + 2);
+	free(hex);
+	if (path == NULL) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+	}
+	return path;
+}
+
+bool ObjectStore::has(File* file) {
+	if (!has_data(file)) return false;
+	char* objpath = this->object_path(file->digest());
+	struct stat sb;
+	bool res = objpath && lstat(objpath, &sb) == 0;
+	free(objpath);
+	return res;
+}
+
+int ObjectStore::store(File* file, const char* path, bool replaced, int* method, off_t* size) {
+	int res = 0;
+	*method = -1;
+	*size = 0;
+	if (!has_data(file)) return 0;
+
+	char* objpath = this->object_path(file->digest());
+	if (!objpath) return -1;
+	struct stat sb;
+	if (lstat(objpath, &sb) == 0) {
+		IF_DEBUG("[objects] %s already stored as %s\n", path, objpath);
+		free(objpath);
+		return 0;
+	}
+
+	// the directory for the first two digits of the digest
+	char* slash = strrchr(objpath, '/');
+	*slash = 0;
+	res = mkdir(objpath, 0750);
+	if (res == -1 && errno == EEXIST) res = 0;
+	*slash = '/';
+
+	char* tmppath = NULL;
+	if (res == 0) asprintf(&tmppath, "%s.%d.tmp", objpath, (int)getpid());
+	if (res == 0 && tmppath) {
+		unlink(tmppath);
+		SHA1Digest* actual = NULL;
+		if (S_ISLNK(file->mode())) {
+			char link[PATH_MAX];
+			ssize_t len = readlink(path, link, sizeof(link));
+			int fd = -1;
+			if (len != -1) {
+				actual = new SHA1Digest((uint8_t*)link, (uint32_t)len);
+				fd = open(tmppath, O_WRONLY | O_CREAT | O_EXCL, 0440);
+			}
+			if (fd != -1 && write(fd, link, len) == len) {
+				*method = BACKUP_COPIED;
+				*size = len;
+			} else {
+				res = -1;
+			}
+			if (fd != -1 && close(fd) != 0) res = -1;
+		} else if (share_data(path, tmppath, replaced, method, size) == 0) {
+			// the object has the same data as path, so either can be read
+			int fd = open(tmppath, O_RDONLY);
+			if (fd != -1) {
+				actual = new SHA1Digest(fd);
+			} else {
+				res = -1;
+			}
+		} else {
+			*method = BACKUP_COPIED;
+			actual = new SHA1Digest();
+			res = copy_data(path, tmppath, actual, size);
+		}
+		bool mismatch = (res == 0 && !Digest::equal(actual, file->digest()));
+		if (mismatch) {
+			fprintf(stderr, "Error: %s changed since it was digested, not storing it as %s\n",
+					path, objpath);
+			res = -1;
+		}
+		if (res == 0) res = rename(tmppath, objpath);
+		if (res != 0 && !mismatch) {
+			fprintf(stderr, "%s:%d: unable to store %s as %s: %s (%d)\n", 
+					__FILE__, __LINE__, path, objpath, strerror(errno), errno);
+		}
+		if (res != 0) {
+			unlink(tmppath);
+			*method = -1;
+		}
+		delete actual;
+	} else if (res != 0) {
+		fprintf(stderr, "%s:%d: %s: %s (%d)\n", 
+				__FILE__, __LINE__, objpath, strerror(errno), errno);
+	}
+	if (res == 0) IF_DEBUG("[objects] stored %s as %s\n", path, objpath);
+	free(tmppath);
+	free(objpath);
+	return res;
+}
+
+int ObjectStore::copy_data(const char* src, const char* dst, Digest* digest, off_t* size) {
+	int res = 0;
+	*size = 0;
+	int sfd = open(src, O_RDONLY | O_NOFOLLOW);
+	if (sfd == -1) return -1;
+	int dfd = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0440);
+	if (dfd == -1) {
+		int saved = errno;
+		close(sfd);
+		errno = saved;
+		return -1;
+	}
+
+	IF_DEBUG("[objects] copying %s to %s\n", src, dst);
+	CC_SHA1_CTX c;
+	CC_SHA1_Init(&c);
+	uint8_t block[65536];
+	while (res == 0) {
+		ssize_t len = read(sfd, block, sizeof(block));
+		if (len == 0) break;
+		if (len == -1 && errno == EINTR) continue;
+		if (len == -1) {
+			res = -1;
+			break;
+		}
+		CC_SHA1_Update(&c, block, (CC_LONG)len);
+		ssize_t off = 0;
+		while (res == 0 && off < len) {
+			ssize_t n = write(dfd, block + off, len - off);
+			if (n == -1 && errno == EINTR) continue;
+			if (n == -1) res = -1; else off += n;
+		}
+		*size += len;
+	}
+	CC_SHA1_Final(digest->m_data, &c);
+
+	int saved = errno;
+	if (close(dfd) != 0 && res == 0) {
+		saved = errno;
+		res = -1;
+	}
+	close(sfd);
+	errno = saved;
+	return res;
+}
+
+int ObjectStore::restore(File* file, const char* path) {
+	int res = 0;
+	mode_t mode = file->mode() & ALLPERMS;
+
+	char parent[PATH_MAX];
+	strlcpy(parent, path, sizeof(parent));
+	char* slash = strrchr(parent, '/');
+	if (slash) *slash = 0;
+	if (slash && !is_directory(parent, false)) {
+		res = mkdir_p(parent);
+		if (res == -1 && errno == EEXIST) res = 0;
+	}
+
+	if (res == 0 && S_ISDIR(file->mode())) {
+		res = mkdir(path, mode);
+		if (res == -1 && errno == EEXIST && is_directory(path, false)) res = 0;
+	} else if (res == 0 && has_data(file)) {
+		char* objpath = this->object_path(file->digest());
+		IF_DEBUG("[objects] restoring %s from %s\n", path, objpath);
+		unlink(path);
+		if (S_ISLNK(file->mode())) {
+			char link[PATH_MAX];
+			ssize_t len = -1;
+			int fd = open(objpath, O_RDONLY);
+			if (fd != -1) {
+				len = read(fd, link, sizeof(link) - 1);
+				close(fd);
+			}
+			if (len >= 0) {
+				link[len] = 0;
+				res = symlink(link, path);
+			} else {
+				res = -1;
+			}
+		} else {
+			int method;
+			off_t size;
+			res = backup_data(objpath, path, false, &method, &size);
+		}
+		if (res != 0) {
+			fprintf(stderr, "%s:%d: unable to restore %s from %s: %s (%d)\n", 
+					__FILE__, __LINE__, path, objpath, strerror(errno), errno);
+		}
+		free(objpath);
+	} else if (res == 0) {
+		// nothing to restore
+		return 0;
+	}
+
+	// chown clears the set-id bits, so the mode comes after
+	if (res == 0) res = lchown(path, file->uid(), file->gid());
+	if (res == 0 && !S_ISLNK(file->mode())) res = chmod(path, mode);
+	if (res != 0) {
+		fprintf(stderr, "%s:%d: %s: %s (%d)\n", 
+				__FILE__, __LINE__, path, strerror(errno), errno);
+	}
+	return res;
+}
+
+int ObjectStore::prune(PathIndex* referenced, uint32_t* removed) {
+	int res = 0;
+	*removed = 0;
+	DIR* top = opendir(m_path);
+	if (!top) {
+		fprintf(stderr, "Error: unable to open %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return -1;
+	}
+	struct dirent* dp;
+	while (res == 0 && (dp = readdir(top)) != NULL) {
+		if (dp->d_name[0] == '.' || strlen(dp->d_name) != 2) continue;
+		char dirpath[PATH_MAX];
+		if (snprintf(dirpath, sizeof(dirpath), "%s/%s", m_path, dp->d_name) >= (int)sizeof(dirpath)) {
+			fprintf(stderr, "Error: path too long: %s/%s\n", m_path, dp->d_name);
+			res = -1;
+			break;
+		}
+		DIR* dir = opendir(dirpath);
+		if (!dir) continue;
+		struct dirent* op;
+		while ((op = readdir(dir)) != NULL) {
+			if (strcmp(op->d_name, ".") == 0 || strcmp(op->d_name, "..") == 0) continue;
+			char hex[PATH_MAX];
+			char objpath[PATH_MAX];
+			if (snprintf(hex, sizeof(hex), "%s%s", dp->d_name, op->d_name) >= (int)sizeof(hex) ||
+				snprintf(objpath, sizeof(objpath), "%s/%s", dirpath, op->d_name) >= (int)sizeof(objpath)) {
+				fprintf(stderr, "Error: path too long: %s/%s\n", dirpath, op->d_name);
+				res = -1;
+				break;
+			}
+			if (referenced->get(hex)) continue;
+			IF_DEBUG("[objects] removing unreferenced %s\n", objpath);
+			if (unlink(objpath) == 0) {
+				(*removed)++;
+			} else {
+				fprintf(stderr, "%s:%d: %s: %s (%d)\n", 
+						__FILE__, __LINE__, objpath, strerror(errno), errno);
+				res = -1;
+			}
+		}
+		closedir(dir);
+		// only succeeds once the last object is gone
+		rmdir(dirpath);
+	}
+	closedir(top);
+	return res;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _OBJECTSTORE_H
+#define _OBJECTSTORE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct Digest;
+struct File;
+struct PathIndex;
+
+////
+//  ObjectStore
+//
+//  Content-addressed storage for the file data in a depot, used in place
+//  of a compacted backing store for each archive once the depot has been
+//  migrated.  The data of each regular file or symlink is stored once,
+//  no matter how many archives refer to it, at
+//
+//      Archives/objects/<first 2 digits of its SHA-1>/<remaining 38 digits>
+//
+//  Symlinks are stored as a regular file holding the link target, which
+//  is the data their digest is computed over.  Objects only hold data;
+//  the mode and ownership of a file come from its database record.
+//
+//  Objects are written under a temporary name and renamed into place,
+//  so an object that exists is always complete.  The data is digested
+//  as it is stored, and is refused if it no longer matches the digest
+//  recorded for the file.
+////
+struct ObjectStore {
+	ObjectStore(const char* archives_path);
+	virtual ~ObjectStore();
+
+	// Returns true if the depot at archives_path has an object store.
+	static bool exists(const char* archives_path);
+
+	// Returns true if file has data that is kept in the object store.
+	static bool has_data(File* file);
+
+	// Creates the objects directory.
+	int create(mode_t mode, uid_t uid, gid_t gid);
+
+	// Path of the objects directory.
+	// Do not modify or free(3).
+	const char* path();
+
+	// Returns the path of the object with the given digest.
+	// The result should be released with free(3).
+	char* object_path(Digest* digest);
+
+	// Returns true if the object for file's data is present.
+	bool has(File* file);
+
+	// Stores the data of file, which is currently at path, unless the
+	// object is already present.  replaced is passed on to share_data().
+	// method is set to one of the BACKUP_ values, or -1 if nothing
+	// was written, and size to the number of bytes stored.
+	int store(File* file, const char* path, bool replaced, int* method, off_t* size);
+
+	// Recreates file at path from its object, or creates the directory,
+	// and applies the mode and ownership from file.
+	int restore(File* file, const char* path);
+
+	// Removes every object whose digest string is not in referenced.
+	int prune(PathIndex* referenced, uint32_t* removed);
+
+	protected:
+
+	// Copies the regular file src to dst, computing the digest of the
+	// data read into digest.
+	static int copy_data(const char* src, const char* dst, Digest* digest, off_t* size);
+
+	char*    m_path;
+};
+
+#endif
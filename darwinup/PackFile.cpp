@@ -0,0 +1,840 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "PackFile.h"
+#include "Digest.h"
+#include "PathIndex.h"
+#include "Utils.h"
+#include "WorkQueue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__APPLE__)
+# include <sys/acl.h>
+# include <Availability.h>
+# if __MAC_OS_X_VERSION_MIN_REQUIRED >= 101100
+#  include <compression.h>
+#  define PACK_HAS_XZ 1
+# endif
+#else
+# include <lzma.h>
+# define PACK_HAS_XZ 1
+#endif
+
+#define PACK_CHUNK_HEADER  8
+#define PACK_RECORD_SIZE   (4 + 3 * 4 + 5 * 8 + 20)
+#define PACK_TRAILER_SIZE  (2 * 8 + PACK_MAGIC_SIZE)
+
+static void pack_put32(uint8_t* p, uint32_t v) {
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+static void pack_put64(uint8_t* p, uint64_t v) {
+	pack_put32(p, (uint32_t)(v >> 32));
+	pack_put32(p + 4, (uint32_t)v);
+}
+
+static uint32_t pack_get32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | 
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t pack_get64(const uint8_t* p) {
+	return ((uint64_t)pack_get32(p) << 32) | pack_get32(p + 4);
+}
+
+
+static const char* pack_codec_names[PACK_CODEC_COUNT] = { "zlib", "none", "xz" };
+
+
+PackFile::PackFile(const char* path, uint32_t codec) {
+	m_path = strdup(path);
+	m_codec = codec;
+	m_level = PACK_LEVEL_DEFAULT;
+	m_fd = -1;
+	m_offset = 0;
+	m_entries = NULL;
+	m_count = 0;
+	m_capacity = 0;
+	m_sorted = NULL;
+	m_raw = NULL;
+	m_zbuf = NULL;
+	m_queue = NULL;
+	m_pending = 0;
+	m_max_pending = 0;
+}
+
+PackFile::~PackFile() {
+	if (m_fd != -1) close(m_fd);
+	this->free_entries();
+	free(m_raw);
+	free(m_zbuf);
+	free(m_path);
+}
+
+int PackFile::parse_codec(const char* spec, uint32_t* codec, uint32_t* level) {
+	const char* colon = strchr(spec, ':');
+	size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+	*level = PACK_LEVEL_DEFAULT;
+	if (colon) {
+		char* end;
+		long value = strtol(colon + 1, &end, 10);
+		if (*end != 0 || end == colon + 1 || value < 1 || value > 9) return -1;
+		*level = (uint32_t)value;
+	}
+	for (uint32_t i = 0; i < PACK_CODEC_COUNT; i++) {
+		if (strlen(pack_codec_names[i]) == len && 
+			strncmp(spec, pack_codec_names[i], len) == 0) {
+			*codec = i;
+#if !PACK_HAS_XZ
+			if (i == PACK_CODEC_XZ) return -1;
+#endif
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char* PackFile::codec_name(uint32_t codec) {
+	if (codec >= PACK_CODEC_COUNT) return "unknown";
+	return pack_codec_names[codec];
+}
+
+void PackFile::free_entries() {
+	for (uint32_t i = 0; i < m_count; i++) {
+		free(m_entries[i].path);
+	}
+	free(m_entries);
+	free(m_sorted);
+	m_entries = NULL;
+	m_sorted = NULL;
+	m_count = 0;
+	m_capacity = 0;
+}
+
+void PackFile::release() {
+	if (m_fd != -1) close(m_fd);
+	m_fd = -1;
+	free(m_raw);
+	free(m_zbuf);
+	m_raw = NULL;
+	m_zbuf = NULL;
+}
+
+bool PackFile::loses_metadata(FTSENT* ent, PathIndex* inodes) {
+	struct stat* sb = ent->fts_statp;
+	// links to files outside of the pack, such as the live files of a
+	// rollback archive, are not lost
+	if (!S_ISDIR(sb->st_mode) && sb->st_nlink > 1) {
+		char key[48];
+		snprintf(key, sizeof(key), "%llu:%llu", 
+				 (unsigned long long)sb->st_dev, (unsigned long long)sb->st_ino);
+		if (inodes->set(key, ent)) return true;
+	}
+#if defined(__APPLE__)
+	if (sb->st_flags != 0) return true;
+	acl_t acl = acl_get_link_np(ent->fts_accpath, ACL_TYPE_EXTENDED);
+	if (acl) {
+		acl_free(acl);
+		return true;
+	}
+#endif
+	// ACLs are extended attributes on other systems
+	return listxattr(ent->fts_accpath, NULL, 0, XATTR_NOFOLLOW) > 0;
+}
+
+int PackFile::write(const char* dirpath, uint32_t level) {
+	int res = PACK_OK;
+	if (m_codec >= PACK_CODEC_COUNT) {
+		fprintf(stderr, "Error: unknown codec for %s: %u\n", m_path, m_codec);
+		return PACK_ERROR;
+	}
+	m_level = level;
+
+	m_fd = open(m_path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (m_fd == -1) {
+		fprintf(stderr, "Error: unable to create %s: %s (%d)\n", 
+				m_path, strerror(errno), errno);
+		return PACK_ERROR;
+	}
+	m_offset = 0;
+	res = this->write_all(PACK_MAGIC, PACK_MAGIC_SIZE);
+
+	m_queue = new WorkQueue(&PackFile::compress_chunk, this, 0);
+	if (res == PACK_OK) res = m_queue->start();
+	m_pending = 0;
+	m_max_pending = m_queue->workers() * PACK_CHUNKS_PER_WORKER;
+	if (m_max_pending > m_queue->capacity()) m_max_pending = m_queue->capacity();
+
+	PathIndex inodes;
+	size_t prefixlen = strlen(dirpath);
+	const char* path_argv[] = { dirpath, NULL };
+	FTS* fts = fts_open((char**)path_argv, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, 
+						fts_compare);
+	FTSENT* ent;
+	while (res == PACK_OK && fts && (ent = fts_read(fts)) != NULL) {
+		if (ent->fts_level == 0 || ent->fts_info == FTS_DP) continue;
+		if (ent->fts_info == FTS_DNR || ent->fts_info == FTS_ERR || 
+			ent->fts_info == FTS_NS) {
+			fprintf(stderr, "Error: %s: %s (%d)\n", ent->fts_path, 
+					strerror(ent->fts_errno), ent->fts_errno);
+			res = PACK_ERROR;
+			break;
+		}
+		if (PackFile::loses_metadata(ent, &inodes)) {
+			IF_DEBUG("[pack] %s has metadata a pack cannot hold\n", ent->fts_path);
+			res = PACK_UNSUPPORTED;
+			break;
+		}
+
+		if (m_count == m_capacity) {
+			uint32_t capacity = m_capacity ? m_capacity * 2 : 256;
+			PackEntry* entries = (PackEntry*)realloc(m_entries, 
+													 capacity * sizeof(PackEntry));
+			if (!entries) {
+				fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+				res = PACK_ERROR;
+				break;
+			}
+			m_entries = entries;
+			m_capacity = capacity;
+		}
+
+		PackEntry* pe = &m_entries[m_count];
+		struct stat* sb = ent->fts_statp;
+		memset(pe, 0, sizeof(PackEntry));
+		pe->path = strdup(ent->fts_path + prefixlen);
+		pe->mode = sb->st_mode;
+		pe->uid = sb->st_uid;
+		pe->gid = sb->st_gid;
+		if (S_ISCHR(sb->st_mode) || S_ISBLK(sb->st_mode)) pe->rdev = sb->st_rdev;
+		pe->mtime = sb->st_mtime;
+		m_count++;
+
+		res = this->write_entry(m_count - 1, ent->fts_path);
+	}
+	if (fts) fts_close(fts);
+
+	// write out the chunks still in flight, or throw them away
+	PackChunk* chunk;
+	if (res == PACK_OK) {
+		m_queue->close();
+	} else {
+		m_queue->cancel();
+	}
+	while ((chunk = (PackChunk*)m_queue->pop()) != NULL) {
+		if (res == PACK_OK) {
+			res = this->write_chunk(chunk);
+		} else {
+			free(chunk->data);
+			free(chunk->out);
+			free(chunk);
+		}
+	}
+	delete m_queue;
+	m_queue = NULL;
+
+	if (res == PACK_OK) res = this->write_index();
+	if (close(m_fd) != 0 && res == PACK_OK) res = PACK_ERROR;
+	m_fd = -1;
+	if (res == PACK_ERROR) fprintf(stderr, "Error: unable to write %s\n", m_path);
+	if (res != PACK_OK) unlink(m_path);
+	return res;
+}
+
+int PackFile::write_all(const void* buf, size_t len) {
+	const uint8_t* p = (const uint8_t*)buf;
+	while (len > 0) {
+		ssize_t n = ::write(m_fd, p, len);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) {
+			fprintf(stderr, "Error: %s: %s (%d)\n", m_path, strerror(errno), errno);
+			return PACK_ERROR;
+		}
+		p += n;
+		len -= n;
+		m_offset += n;
+	}
+	return PACK_OK;
+}
+
+int PackFile::write_entry(uint32_t index, const char* path) {
+	int res = PACK_OK;
+	PackEntry* ent = &m_entries[index];
+	CC_SHA1_CTX c;
+	CC_SHA1_Init(&c);
+
+	// the offset of an entry with data is that of its first chunk,
+	// which is only known once the chunk is written
+	ent->offset = m_offset;
+	ent->length = 0;
+
+	if (S_ISREG(ent->mode)) {
+		int fd = open(path, O_RDONLY);
+		if (fd == -1) {
+			fprintf(stderr, "Error: %s: %s (%d)\n", path, strerror(errno), errno);
+			return PACK_ERROR;
+		}
+		for (;;) {
+			uint8_t* data = (uint8_t*)malloc(PACK_CHUNK_SIZE);
+			ssize_t n = data ? read(fd, data, PACK_CHUNK_SIZE) : -1;
+			while (n == -1 && data && errno == EINTR) n = read(fd, data, PACK_CHUNK_SIZE);
+			if (n == -1) {
+				fprintf(stderr, "Error: %s: %s (%d)\n", path, strerror(errno), errno);
+				res = PACK_ERROR;
+			}
+			if (n <= 0) {
+				free(data);
+				break;
+			}
+			if (ent->size == 0) ent->offset = -1;
+			CC_SHA1_Update(&c, data, (CC_LONG)n);
+			ent->size += n;
+			res = this->queue_chunk(index, data, (uint32_t)n);
+			if (res != PACK_OK) break;
+			// the entries may move while chunks are written
+			ent = &m_entries[index];
+		}
+		close(fd);
+	} else if (S_ISLNK(ent->mode)) {
+		uint8_t* data = (uint8_t*)malloc(PATH_MAX);
+		ssize_t n = data ? readlink(path, (char*)data, PATH_MAX) : -1;
+		if (n <= 0) {
+			fprintf(stderr, "Error: %s: %s (%d)\n", path, strerror(errno), errno);
+			free(data);
+			return PACK_ERROR;
+		}
+		ent->offset = -1;
+		ent->size = n;
+		CC_SHA1_Update(&c, data, (CC_LONG)n);
+		res = this->queue_chunk(index, data, (uint32_t)n);
+		ent = &m_entries[index];
+	}
+
+	CC_SHA1_Final(ent->digest, &c);
+	return res;
+}
+
+int PackFile::queue_chunk(uint32_t index, uint8_t* data, uint32_t size) {
+	int res = PACK_OK;
+	PackChunk* chunk = (PackChunk*)malloc(sizeof(PackChunk));
+	if (!chunk) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		free(data);
+		return PACK_ERROR;
+	}
+	chunk->entry = index;
+	chunk->data = data;
+	chunk->size = size;
+	chunk->out = NULL;
+	chunk->out_size = 0;
+
+	// keep the queue full, writing the oldest chunk once it is done
+	if (m_pending == m_max_pending) {
+		res = this->write_chunk((PackChunk*)m_queue->pop());
+		m_pending--;
+	}
+	if (res == PACK_OK) res = m_queue->push(chunk);
+	if (res == PACK_OK) {
+		m_pending++;
+	} else {
+		free(chunk->data);
+		free(chunk);
+	}
+	return res;
+}
+
+int PackFile::compress_chunk(void* item, void* context) {
+	PackFile* pack = (PackFile*)context;
+	PackChunk* chunk = (PackChunk*)item;
+	size_t len = 0;
+
+	if (pack->m_codec == PACK_CODEC_ZLIB) {
+		uLongf zlen = compressBound(chunk->size);
+		chunk->out = (uint8_t*)malloc(zlen);
+		int level = pack->m_level ? (int)pack->m_level : Z_DEFAULT_COMPRESSION;
+		if (chunk->out && 
+			compress2(chunk->out, &zlen, chunk->data, chunk->size, level) == Z_OK) {
+			len = zlen;
+		}
+#if PACK_HAS_XZ
+	} else if (pack->m_codec == PACK_CODEC_XZ) {
+# if defined(__APPLE__)
+		// the system encoder always uses its default level
+		size_t cap = chunk->size;
+		chunk->out = (uint8_t*)malloc(cap);
+		if (chunk->out) {
+			len = compression_encode_buffer(chunk->out, cap, chunk->data, chunk->size,
+											NULL, COMPRESSION_LZMA);
+		}
+# else
+		size_t cap = lzma_stream_buffer_bound(chunk->size);
+		uint32_t preset = pack->m_level ? pack->m_level : LZMA_PRESET_DEFAULT;
+		chunk->out = (uint8_t*)malloc(cap);
+		if (chunk->out && 
+			lzma_easy_buffer_encode(preset, LZMA_CHECK_CRC32, NULL, chunk->data, 
+									chunk->size, chunk->out, &len, cap) != LZMA_OK) {
+			len = 0;
+		}
+# endif
+#endif
+	}
+
+	// data that does not compress is stored as is
+	if (len == 0 || len >= chunk->size) {
+		free(chunk->out);
+		chunk->out = NULL;
+		len = 0;
+	}
+	chunk->out_size = (uint32_t)len;
+	return 0;
+}
+
+int PackFile::write_chunk(PackChunk* chunk) {
+	int res = PACK_OK;
+	PackEntry* ent = &m_entries[chunk->entry];
+	if (ent->offset == -1) ent->offset = m_offset;
+
+	uint8_t header[PACK_CHUNK_HEADER];
+	pack_put32(header, chunk->out ? chunk->out_size : 0);
+	pack_put32(header + 4, chunk->size);
+	res = this->write_all(header, sizeof(header));
+	if (res == PACK_OK && chunk->out) {
+		res = this->write_all(chunk->out, chunk->out_size);
+	} else if (res == PACK_OK) {
+		res = this->write_all(chunk->data, chunk->size);
+	}
+	ent->length = m_offset - ent->offset;
+
+	free(chunk->data);
+	free(chunk->out);
+	free(chunk);
+	return res;
+}
+
+int PackFile::write_index() {
+	int res = PACK_OK;
+	off_t index_offset = m_offset;
+	for (uint32_t i = 0; res == PACK_OK && i < m_count; i++) {
+		PackEntry* ent = &m_entries[i];
+		uint8_t record[PACK_RECORD_SIZE];
+		uint32_t pathlen = strlen(ent->path);
+		pack_put32(record, pathlen);
+		res = this->write_all(record, 4);
+		if (res == PACK_OK) res = this->write_all(ent->path, pathlen);
+		pack_put32(record, (uint32_t)ent->mode);
+		pack_put32(record + 4, (uint32_t)ent->uid);
+		pack_put32(record + 8, (uint32_t)ent->gid);
+		pack_put64(record + 12, (uint64_t)ent->rdev);
+		pack_put64(record + 20, (uint64_t)ent->mtime);
+		pack_put64(record + 28, (uint64_t)ent->size);
+		pack_put64(record + 36, (uint64_t)ent->offset);
+		pack_put64(record + 44, (uint64_t)ent->length);
+		memcpy(record + 52, ent->digest, sizeof(ent->digest));
+		if (res == PACK_OK) res = this->write_all(record, PACK_RECORD_SIZE - 4);
+	}
+
+	uint8_t trailer[PACK_TRAILER_SIZE];
+	pack_put64(trailer, (uint64_t)index_offset);
+	pack_put64(trailer + 8, (uint64_t)m_count);
+	memcpy(trailer + 16, PACK_MAGIC, PACK_MAGIC_SIZE);
+	if (res == PACK_OK) res = this->write_all(trailer, sizeof(trailer));
+	return res;
+}
+
+int PackFile::open_data() {
+	m_fd = open(m_path, O_RDONLY);
+	if (m_fd == -1) {
+		fprintf(stderr, "Error: unable to open %s: %s (%d)\n", 
+				m_path, strerror(errno), errno);
+		return PACK_ERROR;
+	}
+	return PACK_OK;
+}
+
+static int compare_entries(const void* a, const void* b) {
+	return strcmp((*(PackEntry**)a)->path, (*(PackEntry**)b)->path);
+}
+
+int PackFile::read_index() {
+	this->free_entries();
+	this->release();
+	IF_DEBUG("[pack] reading the index of %s\n", m_path);
+	if (this->open_data() != PACK_OK) return PACK_ERROR;
+
+	struct stat sb;
+	uint8_t magic[PACK_MAGIC_SIZE];
+	uint8_t trailer[PACK_TRAILER_SIZE];
+	if (fstat(m_fd, &sb) != 0 || 
+		sb.st_size < PACK_MAGIC_SIZE + PACK_TRAILER_SIZE ||
+		pread(m_fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+		pread(m_fd, trailer, sizeof(trailer), sb.st_size - sizeof(trailer)) != sizeof(trailer) ||
+		memcmp(magic, PACK_MAGIC, PACK_MAGIC_SIZE) != 0 ||
+		memcmp(trailer + 16, PACK_MAGIC, PACK_MAGIC_SIZE) != 0) {
+		fprintf(stderr, "Error: %s is not a pack file.\n", m_path);
+		return PACK_ERROR;
+	}
+
+	uint64_t index_offset = pack_get64(trailer);
+	uint64_t count = pack_get64(trailer + 8);
+	uint64_t index_end = sb.st_size - sizeof(trailer);
+	if (index_offset < PACK_MAGIC_SIZE || index_offset > index_end ||
+		count > (index_end - index_offset) / PACK_RECORD_SIZE) {
+		fprintf(stderr, "Error: %s has a corrupt index.\n", m_path);
+		return PACK_ERROR;
+	}
+
+	size_t len = index_end - index_offset;
+	uint8_t* index = (uint8_t*)malloc(len);
+	m_entries = (PackEntry*)calloc(count ? count : 1, sizeof(PackEntry));
+	if (!index || !m_entries) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		free(index);
+		return PACK_ERROR;
+	}
+	m_capacity = count;
+
+	int res = PACK_OK;
+	if (pread(m_fd, index, len, index_offset) != (ssize_t)len) res = PACK_ERROR;
+
+	const uint8_t* p = index;
+	const uint8_t* end = index + len;
+	for (uint64_t i = 0; res == PACK_OK && i < count; i++) {
+		if (end - p < 4) {
+			res = PACK_ERROR;
+			break;
+		}
+		uint32_t pathlen = pack_get32(p);
+		p += 4;
+		if ((size_t)(end - p) < pathlen + PACK_RECORD_SIZE - 4) {
+			res = PACK_ERROR;
+			break;
+		}
+		PackEntry* ent = &m_entries[m_count];
+		ent->path = (char*)malloc(pathlen + 1);
+		if (!ent->path) {
+			res = PACK_ERROR;
+			break;
+		}
+		memcpy(ent->path, p, pathlen);
+		ent->path[pathlen] = 0;
+		m_count++;
+		p += pathlen;
+		ent->mode = (mode_t)pack_get32(p);
+		ent->uid = (uid_t)pack_get32(p + 4);
+		ent->gid = (gid_t)pack_get32(p + 8);
+		ent->rdev = (dev_t)pack_get64(p + 12);
+		ent->mtime = (time_t)pack_get64(p + 20);
+		ent->size = (off_t)pack_get64(p + 28);
+		ent->offset = (off_t)pack_get64(p + 36);
+		ent->length = (off_t)pack_get64(p + 44);
+		memcpy(ent->digest, p + 52, sizeof(ent->digest));
+		p += PACK_RECORD_SIZE - 4;
+
+		// entries must stay inside the data and below the destination
+		if (ent->path[0] != '/' || strstr(ent->path, "/../") ||
+			has_suffix(ent->path, "/..") ||
+			ent->offset < PACK_MAGIC_SIZE || ent->length < 0 ||
+			(uint64_t)(ent->offset + ent->length) > index_offset) {
+			res = PACK_ERROR;
+		}
+	}
+	free(index);
+
+	if (res == PACK_OK) {
+		m_sorted = (PackEntry**)malloc((m_count ? m_count : 1) * sizeof(PackEntry*));
+		if (m_sorted) {
+			for (uint32_t i = 0; i < m_count; i++) m_sorted[i] = &m_entries[i];
+			qsort(m_sorted, m_count, sizeof(PackEntry*), &compare_entries);
+		} else {
+			fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+			res = PACK_ERROR;
+		}
+	} else {
+		fprintf(stderr, "Error: %s has a corrupt index.\n", m_path);
+	}
+	if (res != PACK_OK) {
+		this->free_entries();
+		this->release();
+	}
+	return res;
+}
+
+uint32_t PackFile::lower_bound(const char* path) {
+	uint32_t lo = 0;
+	uint32_t hi = m_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (strcmp(m_sorted[mid]->path, path) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+int PackFile::extract(const char* destdir, const char* path, bool subtree) {
+	int res = PACK_OK;
+	if (!m_sorted) {
+		res = this->read_index();
+	} else if (m_fd == -1) {
+		res = this->open_data();
+	}
+	if (res != PACK_OK) return res;
+	if (!m_raw) m_raw = (uint8_t*)malloc(PACK_CHUNK_SIZE);
+	if (!m_zbuf) m_zbuf = (uint8_t*)malloc(PACK_CHUNK_SIZE);
+
+	// the entries to extract, parents first
+	PackEntry** todo = (PackEntry**)malloc((m_count ? m_count : 1) * sizeof(PackEntry*));
+	uint32_t todo_count = 0;
+	// directories get their mode and times once their contents are in place
+	PackEntry** dirs = (PackEntry**)malloc((m_count ? m_count : 1) * sizeof(PackEntry*));
+	uint32_t dir_count = 0;
+	if (!m_raw || !m_zbuf || !todo || !dirs) {
+		fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+		free(todo);
+		free(dirs);
+		return PACK_ERROR;
+	}
+
+	if (!path) {
+		for (uint32_t i = 0; i < m_count; i++) todo[todo_count++] = &m_entries[i];
+	} else {
+		uint32_t i = this->lower_bound(path);
+		if (i < m_count && strcmp(m_sorted[i]->path, path) == 0) {
+			todo[todo_count++] = m_sorted[i];
+		}
+		// everything below path sorts together, though not right after
+		// path when a sibling such as path.orig sorts in between
+		size_t len = strlen(path);
+		char* below = (char*)malloc(len + 2);
+		if (subtree && below) {
+			memcpy(below, path, len);
+			if (len == 0 || path[len - 1] != '/') below[len++] = '/';
+			below[len] = 0;
+			for (i = this->lower_bound(below); 
+				 i < m_count && strncmp(m_sorted[i]->path, below, len) == 0; i++) {
+				todo[todo_count++] = m_sorted[i];
+			}
+		} else if (subtree) {
+			fprintf(stderr, "%s:%d: out of memory\n", __FILE__, __LINE__);
+			res = PACK_ERROR;
+		}
+		free(below);
+	}
+
+	for (uint32_t i = 0; res == PACK_OK && i < todo_count; i++) {
+		PackEntry* ent = todo[i];
+		IF_DEBUG("[pack] extracting %s from %s\n", ent->path, m_path);
+		res = this->extract_entry(ent, destdir);
+		if (res == PACK_OK && S_ISDIR(ent->mode)) dirs[dir_count++] = ent;
+	}
+	free(todo);
+
+	while (dir_count > 0) {
+		PackEntry* ent = dirs[--dir_count];
+		char* dstpath;
+		join_path(&dstpath, destdir, ent->path);
+		this->finish_entry(ent, dstpath, -1);
+		free(dstpath);
+	}
+	free(dirs);
+	return res;
+}
+
+int PackFile::extract_entry(PackEntry* ent, const char* destdir) {
+	int res = PACK_OK;
+	char* dstpath;
+	join_path(&dstpath, destdir, ent->path);
+
+	// parents that are not being extracted are created as plain directories
+	char* slash = strrchr(dstpath, '/');
+	*slash = 0;
+	if (!is_directory(dstpath, false)) {
+		res = mkdir_p(dstpath);
+		if (res == -1 && errno == EEXIST) res = 0;
+	}
+	*slash = '/';
+
+	if (res == 0 && S_ISDIR(ent->mode)) {
+		res = mkdir(dstpath, 0700);
+		if (res == -1 && errno == EEXIST && is_directory(dstpath, false)) res = 0;
+	} else if (res == 0) {
+		if (unlink(dstpath) == -1 && errno != ENOENT) res = -1;
+	}
+
+	if (res == 0 && S_ISREG(ent->mode)) {
+		int fd = open(dstpath, O_WRONLY | O_CREAT | O_EXCL, 0600);
+		if (fd == -1) {
+			res = -1;
+		} else {
+			res = this->read_data(ent, fd, NULL, 0);
+			if (res == PACK_OK) this->finish_entry(ent, NULL, fd);
+			if (close(fd) != 0) res = -1;
+		}
+	} else if (res == 0 && S_ISLNK(ent->mode)) {
+		char target[PATH_MAX];
+		res = this->read_data(ent, -1, target, sizeof(target));
+		if (res == PACK_OK) res = symlink(target, dstpath);
+		if (res == 0) this->finish_entry(ent, dstpath, -1);
+	} else if (res == 0 && !S_ISDIR(ent->mode)) {
+		res = mknod(dstpath, ent->mode, ent->rdev);
+		if (res == 0) this->finish_entry(ent, dstpath, -1);
+	}
+
+	if (res != PACK_OK) {
+		fprintf(stderr, "Error: unable to extract %s from %s: %s (%d)\n", 
+				dstpath, m_path, strerror(errno), errno);
+		res = PACK_ERROR;
+	}
+	free(dstpath);
+	return res;
+}
+
+int PackFile::read_data(PackEntry* ent, int fd, char* target, size_t bufsiz) {
+	CC_SHA1_CTX c;
+	CC_SHA1_Init(&c);
+	off_t pos = ent->offset;
+	off_t end = ent->offset + ent->length;
+	off_t size = 0;
+	while (pos < end) {
+		uint8_t header[PACK_CHUNK_HEADER];
+		if (end - pos < PACK_CHUNK_HEADER ||
+			pread(m_fd, header, sizeof(header), pos) != sizeof(header)) break;
+		pos += sizeof(header);
+		uint32_t zlen = pack_get32(header);
+		uint32_t rlen = pack_get32(header + 4);
+		if (rlen > PACK_CHUNK_SIZE || zlen >= rlen) break;
+		if (zlen == 0) {
+			if (end - pos < (off_t)rlen || pread(m_fd, m_raw, rlen, pos) != (ssize_t)rlen) break;
+			pos += rlen;
+		} else {
+			if (end - pos < (off_t)zlen || pread(m_fd, m_zbuf, zlen, pos) != (ssize_t)zlen) break;
+			pos += zlen;
+			if (this->decompress_chunk(zlen, rlen) != PACK_OK) break;
+		}
+		CC_SHA1_Update(&c, m_raw, (CC_LONG)rlen);
+
+		if (fd != -1) {
+			size_t off = 0;
+			while (off < rlen) {
+				ssize_t n = ::write(fd, m_raw + off, rlen - off);
+				if (n == -1 && errno == EINTR) continue;
+				if (n <= 0) return PACK_ERROR;
+				off += n;
+			}
+		} else if ((size_t)(size + rlen) < bufsiz) {
+			memcpy(target + size, m_raw, rlen);
+			target[size + rlen] = 0;
+		} else {
+			errno = ENAMETOOLONG;
+			return PACK_ERROR;
+		}
+		size += rlen;
+	}
+
+	uint8_t digest[20];
+	CC_SHA1_Final(digest, &c);
+	if (pos != end || size != ent->size || 
+		memcmp(digest, ent->digest, sizeof(digest)) != 0) {
+		fprintf(stderr, "Error: the data for %s in %s is corrupt.\n", ent->path, m_path);
+		errno = EIO;
+		return PACK_ERROR;
+	}
+	if (fd == -1 && size == 0 && bufsiz) target[0] = 0;
+	return PACK_OK;
+}
+
+int PackFile::decompress_chunk(uint32_t zlen, uint32_t rlen) {
+	size_t len = 0;
+	if (m_codec == PACK_CODEC_ZLIB) {
+		uLongf dlen = PACK_CHUNK_SIZE;
+		if (uncompress(m_raw, &dlen, m_zbuf, zlen) == Z_OK) len = dlen;
+#if PACK_HAS_XZ
+	} else if (m_codec == PACK_CODEC_XZ) {
+# if defined(__APPLE__)
+		len = compression_decode_buffer(m_raw, PACK_CHUNK_SIZE, m_zbuf, zlen, 
+										NULL, COMPRESSION_LZMA);
+# else
+		uint64_t memlimit = UINT64_MAX;
+		size_t in_pos = 0;
+		if (lzma_stream_buffer_decode(&memlimit, 0, NULL, m_zbuf, &in_pos, zlen,
+									  m_raw, &len, PACK_CHUNK_SIZE) != LZMA_OK) {
+			len = 0;
+		}
+# endif
+#endif
+	} else {
+		fprintf(stderr, "Error: %s uses an unsupported codec: %s\n", 
+				m_path, PackFile::codec_name(m_codec));
+	}
+	return (len == rlen) ? PACK_OK : PACK_ERROR;
+}
+
+void PackFile::finish_entry(PackEntry* ent, const char* path, int fd) {
+	// the ownership can only be restored by root, which darwinup 
+	// requires to write to the depot anyway
+	if (getuid() == 0) {
+		int res = (fd != -1) ? fchown(fd, ent->uid, ent->gid) : 
+			lchown(path, ent->uid, ent->gid);
+		if (res != 0) IF_DEBUG("[pack] unable to change owner of %s\n", ent->path);
+	}
+	// chown clears the set-id bits, so the mode comes after
+	if (fd != -1) {
+		fchmod(fd, ent->mode & ALLPERMS);
+	} else if (!S_ISLNK(ent->mode)) {
+		chmod(path, ent->mode & ALLPERMS);
+	}
+
+	struct timeval tv[2];
+	tv[0].tv_sec = tv[1].tv_sec = ent->mtime;
+	tv[0].tv_usec = tv[1].tv_usec = 0;
+	if (fd != -1) {
+		futimes(fd, tv);
+	} else {
+		lutimes(path, tv);
+	}
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _PACKFILE_H
+#define _PACKFILE_H
+
+#include <fts.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define PACK_OK          0
+#define PACK_ERROR      -1
+#define PACK_UNSUPPORTED -2
+
+#define PACK_SUFFIX      ".pack"
+#define PACK_MAGIC       "DUPACK01"
+#define PACK_MAGIC_SIZE  8
+
+// uncompressed size of each independently compressed chunk of file data
+#define PACK_CHUNK_SIZE  (1024 * 1024)
+
+// chunks being compressed at once for each worker thread
+#define PACK_CHUNKS_PER_WORKER 4
+
+// Codecs for the chunks of a pack, as recorded for each archive.
+// Packs were always zlib compressed before the codec was recorded.
+#define PACK_CODEC_ZLIB  0
+#define PACK_CODEC_NONE  1
+#define PACK_CODEC_XZ    2
+#define PACK_CODEC_COUNT 3
+
+// level of 0 uses the default level of the codec
+#define PACK_LEVEL_DEFAULT 0
+
+struct PathIndex;
+struct WorkQueue;
+
+////
+//  PackEntry
+//
+//  One file, directory or symlink of a pack, as recorded in its index.
+////
+struct PackEntry {
+	char*    path;      // relative to the packed directory, with a leading slash
+	mode_t   mode;
+	uid_t    uid;
+	gid_t    gid;
+	dev_t    rdev;
+	time_t   mtime;
+	off_t    size;      // of the uncompressed data
+	off_t    offset;    // of the first chunk
+	off_t    length;    // of all of the chunks
+	uint8_t  digest[20];
+};
+
+////
+//  PackChunk
+//
+//  Up to PACK_CHUNK_SIZE bytes of the data of one entry, on its way
+//  through the compression workers.
+////
+struct PackChunk {
+	uint32_t entry;     // index into the entries of the pack
+	uint8_t* data;
+	uint32_t size;
+	uint8_t* out;       // compressed data, or NULL to store data as is
+	uint32_t out_size;
+};
+
+////
+//  PackFile
+//
+//  The compacted backing store of an archive.  Unlike a tarball, any
+//  file in a pack can be extracted without reading the ones before it:
+//
+//      "DUPACK01"
+//      chunks of file data, each a 32-bit compressed length (0 if the
+//        chunk is stored as is), a 32-bit uncompressed length and the
+//        data compressed with the codec of the pack
+//      the index, one record per entry: path length, path, mode, uid,
+//        gid, rdev, mtime, size, offset, length and SHA-1 digest
+//      the offset of the index, the number of entries and "DUPACK01"
+//
+//  All integers are big-endian.  The data of a symlink is its target.
+//  The digest of each entry is checked as it is extracted.
+//
+//  A pack only keeps the data, type, ownership, mode and modification
+//  time of each entry.  Extended attributes, ACLs, file flags and hard
+//  links between entries would be lost, so a directory with any of them
+//  is not packed.
+//
+//  The codec is not stored in the pack; the database records it along
+//  with the archive.  Chunks are compressed on a pool of worker threads
+//  and written in order as they complete.
+////
+struct PackFile {
+	PackFile(const char* path, uint32_t codec);
+	virtual ~PackFile();
+
+	// Parses a codec name, optionally followed by a colon and a level
+	// from 1 to 9, such as "xz:9".  Returns -1 if spec is not valid.
+	static int parse_codec(const char* spec, uint32_t* codec, uint32_t* level);
+	static const char* codec_name(uint32_t codec);
+
+	// Packs everything below dirpath into a new pack file.  Returns
+	// PACK_UNSUPPORTED, without leaving a pack behind, if anything
+	// below dirpath has metadata a pack cannot hold.
+	int write(const char* dirpath, uint32_t level);
+
+	// Extracts the entry for path into destdir, along with everything
+	// below it if subtree is true.  A NULL path extracts every entry.
+	// Paths are relative to destdir and start with a slash.
+	// The index is read once, and kept for later calls.
+	int extract(const char* destdir, const char* path, bool subtree);
+
+	// Closes the pack file, keeping the index.  The next extract()
+	// opens it again.
+	void release();
+
+	protected:
+
+	int     write_all(const void* buf, size_t len);
+	int     write_entry(uint32_t index, const char* path);
+	int     queue_chunk(uint32_t index, uint8_t* data, uint32_t size);
+	int     write_chunk(PackChunk* chunk);
+	int     write_index();
+	static int compress_chunk(void* item, void* context);
+	int     decompress_chunk(uint32_t zlen, uint32_t rlen);
+
+	// inodes holds the links seen so far
+	static bool loses_metadata(FTSENT* ent, PathIndex* inodes);
+
+	int     read_index();
+	int     open_data();
+	uint32_t lower_bound(const char* path);
+	int     extract_entry(PackEntry* ent, const char* destdir);
+	int     read_data(PackEntry* ent, int fd, char* target, size_t bufsiz);
+	void    finish_entry(PackEntry* ent, const char* path, int fd);
+	void    free_entries();
+
+	char*      m_path;
+	uint32_t   m_codec;
+	uint32_t   m_level;
+	int        m_fd;
+	off_t      m_offset;
+	PackEntry* m_entries;
+	uint32_t   m_count;
+	uint32_t   m_capacity;
+	PackEntry** m_sorted; // the entries in strcmp(3) order of their paths
+	uint8_t*   m_raw;     // PACK_CHUNK_SIZE bytes of file data
+	uint8_t*   m_zbuf;    // a compressed chunk, always smaller than its data
+
+	WorkQueue* m_queue;
+	uint32_t   m_pending; // chunks pushed but not yet written
+	uint32_t   m_max_pending;
+};
+
+#endif
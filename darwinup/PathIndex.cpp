@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "PathIndex.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+PathIndex::PathIndex() {
+	m_bucket_count = PATHINDEX_INITIAL_BUCKETS;
+	m_buckets = (PathIndexEntry**)calloc(m_bucket_count, sizeof(PathIndexEntry*));
+	assert(m_buckets != NULL);
+	m_count = 0;
+}
+
+PathIndex::~PathIndex() {
+	for (uint32_t i = 0; i < m_bucket_count; i++) {
+		PathIndexEntry* entry = m_buckets[i];
+		while (entry) {
+			PathIndexEntry* next = entry->next;
+			free(entry->path);
+			free(entry);
+			entry = next;
+		}
+	}
+	free(m_buckets);
+}
+
+uint32_t PathIndex::count() {
+	return m_count;
+}
+
+// 32-bit FNV-1a
+uint32_t PathIndex::hash(const char* path) {
+	uint32_t h = 2166136261U;
+	for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+		h ^= *p;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+PathIndexEntry** PathIndex::find(const char* path, uint32_t hash) {
+	PathIndexEntry** link = &m_buckets[hash & (m_bucket_count - 1)];
+	while (*link) {
+		if ((*link)->hash == hash && strcmp((*link)->path, path) == 0) break;
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+void PathIndex::grow() {
+	uint32_t count = m_bucket_count * 2;
+	PathIndexEntry** buckets = (PathIndexEntry**)calloc(count, sizeof(PathIndexEntry*));
+	if (!buckets) return; // keep the longer chains
+	for (uint32_t i = 0; i < m_bucket_count; i++) {
+		PathIndexEntry* entry = m_buckets[i];
+		while (entry) {
+			PathIndexEntry* next = entry->next;
+			PathIndexEntry** bucket = &buckets[entry->hash & (count - 1)];
+			entry->next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+	free(m_buckets);
+	m_buckets = buckets;
+	m_bucket_count = count;
+}
+
+void* PathIndex::set(const char* path, void* value) {
+	uint32_t h = PathIndex::hash(path);
+	PathIndexEntry** link = this->find(path, h);
+	if (*link) {
+		void* old = (*link)->value;
+		(*link)->value = value;
+		return old;
+	}
+
+	PathIndexEntry* entry = (PathIndexEntry*)malloc(sizeof(PathIndexEntry));
+	assert(entry != NULL);
+	entry->path = strdup(path);
+	entry->hash = h;
+	entry->value = value;
+	entry->next = NULL;
+	*link = entry;
+	m_count++;
+
+	if (m_count > m_bucket_count) this->grow();
+	return NULL;
+}
+
+void* PathIndex::get(const char* path) {
+	PathIndexEntry* entry = *this->find(path, PathIndex::hash(path));
+	return entry ? entry->value : NULL;
+}
+
+void* PathIndex::take(const char* path) {
+	PathIndexEntry** link = this->find(path, PathIndex::hash(path));
+	PathIndexEntry* entry = *link;
+	if (!entry) return NULL;
+	void* value = entry->value;
+	*link = entry->next;
+	free(entry->path);
+	free(entry);
+	m_count--;
+	return value;
+}
+
+int PathIndex::each(PathIndexFunc func, void* context) {
+	int res = 0;
+	for (uint32_t i = 0; res == 0 && i < m_bucket_count; i++) {
+		PathIndexEntry* entry = m_buckets[i];
+		while (res == 0 && entry) {
+			PathIndexEntry* next = entry->next;
+			res = func(entry->path, entry->value, context);
+			entry = next;
+		}
+	}
+	return res;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _PATHINDEX_H
+#define _PATHINDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// initial number of hash buckets, must be a power of 2
+#define PATHINDEX_INITIAL_BUCKETS 256
+
+typedef int (*PathIndexFunc)(const char* path, void* value, void* context);
+
+struct PathIndexEntry {
+	char*           path;
+	uint32_t        hash;
+	void*           value;
+	PathIndexEntry* next;
+};
+
+////
+//  PathIndex
+//
+//  An in-memory hash table from path to an arbitrary pointer.
+//  Paths are copied, values are not owned by the index.
+////
+struct PathIndex {
+	PathIndex();
+	~PathIndex();
+
+	// Stores value for path.
+	// Returns the value previously stored for path, or NULL.
+	void*    set(const char* path, void* value);
+
+	// Returns the value stored for path, or NULL.
+	void*    get(const char* path);
+
+	// Removes path from the index, returning its value or NULL.
+	void*    take(const char* path);
+
+	// Calls func for every entry, in no particular order,
+	// stopping if func returns non-zero.
+	int      each(PathIndexFunc func, void* context);
+
+	uint32_t count();
+
+	static uint32_t hash(const char* path);
+
+	protected:
+
+	PathIndexEntry** find(const char* path, uint32_t hash);
+	void             grow();
+
+	PathIndexEntry** m_buckets;
+	uint32_t         m_bucket_count;
+	uint32_t         m_count;
+};
+
+#endif
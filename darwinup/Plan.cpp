@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "Plan.h"
+#include "Digest.h"
+#include "File.h"
+#include "PathIndex.h"
+#include "Utils.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PLAN_DIGEST_SIZE   20
+#define PLAN_RECORD_SIZE   (3 * 4 + PLAN_DIGEST_SIZE + \
+							5 * 4 + 5 * 8 + PLAN_DIGEST_SIZE)
+#define PLAN_TRAILER_SIZE  (8 + PLAN_MAGIC_SIZE)
+
+static void plan_put32(uint8_t* p, uint32_t v) {
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+static void plan_put64(uint8_t* p, uint64_t v) {
+	plan_put32(p, (uint32_t)(v >> 32));
+	plan_put32(p + 4, (uint32_t)v);
+}
+
+static uint32_t plan_get32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | 
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t plan_get64(const uint8_t* p) {
+	return ((uint64_t)plan_get32(p) << 32) | plan_get32(p + 4);
+}
+
+// a digest is a 32-bit length, 0 if there is none, and 20 bytes
+static void plan_put_digest(uint8_t* p, Digest* digest) {
+	if (digest && digest->size() == PLAN_DIGEST_SIZE) {
+		plan_put32(p, PLAN_DIGEST_SIZE);
+		memcpy(p + 4, digest->data(), PLAN_DIGEST_SIZE);
+	}
+}
+
+static int plan_free_entry(const char* path, void* value, void* context) {
+	delete (PlanEntry*)value;
+	return 0;
+}
+
+
+PlanEntry::PlanEntry() {
+	state = '?';
+	info = actual_info = 0;
+	digest = NULL;
+	actual = NULL;
+	checked = false;
+}
+
+PlanEntry::~PlanEntry() {
+	if (digest) delete digest;
+	if (actual) delete actual;
+}
+
+
+Plan::Plan(const char* path) {
+	m_path = strdup(path);
+	m_root = NULL;
+	m_file = NULL;
+	m_entries = NULL;
+	m_count = 0;
+	m_checked = 0;
+	m_differences = 0;
+}
+
+Plan::~Plan() {
+	if (m_file) fclose(m_file);
+	if (m_entries) {
+		m_entries->each(&plan_free_entry, NULL);
+		delete m_entries;
+	}
+	free(m_root);
+	free(m_path);
+}
+
+const char* Plan::path()  { return m_path; }
+const char* Plan::root()  { return m_root; }
+uint32_t    Plan::count() { return m_count; }
+bool        Plan::is_writing() { return m_file != NULL; }
+
+int Plan::write_all(const void* buf, size_t len) {
+	if (fwrite(buf, 1, len, m_file) != len) {
+		fprintf(stderr, "Error: unable to write %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return PLAN_ERROR;
+	}
+	return PLAN_OK;
+}
+
+int Plan::read_all(void* buf, size_t len) {
+	if (fread(buf, 1, len, m_file) != len) {
+		fprintf(stderr, "Error: %s is not a darwinup plan, or was cut short.\n", m_path);
+		return PLAN_ERROR;
+	}
+	return PLAN_OK;
+}
+
+int Plan::read_string(char** str) {
+	uint8_t len[4];
+	*str = NULL;
+	int res = this->read_all(len, sizeof(len));
+	if (res != PLAN_OK) return res;
+	uint32_t size = plan_get32(len);
+	if (size == 0) return PLAN_OK;
+	if (size >= PATH_MAX) {
+		fprintf(stderr, "Error: %s is not a darwinup plan.\n", m_path);
+		return PLAN_ERROR;
+	}
+	*str = (char*)malloc(size + 1);
+	if (!*str) {
+		fprintf(stderr, "Error: ran out of memory in Plan::read_string\n");
+		return PLAN_ERROR;
+	}
+	res = this->read_all(*str, size);
+	(*str)[size] = 0;
+	return res;
+}
+
+// the other half of plan_put_digest, a member to get at m_data
+Digest* Plan::read_digest(const uint8_t* p) {
+	if (plan_get32(p) != PLAN_DIGEST_SIZE) return NULL;
+	SHA1Digest* digest = new SHA1Digest();
+	memcpy(digest->m_data, p + 4, PLAN_DIGEST_SIZE);
+	return digest;
+}
+
+int Plan::create(const char* root) {
+	// a local root is recorded by its absolute path so the plan can
+	// be applied from any directory
+	char resolved[PATH_MAX];
+	if (realpath(root, resolved)) root = resolved;
+	m_root = strdup(root);
+
+	m_file = fopen(m_path, "w");
+	if (!m_file) {
+		fprintf(stderr, "Error: unable to create %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return PLAN_ERROR;
+	}
+	uint8_t len[4];
+	plan_put32(len, strlen(m_root));
+	int res = this->write_all(PLAN_MAGIC, PLAN_MAGIC_SIZE);
+	if (res == PLAN_OK) res = this->write_all(len, sizeof(len));
+	if (res == PLAN_OK) res = this->write_all(m_root, strlen(m_root));
+	return res;
+}
+
+int Plan::record(File* file, File* actual, char state) {
+	uint8_t len[4];
+	uint8_t record[PLAN_RECORD_SIZE];
+	uint8_t* p = record;
+	memset(record, 0, sizeof(record));
+
+	plan_put32(p, (uint8_t)state);                 p += 4;
+	plan_put32(p, (uint32_t)file->info());         p += 4;
+	plan_put_digest(p, file->digest());            p += 4 + PLAN_DIGEST_SIZE;
+	plan_put32(p, (uint32_t)actual->info());       p += 4;
+	if (!INFO_TEST(actual->info(), FILE_INFO_NO_ENTRY)) {
+		plan_put32(p, actual->mode());
+		plan_put32(p + 4, actual->uid());
+		plan_put32(p + 8, actual->gid());
+		plan_put64(p + 12, actual->size());
+		plan_put64(p + 20, actual->stat_dev());
+		plan_put64(p + 28, actual->stat_ino());
+		plan_put64(p + 36, actual->stat_mtime());
+		plan_put64(p + 44, actual->stat_ctime());
+		plan_put_digest(p + 52, actual->digest());
+	}
+
+	plan_put32(len, strlen(file->path()));
+	int res = this->write_all(len, sizeof(len));
+	if (res == PLAN_OK) res = this->write_all(file->path(), strlen(file->path()));
+	if (res == PLAN_OK) res = this->write_all(record, sizeof(record));
+	if (res == PLAN_OK) m_count++;
+	return res;
+}
+
+int Plan::finish(bool keep) {
+	if (!m_file) return keep ? PLAN_ERROR : PLAN_OK;
+	int res = PLAN_OK;
+	if (keep) {
+		uint8_t trailer[4 + PLAN_TRAILER_SIZE];
+		plan_put32(trailer, 0);
+		plan_put64(trailer + 4, m_count);
+		memcpy(trailer + 12, PLAN_MAGIC, PLAN_MAGIC_SIZE);
+		res = this->write_all(trailer, sizeof(trailer));
+	}
+	if (fclose(m_file) != 0 && res == PLAN_OK) {
+		fprintf(stderr, "Error: unable to write %s: %s (%d)\n", m_path, strerror(errno), errno);
+		res = PLAN_ERROR;
+	}
+	m_file = NULL;
+	if (!keep || res != PLAN_OK) unlink(m_path);
+	return res;
+}
+
+int Plan::load() {
+	m_file = fopen(m_path, "r");
+	if (!m_file) {
+		fprintf(stderr, "Error: unable to read %s: %s (%d)\n", m_path, strerror(errno), errno);
+		return PLAN_ERROR;
+	}
+
+	char magic[PLAN_MAGIC_SIZE];
+	int res = this->read_all(magic, sizeof(magic));
+	if (res == PLAN_OK && memcmp(magic, PLAN_MAGIC, PLAN_MAGIC_SIZE) != 0) {
+		fprintf(stderr, "Error: %s is not a darwinup plan.\n", m_path);
+		res = PLAN_ERROR;
+	}
+	if (res == PLAN_OK) res = this->read_string(&m_root);
+	if (res == PLAN_OK && !m_root) {
+		fprintf(stderr, "Error: %s is not a darwinup plan.\n", m_path);
+		res = PLAN_ERROR;
+	}
+
+	m_entries = new PathIndex();
+	uint8_t record[PLAN_RECORD_SIZE];
+	char* path = NULL;
+	while (res == PLAN_OK) {
+		res = this->read_string(&path);
+		if (res != PLAN_OK || !path) break;
+		res = this->read_all(record, sizeof(record));
+		if (res != PLAN_OK) break;
+
+		const uint8_t* p = record;
+		PlanEntry* entry = new PlanEntry();
+		entry->state = (char)plan_get32(p);            p += 4;
+		entry->info = plan_get32(p);                   p += 4;
+		entry->digest = this->read_digest(p);          p += 4 + PLAN_DIGEST_SIZE;
+		entry->actual_info = plan_get32(p);            p += 4;
+
+		// only a live file with a digest and a stat can stand in for
+		// reading it again
+		Digest* digest = this->read_digest(p + 52);
+		if (digest && plan_get32(p) && plan_get64(p + 28)) {
+			entry->actual = FileFactory(0, NULL, FILE_INFO_NONE, path, plan_get32(p),
+										plan_get32(p + 4), plan_get32(p + 8),
+										plan_get64(p + 12), digest);
+			if (entry->actual) {
+				entry->actual->stat_set(plan_get64(p + 20), plan_get64(p + 28),
+										plan_get64(p + 36), plan_get64(p + 44));
+			}
+		} else if (digest) {
+			delete digest;
+		}
+
+		PlanEntry* older = (PlanEntry*)m_entries->set(path, entry);
+		if (older) delete older;
+		else m_count++;
+		free(path);
+		path = NULL;
+	}
+	free(path);
+
+	uint8_t trailer[PLAN_TRAILER_SIZE];
+	if (res == PLAN_OK) res = this->read_all(trailer, sizeof(trailer));
+	if (res == PLAN_OK && (plan_get64(trailer) != m_count ||
+						   memcmp(trailer + 8, PLAN_MAGIC, PLAN_MAGIC_SIZE) != 0)) {
+		fprintf(stderr, "Error: %s is not a darwinup plan.\n", m_path);
+		res = PLAN_ERROR;
+	}
+	fclose(m_file);
+	m_file = NULL;
+
+	IF_DEBUG("[plan] loaded %u paths of %s from %s\n", m_count, m_root, m_path);
+	return res;
+}
+
+PlanEntry* Plan::get(const char* path) {
+	return m_entries ? (PlanEntry*)m_entries->get(path) : NULL;
+}
+
+bool Plan::check(File* file, File* actual, char state) {
+	PlanEntry* entry = this->get(file->path());
+	if (!entry || entry->checked) {
+		IF_DEBUG("[plan] %s was not planned\n", file->path());
+		m_differences++;
+		return false;
+	}
+	entry->checked = true;
+	m_checked++;
+	if (entry->state != state ||
+		entry->info != (uint32_t)file->info() ||
+		entry->actual_info != (uint32_t)actual->info() ||
+		!Digest::equal(entry->digest, file->digest())) {
+		IF_DEBUG("[plan] %s was planned as '%c' but is now '%c'\n", file->path(),
+				 entry->state, state);
+		m_differences++;
+		return false;
+	}
+	return true;
+}
+
+uint32_t Plan::differences() {
+	return m_differences + (m_count - m_checked);
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _PLAN_H
+#define _PLAN_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define PLAN_OK          0
+#define PLAN_ERROR      -1
+
+#define PLAN_MAGIC       "DUPLAN01"
+#define PLAN_MAGIC_SIZE  8
+
+struct Digest;
+struct File;
+struct PathIndex;
+
+////
+//  PlanEntry
+//
+//  What analyze_stage decided for one path of a plan, along with the
+//  staged file and the live file it based the decision on.
+////
+struct PlanEntry {
+	PlanEntry();
+	~PlanEntry();
+
+	char     state;     // as printed by analyze_stage
+	uint32_t info;      // FILE_INFO flags of the staged file
+	uint32_t actual_info;
+	Digest*  digest;    // of the staged file, or NULL
+	File*    actual;    // the live file with its stat, or NULL
+	bool     checked;
+};
+
+////
+//  Plan
+//
+//  The decisions of a dry run install, saved so a later install of the
+//  same root can skip reading the files that have not changed since:
+//
+//      "DUPLAN01"
+//      the root as a 32-bit length and its path
+//      one record per staged path: path length, path, state, info,
+//        digest length and SHA-1 digest of the staged file, then
+//        info, mode, uid, gid, size, dev, ino, mtime, ctime, digest
+//        length and SHA-1 digest of the live file (a mode of 0 if
+//        there was none)
+//      a path length of 0, the number of records and "DUPLAN01"
+//
+//  All integers are big-endian.  Only the digests of live files are
+//  trusted, and only while they keep their full stat.  Staged files
+//  are always read again, and applying a plan fails if any of them,
+//  or any decision, turns out differently than it was planned.
+////
+struct Plan {
+	Plan(const char* path);
+	~Plan();
+
+	// Starts writing a plan of installing root.
+	int         create(const char* root);
+
+	// Writes what analyze_stage decided for file and the live file.
+	int         record(File* file, File* actual, char state);
+
+	// Finishes a plan started with create().  A plan that is not
+	// kept is removed.
+	int         finish(bool keep);
+
+	// Reads the entries of a plan written by create() and record().
+	int         load();
+
+	// Returns true between create() and finish().
+	bool        is_writing();
+
+	// Returns the entry for path of a loaded plan, or NULL.
+	PlanEntry*  get(const char* path);
+
+	// Compares what analyze_stage decided for file with its entry.
+	// Returns true if the decision is the same as was planned.
+	bool        check(File* file, File* actual, char state);
+
+	// Number of paths checked that were decided differently, plus the
+	// planned paths that were never checked.
+	uint32_t    differences();
+
+	const char* path();
+	const char* root();
+	uint32_t    count();
+
+	protected:
+
+	int         write_all(const void* buf, size_t len);
+	int         read_all(void* buf, size_t len);
+	int         read_string(char** str);
+	Digest*     read_digest(const uint8_t* p);
+
+	char*       m_path;
+	char*       m_root;
+	FILE*       m_file;
+	PathIndex*  m_entries;
+	uint32_t    m_count;
+	uint32_t    m_checked;
+	uint32_t    m_differences;
+};
+
+#endif
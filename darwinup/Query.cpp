@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Query.h"
+#include "Table.h"
+#include "Database.h"
+#include "Utils.h"
+
+Query::Query(Table* table, int kind, Column* column) {
+	m_table = table;
+	m_name = NULL;
+	m_kind = kind;
+	m_column = column;
+	m_order_by = NULL;
+	m_order = ORDER_BY_ASC;
+	m_param_count = 0;
+	m_bound = 0;
+	m_bad_bind = false;
+	m_bad_shape = false;
+	m_sql = NULL;
+	m_stmt = NULL;
+	m_stepping = false;
+	m_row = NULL;
+	m_arena = NULL;
+	
+	if (kind == QUERY_UPDATE) {
+		// the new value is the first parameter
+		assert(column);
+		m_params[m_param_count].column = column;
+		m_params[m_param_count].op = '=';
+		m_params[m_param_count].table = NULL;
+		m_params[m_param_count].key = NULL;
+		m_params[m_param_count].match = NULL;
+		m_param_count++;
+	}
+	if (kind == QUERY_VALUE || kind == QUERY_COLUMN) assert(column);
+}
+
+Query::~Query() {
+	this->reset();
+	sqlite3_finalize(m_stmt);
+	free(m_sql);
+	free(m_row);
+	if (m_arena) delete m_arena;
+}
+
+Query* Query::where(Column* column, char op) {
+	// the shape of a query cannot change once it has been prepared
+	assert(!m_stmt);
+	// checked in every build, like next_param(), since a condition
+	// too many would be written past m_params
+	if (m_param_count >= QUERY_MAX_WHERE + 1) {
+		fprintf(stderr, "Error: query on %s has more than %u conditions\n",
+				m_table->name(), QUERY_MAX_WHERE);
+		m_bad_shape = true;
+		return this;
+	}
+	if (op != '=' && op != '!' && op != '<' && op != '>') {
+		fprintf(stderr, "Error: query on %s has an unknown operator '%c' for %s\n",
+				m_table->name(), op, column->name());
+		m_bad_shape = true;
+		return this;
+	}
+	m_params[m_param_count].column = column;
+	m_params[m_param_count].op = op;
+	m_params[m_param_count].table = NULL;
+	m_params[m_param_count].key = NULL;
+	m_params[m_param_count].match = NULL;
+	m_param_count++;
+	return this;
+}
+
+Query* Query::where_exists(Column* column, Table* table, Column* key, Column* value) {
+	uint32_t count = m_param_count;
+	this->where(value, '=');
+	if (m_param_count == count) return this;
+	m_params[m_param_count - 1].op = 'E';
+	m_params[m_param_count - 1].table = table;
+	m_params[m_param_count - 1].key = key;
+	m_params[m_param_count - 1].match = column;
+	return this;
+}
+
+Query* Query::order_by(Column* column, int order) {
+	assert(!m_stmt);
+	m_order_by = column;
+	m_order = order;
+	return this;
+}
+
+QueryParam* Query::next_param(uint32_t type) {
+	// checked in every build, not with assert(), since one value too
+	// many would be written past m_params
+	if (m_bound >= m_param_count) {
+		fprintf(stderr, "Error: query on %s is bound more than %u values: %s\n",
+				m_table->name(), m_param_count, this->sql());
+		m_bad_bind = true;
+		return NULL;
+	}
+	QueryParam* param = &m_params[m_bound++];
+	if (param->column->type() != type) {
+		fprintf(stderr, "Error: value #%u of query on %s has the wrong type for %s: %s\n",
+				m_bound, m_table->name(), param->column->name(), this->sql());
+		m_bad_bind = true;
+		return NULL;
+	}
+	return param;
+}
+
+Query* Query::bind(uint64_t value) {
+	QueryParam* param = this->next_param(SQLITE_INTEGER);
+	if (param) param->integer = value;
+	return this;
+}
+
+Query* Query::bind(const char* value) {
+	QueryParam* param = this->next_param(SQLITE3_TEXT);
+	if (param) param->data = value;
+	return this;
+}
+
+Query* Query::bind(const void* data, uint32_t size) {
+	QueryParam* param = this->next_param(SQLITE_BLOB);
+	if (param) {
+		param->data = data;
+		param->size = size;
+	}
+	return this;
+}
+
+int Query::kind() {
+	return m_kind;
+}
+
+Table* Query::table() {
+	return m_table;
+}
+
+Column* Query::column() {
+	return m_column;
+}
+
+const char* Query::name() {
+	return m_name ? m_name : this->sql();
+}
+
+void Query::set_name(const char* name) {
+	m_name = name;
+}
+
+const char* Query::sql() {
+	if (m_sql) return m_sql;
+	
+	// calculate the length of the sql statement
+	size_t size = 64 + strlen(m_table->name());
+	if (m_column) size += strlen(m_column->name());
+	if (m_order_by) size += strlen(m_order_by->name());
+	for (uint32_t i = 0; i < m_param_count; i++) {
+		size += strlen(m_params[i].column->name()) + 8;
+		if (m_params[i].op == 'E') {
+			size += 48 + 3 * strlen(m_params[i].table->name()) 
+				+ strlen(m_params[i].key->name()) 
+				+ strlen(m_params[i].match->name()) + strlen(m_table->name());
+		}
+	}
+	SplitColumn* split = m_table->split();
+	if (split) {
+		// the split column is read, matched and ordered by with SQL of its own,
+		//  and rows list every column instead of *
+		size += 2 * strlen(split->select) + m_param_count * strlen(split->where);
+		for (uint32_t i = 0; i < m_table->column_count(); i++) {
+			size += strlen(m_table->column(i)->name()) + 2;
+		}
+	}
+	m_sql = (char*)malloc(size);
+	if (!m_sql) {
+		fprintf(stderr, "Error: ran out of memory!\n");
+		return NULL;
+	}
+	
+	uint32_t first = 0;
+	switch (m_kind) {
+		case QUERY_COUNT:
+			strlcpy(m_sql, "SELECT count(*) FROM ", size);
+			strlcat(m_sql, m_table->name(), size);
+			break;
+		case QUERY_VALUE:
+		case QUERY_COLUMN:
+			strlcpy(m_sql, "SELECT ", size);
+			strlcat(m_sql, this->column_sql(m_column), size);
+			strlcat(m_sql, " FROM ", size);
+			strlcat(m_sql, m_table->name(), size);
+			break;
+		case QUERY_ROW:
+		case QUERY_ROWS:
+			if (split) {
+				strlcpy(m_sql, "SELECT ", size);
+				for (uint32_t i = 0; i < m_table->column_count(); i++) {
+					if (i) strlcat(m_sql, ", ", size);
+					strlcat(m_sql, this->column_sql(m_table->column(i)), size);
+				}
+				strlcat(m_sql, " FROM ", size);
+			} else {
+				strlcpy(m_sql, "SELECT * FROM ", size);
+			}
+			strlcat(m_sql, m_table->name(), size);
+			break;
+		case QUERY_UPDATE:
+			assert(!split || m_column != split->column);
+			strlcpy(m_sql, "UPDATE ", size);
+			strlcat(m_sql, m_table->name(), size);
+			strlcat(m_sql, " SET ", size);
+			strlcat(m_sql, m_column->name(), size);
+			strlcat(m_sql, "=?", size);
+			first = 1;
+			break;
+		case QUERY_DELETE:
+			strlcpy(m_sql, "DELETE FROM ", size);
+			strlcat(m_sql, m_table->name(), size);
+			break;
+	}
+	
+	for (uint32_t i = first; i < m_param_count; i++) {
+		strlcat(m_sql, (i == first ? " WHERE " : " AND "), size);
+		if (m_params[i].op == 'E') {
+			// EXISTS (SELECT 1 FROM t WHERE t.key=table.match AND t.column=?)
+			strlcat(m_sql, "EXISTS (SELECT 1 FROM ", size);
+			strlcat(m_sql, m_params[i].table->name(), size);
+			strlcat(m_sql, " WHERE ", size);
+			strlcat(m_sql, m_params[i].table->name(), size);
+			strlcat(m_sql, ".", size);
+			strlcat(m_sql, m_params[i].key->name(), size);
+			strlcat(m_sql, "=", size);
+			strlcat(m_sql, m_table->name(), size);
+			strlcat(m_sql, ".", size);
+			strlcat(m_sql, m_params[i].match->name(), size);
+			strlcat(m_sql, " AND ", size);
+			strlcat(m_sql, m_params[i].table->name(), size);
+			strlcat(m_sql, ".", size);
+			strlcat(m_sql, m_params[i].column->name(), size);
+			strlcat(m_sql, "=?)", size);
+			continue;
+		}
+		if (split && m_params[i].column == split->column) {
+			// parent=(SELECT key FROM parents WHERE text=?) AND leaf=?
+			assert(m_params[i].op == '=');
+			strlcat(m_sql, split->where, size);
+			continue;
+		}
+		strlcat(m_sql, m_params[i].column->name(), size);
+		switch (m_params[i].op) {
+			case '!': strlcat(m_sql, "!=?", size); break;
+			case '<': strlcat(m_sql, "<?", size); break;
+			case '>': strlcat(m_sql, ">?", size); break;
+			default:  strlcat(m_sql, "=?", size); break;
+		}
+	}
+	
+	if (m_order_by) {
+		strlcat(m_sql, " ORDER BY ", size);
+		if (split && m_order_by == split->column && m_order == ORDER_BY_GROUP) {
+			// equal text has equal parts, which an index can give in order
+			strlcat(m_sql, split->parent->name(), size);
+			strlcat(m_sql, ", ", size);
+			strlcat(m_sql, split->leaf->name(), size);
+		} else if (split && m_order_by == split->column 
+			&& (m_kind == QUERY_ROW || m_kind == QUERY_ROWS)) {
+			// by the result column, or the whole text is built twice a row
+			char ordinal[16] = "";
+			for (uint32_t i = 0; i < m_table->column_count(); i++) {
+				if (m_table->column(i) == m_order_by) {
+					snprintf(ordinal, sizeof(ordinal), "%u", i + 1);
+				}
+			}
+			strlcat(m_sql, ordinal, size);
+		} else {
+			strlcat(m_sql, this->column_sql(m_order_by), size);
+		}
+		strlcat(m_sql, (m_order == ORDER_BY_DESC ? " DESC" : " ASC"), size);
+	}
+	if (m_kind == QUERY_ROW || m_kind == QUERY_VALUE) {
+		strlcat(m_sql, " LIMIT 1", size);
+	}
+	strlcat(m_sql, ";", size);
+	
+	return m_sql;
+}
+
+sqlite3_stmt* Query::statement(sqlite3* db) {
+	if (m_stepping) {
+		// the statement is still in use by get_next()
+		fprintf(stderr, "Error: query on %s is already being read: %s\n",
+				m_table->name(), this->sql());
+		return NULL;
+	}
+	if (m_bad_shape) {
+		// where() already said what was wrong when it was defined
+		m_bound = 0;
+		m_bad_bind = false;
+		return NULL;
+	}
+	if (m_bad_bind) {
+		// next_param() already said what was wrong
+		m_bound = 0;
+		m_bad_bind = false;
+		return NULL;
+	}
+	if (m_bound != m_param_count) {
+		fprintf(stderr, "Error: query on %s has %u of %u values bound: %s\n",
+				m_table->name(), m_bound, m_param_count, this->sql());
+		m_bound = 0;
+		return NULL;
+	}
+	
+	int res = SQLITE_OK;
+	if (!m_stmt) {
+		const char* query = this->sql();
+		if (!query) return NULL;
+		res = sqlite3_prepare_v2(db, query, -1, &m_stmt, NULL);
+		if (res != SQLITE_OK) {
+			fprintf(stderr, "Error: unable to prepare statement for query: %s\n"
+					"Error: %s\n", query, sqlite3_errmsg(db));
+			m_stmt = NULL;
+			m_bound = 0;
+			return NULL;
+		}
+		extern uint32_t verbosity;
+		if (verbosity & VERBOSE_SQL) this->explain(db);
+	}
+	
+	SplitColumn* split = m_table->split();
+	int n = 1; // the next placeholder
+	for (uint32_t i = 0; res == SQLITE_OK && i < m_param_count; i++) {
+		QueryParam* param = &m_params[i];
+		if (split && param->column == split->column && param->op != 'E') {
+			// the parent's text, then the leaf
+			const char* text = (const char*)param->data;
+			const char* slash = strrchr(text, '/');
+			int length = (slash ? (int)(slash - text) : 0);
+			res = sqlite3_bind_text(m_stmt, n++, text, length, SQLITE_STATIC);
+			if (res == SQLITE_OK) {
+				res = sqlite3_bind_text(m_stmt, n++, (slash ? slash + 1 : text), 
+										-1, SQLITE_STATIC);
+			}
+		} else {
+			switch (param->column->type()) {
+				case SQLITE_INTEGER:
+					res = sqlite3_bind_int64(m_stmt, n, param->integer);
+					break;
+				case SQLITE3_TEXT:
+					res = sqlite3_bind_text(m_stmt, n, (const char*)param->data, 
+											-1, SQLITE_STATIC);
+					break;
+				case SQLITE_BLOB:
+					res = sqlite3_bind_blob(m_stmt, n, param->data, param->size, 
+											SQLITE_STATIC);
+					break;
+			}
+			n++;
+		}
+		if (res != SQLITE_OK) {
+			fprintf(stderr, "Error: failed to bind parameter #%u of query: %s: %s\n",
+					i+1, m_sql, sqlite3_errmsg(db));
+		}
+	}
+	if (res != SQLITE_OK) {
+		this->reset();
+		return NULL;
+	}
+	
+	return m_stmt;
+}
+
+const char* Query::column_sql(Column* column) {
+	SplitColumn* split = m_table->split();
+	if (split && column == split->column) return split->select;
+	return column->name();
+}
+
+void Query::forget() {
+	this->reset();
+	sqlite3_finalize(m_stmt);
+	m_stmt = NULL;
+	free(m_sql);
+	m_sql = NULL;
+}
+
+void Query::explain(sqlite3* db) {
+	char* query = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", m_sql);
+	sqlite3_stmt* stmt = NULL;
+	if (query && sqlite3_prepare_v2(db, query, -1, &stmt, NULL) == SQLITE_OK) {
+		// the last column is the detail in every version of sqlite
+		int detail = sqlite3_column_count(stmt) - 1;
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			fprintf(stderr, "[PLAN] %s %s\n", m_sql, 
+					(const char*)sqlite3_column_text(stmt, detail));
+		}
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_free(query);
+}
+
+sqlite3_stmt* Query::cursor(sqlite3* db) {
+	if (m_stepping) return m_stmt;
+	sqlite3_stmt* stmt = this->statement(db);
+	if (stmt) m_stepping = true;
+	return stmt;
+}
+
+uint8_t* Query::row() {
+	if (!m_row) {
+		m_row = (uint8_t*)calloc(1, m_table->row_size());
+		m_arena = new Arena();
+	} else {
+		memset(m_row, 0, m_table->row_size());
+		m_arena->clear();
+	}
+	return m_row;
+}
+
+Arena* Query::arena() {
+	return m_arena;
+}
+
+void Query::reset() {
+	if (m_stmt) sqlite3_reset(m_stmt);
+	if (m_row) {
+		memset(m_row, 0, m_table->row_size());
+		m_arena->clear();
+	}
+	m_stepping = false;
+	m_bound = 0;
+	m_bad_bind = false;
+}
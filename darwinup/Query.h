@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _QUERY_H
+#define _QUERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "Arena.h"
+
+struct Column;
+struct Table;
+
+// what a Query does, which decides the Database function that runs it
+#define QUERY_COUNT   0 // SELECT count(*), run with Database::count()
+#define QUERY_VALUE   1 // SELECT column of the first row, Database::get_value()
+#define QUERY_COLUMN  2 // SELECT column of every row, Database::get_column()
+#define QUERY_ROW     3 // SELECT * of the first row, Database::get_row()
+#define QUERY_ROWS    4 // SELECT * of every row, Database::get_all() or get_next()
+#define QUERY_UPDATE  5 // UPDATE SET column, Database::update_value()
+#define QUERY_DELETE  6 // DELETE, Database::del()
+
+// most conditions a query can have in its WHERE clause
+#define QUERY_MAX_WHERE 4
+
+struct QueryParam {
+	Column*     column;
+	char        op;
+	// for where_exists(), the subquery's table, and its key that must
+	//  equal match, a column of this query's table
+	Table*      table;
+	Column*     key;
+	Column*     match;
+	// the bound value, data points at text or a blob of size bytes
+	uint64_t    integer;
+	const void* data;
+	uint32_t    size;
+};
+
+/**
+ * A Query is a statement whose shape is fixed when it is defined, usually
+ *  in init_schema(), next to the tables it reads:
+ *
+ *      m_archive_by_serial = new Query(m_archives_table, QUERY_ROW);
+ *      m_archive_by_serial->where(m_archives_table->column(0), '=');
+ *      this->add_query(m_archive_by_serial);
+ *
+ * Its SQL is generated and prepared once, on first use, and the statement
+ *  stays with the Query.  Each use then binds its values with the bind()
+ *  overload for the column's type and passes the Query to the Database:
+ *
+ *      res = this->get_row(m_archive_by_serial->bind(serial), &data);
+ *
+ * so no statement name is hashed, no va_list is walked and no SQL is
+ *  built on the way to sqlite.  Binding a value of the wrong type for its
+ *  column, or too many values, is reported at the bind() call, and the
+ *  Database function the Query is passed to fails.  Columns only carry
+ *  their type at run time, so the compiler cannot catch these.
+ */
+struct Query {
+	// column is the column selected by QUERY_VALUE and QUERY_COLUMN,
+	//  or set by QUERY_UPDATE, NULL otherwise
+	Query(Table* table, int kind, Column* column = NULL);
+	virtual ~Query();
+
+	// Adds "column op ?" to the WHERE clause, 
+	//  op is one of '=', '!' (not equal), '<' or '>'
+	Query*        where(Column* column, char op);
+	// Adds "EXISTS (SELECT 1 FROM table WHERE key=column AND value=?)",
+	//  so only rows with a row in table whose value is bound count,
+	//  key should be the primary key of table
+	Query*        where_exists(Column* column, Table* table, Column* key, 
+							   Column* value);
+	// Orders the results by column, order is ORDER_BY_ASC, ORDER_BY_DESC
+	//  or ORDER_BY_GROUP
+	Query*        order_by(Column* column, int order);
+
+	// Bind the next value: the new value of a QUERY_UPDATE first, 
+	//  then one for each where() in the order they were added.
+	//  Text and blobs are not copied and must outlive the query's use.
+	Query*        bind(uint64_t value);
+	Query*        bind(const char* value);
+	Query*        bind(const void* data, uint32_t size);
+
+	int           kind();
+	Table*        table();
+	Column*       column();
+	const char*   sql();
+	// The name it was added to its Database under, or else its SQL
+	const char*   name();
+	// name must outlive the query
+	void          set_name(const char* name);
+
+	// Returns the statement with every value bound, preparing it the
+	//  first time, or NULL if not all values were bound
+	sqlite3_stmt* statement(sqlite3* db);
+	// Returns the statement Database::get_next() is stepping through,
+	//  binding it for the first row
+	sqlite3_stmt* cursor(sqlite3* db);
+	// The result record get_next() decodes each row into, emptied of
+	//  the previous row's text and blobs first
+	uint8_t*      row();
+	// Where get_next() keeps the text and blobs of the current row
+	Arena*        arena();
+	// Resets the statement and forgets the bound values, call after 
+	//  stepping through the results
+	void          reset();
+	// Finalizes the statement and forgets its SQL, so both are made 
+	//  again, for when the table changes how it stores a column
+	void          forget();
+
+protected:
+
+	QueryParam*   next_param(uint32_t type);
+	// the SQL that reads column, which is not its name if it is split
+	const char*   column_sql(Column* column);
+	// prints how sqlite runs the statement, with -vvv
+	void          explain(sqlite3* db);
+
+	Table*        m_table;
+	const char*   m_name;
+	int           m_kind;
+	Column*       m_column;
+	Column*       m_order_by;
+	int           m_order;
+	
+	// the value of a QUERY_UPDATE, then the WHERE conditions
+	QueryParam    m_params[QUERY_MAX_WHERE + 1];
+	uint32_t      m_param_count;
+	uint32_t      m_bound;
+	// a value was bound past the last parameter or with the wrong type,
+	//  so statement() fails
+	bool          m_bad_bind;
+	// where() was given a condition too many or an unknown operator,
+	//  so statement() always fails
+	bool          m_bad_shape;
+
+	char*         m_sql;
+	sqlite3_stmt* m_stmt;
+	
+	// for get_next(), the statement is part way through its results
+	bool          m_stepping;
+	uint8_t*      m_row;
+	Arena*        m_arena;
+};
+
+#endif
@@ -66,3 +66,13 @@ int SerialSet::add(uint64_t value) {
 
 	return 0;
 }
+
+bool SerialSet::contains(uint64_t value) {
+	uint32_t i;
+	for (i = 0; i < this->count; ++i) {
+		if (this->values[i] == value) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -42,6 +42,7 @@ struct SerialSet {
 	~SerialSet();
 	
 	int add(uint64_t value);
+	bool contains(uint64_t value);
 
 	uint32_t capacity;
 	uint32_t count;
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "StatementRegistry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+StatementRegistry::StatementRegistry() {
+	m_count = 0;
+	m_hits = 0;
+	m_misses = 0;
+	m_prepares = 0;
+}
+
+StatementRegistry::~StatementRegistry() {
+	for (uint32_t i = 0; i < m_count; i++) {
+		sqlite3_finalize(m_statements[i]);
+		free(m_names[i]);
+	}
+}
+
+uint32_t StatementRegistry::intern(const char* name) {
+	for (uint32_t i = 0; i < m_count; i++) {
+		if (strcmp(m_names[i], name) == 0) return i + 1;
+	}
+	
+	if (m_count >= STATEMENT_REGISTRY_MAX) {
+		fprintf(stderr, "Error: too many statements to keep %s\n", name);
+		return STATEMENT_NONE;
+	}
+	m_names[m_count] = strdup(name);
+	if (!m_names[m_count]) {
+		fprintf(stderr, "Error: ran out of memory!\n");
+		return STATEMENT_NONE;
+	}
+	m_statements[m_count] = NULL;
+	return ++m_count;
+}
+
+sqlite3_stmt* StatementRegistry::get(uint32_t id) {
+	sqlite3_stmt* stmt = NULL;
+	if (id != STATEMENT_NONE && id <= m_count) stmt = m_statements[id - 1];
+	if (stmt) {
+		m_hits++;
+	} else {
+		m_misses++;
+	}
+	return stmt;
+}
+
+bool StatementRegistry::set(uint32_t id, sqlite3_stmt* stmt) {
+	if (stmt) m_prepares++;
+	if (id == STATEMENT_NONE || id > m_count) return false;
+	sqlite3_finalize(m_statements[id - 1]);
+	m_statements[id - 1] = stmt;
+	return true;
+}
+
+const char* StatementRegistry::name(uint32_t id) {
+	if (id != STATEMENT_NONE && id <= m_count) return m_names[id - 1];
+	return NULL;
+}
+
+uint32_t StatementRegistry::count() {
+	return m_count;
+}
+
+uint64_t StatementRegistry::hits() {
+	return m_hits;
+}
+
+uint64_t StatementRegistry::misses() {
+	return m_misses;
+}
+
+uint64_t StatementRegistry::prepares() {
+	return m_prepares;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _STATEMENTREGISTRY_H
+#define _STATEMENTREGISTRY_H
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+// most statements a registry holds, there are a few dozen at most
+#define STATEMENT_REGISTRY_MAX 64
+// the id of a name that could not be interned because the registry is full
+#define STATEMENT_NONE 0
+
+////
+//  StatementRegistry
+//
+//  The prepared statements a Database has built from a name and some
+//  SQL, kept in a fixed array and found by a small integer id.  A name
+//  is interned the first time it is seen, and is recognized after that
+//  by its text, so the caller's copy may be reused once intern returns.
+//
+//  A registry belongs to one Database and is used only by the thread
+//  using that database's connection, so it takes no locks.
+////
+struct StatementRegistry {
+	StatementRegistry();
+	~StatementRegistry();
+
+	// Returns the id of name, interning it if it is new, or 
+	//  STATEMENT_NONE if the registry is full
+	uint32_t      intern(const char* name);
+	// Returns the statement for id, or NULL if there is none yet
+	sqlite3_stmt* get(uint32_t id);
+	// Keeps stmt as the statement for id, which then finalizes it.
+	//  Returns false if id is STATEMENT_NONE, leaving stmt to the caller.
+	bool          set(uint32_t id, sqlite3_stmt* stmt);
+	
+	const char*   name(uint32_t id);
+	uint32_t      count();
+	uint64_t      hits();
+	uint64_t      misses();
+	uint64_t      prepares();
+
+protected:
+	// a copy of the text of each name
+	char*         m_names[STATEMENT_REGISTRY_MAX];
+	sqlite3_stmt* m_statements[STATEMENT_REGISTRY_MAX];
+	uint32_t      m_count;
+	
+	uint64_t      m_hits;
+	uint64_t      m_misses;
+	uint64_t      m_prepares;
+};
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "Stats.h"
+
+#include <mach/mach_time.h>
+#include <stdlib.h>
+#include <string.h>
+
+Stats* stats = NULL;
+
+// initial number of statements and phases
+#define STATS_INITIAL 64
+
+Stats::Stats() {
+	m_start = Stats::now();
+	memset(&m_statements, 0, sizeof(m_statements));
+	memset(&m_waits, 0, sizeof(m_waits));
+	m_phase_count = 0;
+	m_phase_max = STATS_INITIAL;
+	m_phases = (PhaseStats*)malloc(m_phase_max * sizeof(PhaseStats));
+}
+
+Stats::~Stats() {
+	StatsList* lists[] = { &m_statements, &m_waits };
+	for (uint32_t l = 0; l < 2; l++) {
+		for (uint32_t i = 0; i < lists[l]->count; i++) {
+			free(lists[l]->items[i]->name);
+			free(lists[l]->items[i]);
+		}
+		free(lists[l]->items);
+	}
+	for (uint32_t i = 0; i < m_phase_count; i++) {
+		free(m_phases[i].name);
+	}
+	free(m_phases);
+}
+
+uint64_t Stats::now() {
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0) mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+void Stats::statement(const char* name, uint64_t start, uint64_t rows) {
+	uint64_t ns = Stats::now() - start;
+	StatementStats* s = Stats::find(&m_statements, name);
+	if (s) Stats::add(s, ns, rows);
+}
+
+void Stats::phase(const char* name, uint64_t* mark) {
+	uint64_t now = Stats::now();
+	PhaseStats* p = this->find_phase(name);
+	if (p) {
+		p->calls++;
+		p->total_ns += now - *mark;
+	}
+	*mark = now;
+}
+
+void Stats::wait(const char* name, uint64_t ns) {
+	StatementStats* s = Stats::find(&m_waits, name);
+	if (s) Stats::add(s, ns, 0);
+}
+
+uint64_t Stats::percentile(StatementStats* s, double fraction) {
+	uint64_t target = (uint64_t)(fraction * s->calls);
+	if (target < fraction * s->calls) target++;
+	if (target == 0) return s->min_ns;
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < STATS_BUCKETS; i++) {
+		seen += s->buckets[i];
+		if (seen >= target) {
+			uint64_t ns = Stats::bucket_max(i);
+			return ns < s->max_ns ? ns : s->max_ns;
+		}
+	}
+	return s->max_ns;
+}
+
+static int compare_total(const void* a, const void* b) {
+	const StatementStats* sa = *(const StatementStats**)a;
+	const StatementStats* sb = *(const StatementStats**)b;
+	if (sa->total_ns > sb->total_ns) return -1;
+	if (sa->total_ns < sb->total_ns) return 1;
+	return strcmp(sa->name, sb->name);
+}
+
+int Stats::write(FILE* out, const char* command) {
+	fprintf(out, "{\n  \"command\": ");
+	Stats::write_string(out, command);
+	fprintf(out, ",\n  \"elapsed_ns\": %llu,\n  \"phases\": [", 
+			(unsigned long long)(Stats::now() - m_start));
+	for (uint32_t i = 0; i < m_phase_count; i++) {
+		PhaseStats* p = &m_phases[i];
+		fprintf(out, "%s\n    { \"name\": ", i ? "," : "");
+		Stats::write_string(out, p->name);
+		fprintf(out, ", \"calls\": %llu, \"total_ns\": %llu }",
+				(unsigned long long)p->calls, (unsigned long long)p->total_ns);
+	}
+	fprintf(out, "%s],\n", m_phase_count ? "\n  " : "");
+	this->write_list(out, "waits", &m_waits, false);
+	fprintf(out, ",\n");
+	this->write_list(out, "statements", &m_statements, true);
+	fprintf(out, "\n}\n");
+	return ferror(out);
+}
+
+void Stats::write_list(FILE* out, const char* key, StatsList* list, bool rows) {
+	qsort(list->items, list->count, sizeof(StatementStats*), compare_total);
+	fprintf(out, "  \"%s\": [", key);
+	for (uint32_t i = 0; i < list->count; i++) {
+		StatementStats* s = list->items[i];
+		fprintf(out, "%s\n    { \"name\": ", i ? "," : "");
+		Stats::write_string(out, s->name);
+		fprintf(out, ", \"calls\": %llu, ", (unsigned long long)s->calls);
+		if (rows) fprintf(out, "\"rows\": %llu, ", (unsigned long long)s->rows);
+		fprintf(out, "\"total_ns\": %llu, \"min_ns\": %llu, \"max_ns\": %llu, "
+				"\"p99_ns\": %llu }",
+				(unsigned long long)s->total_ns, (unsigned long long)s->min_ns,
+				(unsigned long long)s->max_ns, 
+				(unsigned long long)this->percentile(s, 0.99));
+	}
+	fprintf(out, "%s]", list->count ? "\n  " : "");
+}
+
+StatementStats* Stats::find(StatsList* list, const char* name) {
+	if (list->last && (list->last->name == name || strcmp(list->last->name, name) == 0)) {
+		return list->last;
+	}
+	for (uint32_t i = 0; i < list->count; i++) {
+		if (strcmp(list->items[i]->name, name) == 0) {
+			list->last = list->items[i];
+			return list->last;
+		}
+	}
+	
+	if (list->count == list->max) {
+		list->max = list->max ? list->max * 2 : STATS_INITIAL;
+		list->items = (StatementStats**)realloc(list->items, 
+												list->max * sizeof(StatementStats*));
+	}
+	StatementStats* s = (StatementStats*)calloc(1, sizeof(StatementStats));
+	if (!list->items || !s) {
+		fprintf(stderr, "Error: ran out of memory in Stats::find\n");
+		free(s);
+		return NULL;
+	}
+	s->name = strdup(name);
+	list->items[list->count++] = s;
+	list->last = s;
+	return s;
+}
+
+void Stats::add(StatementStats* s, uint64_t ns, uint64_t rows) {
+	if (s->calls == 0 || ns < s->min_ns) s->min_ns = ns;
+	if (ns > s->max_ns) s->max_ns = ns;
+	s->calls++;
+	s->rows += rows;
+	s->total_ns += ns;
+	s->buckets[Stats::bucket(ns)]++;
+}
+
+PhaseStats* Stats::find_phase(const char* name) {
+	for (uint32_t i = 0; i < m_phase_count; i++) {
+		if (strcmp(m_phases[i].name, name) == 0) return &m_phases[i];
+	}
+	
+	if (m_phase_count == m_phase_max) {
+		m_phase_max *= 2;
+		m_phases = (PhaseStats*)realloc(m_phases, m_phase_max * sizeof(PhaseStats));
+	}
+	if (!m_phases) {
+		fprintf(stderr, "Error: ran out of memory in Stats::phase\n");
+		return NULL;
+	}
+	PhaseStats* p = &m_phases[m_phase_count++];
+	p->name = strdup(name);
+	p->calls = 0;
+	p->total_ns = 0;
+	return p;
+}
+
+uint32_t Stats::bucket(uint64_t ns) {
+	if (ns < STATS_SUB_BUCKETS) return (uint32_t)ns;
+	// the top bit picks the power of 2, the 3 bits after it the sub bucket
+	uint32_t msb = 63 - __builtin_clzll(ns);
+	uint32_t sub = (uint32_t)(ns >> (msb - 3)) & (STATS_SUB_BUCKETS - 1);
+	return (msb - 2) * STATS_SUB_BUCKETS + sub;
+}
+
+uint64_t Stats::bucket_max(uint32_t bucket) {
+	if (bucket < STATS_SUB_BUCKETS) return bucket;
+	uint32_t msb = bucket / STATS_SUB_BUCKETS + 2;
+	uint64_t sub = bucket % STATS_SUB_BUCKETS;
+	uint64_t width = 1ULL << (msb - 3);
+	return ((STATS_SUB_BUCKETS + sub) << (msb - 3)) + width - 1;
+}
+
+void Stats::write_string(FILE* out, const char* str) {
+	fputc('"', out);
+	for (const char* c = str; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			fprintf(out, "\\%c", *c);
+		} else if ((unsigned char)*c < 0x20) {
+			fprintf(out, "\\u%04x", (unsigned char)*c);
+		} else {
+			fputc(*c, out);
+		}
+	}
+	fputc('"', out);
+}
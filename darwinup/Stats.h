@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// times are kept in a log-linear histogram: 8 buckets for each power of 2
+// nanoseconds, so a percentile is within 12.5% of the real value
+#define STATS_SUB_BUCKETS 8
+#define STATS_BUCKETS     (64 * STATS_SUB_BUCKETS)
+
+struct StatementStats {
+	char*       name;
+	uint64_t    calls;
+	uint64_t    rows;
+	uint64_t    total_ns;
+	uint64_t    min_ns;
+	uint64_t    max_ns;
+	uint32_t    buckets[STATS_BUCKETS];
+};
+
+// the statements, or waits, seen so far
+struct StatsList {
+	StatementStats** items;
+	uint32_t         count;
+	uint32_t         max;
+	// the last one found, runs of one statement tend to come together
+	StatementStats*  last;
+};
+
+struct PhaseStats {
+	char*       name;
+	uint64_t    calls;
+	uint64_t    total_ns;
+};
+
+////
+//  Stats
+//
+//  Counts how often, and for how long, each database statement runs,
+//  along with the time spent in each phase of an install or uninstall
+//  and waiting for locks.
+//  There is one, the global stats, and only when darwinup was asked
+//  for it with the stats command or DARWINUP_PROFILE; the STATS_ macros
+//  cost a test of that pointer otherwise.
+////
+struct Stats {
+	Stats();
+	~Stats();
+
+	// monotonic nanoseconds
+	static uint64_t now();
+
+	// Adds a run of the statement called name which began at start and
+	// returned rows rows.
+	void     statement(const char* name, uint64_t start, uint64_t rows);
+	// Adds the time since *mark to the phase called name, and moves
+	// *mark to now for the next phase.
+	void     phase(const char* name, uint64_t* mark);
+	// Adds a wait of ns for the lock called name.
+	void     wait(const char* name, uint64_t ns);
+
+	// the time below which fraction of the runs of statement finished
+	uint64_t percentile(StatementStats* statement, double fraction);
+
+	// Writes everything as JSON, statements costliest first.
+	int      write(FILE* out, const char* command);
+
+	protected:
+
+	static StatementStats* find(StatsList* list, const char* name);
+	static void     add(StatementStats* s, uint64_t ns, uint64_t rows);
+	void            write_list(FILE* out, const char* key, StatsList* list, bool rows);
+	PhaseStats*     find_phase(const char* name);
+	static uint32_t bucket(uint64_t ns);
+	static uint64_t bucket_max(uint32_t bucket);
+	static void     write_string(FILE* out, const char* str);
+
+	uint64_t         m_start;
+
+	StatsList        m_statements;
+	StatsList        m_waits;
+
+	PhaseStats*      m_phases;
+	uint32_t         m_phase_count;
+	uint32_t         m_phase_max;
+};
+
+// the Stats of this run of darwinup, or NULL
+extern Stats* stats;
+
+#define STATS_START() (stats ? Stats::now() : 0)
+#define STATS_STATEMENT(name, start, rows) \
+	do { if (stats) stats->statement(name, start, rows); } while (0)
+#define STATS_PHASE(name, mark) \
+	do { if (stats) stats->phase(name, mark); } while (0)
+
+#endif
@@ -30,6 +30,7 @@
  * @APPLE_BSD_LICENSE_HEADER_END@
  */
 
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -43,9 +44,9 @@ Table::Table(const char* name) {
 	m_column_count  = 0;
 	m_columns       = (Column**)malloc(sizeof(Column*) * m_column_max);
 	m_columns_size  = 0; 
-	m_result_max    = 1;
-	m_result_count  = 0;
-	m_results       = (uint8_t**)malloc(sizeof(uint8_t*) * m_result_max);
+	m_indexes       = NULL;
+	m_index_count   = 0;
+	m_split         = NULL;
 	m_name          = strdup(name);
 	m_create_sql    = NULL;
 	m_custom_create_sql    = NULL;
@@ -64,13 +65,17 @@ Table::~Table() {
 	}
 	free(m_columns);
 	
-
-	for (uint32_t i=0; i < m_result_count; i++) {
-		if (m_results[i]) {
-			this->free_result(m_results[i]);
-		}
+	for (uint32_t i = 0; i < m_index_count; i++) {
+		free(m_indexes[i].name);
+		free(m_indexes[i].sql);
+	}
+	free(m_indexes);
+	
+	if (m_split) {
+		free(m_split->select);
+		free(m_split->where);
+		free(m_split);
 	}
-	free(m_results);
 	
 	free(m_name);
 
@@ -99,6 +104,63 @@ int Table::set_custom_create(const char* sql) {
 	return this->m_custom_create_sql == 0;
 }
 
+int Table::add_index(const char* name, const char* columns, uint32_t schema_version) {
+	// the create sql would otherwise be missing this index
+	assert(!m_create_sql);
+	TableIndex* indexes = (TableIndex*)realloc(m_indexes, 
+											   (m_index_count + 1) * sizeof(TableIndex));
+	if (!indexes) {
+		fprintf(stderr, "Error: unable to reallocate memory to add an index\n");
+		return 1;
+	}
+	m_indexes = indexes;
+	TableIndex* index = &m_indexes[m_index_count];
+	index->name = strdup(name);
+	asprintf(&index->sql, "CREATE INDEX %s ON %s (%s);", name, m_name, columns);
+	index->version = schema_version;
+	if (!index->name || !index->sql) {
+		fprintf(stderr, "Error: ran out of memory!\n");
+		free(index->name);
+		free(index->sql);
+		return 1;
+	}
+	m_index_count++;
+	return 0;
+}
+
+int Table::split_column(Column* column, Column* parent, Column* leaf, Table* parents,
+						Column* parent_key, Column* parent_text) {
+	if (m_split) return 1;
+	m_split = (SplitColumn*)calloc(1, sizeof(SplitColumn));
+	if (!m_split) {
+		fprintf(stderr, "Error: ran out of memory!\n");
+		return 1;
+	}
+	m_split->column = column;
+	m_split->parent = parent;
+	m_split->leaf = leaf;
+	m_split->parents = parents;
+	m_split->parent_key = parent_key;
+	m_split->parent_text = parent_text;
+	asprintf(&m_split->select, "(SELECT %s.%s FROM %s WHERE %s.%s=%s.%s)||'/'||%s.%s",
+			 parents->name(), parent_text->name(), parents->name(),
+			 parents->name(), parent_key->name(), m_name, parent->name(),
+			 m_name, leaf->name());
+	asprintf(&m_split->where, "%s.%s=(SELECT %s.%s FROM %s WHERE %s.%s=?) AND %s.%s=?",
+			 m_name, parent->name(), parents->name(), parent_key->name(),
+			 parents->name(), parents->name(), parent_text->name(),
+			 m_name, leaf->name());
+	if (!m_split->select || !m_split->where) {
+		fprintf(stderr, "Error: ran out of memory!\n");
+		return 1;
+	}
+	return 0;
+}
+
+SplitColumn* Table::split() {
+	return m_split;
+}
+
 int Table::add_column(Column* c, uint32_t schema_version) {
 	// accumulate offsets for columns in m_columns_size
 	c->m_offset = this->m_columns_size;
@@ -134,36 +196,22 @@ uint32_t Table::row_size() {
 	return m_columns_size;
 }
 
+/**
+ * Result records belong to the caller, who frees each with free_result(),
+ *  the Table does not keep track of them.
+ */
 uint8_t* Table::alloc_result() {
-	if (m_result_count >= m_result_max) {
-		m_results = (uint8_t**)realloc(m_results, m_result_max * sizeof(uint8_t*) * REALLOC_FACTOR);
-		if (!m_results) {
-			fprintf(stderr, "Error: unable to reallocate memory to add a result row\n");
-			return NULL;
-		}
-		m_result_max *= REALLOC_FACTOR;
+	uint8_t* result = (uint8_t*)calloc(1, this->row_size());
+	if (!result) {
+		fprintf(stderr, "Error: unable to allocate memory for a result row\n");
 	}
-	m_result_count++;
-	m_results[m_result_count-1] = (uint8_t*)calloc(1, this->row_size());
-	return m_results[m_result_count-1];
+	return result;
 }
 
 int Table::free_result(uint8_t* result) {
-	for (uint32_t i=0; i < m_result_count; i++) {
-		// look for matching result
-		if (result == m_results[i]) {
-			this->free_row((uint8_t*)m_results[i]);
-			free(m_results[i]);
-			m_results[i] = NULL;
-			// if we did not free the last result,
-			// move last result to the empty slot
-			if (i != (m_result_count - 1)) {
-				m_results[i] = m_results[m_result_count-1];
-				m_results[m_result_count-1] = NULL;
-			}
-			m_result_count--;
-		}
-	}
+	if (!result) return 0;
+	this->free_row(result);
+	free(result);
 	return 0;
 }
 
@@ -450,6 +498,9 @@ const char* Table::create() {
 			// custom sql
 			if (m_custom_create_sql) size += strlen(m_custom_create_sql);
 		}
+		for (i=0; i<m_index_count; i++) {
+			size += strlen(m_indexes[i].sql);
+		}
 		
 		// create creation sql
 		m_create_sql = (char*)malloc(size);
@@ -473,11 +524,23 @@ const char* Table::create() {
 			}
 		}
 		if (m_custom_create_sql) strlcat(m_create_sql, m_custom_create_sql, size);
+		for (i=0; i<m_index_count; i++) {
+			strlcat(m_create_sql, m_indexes[i].sql, size);
+		}
 	}
 
 	return (const char*)m_create_sql;
 }
 
+uint32_t Table::index_count() {
+	return m_index_count;
+}
+
+TableIndex* Table::index(uint32_t index) {
+	if (index < m_index_count) return &m_indexes[index];
+	return NULL;
+}
+
 const char* Table::alter_add_column(uint32_t index) {
 	if (m_columns[index]) return m_columns[index]->alter(m_name);
 	return NULL;
@@ -551,11 +614,3 @@ int Table::free_row(uint8_t* row) {
 	return 0;
 }
 
-void Table::dump_results(FILE* f) {
-	fprintf(f, "====================================================================\n");
-	for (uint32_t i=0; i < m_result_count; i++) {
-		fprintf(f, "%p %u:\n", m_results[i], i);
-		__data_hex(f, m_results[i], 48);
-	}
-	fprintf(f, "====================================================================\n");
-}
@@ -38,6 +38,31 @@
 
 #include "Column.h"
 
+struct Table;
+
+// an index on more than one column, created with its table or, for an
+//  existing table, when the schema is upgraded past version
+struct TableIndex {
+	char*          name;
+	char*          sql;
+	uint32_t       version; // schema version this was added
+};
+
+// a text column kept as the serial of its parent in another table and
+//  the text after its last '/', see Table::split_column()
+struct SplitColumn {
+	Column*        column;      // the whole text, NULL in every row
+	Column*        parent;      // serial of the parent's row in parents
+	Column*        leaf;        // text after the last '/'
+	Table*         parents;
+	Column*        parent_key;  // primary key of parents
+	Column*        parent_text; // text before the last '/'
+	// the SQL that reads the whole text, and that matches it to a 
+	//  parent and leaf bound in that order
+	char*          select;
+	char*          where;
+};
+
 
 struct Table {	
 	Table(const char* name);
@@ -48,6 +73,20 @@ struct Table {
 
 	// Add custom SQL to table initialization
 	int            set_custom_create(const char* sql);
+	// Add an index named name on columns, a comma separated list
+	int            add_index(const char* name, const char* columns, 
+							 uint32_t schema_version);
+	
+	// Stores column as parent and leaf from now on, where parent is the 
+	//  parent_key of the row of parents whose parent_text is everything
+	//  before the last '/' of the column's text.  Queries go on reading
+	//  and matching column, but may only match it with '='.  Rows must
+	//  be written with the parent and leaf, and NULL for column.
+	int            split_column(Column* column, Column* parent, Column* leaf,
+								Table* parents, Column* parent_key, 
+								Column* parent_text);
+	// Returns the split column, or NULL
+	SplitColumn*   split();
 	
 	// Column handling
 	int            add_column(Column*, uint32_t schema_version);
@@ -70,7 +109,7 @@ struct Table {
 	sqlite3_stmt*    del(sqlite3* db);
 	
 	/**
-	 * sql statement generators (cached by Database & libcache)
+	 * sql statement generators (kept by the Database's StatementRegistry)
 	 *
 	 * - order is either ORDER_BY_ASC or ORDER_BY_DESC
 	 * - count parameters should be the number of items in the va_list
@@ -97,6 +136,8 @@ protected:
 
 	const char*    create();  
 	const char*    alter_add_column(uint32_t index);
+	uint32_t       index_count();
+	TableIndex*    index(uint32_t index);
 	
 	int            where_va_columns(uint32_t count, char* query, size_t size, 
 									size_t* used, va_list args);
@@ -105,7 +146,6 @@ protected:
 
 	// free the out-of-band columns (text, blob) from a result record
 	int            free_row(uint8_t* row);
-	void           dump_results(FILE* f);	
 	
 	char*          m_name;
 	uint32_t       m_version; // schema version this was added
@@ -121,15 +161,17 @@ protected:
 	uint32_t       m_column_max;
 	int            m_columns_size;
 	
+	TableIndex*    m_indexes;
+	uint32_t       m_index_count;
+	
+	SplitColumn*   m_split;
+	
 	sqlite3_stmt*  m_prepared_insert;
 	sqlite3_stmt*  m_prepared_update;
 	sqlite3_stmt*  m_prepared_delete;
-	
-	uint8_t**      m_results;
-	uint32_t       m_result_count;
-	uint32_t       m_result_max;
 
 	friend struct Database;
+	friend struct Query;
 };
 
 #endif
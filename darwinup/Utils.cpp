@@ -32,6 +32,15 @@
 
 #include "Utils.h"
 
+#include <copyfile.h>
+#if defined(__APPLE__) && __MAC_OS_X_VERSION_MIN_REQUIRED >= 101200
+#include <sys/clonefile.h>
+#elif defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#endif
+
 extern char** environ;
 
 int fts_compare(const FTSENT **a, const FTSENT **b) {
@@ -117,6 +126,114 @@ int is_directory(const char* path, bool followlinks) {
 	return (res == 0 && S_ISDIR(sb.st_mode));
 }
 
+#if defined(FICLONE)
+// Copies the extended attributes of sfd, which include its ACL, to dfd.
+// Like copyfile(3), attributes that only root may set are left out.
+static int clone_xattrs(int sfd, int dfd) {
+	ssize_t len = flistxattr(sfd, NULL, 0);
+	if (len == -1 && errno == ENOTSUP) return 0;
+	if (len <= 0) return (int)len;
+	char* names = (char*)malloc(len);
+	if (!names) return -1;
+	len = flistxattr(sfd, names, len);
+	int res = (len == -1) ? -1 : 0;
+	for (char* name = names; res == 0 && name < names + len; name += strlen(name) + 1) {
+		ssize_t size = fgetxattr(sfd, name, NULL, 0);
+		void* value = (size > 0) ? malloc(size) : NULL;
+		if (size > 0 && !value) {
+			res = -1;
+			break;
+		}
+		if (size > 0) size = fgetxattr(sfd, name, value, size);
+		if (size == -1 || fsetxattr(dfd, name, value, size, 0) == -1) {
+			if (errno != EPERM && errno != ENOTSUP) res = -1;
+		}
+		free(value);
+	}
+	free(names);
+	return res;
+}
+#endif
+
+// Shares src's data blocks with a new file at dst, and gives it the
+// ownership, mode, extended attributes and times of src, as copyfile(3)
+// would with COPYFILE_ALL.  Fails with ENOTSUP if the filesystem cannot.
+static int clone_data(const char* src, const char* dst, struct stat* sb) {
+#if defined(__APPLE__) && __MAC_OS_X_VERSION_MIN_REQUIRED >= 101200
+	return clonefile(src, dst, CLONE_NOFOLLOW);
+#elif defined(FICLONE)
+	int res = -1;
+	int sfd = open(src, O_RDONLY | O_NOFOLLOW);
+	if (sfd == -1) return -1;
+	int dfd = open(dst, O_WRONLY | O_CREAT | O_EXCL, sb->st_mode & ALLPERMS);
+	if (dfd != -1) {
+		res = ioctl(dfd, FICLONE, sfd);
+		// like copyfile(3), only root gets to keep the ownership
+		if (res == 0 && fchown(dfd, sb->st_uid, sb->st_gid) == -1 && errno != EPERM) {
+			res = -1;
+		}
+		if (res == 0) res = fchmod(dfd, sb->st_mode & ALLPERMS);
+		if (res == 0) res = clone_xattrs(sfd, dfd);
+		// last, since nothing after it may touch the file
+		struct timespec times[2] = { sb->st_atim, sb->st_mtim };
+		if (res == 0) res = futimens(dfd, times);
+		int saved = errno;
+		close(dfd);
+		if (res != 0) unlink(dst);
+		errno = saved;
+	}
+	close(sfd);
+	return res;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+int share_data(const char* src, const char* dst, bool replaced, int* method, off_t* size) {
+	int res;
+	struct stat sb;
+	*size = 0;
+	res = lstat(src, &sb);
+	if (res == 0 && !S_ISREG(sb.st_mode)) {
+		errno = ENOTSUP;
+		res = -1;
+	}
+	if (res == 0) {
+		*size = sb.st_size;
+		res = clone_data(src, dst, &sb);
+		if (res == 0) {
+			IF_DEBUG("[backup] cloned %s to %s\n", src, dst);
+			*method = BACKUP_CLONED;
+			return 0;
+		}
+		IF_DEBUG("[backup] unable to clone %s: %s (%d)\n", src, strerror(errno), errno);
+		
+		// src keeps its inode when it is replaced, so the link
+		// still has the old data afterwards, unless another name
+		// for the same inode is modified in place
+		if (replaced && sb.st_nlink == 1) {
+			res = link(src, dst);
+			if (res == 0) {
+				IF_DEBUG("[backup] linked %s to %s\n", src, dst);
+				*method = BACKUP_LINKED;
+				return 0;
+			}
+			IF_DEBUG("[backup] unable to link %s: %s (%d)\n", src, strerror(errno), errno);
+		}
+		res = -1;
+	}
+	return res;
+}
+
+int backup_data(const char* src, const char* dst, bool replaced, int* method, off_t* size) {
+	if (share_data(src, dst, replaced, method, size) == 0) return 0;
+
+	IF_DEBUG("[backup] copyfile(%s, %s)\n", src, dst);
+	*method = BACKUP_COPIED;
+	return copyfile(src, dst, NULL, COPYFILE_ALL|COPYFILE_NOFOLLOW);
+}
+
 int is_regular_file(const char* path) {
 	struct stat sb;
 	int res = stat(path, &sb);
@@ -51,6 +51,12 @@
 #include <sys/stat.h>
 
 
+// how backup_data() saved a file, fastest first
+#define BACKUP_CLONED   0
+#define BACKUP_LINKED   1
+#define BACKUP_COPIED   2
+#define BACKUP_METHODS  3
+
 const uint32_t VERBOSE		    = 0x1;
 const uint32_t VERBOSE_DEBUG	= 0x2;
 const uint32_t VERBOSE_SQL      = 0x4;
@@ -62,6 +68,17 @@ int fts_compare(const FTSENT **a, const FTSENT **b);
 size_t ftsent_filename(FTSENT* ent, char* filename, size_t bufsiz);
 int mkdir_p(const char* path);
 int remove_directory(const char* path);
+// Saves src at dst with its metadata, by cloning the file if the
+// filesystem can, or hard linking it if replaced is true, otherwise
+// copying it.  replaced must only be true if src is about to be
+// replaced with rename(2) or unlink(2), never modified in place.
+// Files with more than one link are never linked.
+// method is set to one of the BACKUP_ values, and size to the
+// number of bytes of file data saved that way.
+int backup_data(const char* src, const char* dst, bool replaced, int* method, off_t* size);
+// Like backup_data(), but only clones or links the regular file src,
+// and fails instead of copying it.
+int share_data(const char* src, const char* dst, bool replaced, int* method, off_t* size);
 int is_directory(const char* path);
 int is_directory(const char* path, bool followlinks);
 int is_regular_file(const char* path);
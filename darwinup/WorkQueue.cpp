@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#include "WorkQueue.h"
+#include "Utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+WorkQueue::WorkQueue(WorkFunc func, void* context, uint32_t workers) {
+	m_func = func;
+	m_context = context;
+	if (workers == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = (ncpu > 0) ? (uint32_t)ncpu : 1;
+	}
+	m_workers = workers;
+	m_started = 0;
+	m_threads = (pthread_t*)calloc(m_workers, sizeof(pthread_t));
+
+	m_capacity = m_workers * WORKQUEUE_ITEMS_PER_WORKER;
+	m_items = (void**)calloc(m_capacity, sizeof(void*));
+	m_done = (bool*)calloc(m_capacity, sizeof(bool));
+	m_head = 0;
+	m_next = 0;
+	m_tail = 0;
+	m_closed = false;
+	m_cancelled = false;
+
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_has_work, NULL);
+	pthread_cond_init(&m_has_room, NULL);
+	pthread_cond_init(&m_has_done, NULL);
+}
+
+WorkQueue::~WorkQueue() {
+	this->cancel();
+	pthread_mutex_destroy(&m_lock);
+	pthread_cond_destroy(&m_has_work);
+	pthread_cond_destroy(&m_has_room);
+	pthread_cond_destroy(&m_has_done);
+	free(m_threads);
+	free(m_items);
+	free(m_done);
+}
+
+uint32_t WorkQueue::workers() {
+	return m_workers;
+}
+
+uint32_t WorkQueue::capacity() {
+	return m_capacity;
+}
+
+int WorkQueue::start() {
+	int res = 0;
+	if (!m_threads || !m_items || !m_done) {
+		fprintf(stderr, "Error: ran out of memory in WorkQueue::start\n");
+		return -1;
+	}
+	IF_DEBUG("[workqueue] starting %u workers\n", m_workers);
+	for (uint32_t i = 0; res == 0 && i < m_workers; i++) {
+		res = pthread_create(&m_threads[i], NULL, &WorkQueue::worker_main, this);
+		if (res == 0) {
+			m_started++;
+		} else {
+			fprintf(stderr, "Error: unable to create worker thread: %s (%d)\n",
+					strerror(res), res);
+		}
+	}
+	if (res) this->cancel();
+	return res;
+}
+
+void* WorkQueue::worker_main(void* arg) {
+	WorkQueue* queue = (WorkQueue*)arg;
+	pthread_mutex_lock(&queue->m_lock);
+	for (;;) {
+		while (!queue->m_cancelled && queue->m_next == queue->m_tail && !queue->m_closed) {
+			pthread_cond_wait(&queue->m_has_work, &queue->m_lock);
+		}
+		if (queue->m_cancelled || queue->m_next == queue->m_tail) break;
+
+		uint32_t slot = (uint32_t)(queue->m_next++ % queue->m_capacity);
+		void* item = queue->m_items[slot];
+		pthread_mutex_unlock(&queue->m_lock);
+
+		queue->m_func(item, queue->m_context);
+
+		pthread_mutex_lock(&queue->m_lock);
+		queue->m_done[slot] = true;
+		pthread_cond_broadcast(&queue->m_has_done);
+	}
+	pthread_mutex_unlock(&queue->m_lock);
+	return NULL;
+}
+
+int WorkQueue::push(void* item) {
+	int res = 0;
+	pthread_mutex_lock(&m_lock);
+	while (!m_cancelled && (m_tail - m_head) >= m_capacity) {
+		pthread_cond_wait(&m_has_room, &m_lock);
+	}
+	if (m_cancelled || m_closed) {
+		res = -1;
+	} else {
+		uint32_t slot = (uint32_t)(m_tail++ % m_capacity);
+		m_items[slot] = item;
+		m_done[slot] = false;
+		pthread_cond_signal(&m_has_work);
+	}
+	pthread_mutex_unlock(&m_lock);
+	return res;
+}
+
+void WorkQueue::close() {
+	pthread_mutex_lock(&m_lock);
+	m_closed = true;
+	pthread_cond_broadcast(&m_has_work);
+	pthread_cond_broadcast(&m_has_done);
+	pthread_mutex_unlock(&m_lock);
+}
+
+void* WorkQueue::pop() {
+	void* item = NULL;
+	pthread_mutex_lock(&m_lock);
+	for (;;) {
+		if (m_head == m_tail && (m_closed || m_cancelled)) break;
+		if (m_head == m_tail) {
+			if (m_closed) break;
+			pthread_cond_wait(&m_has_done, &m_lock);
+			continue;
+		}
+		uint32_t slot = (uint32_t)(m_head % m_capacity);
+		if (!m_done[slot] && !m_cancelled) {
+			pthread_cond_wait(&m_has_done, &m_lock);
+			continue;
+		}
+		item = m_items[slot];
+		m_items[slot] = NULL;
+		m_head++;
+		pthread_cond_signal(&m_has_room);
+		break;
+	}
+	pthread_mutex_unlock(&m_lock);
+	return item;
+}
+
+void WorkQueue::cancel() {
+	pthread_mutex_lock(&m_lock);
+	m_cancelled = true;
+	pthread_cond_broadcast(&m_has_work);
+	pthread_cond_broadcast(&m_has_room);
+	pthread_cond_broadcast(&m_has_done);
+	pthread_mutex_unlock(&m_lock);
+	this->join();
+}
+
+void WorkQueue::join() {
+	for (uint32_t i = 0; i < m_started; i++) {
+		pthread_join(m_threads[i], NULL);
+	}
+	m_started = 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2026 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// number of items that may be in flight for each worker thread
+#define WORKQUEUE_ITEMS_PER_WORKER 32
+// most worker threads a queue may be asked for
+#define WORKQUEUE_MAX_WORKERS 256
+
+typedef int (*WorkFunc)(void* item, void* context);
+
+////
+//  WorkQueue
+//
+//  An ordered, bounded queue serviced by a pool of worker threads.
+//
+//  A producer push()es items, which are handed to func on one of
+//  the worker threads.  A single consumer pop()s the items back out
+//  in the same order they were pushed, blocking until each one has
+//  been processed.  push() blocks while the queue is full, so a
+//  caller that both pushes and pops must keep no more than capacity()
+//  items outstanding.
+//
+//  func must not touch the database or anything else that is not
+//  safe to use from multiple threads.
+////
+struct WorkQueue {
+	// workers of 0 uses one worker per online cpu
+	WorkQueue(WorkFunc func, void* context, uint32_t workers);
+	~WorkQueue();
+
+	// spawns the worker threads
+	int      start();
+
+	// Producer side.
+	// Returns 0, or -1 if the queue has been cancelled.
+	int      push(void* item);
+	// signals that nothing more will be pushed
+	void     close();
+
+	// Consumer side.
+	// Returns the next item in push() order once func has processed it,
+	// or NULL when the queue is closed and drained.
+	void*    pop();
+	// Stops the workers and unblocks the producer.
+	// After cancel(), pop() hands back the remaining items without
+	// waiting for them to be processed, so they can be freed.
+	void     cancel();
+
+	uint32_t workers();
+	// the number of items that may be pushed but not yet popped
+	uint32_t capacity();
+
+	protected:
+
+	static void* worker_main(void* queue);
+	void         join();
+
+	WorkFunc         m_func;
+	void*            m_context;
+
+	pthread_t*       m_threads;
+	uint32_t         m_workers;
+	uint32_t         m_started;
+
+	pthread_mutex_t  m_lock;
+	pthread_cond_t   m_has_work;   // signalled when an item is pushed
+	pthread_cond_t   m_has_room;   // signalled when an item is popped
+	pthread_cond_t   m_has_done;   // signalled when an item is processed
+
+	// ring buffer of items and their completion state
+	void**           m_items;
+	bool*            m_done;
+	uint32_t         m_capacity;
+	uint64_t         m_head;       // next item to pop
+	uint64_t         m_next;       // next item to hand to a worker
+	uint64_t         m_tail;       // next free slot to push into
+
+	bool             m_closed;
+	bool             m_cancelled;
+};
+
+#endif
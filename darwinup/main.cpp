@@ -31,6 +31,8 @@
  */
 
 #include <Availability.h>
+#include <errno.h>
+#include <getopt.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,7 +43,10 @@
 
 #include "Archive.h"
 #include "Depot.h"
+#include "PackFile.h"
+#include "Stats.h"
 #include "Utils.h"
+#include "WorkQueue.h"
 #include "DB.h"
 
 
@@ -54,18 +59,42 @@ void usage(char* progname) {
 	fprintf(stderr, "          -d        disable helpful automation                 \n");	
 #endif
 	fprintf(stderr, "          -f        force operation to succeed at all costs    \n");
+	fprintf(stderr, "          -l        list file counts, sizes and install times  \n");
 	fprintf(stderr, "          -n        dry run                                    \n");
+	fprintf(stderr, "          -o FILE   write the plan made by plan to FILE        \n");
 	fprintf(stderr, "          -p DIR    operate on roots under DIR (default: /)    \n");
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
 	fprintf(stderr, "          -r        gracefully restart when finished           \n");	
 #endif
 	fprintf(stderr, "          -v        verbose (use -vv for extra verbosity)      \n");
+	fprintf(stderr, "          --paranoid  always read file data, even if unchanged \n");
+	fprintf(stderr, "                      since darwinup installed it              \n");
+	fprintf(stderr, "          --compress CODEC[:LEVEL]                             \n");
+	fprintf(stderr, "                      compact archives with none, zlib or xz   \n");
+	fprintf(stderr, "                      at LEVEL 1-9 (default: zlib)             \n");
+	fprintf(stderr, "          --db-profile NAME                                    \n");
+	fprintf(stderr, "                      open the database with the default, wal  \n");
+	fprintf(stderr, "                      or fast profile for this run             \n");
+	fprintf(stderr, "          --lock-timeout SECONDS                               \n");
+	fprintf(stderr, "                      give up waiting for another darwinup     \n");
+	fprintf(stderr, "                      after SECONDS (default: 300)             \n");
+	fprintf(stderr, "          --io-jobs N                                          \n");
+	fprintf(stderr, "                      read and hash at most N files at once    \n");
+	fprintf(stderr, "                      (default: one per cpu)                   \n");
 	fprintf(stderr, "                                                               \n");
 	fprintf(stderr, "commands:                                                      \n");
+	fprintf(stderr, "          apply      <plan>                                    \n");
 	fprintf(stderr, "          files      <archive>                                 \n");
 	fprintf(stderr, "          install    <path>                                    \n");
 	fprintf(stderr, "          list       [archive]                                 \n");
+	fprintf(stderr, "          migrate-paths                                        \n");
+	fprintf(stderr, "          migrate-store                                        \n");
+	fprintf(stderr, "          owner      <file>                                    \n");
+	fprintf(stderr, "          plan       -o <plan> <path>                          \n");
+	fprintf(stderr, "          profile    [name]                                    \n");
 	fprintf(stderr, "          rename     <archive> <name>                          \n");
+	fprintf(stderr, "          resume     <archive>                                 \n");
+	fprintf(stderr, "          stats      <command> [args]                          \n");
 	fprintf(stderr, "          uninstall  <archive>                                 \n");
 	fprintf(stderr, "          upgrade    <path>                                    \n");
 	fprintf(stderr, "          verify     <archive>                                 \n");
@@ -78,7 +107,7 @@ void usage(char* progname) {
 	fprintf(stderr, "Files must be in one of the supported archive formats:         \n");
 	fprintf(stderr, "          cpio, cpio.gz, cpio.bz2                              \n");
 	fprintf(stderr, "          pax, pax.gz, pax.bz2                                 \n");
-	fprintf(stderr, "          tar, tar.gz, tar.bz2                                 \n");
+	fprintf(stderr, "          tar, tar.gz, tar.bz2, tar.xz                          \n");
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060	
 	fprintf(stderr, "          xar, zip                                             \n");
 #else
@@ -102,11 +131,44 @@ void usage(char* progname) {
 uint32_t verbosity;
 uint32_t force;
 uint32_t dryrun;
+uint32_t paranoid;
+uint32_t compress_codec = PACK_CODEC_ZLIB;
+uint32_t compress_level = PACK_LEVEL_DEFAULT;
+uint32_t db_profile = DB_PROFILE_STORED;
+uint32_t lock_timeout = DB_BUSY_TIMEOUT;
+uint32_t io_jobs;
+uint32_t long_list;
+
+// where the stats of this run go when it exits
+static bool stats_stdout = false;
+static const char* stats_path = NULL;
+static const char* stats_command = NULL;
+
+static void write_stats() {
+	if (stats_stdout) stats->write(stdout, stats_command);
+	if (stats_path) {
+		FILE* f = fopen(stats_path, "w");
+		if (!f || stats->write(f, stats_command)) {
+			fprintf(stderr, "Warning: unable to write stats to %s\n", stats_path);
+		}
+		if (f) fclose(f);
+	}
+}
+
+static struct option longopts[] = {
+	{ "paranoid",   no_argument,       NULL, 'P' },
+	{ "compress",   required_argument, NULL, 'Z' },
+	{ "db-profile", required_argument, NULL, 'B' },
+	{ "lock-timeout", required_argument, NULL, 'L' },
+	{ "io-jobs",    required_argument, NULL, 'J' },
+	{ NULL,         0,                 NULL, 0   }
+};
 
 
 int main(int argc, char* argv[]) {
 	char* progname = strdup(basename(argv[0]));      
 	char* path = NULL;
+	char* output = NULL;
 	bool disable_automation = false;
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
 	bool restart = false;
@@ -114,9 +176,9 @@ int main(int argc, char* argv[]) {
 	
 	int ch;
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
-	while ((ch = getopt(argc, argv, "dfnp:rvh")) != -1) {
+	while ((ch = getopt_long(argc, argv, "dflno:p:rvh", longopts, NULL)) != -1) {
 #else
-	while ((ch = getopt(argc, argv, "dfnp:vh")) != -1) {
+	while ((ch = getopt_long(argc, argv, "dflno:p:vh", longopts, NULL)) != -1) {
 #endif
 		switch (ch) {
 		case 'd':
@@ -125,10 +187,16 @@ int main(int argc, char* argv[]) {
 		case 'f':
 				force = 1;
 				break;
+		case 'l':
+				long_list = 1;
+				break;
 		case 'n':
 				dryrun = 1;
 				disable_automation = true;
 				break;
+		case 'o':
+				output = optarg;
+				break;
 		case 'p':
 				if (optarg[0] != '/') {
 					fprintf(stderr, "Error: -p option must be an absolute path\n");
@@ -149,6 +217,45 @@ int main(int argc, char* argv[]) {
 				verbosity <<= 1;
 				verbosity |= VERBOSE;
 				break;
+		case 'P':
+				paranoid = 1;
+				break;
+		case 'Z':
+				if (PackFile::parse_codec(optarg, &compress_codec, &compress_level)) {
+					fprintf(stderr, "Error: unsupported compression: %s\n", optarg);
+					exit(4);
+				}
+				break;
+		case 'B':
+				db_profile = Database::profile_named(optarg);
+				if (db_profile == DB_PROFILE_STORED) {
+					fprintf(stderr, "Error: unknown database profile: %s\n", optarg);
+					exit(4);
+				}
+				break;
+		case 'L': {
+				char* end = NULL;
+				errno = 0;
+				unsigned long seconds = strtoul(optarg, &end, 10);
+				if (!optarg[0] || *end || errno || seconds > 0xFFFFFFFFUL) {
+					fprintf(stderr, "Error: invalid lock timeout: %s\n", optarg);
+					exit(4);
+				}
+				lock_timeout = (uint32_t)seconds;
+				break;
+		}
+		case 'J': {
+				char* end = NULL;
+				errno = 0;
+				unsigned long jobs = strtoul(optarg, &end, 10);
+				if (!optarg[0] || *end || errno || jobs == 0 || jobs > WORKQUEUE_MAX_WORKERS) {
+					fprintf(stderr, "Error: --io-jobs must be from 1 to %u: %s\n", 
+							WORKQUEUE_MAX_WORKERS, optarg);
+					exit(4);
+				}
+				io_jobs = (uint32_t)jobs;
+				break;
+		}
 		case '?':
 		case 'h':
 		default:
@@ -159,10 +266,40 @@ int main(int argc, char* argv[]) {
     argv += optind;
 	if (argc == 0) usage(progname);
 	
+	// stats runs the rest of the command line, timing the database
+	if (strcmp(argv[0], "stats") == 0) {
+		stats_stdout = true;
+		argc--;
+		argv++;
+		if (argc == 0) usage(progname);
+	}
+	// a plan is a dry run install that is saved for later
+	if (strcmp(argv[0], "plan") == 0) {
+		dryrun = 1;
+		disable_automation = true;
+	}
+	stats_path = getenv("DARWINUP_PROFILE");
+	if (stats_path && !stats_path[0]) stats_path = NULL;
+	if (stats_stdout || stats_path) {
+		stats_command = argv[0];
+		stats = new Stats();
+		atexit(write_stats);
+	}
+	
 	int res = 0;
 
 	if (dryrun) IF_DEBUG("option: dry run\n");
 	if (force)  IF_DEBUG("option: forcing operations\n");
+	if (paranoid) IF_DEBUG("option: paranoid\n");
+	IF_DEBUG("option: compress with %s level %u\n", 
+			 PackFile::codec_name(compress_codec), compress_level);
+	if (db_profile != DB_PROFILE_STORED) {
+		IF_DEBUG("option: database profile %s\n", Database::profile_name(db_profile));
+	}
+	if (io_jobs) IF_DEBUG("option: %u io jobs\n", io_jobs);
+	if (lock_timeout != DB_BUSY_TIMEOUT) {
+		IF_DEBUG("option: lock timeout %u seconds\n", lock_timeout);
+	}
 	if (disable_automation) IF_DEBUG("option: helpful automation disabled\n");
 #if __MAC_OS_X_VERSION_MIN_REQUIRED >= 1060
     if (restart) IF_DEBUG("option: restart when finished\n");
@@ -183,7 +320,11 @@ int main(int argc, char* argv[]) {
 			// we are not asking to write, 
 			// but no depot exists yet either,
 			// so print an empty list
-			depot->archive_header();
+			if (long_list) {
+				depot->archive_stats_header();
+			} else {
+				depot->archive_header();
+			}
 			exit(0);
 		}
 		if (res == DEPOT_PERM_DENIED) {
@@ -198,6 +339,15 @@ int main(int argc, char* argv[]) {
 		if (strcmp(argv[0], "dump") == 0) {
 			if (depot->initialize(false)) exit(11);
 			depot->dump();
+		} else if (strcmp(argv[0], "migrate-paths") == 0) {
+			if (depot->initialize(true)) exit(22);
+			res = depot->migrate_paths();
+		} else if (strcmp(argv[0], "migrate-store") == 0) {
+			if (depot->initialize(true)) exit(19);
+			res = depot->migrate_store();
+		} else if (strcmp(argv[0], "profile") == 0) {
+			if (depot->initialize(false)) exit(21);
+			res = depot->set_profile(NULL);
 		} else {
 			fprintf(stderr, "Error: unknown command: '%s' \n", argv[0]);
 			usage(progname);
@@ -243,7 +393,23 @@ int main(int argc, char* argv[]) {
 				if (i==1 && depot->initialize(true)) exit(15);
 				res = depot->process_archive(argv[0], argv[i]);
 			} else if (strcmp(argv[0], "verify") == 0) {
-				if (i==1 && depot->initialize(true)) exit(16);
+				if (i==1 && depot->initialize(false)) exit(16);
+				res = depot->process_archive(argv[0], argv[i]);
+			} else if (strcmp(argv[0], "owner") == 0) {
+				if (i==1 && depot->initialize(false)) exit(23);
+				res = depot->owner(argv[i]);
+			} else if (strcmp(argv[0], "plan") == 0) {
+				if (!output || argc > 2) {
+					fprintf(stderr, "Error: plan command takes -o FILE and 1 argument.\n");
+					exit(24);
+				}
+				if (i==1 && depot->initialize(true)) exit(24);
+				res = depot->plan(argv[i], output);
+			} else if (strcmp(argv[0], "apply") == 0) {
+				if (i==1 && depot->initialize(true)) exit(25);
+				res = depot->apply(argv[i]);
+			} else if (strcmp(argv[0], "resume") == 0) {
+				if (i==1 && depot->initialize(true)) exit(20);
 				res = depot->process_archive(argv[0], argv[i]);
 			} else if (strcmp(argv[0], "rename") == 0) {
 				if (i==1 && depot->initialize(true)) exit(17);
@@ -255,6 +421,13 @@ int main(int argc, char* argv[]) {
 				}
 				res = depot->rename_archive(argv[i], argv[i+1]);
 				i++;
+			} else if (strcmp(argv[0], "profile") == 0) {
+				if (i==1 && depot->initialize(true)) exit(21);
+				if (argc > 2) {
+					fprintf(stderr, "Error: profile command takes 1 argument.\n");
+					exit(21);
+				}
+				res = depot->set_profile(argv[i]);
 			} else {
 				fprintf(stderr, "Error: unknown command: '%s' \n", argv[0]);
 				usage(progname);
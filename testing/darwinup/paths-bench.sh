@@ -0,0 +1,54 @@
+#!/bin/bash
+set -e
+pushd $(dirname $0) >> /dev/null
+
+#
+# Compare the size of a depot holding ROWS files, and the time a few
+# commands take on it, with whole paths and with interned paths.
+#
+# usage: paths-bench.sh [ROWS] [darwinup]
+#
+ROWS=${1:-1000000}
+DARWINUP=${2:-darwinup}
+PREFIX=/tmp/testing/darwinup-paths
+WHOLE=$PREFIX/whole
+INTERNED=$PREFIX/interned
+DB=.DarwinDepot/Database-V100
+PER_DIR=50
+
+echo "INFO: building a depot with $ROWS files, $PER_DIR per directory ..."
+rm -rf $PREFIX
+mkdir -p $WHOLE $PREFIX/orig
+tar -C $PREFIX/orig -xjf 300files.tbz2
+$DARWINUP -p $WHOLE install $PREFIX/orig/300files >> /dev/null
+# the rows of a second archive, deep enough to look like a system root
+sqlite3 $WHOLE/$DB <<SQL
+INSERT INTO archives (uuid, name, date_added, active, info, osbuild, codec)
+	VALUES (randomblob(16), 'synthetic', strftime('%s','now'), 1, 0, NULL, 0);
+WITH RECURSIVE n(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM n WHERE i + 1 < $ROWS)
+INSERT INTO files (archive, info, mode, uid, gid, size, digest, path)
+	SELECT (SELECT MAX(serial) FROM archives), 0, 33188, 0, 0, 0, randomblob(20),
+		printf('/System/Library/Frameworks/Bench%03d.framework/Versions/A/Resources/d%05d/file%03d.txt',
+			   i / $PER_DIR / 100, i / $PER_DIR, i % $PER_DIR)
+	FROM n;
+SQL
+cp -R $WHOLE $INTERNED
+$DARWINUP -p $INTERNED migrate-paths
+
+TIMEFORMAT=%R
+function elapsed {
+	{ time "$@" >> /dev/null 2>&1 ; } 2>&1
+}
+
+printf "%-10s %10s %10s %10s %10s\n" paths size files superseded install
+for P in whole interned; do
+	DEST=$PREFIX/$P
+	SIZE=$(( $(wc -c < $DEST/$DB) / 1024 ))
+	FILES=$(elapsed $DARWINUP -p $DEST files synthetic)
+	SUPERSEDED=$(elapsed $DARWINUP -p $DEST list superseded)
+	INSTALL=$(elapsed $DARWINUP -p $DEST install $PREFIX/orig/300files)
+	printf "%-10s %8dKB %9.2fs %9.2fs %9.2fs\n" $P $SIZE $FILES $SUPERSEDED $INSTALL
+done
+
+rm -rf $PREFIX
+popd >> /dev/null
@@ -0,0 +1,49 @@
+#!/bin/bash
+set -e
+pushd $(dirname $0) >> /dev/null
+
+#
+# Time install and uninstall of the 300files and 300dirs roots,
+# replicated SCALE times into one root, under each database profile.
+#
+# usage: profile-bench.sh [SCALE] [darwinup]
+#
+SCALE=${1:-1000}
+DARWINUP=${2:-darwinup}
+PREFIX=/tmp/testing/darwinup-bench
+ROOT=$PREFIX/scaled
+DEST=$PREFIX/dest
+PROFILES="default wal fast"
+
+echo "INFO: building a root with $SCALE copies of 300files and 300dirs ..."
+rm -rf $PREFIX
+mkdir -p $ROOT $PREFIX/orig
+tar -C $PREFIX/orig -xjf 300files.tbz2
+tar -C $PREFIX/orig -xjf 300dirs.tbz2
+for i in $(seq 1 $SCALE); do
+	mkdir -p $ROOT/$i
+	cp -R $PREFIX/orig/300files $PREFIX/orig/300dirs $ROOT/$i/
+done
+echo "INFO: $(find $ROOT | wc -l) paths"
+
+TIMEFORMAT=%R
+function elapsed {
+	{ time "$@" >> /dev/null 2>&1 ; } 2>&1
+}
+
+printf "%-10s %10s %10s\n" profile install uninstall
+for P in $PROFILES; do
+	rm -rf $DEST
+	mkdir -p $DEST
+	# the first install creates the depot, which is then switched to P
+	# and emptied, so every profile starts from an empty database
+	$DARWINUP -p $DEST install $PREFIX/orig/300files >> /dev/null
+	$DARWINUP -p $DEST profile $P >> /dev/null
+	$DARWINUP -p $DEST uninstall newest >> /dev/null
+	INSTALL=$(elapsed $DARWINUP -p $DEST install $ROOT)
+	UNINSTALL=$(elapsed $DARWINUP -p $DEST uninstall scaled)
+	printf "%-10s %9.2fs %9.2fs\n" $P $INSTALL $UNINSTALL
+done
+
+rm -rf $PREFIX
+popd >> /dev/null
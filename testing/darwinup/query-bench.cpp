@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2010 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_START@
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 3.  Neither the name of Apple Computer, Inc. ("Apple") nor the names of
+ *     its contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE AND ITS CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL APPLE OR ITS CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @APPLE_BSD_LICENSE_HEADER_END@
+ */
+
+/**
+ * Compares the per-call cost of a named, va_list Database query with the 
+ *  same query run through a Query object.  Build it from this directory 
+ *  against the darwinup sources, leaving out main.cpp:
+ *
+ *    c++ -O2 -I../../darwinup -o query-bench query-bench.cpp \
+ *        $(ls ../../darwinup/*.cpp | grep -v main.cpp) \
+ *        -lsqlite3 -lcrypto -lz -lbz2 -llzma
+ *
+ *  and run it as ./query-bench [rows] [calls]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "Database.h"
+#include "PackFile.h"
+#include "Query.h"
+
+// the options main.cpp would otherwise define
+uint32_t verbosity = 0;
+uint32_t force = 0;
+uint32_t dryrun = 0;
+uint32_t paranoid = 0;
+uint32_t compress_codec = PACK_CODEC_ZLIB;
+uint32_t compress_level = PACK_LEVEL_DEFAULT;
+uint32_t db_profile = DB_PROFILE_STORED;
+uint32_t lock_timeout = DB_BUSY_TIMEOUT;
+uint32_t io_jobs = 0;
+uint32_t long_list = 0;
+
+struct BenchDatabase : Database {
+	BenchDatabase(const char* path) : Database(path) {}
+	
+	int init_schema() {
+		SCHEMA_VERSION(0);
+		m_items = new Table("items");
+		ADD_TABLE(m_items);
+		ADD_PK(m_items, "serial");
+		ADD_INDEX(m_items, "group_id", TYPE_INTEGER, false);
+		ADD_INDEX(m_items, "path", TYPE_TEXT, false);
+		
+		m_item_by_path = new Query(m_items, QUERY_ROW);
+		m_item_by_path->where(m_items->column(2), '=');
+		ADD_QUERY(m_item_by_path);
+		
+		m_items_by_group = new Query(m_items, QUERY_ROWS);
+		m_items_by_group->where(m_items->column(1), '=');
+		m_items_by_group->order_by(m_items->column(2), ORDER_BY_ASC);
+		ADD_QUERY(m_items_by_group);
+		return 0;
+	}
+	
+	int fill(uint32_t rows) {
+		char path[64];
+		int res = this->begin_transaction();
+		for (uint32_t i = 0; res == DB_OK && i < rows; i++) {
+			snprintf(path, sizeof(path), "/usr/lib/item%u", i);
+			res = this->insert(m_items, (uint64_t)(i % 16), path);
+		}
+		if (res == DB_OK) res = this->commit_transaction();
+		return res;
+	}
+	
+	Table* m_items;
+	Query* m_item_by_path;
+	Query* m_items_by_group;
+};
+
+static double now_ns() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec * 1e9 + (double)tv.tv_usec * 1e3;
+}
+
+static void free_rows(Table* table, uint8_t** rows, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) table->free_result(rows[i]);
+	free(rows);
+}
+
+int main(int argc, char* argv[]) {
+	uint32_t rows = (argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 10000);
+	uint32_t calls = (argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 100000);
+	
+	char path[] = "/tmp/query-bench.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	unlink(path);
+	
+	BenchDatabase* db = new BenchDatabase(path);
+	if (db->connect() || db->fill(rows)) {
+		fprintf(stderr, "Error: unable to create %s\n", path);
+		return 1;
+	}
+	Table* items = db->m_items;
+	char key[64];
+	uint8_t* row;
+	uint8_t** all;
+	uint32_t count;
+	double start;
+	
+	printf("%u rows, %u calls\n", rows, calls);
+	
+	start = now_ns();
+	for (uint32_t i = 0; i < calls; i++) {
+		snprintf(key, sizeof(key), "/usr/lib/item%u", i % rows);
+		db->get_row("item__path", &row, items, 1, items->column(2), '=', key);
+		items->free_result(row);
+	}
+	printf("row by path, va_list: %8.0f ns/call\n", (now_ns() - start) / calls);
+	
+	start = now_ns();
+	for (uint32_t i = 0; i < calls; i++) {
+		snprintf(key, sizeof(key), "/usr/lib/item%u", i % rows);
+		db->get_row(db->m_item_by_path->bind(key), &row);
+		items->free_result(row);
+	}
+	printf("row by path, Query:   %8.0f ns/call\n", (now_ns() - start) / calls);
+	
+	uint32_t group_calls = calls / 100 + 1;
+	start = now_ns();
+	for (uint32_t i = 0; i < group_calls; i++) {
+		db->get_all_ordered("items__group", &all, &count, items, items->column(2), 
+							ORDER_BY_ASC, 1, items->column(1), '=', (uint64_t)(i % 16));
+		free_rows(items, all, count);
+	}
+	printf("rows by group, va_list: %8.0f ns/call\n", (now_ns() - start) / group_calls);
+	
+	start = now_ns();
+	for (uint32_t i = 0; i < group_calls; i++) {
+		db->get_all(db->m_items_by_group->bind((uint64_t)(i % 16)), &all, &count);
+		free_rows(items, all, count);
+	}
+	printf("rows by group, Query:   %8.0f ns/call\n", (now_ns() - start) / group_calls);
+	
+	delete db;
+	unlink(path);
+	return 0;
+}
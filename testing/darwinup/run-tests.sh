@@ -64,6 +64,7 @@ done;
 
 cp corrupt.tgz $PREFIX/
 cp depotroot.tar.gz $PREFIX/
+cp link_escape.tar.gz $PREFIX/
 
 mkdir -p $ORIG
 cp -R $DEST/* $ORIG/
@@ -141,7 +142,9 @@ if [ $LINES -lt 5 ]; then
 	echo "Failed multiple argument test."
 	exit 1;
 fi
-$DARWINUP uninstall all
+# every root touches /c.txt, which is restored once for the whole set
+C=$($DARWINUP uninstall all | grep ' /c.txt$' | wc -l | xargs)
+test "$C" == "1"
 echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 
@@ -153,7 +156,15 @@ do
 	$DARWINUP install $PREFIX/$R
 done
 
-$DARWINUP verify all
+$DARWINUP verify all > $PREFIX/verify-all.txt
+$DARWINUP --io-jobs 1 verify all > $PREFIX/verify-one.txt
+cmp $PREFIX/verify-all.txt $PREFIX/verify-one.txt
+# all is read in one pass, but prints the same as each archive in turn
+for S in $($DARWINUP list | grep -E '^[0-9]+ ' | awk '{print $1}');
+do
+	$DARWINUP verify $S
+done > $PREFIX/verify-each.txt
+cmp $PREFIX/verify-all.txt $PREFIX/verify-each.txt
 $DARWINUP files  all
 $DARWINUP dump
 
@@ -246,6 +257,19 @@ rmdir $DEST/d
 echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 
+echo "========== TEST: Uninstall all with user data in rollback =========="
+$DARWINUP install $PREFIX/root5
+$DARWINUP install $PREFIX/root6
+echo "modification" >> $DEST/d/file
+$DARWINUP install $PREFIX/root7
+$DARWINUP uninstall all
+# the edit is put back and then left alone, as uninstalling one at a time would
+grep -q modification $DEST/d/file
+rm $DEST/d/file
+rmdir $DEST/d
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
 echo "========== TEST: Deep rollback while saving user data =========="
 $DARWINUP install $PREFIX/deep-rollback.cpgz
 echo "modified" >> $DEST/d1/d2/d3/d4/d5/d6/file
@@ -289,6 +313,20 @@ $DARWINUP uninstall oldest
 echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 
+echo "========== TEST: Modify installed file in place ============="
+$DARWINUP install $PREFIX/root
+touch -r $DEST/c.txt $PREFIX/c.txt.mtime
+printf "NEW" | dd of=$DEST/c.txt bs=1 conv=notrunc
+touch -r $PREFIX/c.txt.mtime $DEST/c.txt
+C=$($DARWINUP verify newest | grep "^M .*/c.txt" | wc -l | xargs)
+test "$C" == "1"
+$DARWINUP uninstall newest
+# same size and mtime, but the change must still be noticed and kept
+test "$(head -c 3 $DEST/c.txt)" == "NEW"
+cp $ORIG/c.txt $DEST/c.txt
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
 echo "========== TEST: Try to upgrade with non-existent file ============="
 $DARWINUP install $PREFIX/root5
 mv $PREFIX/root5 $PREFIX/root5.tmp
@@ -310,7 +348,48 @@ $DARWINUP install $PREFIX/root2
 $DARWINUP install $PREFIX/root6
 $DARWINUP install $PREFIX/root6
 $DARWINUP install $PREFIX/root5
-$DARWINUP list superseded
+# every archive is decided in one pass over the files in path order,
+# read from an index without a sort
+$DARWINUP -vvv list superseded > $PREFIX/verbose.txt 2>&1
+grep '^\[PLAN\] SELECT \* FROM files ORDER BY path' $PREFIX/verbose.txt > $PREFIX/plan.txt
+grep -q 'SCAN files USING INDEX files_path_archive' $PREFIX/plan.txt
+C=$(grep -c 'TEMP B-TREE' $PREFIX/plan.txt || true)
+test "$C" == "0"
+# and remembered, so the next listing reads no files and lists the same
+C=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT COUNT(*) FROM archives WHERE survivor!=0" | xargs)
+test "$C" != "0"
+$DARWINUP list superseded | tee $PREFIX/superseded.txt
+grep -E '^[0-9]+ ' $PREFIX/verbose.txt | cmp - <(grep -E '^[0-9]+ ' $PREFIX/superseded.txt)
+C=$($DARWINUP -vvv list superseded 2>&1 | grep -c '^\[PLAN\] SELECT \* FROM files ORDER BY path' || true)
+test "$C" == "0"
+# the file after each path of an archive is found with index seeks alone,
+# with neither a scan nor a sort of the files at that path
+sqlite3 $DEST/.DarwinDepot/Database-V100 "EXPLAIN QUERY PLAN SELECT * FROM files \
+	WHERE archive>1 AND path='a' AND EXISTS (SELECT 1 FROM archives \
+	WHERE archives.serial=files.archive AND archives.active=1) \
+	ORDER BY archive ASC LIMIT 1;" > $PREFIX/plan.txt
+grep -q 'SEARCH files USING INDEX files_path_archive (path=? AND archive>?)' $PREFIX/plan.txt
+grep -q 'SEARCH archives USING INTEGER PRIMARY KEY' $PREFIX/plan.txt
+C=$(grep -Ec 'SCAN|TEMP B-TREE' $PREFIX/plan.txt || true)
+test "$C" == "0"
+# and so is the file before each path
+sqlite3 $DEST/.DarwinDepot/Database-V100 "EXPLAIN QUERY PLAN SELECT * FROM files \
+	WHERE archive<1 AND path='a' AND EXISTS (SELECT 1 FROM archives \
+	WHERE archives.serial=files.archive AND archives.active=1) \
+	ORDER BY archive DESC LIMIT 1;" > $PREFIX/plan.txt
+grep -q 'SEARCH files USING INDEX files_path_archive (path=? AND archive<?)' $PREFIX/plan.txt
+C=$(grep -Ec 'SCAN|TEMP B-TREE' $PREFIX/plan.txt || true)
+test "$C" == "0"
+# which is how install finds the file before each staged path, rather
+# than reading every older file under the same top level directories
+$DARWINUP -vvv install $PREFIX/root6 > $PREFIX/verbose.txt 2>&1
+N=$(find $PREFIX/root6 -mindepth 1 | wc -l | xargs)
+C=$(grep -c '^\[SQL\] SELECT \* FROM files WHERE archive<[0-9]* AND path=' $PREFIX/verbose.txt || true)
+test "$C" == "$N"
+grep -q "^Looked up the preceding files of $N paths" $PREFIX/verbose.txt
+C=$(grep -c '^\[SQL\] SELECT \* FROM files WHERE archive<[0-9]* ORDER BY' $PREFIX/verbose.txt || true)
+test "$C" == "0"
+$DARWINUP uninstall newest
 $DARWINUP uninstall superseded
 C=$($DARWINUP list | grep root | wc -l | xargs)
 test "$C" == "2" 
@@ -320,6 +399,128 @@ echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 
 
+echo "========== TEST: Archive stats ============="
+$DARWINUP install $PREFIX/root5
+$DARWINUP install $PREFIX/300files.tbz2
+$DARWINUP -l list
+# the totals are those of the files the archive was installed with
+S=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT serial FROM archives WHERE name='300files.tbz2'" | xargs)
+C=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT files FROM archive_stats WHERE archive=$S" | xargs)
+N=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT COUNT(*) FROM files WHERE archive=$S" | xargs)
+test "$C" == "$N"
+C=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT bytes FROM archive_stats WHERE archive=$S" | xargs)
+N=$(find $DEST/300files -type f -exec cat {} + | wc -c | xargs)
+test "$C" == "$N"
+# and are listed without reading any files
+C=$($DARWINUP -vvv -l list 2>&1 | grep -c '^\[SQL\] .*FROM files' || true)
+test "$C" == "0"
+# and go with the archive, while the base system rollbacks stay
+$DARWINUP uninstall all
+C=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT COUNT(*) FROM archive_stats \
+	WHERE archive NOT IN (SELECT serial FROM archives)" | xargs)
+test "$C" == "0"
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Owner ============="
+$DARWINUP install $PREFIX/root5
+$DARWINUP install $PREFIX/root6
+$DARWINUP install $PREFIX/root2
+# the newest root with a path owns it, however the path is given
+C=$($DARWINUP owner /d/file $DEST/d/file/ | grep -c ' root6 ' || true)
+test "$C" == "2"
+C=$($DARWINUP owner c.txt | grep -c ' root2 ' || true)
+test "$C" == "1"
+C=$($DARWINUP owner /nonexistent | awk '{print $1}')
+test "$C" == "-"
+# with one index seek for each path
+$DARWINUP -vvv owner /d/file 2>&1 | grep '^\[PLAN\] SELECT \* FROM files WHERE path=' > $PREFIX/plan.txt
+grep -q 'SEARCH files USING INDEX files_path_archive (path=?)' $PREFIX/plan.txt
+C=$(grep -c 'TEMP B-TREE' $PREFIX/plan.txt || true)
+test "$C" == "0"
+# and paths can come on stdin
+(cd $DEST && find . ! -path '*.DarwinDepot*' | sed -e 's/^\.//' -e '/^$/d') > $PREFIX/paths.txt
+$DARWINUP owner - < $PREFIX/paths.txt > $PREFIX/owners.txt
+C=$(wc -l < $PREFIX/owners.txt | xargs)
+N=$(wc -l < $PREFIX/paths.txt | xargs)
+test "$C" == "$N"
+C=$(grep -c ' root2 ' $PREFIX/owners.txt || true)
+test "$C" -gt "0"
+$DARWINUP uninstall root6
+C=$($DARWINUP owner /d/file | grep -c ' root5 ' || true)
+test "$C" == "1"
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Plan and apply ============="
+$DARWINUP -o $PREFIX/root2.plan plan $PREFIX/root2
+test -s $PREFIX/root2.plan
+# planning installs nothing
+C=$($DARWINUP list | grep -c ' root2 *$' || true)
+test "$C" == "0"
+# a plan no longer matched by the destination is refused
+mv $DEST/c.txt $PREFIX/c.txt.saved
+set +e
+$DARWINUP apply $PREFIX/root2.plan
+if [ $? -ne 255 ]; then exit 1; fi
+set -e
+mv $PREFIX/c.txt.saved $DEST/c.txt
+# as is one whose root changed, even keeping its sizes and mtimes
+cp -p $PREFIX/root2/c.txt $PREFIX/c.txt.root
+printf "NEW" | dd of=$PREFIX/root2/c.txt bs=1 conv=notrunc
+touch -r $PREFIX/c.txt.root $PREFIX/root2/c.txt
+set +e
+$DARWINUP apply $PREFIX/root2.plan
+if [ $? -ne 255 ]; then exit 1; fi
+set -e
+cp -p $PREFIX/c.txt.root $PREFIX/root2/c.txt
+C=$($DARWINUP list | grep -c ' root2 *$' || true)
+test "$C" == "0"
+# otherwise it installs without reading the live files again
+$DARWINUP -o $PREFIX/root2.plan plan $PREFIX/root2
+$DARWINUP -v apply $PREFIX/root2.plan > $PREFIX/apply.txt
+grep -q '^Reused [1-9][0-9]* digests of live files from the plan' $PREFIX/apply.txt
+C=$($DARWINUP list | grep -c ' root2 *$' || true)
+test "$C" == "1"
+cmp $PREFIX/root2/c.txt $DEST/c.txt
+$DARWINUP uninstall root2
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Statement stats ============="
+$DARWINUP stats install $PREFIX/root2 > $PREFIX/stats.txt
+grep -q '"command": "install"' $PREFIX/stats.txt
+grep -q '{ "name": "install.analyze", "calls": 1,' $PREFIX/stats.txt
+grep -q '{ "name": "insert_files", "calls": [1-9]' $PREFIX/stats.txt
+grep -q '"p99_ns": ' $PREFIX/stats.txt
+DARWINUP_PROFILE=$PREFIX/stats.json $DARWINUP uninstall root2 > $PREFIX/stats.txt
+C=$(grep -c '"statements"' $PREFIX/stats.txt || true)
+test "$C" == "0"
+grep -q '"command": "uninstall"' $PREFIX/stats.json
+grep -q '{ "name": "uninstall.files", "calls": 1,' $PREFIX/stats.json
+grep -q '{ "name": "files_at_path", "calls": [1-9]' $PREFIX/stats.json
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Depot lock timeout ============="
+echo "INFO: waiting for a depot locked by someone else ..."
+perl -e 'use Fcntl ":flock"; open(F, "<", $ARGV[0]) or die; flock(F, LOCK_EX) or die; sleep 3' \
+	$DEST/.DarwinDepot &
+LOCKER=$!
+sleep 1
+set +e
+$DARWINUP --lock-timeout 1 list > $PREFIX/lock.txt 2>&1
+res=$?
+set -e
+test $res -ne 0
+grep -q 'after 1 seconds, giving up' $PREFIX/lock.txt
+$DARWINUP stats list > $PREFIX/stats.txt
+wait $LOCKER
+grep -q '{ "name": "depot_lock", "calls": 1,' $PREFIX/stats.txt
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
 echo "========== TEST: Archive Rename ============="
 $DARWINUP install $PREFIX/root2
 $DARWINUP install $PREFIX/root
@@ -348,6 +549,164 @@ $DARWINUP uninstall all
 echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 
+echo "========== TEST: Compact with each codec ============="
+$DARWINUP --compress xz:9 install $PREFIX/root2
+$DARWINUP --compress none install $PREFIX/root
+$DARWINUP --compress zlib:1 install $PREFIX/root6
+C=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT COUNT(DISTINCT codec) FROM archives" | xargs)
+test "$C" == "3"
+$DARWINUP uninstall root
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+set +e
+$DARWINUP --compress zstd install $PREFIX/root2
+if [ $? -ne 4 ]; then exit 1; fi
+set -e
+
+echo "========== TEST: Keep hard links through compaction ============="
+mkdir -p $PREFIX/hardlinks/hl $PREFIX/hardlinks2/hl
+echo "one" > $PREFIX/hardlinks/hl/a
+ln $PREFIX/hardlinks/hl/a $PREFIX/hardlinks/hl/b
+echo "two" > $PREFIX/hardlinks2/hl/a
+echo "two" > $PREFIX/hardlinks2/hl/b
+tar -C $PREFIX/hardlinks -cf $PREFIX/hardlinks.tar hl
+$DARWINUP install $PREFIX/hardlinks.tar
+# a pack would lose the link, so the archive is a tarball
+C=$(ls $DEST/.DarwinDepot/Archives | grep -c '\.tar\.bz2$' | xargs)
+test "$C" == "1"
+$DARWINUP install $PREFIX/hardlinks2
+$DARWINUP uninstall hardlinks2
+C=$(find $DEST/hl -type f -links 2 | wc -l | xargs)
+test "$C" == "2"
+grep -q '^one$' $DEST/hl/b
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Restore the times of backed up files ============="
+mkdir -p $PREFIX/timeroot
+echo "new" > $PREFIX/timeroot/timefile
+echo "old" > $DEST/timefile
+touch -t 200001010000 $DEST/timefile
+touch -t 200001020000 $PREFIX/timeref
+$DARWINUP install $PREFIX/timeroot
+$DARWINUP uninstall timeroot
+grep -q '^old$' $DEST/timefile
+C=$(find $DEST/timefile -newer $PREFIX/timeref | wc -l | xargs)
+test "$C" == "0"
+rm $DEST/timefile
+
+echo "========== TEST: Read each pack index once ============="
+mkdir -p $PREFIX/packed/p $PREFIX/packed2/p
+for i in 1 2 3 4 5; do
+	echo "one $i" > $PREFIX/packed/p/$i
+	echo "two $i" > $PREFIX/packed2/p/$i
+done
+$DARWINUP install $PREFIX/packed
+$DARWINUP install $PREFIX/packed2
+$DARWINUP -vv uninstall packed2 > $PREFIX/packs.txt 2>&1
+C=$(grep -c '^DEBUG: \[pack\] extracting /p/' $PREFIX/packs.txt | xargs)
+test "$C" == "5"
+C=$(grep -c '^DEBUG: \[pack\] reading the index' $PREFIX/packs.txt | xargs)
+test "$C" == "1"
+grep -q '^one 3$' $DEST/p/3
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Migrate to the object store ============="
+$DARWINUP install $PREFIX/root2
+$DARWINUP install $PREFIX/root
+C=$(ls $DEST/.DarwinDepot/Archives | grep -c '\.pack$' | xargs)
+test "$C" -gt "0"
+$DARWINUP migrate-store
+C=$(ls $DEST/.DarwinDepot/Archives | grep -c '\.tar\|\.pack' | xargs)
+test "$C" == "0"
+test -d $DEST/.DarwinDepot/Archives/objects
+$DARWINUP install $PREFIX/root6
+$DARWINUP uninstall root
+C=$($DARWINUP verify root6 | grep -Ev '^Found' | wc -l | xargs)
+test "$C" == "8"
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+C=$(find $DEST/.DarwinDepot/Archives/objects -type f | wc -l | xargs)
+D=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT COUNT(DISTINCT digest) FROM files")
+test "$C" == "$D"
+# the backups of live files are copies, never links to the files
+mkdir -p $PREFIX/objroot
+echo "new" > $PREFIX/objroot/objfile
+echo "live" > $DEST/objfile
+$DARWINUP -v install $PREFIX/objroot > $PREFIX/objects.txt
+grep -q '^Backed up 1 files: [0-9]* bytes cloned, 0 bytes linked' $PREFIX/objects.txt
+$DARWINUP uninstall objroot
+grep -q '^live$' $DEST/objfile
+rm $DEST/objfile
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
+echo "========== TEST: Intern paths ============="
+# every later test runs with interned paths
+$DARWINUP install $PREFIX/root5
+$DARWINUP install $PREFIX/root6
+$DARWINUP files root5 | sort > $PREFIX/files-before.txt
+$DARWINUP files root6 | sort >> $PREFIX/files-before.txt
+$DARWINUP migrate-paths
+C=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT COUNT(*) FROM files WHERE path IS NOT NULL" | xargs)
+test "$C" == "0"
+$DARWINUP files root5 | sort > $PREFIX/files-after.txt
+$DARWINUP files root6 | sort >> $PREFIX/files-after.txt
+cmp $PREFIX/files-before.txt $PREFIX/files-after.txt
+$DARWINUP install $PREFIX/root5
+# installing forgets what was remembered about the older archives
+C=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT COUNT(*) FROM archives WHERE survivor!=0" | xargs)
+test "$C" == "0"
+$DARWINUP -vvv list superseded > $PREFIX/verbose.txt 2>&1
+C=$(grep -E '^[0-9]+ ' $PREFIX/verbose.txt | grep root5 | wc -l | xargs)
+test "$C" == "1"
+grep '^\[PLAN\] SELECT .* FROM files ORDER BY' $PREFIX/verbose.txt > $PREFIX/plan.txt
+grep -q 'SCAN files USING INDEX files_dir_basename_archive' $PREFIX/plan.txt
+$DARWINUP uninstall superseded
+$DARWINUP uninstall all
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+# a second run only drops the directories no file is in
+$DARWINUP migrate-paths
+C=$(sqlite3 $DEST/.DarwinDepot/Database-V100 "SELECT COUNT(*) FROM dirs WHERE serial NOT IN (SELECT dir FROM files)" | xargs)
+test "$C" == "0"
+
+echo "========== TEST: Snapshot readers during an install ============="
+mkdir -p $PREFIX/snapshot/orig $PREFIX/snapshot/big
+tar -C $PREFIX/snapshot/orig -xjf $PREFIX/300files.tbz2
+for i in $(seq 1 20); do
+	mkdir $PREFIX/snapshot/big/$i
+	cp -R $PREFIX/snapshot/orig/300files $PREFIX/snapshot/big/$i/
+done
+N=$(find $PREFIX/snapshot/big -mindepth 1 | wc -l | xargs)
+$DARWINUP profile wal
+$DARWINUP install $PREFIX/snapshot/big > $PREFIX/snapshot/install.txt &
+INSTALLER=$!
+# readers must neither wait for the depot lock nor see part of the install
+READS=0
+while kill -0 $INSTALLER 2>/dev/null; do
+	$DARWINUP --lock-timeout 0 list > $PREFIX/snapshot/list.txt
+	if grep -q ' big$' $PREFIX/snapshot/list.txt; then
+		C=$($DARWINUP --lock-timeout 0 files big | grep -c ' /[0-9]')
+		test "$C" == "$N"
+	fi
+	READS=$((READS+1))
+done
+wait $INSTALLER
+echo "INFO: $READS snapshot reads during the install"
+test $READS -gt 0
+C=$($DARWINUP files big | grep -c ' /[0-9]')
+test "$C" == "$N"
+$DARWINUP uninstall big
+$DARWINUP profile default
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+
 echo "========== TEST: Modify /System/Library/Extensions =========="
 mkdir -p $DEST/System/Library/Extensions/Foo.kext
 BEFORE=$(ls -Tld $DEST/System/Library/Extensions/ | awk '{print $6$7$8$9}');
@@ -493,6 +852,20 @@ echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 if [ $? -ne 0 ]; then exit 1; fi
 
+echo "========== TEST: hard link through a symlink out of the root ==========";
+mkdir -p $PREFIX/outside
+echo victim > $PREFIX/outside/victim
+$DARWINUP install $PREFIX/link_escape.tar.gz
+if [ $? -ne 255 ]; then exit 1; fi
+test ! -e $DEST/link_escape/grab -a ! -e $DEST/grab
+if [ $? -ne 0 ]; then exit 1; fi
+C=$(ls -l $PREFIX/outside/victim | awk '{print $2}')
+test "$C" == "1"
+if [ $? -ne 0 ]; then exit 1; fi
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+if [ $? -ne 0 ]; then exit 1; fi
+
 echo "========== TEST: testing recursive install guards ==========";
 $DARWINUP install $PREFIX/depotroot.tar.gz
 if [ $? -ne 255 ]; then exit 1; fi
@@ -566,6 +939,58 @@ echo "DIFF: diffing original test files to dest (should be no diffs) ..."
 $DIFF $ORIG $DEST 2>&1
 if [ $? -ne 0 ]; then exit 1; fi
 
+echo "========== TEST: Resume an install that was not interrupted =========="
+$DARWINUP install $PREFIX/root
+$DARWINUP resume newest
+if [ $? -ne 255 ]; then exit 1; fi
+$DARWINUP uninstall newest
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+if [ $? -ne 0 ]; then exit 1; fi
+
+echo "========== TEST: Resume and uninstall an interrupted install =========="
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	mkdir -p $PREFIX/interrupted/$i
+	tar -C $PREFIX/interrupted/$i -xjf $PREFIX/300files.tbz2
+done
+# kills an install of the interrupted root once it has moved files into place
+function interrupt_install {
+	$DARWINUP install $PREFIX/interrupted >> /dev/null &
+	local P=$!
+	JOURNAL=
+	while kill -0 $P 2>/dev/null; do
+		JOURNAL=$(ls $DEST/.DarwinDepot/Archives/*.journal 2>/dev/null | head -1)
+		if [ -n "$JOURNAL" ] && grep -q '^I ' $JOURNAL; then
+			kill -9 $P
+			break
+		fi
+	done
+	wait $P
+	test -f "$JOURNAL"
+}
+interrupt_install
+if [ $? -ne 0 ]; then exit 1; fi
+$DARWINUP resume newest
+if [ $? -ne 0 ]; then exit 1; fi
+test ! -e $JOURNAL
+if [ $? -ne 0 ]; then exit 1; fi
+$DIFF $PREFIX/interrupted $DEST 2>&1 | grep -v "^Only in $DEST"
+if [ $? -eq 0 ]; then exit 1; fi
+$DARWINUP uninstall newest
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+if [ $? -ne 0 ]; then exit 1; fi
+# a power failure can lose the per-file records, but not the phases
+interrupt_install
+if [ $? -ne 0 ]; then exit 1; fi
+grep -v '^[BiI] ' $JOURNAL > $PREFIX/journal.txt
+cat $PREFIX/journal.txt > $JOURNAL
+$DARWINUP uninstall newest
+if [ $? -ne 0 ]; then exit 1; fi
+echo "DIFF: diffing original test files to dest (should be no diffs) ..."
+$DIFF $ORIG $DEST 2>&1
+if [ $? -ne 0 ]; then exit 1; fi
+
 popd >> /dev/null
 echo "INFO: Done testing!"
 